@@ -0,0 +1,283 @@
+/**
+ * @brief Benchmark of DedupIndex against a node-based hash map
+ *
+ * Builds torrents whose files are drawn from a shared pool, so the same
+ * content appears in many torrents: sometimes piece-aligned with the same
+ * piece length, where whole files can be matched, sometimes at another
+ * offset, where only some pieces repeat. Piece hashes are derived from
+ * the content they would cover, so they repeat exactly when the data does.
+ *
+ * Every torrent is indexed by DedupIndex and by an unordered_map from the
+ * full 20-byte hash to its first piece, as a straightforward
+ * implementation would. The index must report exactly the expected file
+ * matches and the same duplicate piece bytes as the map. Reported are
+ * insert and lookup rates and heap bytes per distinct piece hash.
+ *
+ * Usage: bench_dedup [torrents] [pool files] [lookups]
+ */
+
+#include <algorithm>
+#include <bencode.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <dedupindex.hpp>
+#include <iomanip>
+#include <iostream>
+#include <malloc.h>
+#include <map>
+#include <string>
+#include <torrentfile.hpp>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int64_t kKiB = 1024;
+
+/**
+ * @brief SplitMix64 step
+ */
+uint64_t splitMix(uint64_t &state) {
+  uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/**
+ * @brief A 20-byte stand-in for the SHA-1 of some content
+ */
+std::string fakeHash(uint64_t a, uint64_t b, uint64_t c, uint64_t d) {
+  uint64_t state = a * 0x9e3779b97f4a7c15ULL ^ splitMix(b);
+  state ^= splitMix(c) * 3 + splitMix(d) * 5;
+  std::string hash(20, '\0');
+  for (size_t i = 0; i < hash.size(); i += 8) {
+    uint64_t word = splitMix(state);
+    std::memcpy(hash.data() + i, &word, std::min<size_t>(8, 20 - i));
+  }
+  return hash;
+}
+
+/**
+ * @brief A file of a synthetic torrent
+ */
+struct Placed {
+  int64_t content; // Pool file, or -1 for content of its own
+  int64_t length;
+  int64_t start;   // Offset in the torrent
+};
+
+/**
+ * @brief Heap bytes in use, from the allocator
+ */
+size_t heapBytes() { return mallinfo2().uordblks; }
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void check(bool ok, const std::string &what) {
+  if (!ok) {
+    std::cerr << "Check failed: " << what << '\n';
+    std::exit(1);
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const uint64_t torrents = argc > 1 ? std::atoll(argv[1]) : 20000;
+  const uint64_t poolSize = argc > 2 ? std::atoll(argv[2]) : 2000;
+  const uint64_t lookups = argc > 3 ? std::atoll(argv[3]) : 4000000;
+
+  uint64_t random = 42;
+  std::vector<int64_t> pool(poolSize);
+  for (auto &length : pool) {
+    // 64 KiB to 128 MiB, log-uniform
+    length = int64_t(64 * kKiB) << (splitMix(random) % 12);
+    length += splitMix(random) % length;
+  }
+
+  DedupIndex index;
+  std::unordered_map<std::string, std::pair<uint32_t, uint32_t>> map;
+  size_t mapHeap = 0;
+  double indexSeconds = 0;
+  double mapSeconds = 0;
+  uint64_t mapDuplicateBytes = 0;
+  uint64_t expectedFileMatches = 0;
+  // First aligned occurrence of (pool file, piece length)
+  std::map<std::pair<int64_t, int64_t>, DedupIndex::FileRef> firstAligned;
+  std::vector<std::string> sample; // Hashes to look up later
+
+  std::string data;
+  std::vector<DedupIndex::FileMatch> matches;
+  for (uint64_t t = 0; t < torrents; ++t) {
+    const int64_t pieceLength = splitMix(random) % 4 == 0 ? 1024 * kKiB
+                                                          : 256 * kKiB;
+    std::vector<Placed> files;
+    const size_t fileCount = 1 + splitMix(random) % 6;
+    int64_t offset = 0;
+    for (size_t f = 0; f < fileCount; ++f) {
+      Placed placed;
+      if (splitMix(random) % 3 != 0) {
+        placed.content = splitMix(random) % poolSize;
+        placed.length = pool[placed.content];
+      } else {
+        placed.content = -1;
+        placed.length = int64_t(16 * kKiB) + splitMix(random) % (64 << 20);
+      }
+      placed.start = offset;
+      offset += placed.length;
+      files.push_back(placed);
+    }
+    const int64_t totalSize = offset;
+    const uint64_t pieceCount = (totalSize + pieceLength - 1) / pieceLength;
+
+    // A piece inside one pool file covers that file's bytes; any other
+    // piece is unique to this torrent
+    std::string pieces;
+    pieces.reserve(pieceCount * 20);
+    size_t f = 0;
+    for (uint64_t p = 0; p < pieceCount; ++p) {
+      int64_t begin = p * pieceLength;
+      int64_t end = std::min(begin + pieceLength, totalSize);
+      while (files[f].start + files[f].length <= begin) {
+        ++f;
+      }
+      const Placed &file = files[f];
+      if (file.content >= 0 && end <= file.start + file.length) {
+        pieces += fakeHash(file.content, begin - file.start, end - begin, 0);
+      } else {
+        pieces += fakeHash(t, p, 1, 1);
+      }
+    }
+
+    data = "d4:infod5:filesl";
+    for (size_t i = 0; i < files.size(); ++i) {
+      data += "d6:length";
+      BencodeEncoder::encodeInt(files[i].length, data);
+      data += "4:pathl";
+      BencodeEncoder::encodeString("file" + std::to_string(i), data);
+      data += "ee";
+    }
+    data += "e4:name";
+    BencodeEncoder::encodeString("torrent" + std::to_string(t), data);
+    data += "12:piece length";
+    BencodeEncoder::encodeInt(pieceLength, data);
+    data += "6:pieces";
+    BencodeEncoder::encodeString(pieces, data);
+    data += "ee";
+    TorrentFile torrent = TorrentFile::fromBencode(data);
+
+    // Expected matches, in file order
+    std::vector<DedupIndex::FileMatch> expected;
+    for (size_t i = 0; i < files.size(); ++i) {
+      const Placed &file = files[i];
+      if (file.content < 0 || file.start % pieceLength != 0 ||
+          file.length < pieceLength) {
+        continue;
+      }
+      auto [it, inserted] = firstAligned.try_emplace(
+          {file.content, pieceLength},
+          DedupIndex::FileRef{uint32_t(t), uint32_t(i)});
+      if (!inserted) {
+        expected.push_back({uint32_t(i), it->second, file.length,
+                            file.length / pieceLength * pieceLength});
+      }
+    }
+    expectedFileMatches += expected.size();
+
+    matches.clear();
+    auto start = Clock::now();
+    index.add(torrent, &matches);
+    indexSeconds += secondsSince(start);
+
+    check(matches.size() == expected.size(), "file match count");
+    for (size_t i = 0; i < matches.size(); ++i) {
+      check(matches[i].file == expected[i].file &&
+                matches[i].existing.torrent ==
+                    expected[i].existing.torrent &&
+                matches[i].existing.file == expected[i].existing.file &&
+                matches[i].coveredBytes == expected[i].coveredBytes,
+            "file match " + std::to_string(t));
+    }
+
+    size_t heap = heapBytes();
+    start = Clock::now();
+    const auto &hashes = torrent.getPieces();
+    for (size_t p = 0; p < hashes.size(); ++p) {
+      if (!map.try_emplace(hashes[p], uint32_t(t), uint32_t(p)).second) {
+        mapDuplicateBytes +=
+            p + 1 < hashes.size() ? pieceLength
+                                  : totalSize - int64_t(p) * pieceLength;
+      }
+    }
+    mapSeconds += secondsSince(start);
+    mapHeap += heapBytes() - heap;
+
+    if (splitMix(random) % 8 == 0) {
+      sample.push_back(hashes[splitMix(random) % hashes.size()]);
+    }
+  }
+  DedupIndex::Stats stats = index.stats();
+  check(stats.uniquePieces == map.size(), "distinct piece count");
+  check(stats.duplicatePieceBytes == mapDuplicateBytes,
+        "duplicate piece bytes");
+  check(stats.duplicateFiles == expectedFileMatches, "duplicate files");
+
+  // Lookups of present and absent hashes, alternating
+  std::vector<std::string> absent;
+  for (size_t i = 0; i < sample.size(); ++i) {
+    absent.push_back(fakeHash(i, 7, 7, 7));
+  }
+  auto hashOf = [&](uint64_t i) -> const std::string & {
+    return i % 2 == 0 ? sample[i / 2 % sample.size()]
+                      : absent[i / 2 % absent.size()];
+  };
+  uint64_t indexFound = 0;
+  auto start = Clock::now();
+  for (uint64_t i = 0; i < lookups; ++i) {
+    indexFound += index.findPiece(hashOf(i)).has_value();
+  }
+  double indexLookup = secondsSince(start);
+  uint64_t mapFound = 0;
+  start = Clock::now();
+  for (uint64_t i = 0; i < lookups; ++i) {
+    mapFound += map.count(hashOf(i));
+  }
+  double mapLookup = secondsSince(start);
+  check(indexFound == mapFound && indexFound == (lookups + 1) / 2,
+        "lookups");
+
+  auto percent = [](uint64_t part, uint64_t whole) {
+    return 100.0 * part / std::max<uint64_t>(whole, 1);
+  };
+  std::cout << std::fixed << std::setprecision(1) << "Torrents " << torrents
+            << ", files " << stats.files << " (" << stats.alignedFiles
+            << " piece-aligned), pieces " << stats.pieces << " ("
+            << stats.uniquePieces << " distinct)\n"
+            << "Duplicate files: " << stats.duplicateFiles << ", "
+            << stats.duplicateFileBytes / double(1 << 30) << " GiB\n"
+            << "Duplicate pieces: "
+            << stats.duplicatePieceBytes / double(1 << 30) << " GiB of "
+            << stats.pieceBytes / double(1 << 30) << " GiB ("
+            << percent(stats.duplicatePieceBytes, stats.pieceBytes)
+            << "%)\n\n"
+            << std::setw(14) << "" << std::setw(14) << "insert M/s"
+            << std::setw(14) << "lookup M/s" << std::setw(16)
+            << "bytes/distinct\n"
+            << std::setw(14) << "DedupIndex" << std::setw(14)
+            << stats.pieces / indexSeconds / 1e6 << std::setw(14)
+            << lookups / indexLookup / 1e6 << std::setw(15)
+            << double(stats.memoryBytes) / stats.uniquePieces << '\n'
+            << std::setw(14) << "unordered_map" << std::setw(14)
+            << stats.pieces / mapSeconds / 1e6 << std::setw(14)
+            << lookups / mapLookup / 1e6 << std::setw(15)
+            << double(mapHeap) / map.size() << '\n';
+  return 0;
+}
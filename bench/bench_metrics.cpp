@@ -0,0 +1,86 @@
+/**
+ * @brief Benchmark of metric updates from many threads
+ *
+ * Every thread increments a counter and records into a histogram in a tight
+ * loop. The sharded MetricsRegistry counter is compared with a single shared
+ * atomic, which is what an unsharded counter costs once several cores write
+ * to it. The registry's Prometheus exposition is printed at the end.
+ *
+ * Usage: bench_metrics [threads] [million increments per thread]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <metrics.hpp>
+#include <thread>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief Run a loop on several threads at once
+ * @return Wall nanoseconds per iteration of one thread's loop
+ */
+template <typename Body>
+double runThreads(size_t numThreads, uint64_t iterations, const Body &body) {
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&] {
+      for (uint64_t i = 0; i < iterations; ++i) {
+        body(i);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  double nanos = std::chrono::duration<double, std::nano>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  return nanos / iterations;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const size_t numThreads =
+      argc > 1 ? std::atoi(argv[1])
+               : std::max(2u, std::thread::hardware_concurrency());
+  const uint64_t iterations =
+      (argc > 2 ? std::atoll(argv[2]) : 20) * uint64_t{1000000};
+
+  MetricsRegistry registry;
+  auto &counter = registry.counter("bench_increments_total",
+                                   "Increments made by the benchmark");
+  auto &histogram = registry.histogram(
+      "bench_value_seconds", "Values recorded by the benchmark", {},
+      MetricsRegistry::HistogramSpec{1e-9, 4, 12});
+  alignas(64) std::atomic<uint64_t> shared{0};
+
+  double sharded = runThreads(numThreads, iterations,
+                              [&](uint64_t) { counter.add(); });
+  double single = runThreads(numThreads, iterations, [&](uint64_t) {
+    shared.fetch_add(1, std::memory_order_relaxed);
+  });
+  double recorded = runThreads(numThreads, iterations, [&](uint64_t i) {
+    histogram.record(i & 4095);
+  });
+
+  std::cout << numThreads << " threads x " << iterations / 1000000
+            << "M updates, wall ns per loop iteration\n"
+            << std::fixed << std::setprecision(2)
+            << "  sharded counter:  " << sharded << '\n'
+            << "  shared atomic:    " << single << '\n'
+            << "  histogram record: " << recorded << "\n\n";
+  if (counter.value() != numThreads * iterations ||
+      shared.load() != numThreads * iterations) {
+    std::cerr << "Lost increments\n";
+    return 1;
+  }
+  std::cout << registry.render();
+  return 0;
+}
@@ -0,0 +1,227 @@
+/**
+ * @brief Benchmark of BEP 47 padding handling in storage and hashing
+ *
+ * Builds a hybrid-style torrent of many small files, each followed by a
+ * padding file up to the next piece boundary, parses it and writes its
+ * content through Storage. Then checks that padding never reached the disk,
+ * reads back as zeros and hashes to the expected piece hashes, and times
+ * verifying every piece:
+ * - with padding treated as virtual zeros (no reads, zero-block hashing),
+ * - with the padding flags cleared, as a client ignoring attr would store
+ *   and read them as real files.
+ *
+ * Also times SHA-1 over runs of zeros fed from memory, with
+ * Sha1::updateZeros at the start of a message (precomputed states) and in
+ * the middle of one (compression without a message schedule).
+ *
+ * Usage: bench_padding [files] [piece KiB]
+ */
+
+#include <algorithm>
+#include <bencode.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sha1.hpp>
+#include <storage.hpp>
+#include <string>
+#include <torrentfile.hpp>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void check(bool ok, const std::string &what) {
+  if (!ok) {
+    std::cerr << "Check failed: " << what << '\n';
+    std::exit(1);
+  }
+}
+
+/**
+ * @brief Bytes of all regular files below a directory
+ */
+uint64_t bytesOnDisk(const std::string &directory) {
+  uint64_t bytes = 0;
+  for (const auto &entry :
+       std::filesystem::recursive_directory_iterator(directory)) {
+    if (entry.is_regular_file()) {
+      bytes += entry.file_size();
+    }
+  }
+  return bytes;
+}
+
+/**
+ * @brief Hash every piece and compare with the torrent
+ * @return Seconds taken
+ */
+double verifyAll(Storage &storage, const TorrentFile &torrent) {
+  auto start = Clock::now();
+  for (uint32_t piece = 0; piece < storage.numPieces(); ++piece) {
+    check(storage.hashPiece(piece) == torrent.getPieces()[piece],
+          "piece " + std::to_string(piece) + " verifies");
+  }
+  return secondsSince(start);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const size_t fileCount = argc > 1 ? std::atoll(argv[1]) : 400;
+  const int64_t pieceLength =
+      int64_t(argc > 2 ? std::atoll(argv[2]) : 1024) * 1024;
+
+  // Content: small files, each padded to the next piece boundary
+  uint64_t random = 7;
+  auto next = [&random] {
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    return random;
+  };
+  std::string content;
+  std::string files = "l";
+  for (size_t i = 0; i < fileCount; ++i) {
+    int64_t length = 4096 + next() % (2 * pieceLength);
+    size_t begin = content.size();
+    content.resize(begin + length);
+    for (int64_t k = 0; k < length; k += 8) {
+      uint64_t word = next();
+      std::memcpy(&content[begin + k], &word,
+                  std::min<int64_t>(8, length - k));
+    }
+    files += i % 10 == 0 ? "d4:attr1:x" : "d";
+    files += "6:length";
+    BencodeEncoder::encodeInt(length, files);
+    files += "4:pathl";
+    BencodeEncoder::encodeString("file" + std::to_string(i), files);
+    files += "ee";
+    int64_t pad = (pieceLength - content.size() % pieceLength) % pieceLength;
+    if (pad > 0 && i + 1 < fileCount) {
+      content.append(pad, '\0');
+      files += "d4:attr1:p6:length";
+      BencodeEncoder::encodeInt(pad, files);
+      files += "4:pathl4:.pad";
+      BencodeEncoder::encodeString(std::to_string(i), files);
+      files += "ee";
+    }
+  }
+  files += 'e';
+
+  std::string pieces;
+  for (size_t offset = 0; offset < content.size(); offset += pieceLength) {
+    pieces += Sha1::hash(std::string_view(content).substr(offset, pieceLength));
+  }
+  std::string data = "d4:infod5:files" + files + "4:name5:bench";
+  data += "12:piece length";
+  BencodeEncoder::encodeInt(pieceLength, data);
+  data += "6:pieces";
+  BencodeEncoder::encodeString(pieces, data);
+  data += "ee";
+  TorrentFile torrent = TorrentFile::fromBencode(data);
+  check(torrent.getFiles()[0].executable, "attr x parsed");
+  check(torrent.getPaddingSize() > 0, "padding parsed");
+
+  std::string root =
+      (std::filesystem::temp_directory_path() / "bench_padding.XXXXXX")
+          .string();
+  check(mkdtemp(root.data()) != nullptr, "mkdtemp");
+
+  Storage storage(torrent, root + "/virtual");
+  for (uint32_t piece = 0; piece < storage.numPieces(); ++piece) {
+    storage.writeBlock(piece, 0, storage.pieceSize(piece),
+                       content.data() + int64_t(piece) * pieceLength);
+  }
+  uint64_t disk = bytesOnDisk(root + "/virtual");
+  check(disk == uint64_t(torrent.getTotalSize() - torrent.getPaddingSize()),
+        "padding not stored");
+  std::vector<char> block(pieceLength);
+  for (uint32_t piece = 0; piece < storage.numPieces(); ++piece) {
+    storage.readBlock(piece, 0, storage.pieceSize(piece), block.data());
+    check(std::memcmp(block.data(),
+                      content.data() + int64_t(piece) * pieceLength,
+                      storage.pieceSize(piece)) == 0,
+          "read back with zeros");
+  }
+
+  // The same layout stored by a client that ignores attr
+  std::vector<TorrentFile::FileInfo> real = torrent.getFiles();
+  for (auto &file : real) {
+    file.padding = false;
+  }
+  Storage plain(real, pieceLength, root + "/plain");
+  for (uint32_t piece = 0; piece < plain.numPieces(); ++piece) {
+    plain.writeBlock(piece, 0, plain.pieceSize(piece),
+                     content.data() + int64_t(piece) * pieceLength);
+  }
+
+  // Warm both, then time
+  verifyAll(storage, torrent);
+  verifyAll(plain, torrent);
+  double virtualSeconds = verifyAll(storage, torrent);
+  double plainSeconds = verifyAll(plain, torrent);
+
+  const double mib = torrent.getTotalSize() / double(1 << 20);
+  std::cout << std::fixed << std::setprecision(1) << "Files " << fileCount
+            << ", pieces " << storage.numPieces() << " of "
+            << pieceLength / 1024 << " KiB, " << mib << " MiB of which "
+            << torrent.getPaddingSize() / double(1 << 20)
+            << " MiB padding\n"
+            << "On disk: " << disk / double(1 << 20) << " MiB with padding "
+            << "virtual, " << bytesOnDisk(root + "/plain") / double(1 << 20)
+            << " MiB without\n\n"
+            << "Verify all pieces, padding virtual: " << mib / virtualSeconds
+            << " MiB/s\n"
+            << "Verify all pieces, padding on disk: " << mib / plainSeconds
+            << " MiB/s\n\n";
+
+  // Zero runs in isolation
+  const uint64_t run = pieceLength;
+  const int repetitions = 256;
+  std::string zeros(run, '\0');
+  std::string digest;
+  auto start = Clock::now();
+  for (int i = 0; i < repetitions; ++i) {
+    Sha1 sha1;
+    sha1.update("x");
+    sha1.update(zeros);
+    digest = sha1.finish();
+  }
+  double fromMemory = secondsSince(start);
+  start = Clock::now();
+  for (int i = 0; i < repetitions; ++i) {
+    Sha1 sha1;
+    sha1.update("x");
+    sha1.updateZeros(run);
+    check(sha1.finish() == digest, "zero run digest");
+  }
+  double middle = secondsSince(start);
+  Sha1 reference;
+  reference.update(zeros);
+  digest = reference.finish();
+  start = Clock::now();
+  for (int i = 0; i < repetitions; ++i) {
+    Sha1 sha1;
+    sha1.updateZeros(run);
+    check(sha1.finish() == digest, "leading zero run digest");
+  }
+  double leading = secondsSince(start);
+  const double runMib = repetitions * run / double(1 << 20);
+  std::cout << std::setprecision(0) << "SHA-1 of " << run / 1024
+            << " KiB zero runs: from memory " << runMib / fromMemory
+            << " MiB/s, updateZeros mid-message " << runMib / middle
+            << " MiB/s, at message start " << runMib / leading << " MiB/s\n";
+
+  std::filesystem::remove_all(root);
+  return 0;
+}
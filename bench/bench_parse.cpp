@@ -0,0 +1,159 @@
+/**
+ * @brief Benchmark of TorrentFile loading and its instrumentation
+ *
+ * Generates a corpus of synthetic torrents, loads it from memory with
+ * ParseStats disabled and enabled and times trace spans in a loop, to measure
+ * the cost of the hooks. Then loads it from disk with ParseStats enabled and
+ * prints the phase histograms. With a trace file argument, the spans of the
+ * disk loads are written there as Chrome trace JSON.
+ *
+ * The program replaces operator new with a counting version and installs it
+ * as the allocation counter, so the report includes allocations per phase.
+ *
+ * Usage: bench_parse [torrents] [max files per torrent] [trace.json]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <parsestats.hpp>
+#include <string>
+#include <torrentfile.hpp>
+#include <torrentgen.hpp>
+#include <trace.hpp>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+thread_local uint64_t allocationCount = 0;
+
+uint64_t countAllocations() { return allocationCount; }
+
+/**
+ * @brief Load every torrent of the corpus from memory
+ * @return Nanoseconds per load
+ */
+double loadAll(const std::vector<std::string> &corpus) {
+  auto start = std::chrono::steady_clock::now();
+  size_t files = 0;
+  for (const auto &data : corpus) {
+    files += TorrentFile::fromBencode(data).getFiles().size();
+  }
+  double nanos = std::chrono::duration<double, std::nano>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  if (files == 0) {
+    std::cerr << "Empty corpus\n";
+  }
+  return nanos / corpus.size();
+}
+
+/**
+ * @brief Time an empty span in a tight loop
+ * @return Nanoseconds per span
+ */
+double spanNanos() {
+  constexpr int kSpans = 1000000;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kSpans; ++i) {
+    TRACE_SCOPE("bench.span", "bench", "index", i);
+  }
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - start)
+             .count() /
+         kSpans;
+}
+
+} // namespace
+
+void *operator new(size_t size) {
+  ++allocationCount;
+  if (void *pointer = std::malloc(size == 0 ? 1 : size)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+
+void operator delete(void *pointer, size_t) noexcept { std::free(pointer); }
+
+int main(int argc, char *argv[]) {
+  const size_t count = argc > 1 ? std::atoi(argv[1]) : 5000;
+  const uint32_t maxFiles = argc > 2 ? std::atoi(argv[2]) : 64;
+  const std::string tracePath = argc > 3 ? argv[3] : "";
+  constexpr int kRounds = 5;
+
+  TorrentGenerator::Options options;
+  options.maxFiles = maxFiles;
+  options.extraKeys = 2;
+  TorrentGenerator generator(options);
+  std::vector<std::string> corpus(count);
+  size_t totalBytes = 0;
+  for (size_t i = 0; i < count; ++i) {
+    generator.generate(i, corpus[i]);
+    totalBytes += corpus[i].size();
+  }
+  std::cout << "Corpus: " << count << " torrents, 1-" << maxFiles
+            << " files, " << totalBytes / count << " bytes on average\n\n";
+
+  // Alternate disabled and enabled rounds and keep the fastest of each, so
+  // frequency changes and cache warm-up affect both alike
+  ParseStats::setAllocationCounter(countAllocations);
+  double disabled = 1e300;
+  double enabled = 1e300;
+  double spanOff = 1e300;
+  double spanOn = 1e300;
+  for (int round = 0; round < kRounds; ++round) {
+    ParseStats::disable();
+    disabled = std::min(disabled, loadAll(corpus));
+    ParseStats::enable();
+    enabled = std::min(enabled, loadAll(corpus));
+    ParseStats::disable();
+    spanOff = std::min(spanOff, spanNanos());
+    Trace::enable();
+    spanOn = std::min(spanOn, spanNanos());
+    Trace::disable();
+  }
+  std::cout << std::fixed << std::setprecision(0)
+            << "In-memory load, stats disabled: " << disabled << " ns\n"
+            << "In-memory load, stats enabled:  " << enabled << " ns ("
+            << std::showpos << enabled - disabled << std::noshowpos
+            << " ns, mostly the node count walk)\n"
+            << std::setprecision(1) << "Trace span, disabled: " << spanOff
+            << " ns, enabled: " << spanOn << " ns\n\n";
+
+  auto root = std::filesystem::temp_directory_path() /
+              ("bench_parse." + std::to_string(::getpid()));
+  std::filesystem::create_directories(root);
+  for (size_t i = 0; i < count; ++i) {
+    std::ofstream(root / (std::to_string(i) + ".torrent"), std::ios::binary)
+        << corpus[i];
+  }
+
+  ParseStats::enable();
+  ParseStats::reset();
+  if (!tracePath.empty()) {
+    Trace::clear();
+    Trace::setThreadName("loader");
+    Trace::enable();
+  }
+  for (size_t i = 0; i < count; ++i) {
+    TorrentFile torrent((root / (std::to_string(i) + ".torrent")).string());
+  }
+  std::filesystem::remove_all(root);
+
+  std::cout << "Load from disk (page cache), ParseStats::report():\n"
+            << ParseStats::report();
+  if (!tracePath.empty()) {
+    Trace::writeChromeJson(tracePath);
+    std::cout << "\nTrace written to " << tracePath << '\n';
+  }
+  return 0;
+}
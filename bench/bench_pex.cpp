@@ -0,0 +1,271 @@
+/**
+ * @brief Benchmark of PeerExchange deltas against per-recipient set diffs
+ *
+ * A torrent has N connected peers, all speaking ut_pex. Each round, one
+ * simulated minute, 1% of them disconnect and as many new peers connect,
+ * and then every peer gets its next message. A third of the leavers
+ * change flags first and a third reconnect and drop again in between.
+ * PeerExchange reads each delta from its generation-ordered event log.
+ * The baseline keeps, per recipient, the sorted set of peers it was told
+ * about and diffs it with the connected set, which is what a naive
+ * implementation does and costs O(N) per recipient, O(N^2) per round.
+ *
+ * New recipients learn the swarm 50 peers per message, so the first
+ * N / 50 rounds are catch-up; both are timed after it. Joiners keep
+ * catching up, so messages list more than the churn. The deltas of a
+ * sample of recipients are also encoded, framed as BEP 10 extended
+ * messages, decoded and applied to their view of the swarm, which must
+ * end up equal to the connected set.
+ *
+ * Usage: bench_pex [peers]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <peerexchange.hpp>
+#include <peerwire.hpp>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kSampled = 20;   // Recipients whose messages are checked
+constexpr uint8_t kPexId = 1;     // ut_pex id in the extension handshake
+
+void check(bool ok, const std::string &what) {
+  if (!ok) {
+    std::cerr << "Check failed: " << what << '\n';
+    std::exit(1);
+  }
+}
+
+double millisSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Compact IPv4 peer number i, 10.x.y.z:6881
+std::string peerAddress(uint32_t i) {
+  std::string out(6, '\0');
+  out[0] = 10;
+  out[1] = static_cast<char>(i >> 16);
+  out[2] = static_cast<char>(i >> 8);
+  out[3] = static_cast<char>(i);
+  out[4] = static_cast<char>(6881 >> 8);
+  out[5] = static_cast<char>(6881 & 0xff);
+  return out;
+}
+
+// A connected peer of the simulation
+struct Slot {
+  uint32_t address;              // Index for peerAddress()
+  PeerExchange::PeerId peer;     // In the PeerExchange
+  std::vector<uint32_t> told;    // Baseline: addresses sent, sorted
+  bool sampled = false;
+  std::set<std::string> view;    // Sampled: swarm as the messages say
+};
+
+/**
+ * @brief Baseline delta: diff the connected set with what was told
+ *
+ * Added and dropped peers are capped at 50 each, as for PeerExchange.
+ */
+void diffDelta(const std::vector<uint32_t> &connected, Slot &slot) {
+  std::vector<uint32_t> added, dropped;
+  std::set_difference(connected.begin(), connected.end(),
+                      slot.told.begin(), slot.told.end(),
+                      std::back_inserter(added));
+  std::set_difference(slot.told.begin(), slot.told.end(),
+                      connected.begin(), connected.end(),
+                      std::back_inserter(dropped));
+  added.erase(std::remove(added.begin(), added.end(), slot.address),
+              added.end());
+  added.resize(std::min<size_t>(added.size(), 50));
+  dropped.resize(std::min<size_t>(dropped.size(), 50));
+  std::vector<uint32_t> told;
+  std::set_difference(slot.told.begin(), slot.told.end(), dropped.begin(),
+                      dropped.end(), std::back_inserter(told));
+  std::vector<uint32_t> merged;
+  std::merge(told.begin(), told.end(), added.begin(), added.end(),
+             std::back_inserter(merged));
+  slot.told = std::move(merged);
+}
+
+struct RoundTimes {
+  double exchange = 0; // Milliseconds per round, PeerExchange
+  double diff = 0;     // Milliseconds per round, set diffs
+  uint64_t entries = 0; // Peers listed per round, PeerExchange
+  size_t logSize = 0;
+};
+
+RoundTimes run(size_t peers, size_t timedRounds) {
+  std::mt19937 random(11);
+  PeerExchange exchange;
+  std::vector<Slot> slots;
+  uint32_t nextAddress = 0;
+  auto join = [&] {
+    Slot slot;
+    slot.address = nextAddress++;
+    slot.peer = exchange.connect(peerAddress(slot.address),
+                                 PeerExchange::kUtp);
+    exchange.enable(slot.peer);
+    slots.push_back(std::move(slot));
+  };
+  for (size_t i = 0; i < peers; ++i) {
+    join();
+  }
+  for (size_t i = 0; i < kSampled; ++i) {
+    slots[i].sampled = true;
+  }
+
+  const size_t churn = std::max<size_t>(1, peers / 100);
+  const size_t catchUp = peers / 50 + 2;
+  RoundTimes times;
+  PeerExchange::Message message;
+  std::string wire;
+  PeerWire::Reader reader(false);
+  // Send a sampled recipient its message over the wire and apply it
+  auto deliver = [&](Slot &slot) {
+    wire.clear();
+    PeerWire::appendExtended(wire, kPexId, PeerExchange::encode(message));
+    reader.feed(wire.data(), wire.size());
+    PeerWire::Message framed;
+    check(reader.next(framed) &&
+              framed.id == PeerWire::MessageId::Extended &&
+              framed.extendedId == kPexId,
+          "ut_pex message framed");
+    PeerExchange::Message decoded = PeerExchange::decode(framed.data);
+    for (const std::string &peer : decoded.dropped) {
+      slot.view.erase(peer);
+    }
+    slot.view.insert(decoded.added.begin(), decoded.added.end());
+  };
+
+  for (size_t round = 0; round < catchUp + timedRounds; ++round) {
+    const bool timed = round >= catchUp;
+    for (size_t i = 0; i < churn; ++i) {
+      size_t victim = kSampled + random() % (slots.size() - kSampled);
+      Slot &leaving = slots[victim];
+      if (i % 3 == 1) {
+        // Flags change just before the peer leaves
+        exchange.setFlags(leaving.peer, PeerExchange::kUtp |
+                                            PeerExchange::kSeed);
+      } else if (i % 3 == 2) {
+        // A quick reconnect, gone again before the next message
+        exchange.disconnect(leaving.peer);
+        leaving.peer = exchange.connect(peerAddress(leaving.address),
+                                        PeerExchange::kUtp);
+      }
+      exchange.disconnect(leaving.peer);
+      slots[victim] = std::move(slots.back());
+      slots.pop_back();
+      join();
+    }
+
+    std::vector<uint32_t> connected;
+    for (const Slot &slot : slots) {
+      connected.push_back(slot.address);
+    }
+    std::sort(connected.begin(), connected.end());
+    auto start = Clock::now();
+    for (Slot &slot : slots) {
+      diffDelta(connected, slot);
+    }
+    if (timed) {
+      times.diff += millisSince(start);
+    }
+
+    start = Clock::now();
+    for (Slot &slot : slots) {
+      if (!exchange.next(slot.peer, message)) {
+        continue;
+      }
+      if (timed) {
+        times.entries += message.added.size() + message.dropped.size();
+      }
+      if (slot.sampled) {
+        deliver(slot);
+      }
+    }
+    if (timed) {
+      times.exchange += millisSince(start);
+    }
+  }
+
+  // Without churn, the sampled recipients run out of news
+  bool settling = true;
+  while (settling) {
+    settling = false;
+    for (size_t i = 0; i < kSampled; ++i) {
+      if (exchange.next(slots[i].peer, message)) {
+        deliver(slots[i]);
+        settling = true;
+      }
+    }
+  }
+  times.exchange /= timedRounds;
+  times.diff /= timedRounds;
+  times.entries /= timedRounds;
+  times.logSize = exchange.logSize();
+
+  std::set<std::string> swarm;
+  for (const Slot &slot : slots) {
+    swarm.insert(peerAddress(slot.address));
+  }
+  for (const Slot &slot : slots) {
+    if (slot.sampled) {
+      std::set<std::string> expected = swarm;
+      expected.erase(peerAddress(slot.address));
+      check(slot.view == expected, "recipient's view matches the swarm");
+    }
+  }
+  return times;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const size_t maxPeers =
+      argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 5000;
+  const size_t rounds = 20;
+
+  PeerExchange::Message mixed;
+  mixed.added = {PeerExchange::compactPeer("192.0.2.7", 6881),
+                 PeerExchange::compactPeer("2001:db8::1", 51413)};
+  mixed.addedFlags = {PeerExchange::kSeed,
+                      PeerExchange::kUtp | PeerExchange::kReachable};
+  mixed.dropped = {PeerExchange::compactPeer("::ffff:10.0.0.1", 1)};
+  PeerExchange::Message decoded =
+      PeerExchange::decode(PeerExchange::encode(mixed));
+  check(decoded.added == mixed.added &&
+            decoded.addedFlags == mixed.addedFlags &&
+            decoded.dropped == mixed.dropped,
+        "IPv4 and IPv6 peers survive encode and decode");
+  check(PeerExchange::formatPeer(decoded.added[1]) == "[2001:db8::1]:51413",
+        "IPv6 peer formatted");
+
+  std::cout << std::fixed << std::setprecision(2)
+            << "ut_pex rounds, 1% churn per round, every peer messaged; "
+            << "mean of " << rounds << " rounds after catch-up\n";
+  for (size_t peers : {maxPeers / 5, maxPeers / 2, maxPeers}) {
+    RoundTimes t = run(peers, rounds);
+    std::cout << "  " << std::setw(5) << peers << " peers: event log "
+              << std::setw(6) << t.exchange << " ms/round ("
+              << std::setw(5) << t.exchange * 1e6 / t.entries
+              << " ns/peer listed), set diffs " << std::setw(8) << t.diff
+              << " ms/round, " << std::setprecision(0) << std::setw(4)
+              << t.diff / t.exchange << "x; " << t.entries
+              << " peers listed per round, " << t.logSize
+              << " log events" << std::setprecision(2) << '\n';
+  }
+  std::cout << "Sampled recipients' decoded views match the swarm\n";
+  return 0;
+}
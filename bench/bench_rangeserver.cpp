@@ -0,0 +1,399 @@
+/**
+ * @brief Benchmark of RangeServer under many concurrent range requests
+ *
+ * Writes a multi-file torrent with generated content through Storage and
+ * serves it. First checks the protocol with a blocking client: whole
+ * files, ranges, suffix ranges, HEAD, pipelined requests and the error
+ * statuses, and a range that reaches a missing piece, which must wait
+ * until pieceCompleted() reports it. Then opens many keep-alive
+ * connections from one epoll loop, each requesting random ranges back to
+ * back, and reports requests per second, throughput and latency; every
+ * 16th response body is compared with the content.
+ *
+ * Usage: bench_rangeserver [connections] [requests each] [range KiB]
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <bencode.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <numeric>
+#include <random>
+#include <rangeserver.hpp>
+#include <storage.hpp>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <torrentfile.hpp>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int64_t kPieceLength = 256 * 1024;
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void check(bool ok, const std::string &what) {
+  if (!ok) {
+    std::cerr << "Check failed: " << what << '\n';
+    std::exit(1);
+  }
+}
+
+/**
+ * @brief Content byte at a position of the torrent
+ */
+char contentAt(int64_t position) {
+  uint64_t x = static_cast<uint64_t>(position >> 3) * 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 31)) * 0xbf58476d1ce4e5b9ULL;
+  return static_cast<char>((x ^ (x >> 29)) >> ((position & 7) * 8));
+}
+
+bool matches(const char *data, size_t length, int64_t position) {
+  for (size_t i = 0; i < length; ++i) {
+    if (data[i] != contentAt(position + i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int connectTo(uint16_t port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  check(fd >= 0 && connect(fd, reinterpret_cast<sockaddr *>(&address),
+                           sizeof(address)) == 0,
+        "connect");
+  return fd;
+}
+
+/**
+ * @brief A parsed response of the blocking client
+ */
+struct Response {
+  int status = 0;
+  std::string headers;
+  std::string body;
+};
+
+/**
+ * @brief Read one response from a blocking socket
+ * @param pending Bytes read past the previous response, kept for the next
+ */
+Response readResponse(int fd, std::string &pending, bool head = false) {
+  Response response;
+  char buffer[64 * 1024];
+  size_t end;
+  while ((end = pending.find("\r\n\r\n")) == std::string::npos) {
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    check(n > 0, "response headers");
+    pending.append(buffer, n);
+  }
+  response.headers = pending.substr(0, end + 4);
+  pending.erase(0, end + 4);
+  response.status = std::atoi(response.headers.c_str() + 9);
+  size_t at = response.headers.find("Content-Length: ");
+  size_t length = head ? 0 : std::strtoull(
+                                 response.headers.c_str() + at + 16, nullptr,
+                                 10);
+  while (pending.size() < length) {
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    check(n > 0, "response body");
+    pending.append(buffer, n);
+  }
+  response.body = pending.substr(0, length);
+  pending.erase(0, length);
+  return response;
+}
+
+Response request(uint16_t port, const std::string &text, bool head = false) {
+  int fd = connectTo(port);
+  check(send(fd, text.data(), text.size(), 0) ==
+            static_cast<ssize_t>(text.size()),
+        "send");
+  std::string pending;
+  Response response = readResponse(fd, pending, head);
+  close(fd);
+  return response;
+}
+
+/**
+ * @brief A keep-alive connection of the load client
+ */
+struct Client {
+  int fd = -1;
+  std::string headers;     // Response headers read so far
+  bool inBody = false;
+  int64_t remaining = 0;   // Body bytes still expected
+  int64_t position = 0;    // Torrent position of the next body byte
+  bool verify = false;     // Compare the body with the content
+  size_t done = 0;         // Completed requests
+  Clock::time_point sent;  // When the current request went out
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const size_t connections = argc > 1 ? std::atoll(argv[1]) : 2000;
+  const size_t requestsEach = argc > 2 ? std::atoll(argv[2]) : 20;
+  const int64_t rangeBytes = int64_t(argc > 3 ? std::atoll(argv[3]) : 256) *
+                             1024;
+
+  // Three files, the middle one not on a piece boundary
+  const std::vector<std::pair<std::string, int64_t>> layout = {
+      {"movie one.mkv", 40 << 20}, {"extras/trailer.mp4", (12 << 20) + 12345},
+      {"subs.srt", 70000}};
+  std::string data = "d4:infod5:filesl";
+  int64_t totalSize = 0;
+  for (const auto &[path, length] : layout) {
+    data += "d6:length";
+    BencodeEncoder::encodeInt(length, data);
+    data += "4:pathl";
+    size_t slash = path.find('/');
+    if (slash != std::string::npos) {
+      BencodeEncoder::encodeString(path.substr(0, slash), data);
+    }
+    BencodeEncoder::encodeString(path.substr(slash + 1), data);
+    data += "ee";
+    totalSize += length;
+  }
+  const uint32_t pieceCount = (totalSize + kPieceLength - 1) / kPieceLength;
+  data += "e4:name5:bench12:piece length";
+  BencodeEncoder::encodeInt(kPieceLength, data);
+  data += "6:pieces";
+  BencodeEncoder::encodeString(std::string(20 * pieceCount, 'x'), data);
+  data += "ee";
+  TorrentFile torrent = TorrentFile::fromBencode(data);
+
+  std::string root =
+      (std::filesystem::temp_directory_path() / "bench_rangeserver.XXXXXX")
+          .string();
+  check(mkdtemp(root.data()) != nullptr, "mkdtemp");
+  {
+    Storage storage(torrent, root);
+    std::string block(kPieceLength, '\0');
+    for (uint32_t piece = 0; piece < pieceCount; ++piece) {
+      for (uint32_t i = 0; i < storage.pieceSize(piece); ++i) {
+        block[i] = contentAt(int64_t(piece) * kPieceLength + i);
+      }
+      storage.writeBlock(piece, 0, storage.pieceSize(piece), block.data());
+    }
+  }
+
+  // Protocol checks, with one piece of the second file missing
+  const uint32_t missing = (40 << 20) / kPieceLength + 3;
+  std::vector<bool> have(pieceCount, true);
+  have[missing] = false;
+  RangeServer server(torrent, root, have, {});
+  const uint16_t port = server.port();
+  const std::string movie = server.urlPath(0);
+  const std::string trailer = server.urlPath(1);
+  const int64_t trailerStart = 40 << 20;
+  check(movie == "/bench/movie%20one.mkv", "encoded path");
+
+  Response r =
+      request(port, "GET " + server.urlPath(2) + " HTTP/1.1\r\n\r\n");
+  check(r.status == 200 && r.body.size() == 70000 &&
+            matches(r.body.data(), r.body.size(), totalSize - 70000),
+        "whole file");
+  r = request(port,
+              "GET " + movie + " HTTP/1.1\r\nRange: bytes=100-199\r\n\r\n");
+  check(r.status == 206 && r.body.size() == 100 &&
+            matches(r.body.data(), 100, 100) &&
+            r.headers.find("Content-Range: bytes 100-199/41943040") !=
+                std::string::npos &&
+            r.headers.find("video/x-matroska") != std::string::npos,
+        "range");
+  r = request(port, "GET " + movie + " HTTP/1.1\r\nRange: bytes=-10\r\n\r\n");
+  check(r.status == 206 && matches(r.body.data(), 10, (40 << 20) - 10),
+        "suffix range");
+  r = request(port, "HEAD " + movie + " HTTP/1.1\r\n\r\n", true);
+  check(r.status == 200 && r.body.empty(), "head");
+  r = request(port, "GET " + movie +
+                        " HTTP/1.1\r\nRange: bytes=50000000-\r\n\r\n");
+  check(r.status == 416, "unsatisfiable range");
+  r = request(port, "GET /nothing HTTP/1.1\r\n\r\n");
+  check(r.status == 404, "not found");
+  r = request(port, "POST " + movie + " HTTP/1.1\r\n\r\n");
+  check(r.status == 405, "method");
+  {
+    int fd = connectTo(port);
+    std::string two = "GET " + movie + " HTTP/1.1\r\nRange: bytes=0-9\r\n\r\n"
+                      "GET " + movie + " HTTP/1.1\r\nRange: bytes=10-19\r\n"
+                      "Connection: close\r\n\r\n";
+    send(fd, two.data(), two.size(), 0);
+    std::string pending;
+    Response a = readResponse(fd, pending);
+    Response b = readResponse(fd, pending);
+    check(matches(a.body.data(), 10, 0) && matches(b.body.data(), 10, 10) &&
+              recv(fd, &pending[0], 1, 0) == 0,
+          "pipelined requests");
+    close(fd);
+  }
+
+  // A range across the missing piece waits for it
+  const int64_t across = int64_t(missing) * kPieceLength - trailerStart - 1000;
+  auto start = Clock::now();
+  std::thread completer([&server, missing] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    server.pieceCompleted(missing);
+  });
+  r = request(port, "GET " + trailer + " HTTP/1.1\r\nRange: bytes=" +
+                        std::to_string(across) + "-" +
+                        std::to_string(across + kPieceLength) + "\r\n\r\n");
+  double waited = secondsSince(start);
+  completer.join();
+  check(r.status == 206 &&
+            matches(r.body.data(), r.body.size(), trailerStart + across) &&
+            waited >= 0.1 && server.stats().waits == 1,
+        "wait for missing piece");
+  std::cout << std::fixed << std::setprecision(1)
+            << "Protocol checks passed; range across a missing piece served "
+            << waited * 1000 << " ms after the request (piece completed at "
+            << "100 ms)\n";
+
+  // Load: keep-alive connections with random ranges back to back
+  std::mt19937_64 random(1);
+  auto nextRange = [&](Client &client) {
+    size_t file = random() % 2;
+    int64_t fileStart = file == 0 ? 0 : trailerStart;
+    int64_t size = layout[file].second;
+    int64_t first = random() % size;
+    int64_t last = std::min(size, first + rangeBytes) - 1;
+    std::string text = "GET " + (file == 0 ? movie : trailer) +
+                       " HTTP/1.1\r\nHost: localhost\r\nRange: bytes=" +
+                       std::to_string(first) + "-" + std::to_string(last) +
+                       "\r\n\r\n";
+    client.headers.clear();
+    client.inBody = false;
+    client.position = fileStart + first;
+    client.verify = client.done % 16 == 0;
+    client.sent = Clock::now();
+    check(send(client.fd, text.data(), text.size(), MSG_NOSIGNAL) ==
+              static_cast<ssize_t>(text.size()),
+          "send request");
+  };
+
+  int epollFd = epoll_create1(EPOLL_CLOEXEC);
+  std::vector<Client> clients(connections);
+  start = Clock::now();
+  for (size_t i = 0; i < connections; ++i) {
+    clients[i].fd = connectTo(port);
+    check(fcntl(clients[i].fd, F_SETFL, O_NONBLOCK) == 0, "non-blocking");
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.u64 = i;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, clients[i].fd, &event);
+  }
+  double connectSeconds = secondsSince(start);
+
+  start = Clock::now();
+  for (auto &client : clients) {
+    nextRange(client);
+  }
+  std::vector<double> latencies;
+  latencies.reserve(connections * requestsEach);
+  uint64_t bodyBytes = 0;
+  size_t active = connections;
+  std::vector<char> buffer(256 * 1024);
+  std::vector<epoll_event> events(1024);
+  while (active > 0) {
+    int count = epoll_wait(epollFd, events.data(), events.size(), 5000);
+    check(count > 0, "responses arrive");
+    for (int e = 0; e < count; ++e) {
+      Client &client = clients[events[e].data.u64];
+      while (client.fd >= 0) {
+        ssize_t n = recv(client.fd, buffer.data(), buffer.size(), 0);
+        if (n < 0 && errno == EAGAIN) {
+          break;
+        }
+        check(n > 0, "connection stays open");
+        const char *p = buffer.data();
+        while (n > 0 && client.fd >= 0) {
+          if (!client.inBody) {
+            size_t before = client.headers.size();
+            client.headers.append(p, n);
+            size_t end = client.headers.find("\r\n\r\n");
+            if (end == std::string::npos) {
+              n = 0;
+              break;
+            }
+            check(client.headers.compare(9, 3, "206") == 0, "status 206");
+            size_t at = client.headers.find("Content-Length: ");
+            client.remaining =
+                std::strtoll(client.headers.c_str() + at + 16, nullptr, 10);
+            client.inBody = true;
+            size_t used = end + 4 - before;
+            p += used;
+            n -= used;
+          }
+          int64_t take = std::min<int64_t>(n, client.remaining);
+          if (client.verify) {
+            check(matches(p, take, client.position), "body content");
+          }
+          client.position += take;
+          client.remaining -= take;
+          bodyBytes += take;
+          p += take;
+          n -= take;
+          if (client.remaining == 0) {
+            latencies.push_back(secondsSince(client.sent));
+            if (++client.done == requestsEach) {
+              check(n == 0, "no bytes after the last response");
+              close(client.fd);
+              client.fd = -1;
+              --active;
+            } else {
+              nextRange(client);
+            }
+          }
+        }
+      }
+    }
+  }
+  double seconds = secondsSince(start);
+  close(epollFd);
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies[size_t(p / 100 * (latencies.size() - 1))] * 1000;
+  };
+  RangeServer::Stats stats = server.stats();
+  std::cout << connections << " connections (opened in "
+            << connectSeconds * 1000 << " ms), " << requestsEach
+            << " requests of " << rangeBytes / 1024 << " KiB each\n"
+            << std::setprecision(0) << latencies.size() / seconds
+            << " requests/s, " << std::setprecision(1)
+            << bodyBytes / seconds / (1 << 20) << " MiB/s\n"
+            << "Latency ms: mean "
+            << std::accumulate(latencies.begin(), latencies.end(), 0.0) /
+                   latencies.size() * 1000
+            << "  p50 "
+            << percentile(50) << "  p90 "
+            << percentile(90) << "  p99 " << percentile(99) << "  max "
+            << latencies.back() * 1000 << "\n"
+            << "Server: " << stats.requests << " requests, " << stats.ranges
+            << " ranges, " << stats.errors << " errors, "
+            << stats.bytesSent / (1 << 20) << " MiB sent\n";
+
+  server.stop();
+  std::filesystem::remove_all(root);
+  return 0;
+}
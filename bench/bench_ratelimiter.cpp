@@ -0,0 +1,94 @@
+/**
+ * @brief Benchmark of the hierarchical bandwidth scheduler
+ *
+ * Simulates a large number of always-busy connections spread over many
+ * torrents and two peer classes below a global limit, and measures how long
+ * each scheduler tick takes. It also reports the achieved rate and how evenly
+ * bandwidth was shared, so regressions in fairness show up next to regressions
+ * in speed.
+ *
+ * Usage: bench_ratelimiter [connections] [ticks]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <ratelimiter.hpp>
+#include <vector>
+
+int main(int argc, char *argv[]) {
+  const size_t numConnections = argc > 1 ? std::atoi(argv[1]) : 10000;
+  const int numTicks = argc > 2 ? std::atoi(argv[2]) : 2000;
+  const size_t numTorrents = 100;
+  const int64_t tickMicros = 10 * 1000; // 100 ticks per second
+  const int64_t globalRate = 100 * 1024 * 1024;
+  const int64_t backlog = 64 * 1024; // Bytes each connection keeps queued
+
+  // Global root, one channel per torrent and two peer classes
+  BandwidthScheduler scheduler;
+  auto global =
+      scheduler.addChannel(BandwidthScheduler::kNoParent, globalRate);
+  std::vector<BandwidthScheduler::ChannelId> torrents;
+  for (size_t i = 0; i < numTorrents; ++i) {
+    torrents.push_back(scheduler.addChannel(global, 2 * 1024 * 1024));
+  }
+  auto localClass = scheduler.addChannel(global, 0);
+  auto internetClass = scheduler.addChannel(global, 80 * 1024 * 1024);
+
+  std::vector<BandwidthScheduler::ConnectionId> ids;
+  for (size_t i = 0; i < numConnections; ++i) {
+    auto peerClass = i % 10 == 0 ? localClass : internetClass;
+    ids.push_back(
+        scheduler.addConnection({torrents[i % numTorrents], peerClass}));
+    scheduler.request(ids.back(), backlog);
+  }
+
+  // Every connection immediately asks for as much as it was granted, so the
+  // scheduler always has the full set of connections waiting
+  std::vector<int64_t> received(numConnections, 0);
+  int64_t total = 0;
+  auto onGrant = [&](BandwidthScheduler::ConnectionId id, int64_t bytes) {
+    received[id] += bytes;
+    total += bytes;
+    scheduler.request(id, bytes);
+  };
+
+  // Warm up so buckets reach steady state before timing
+  for (int i = 0; i < 100; ++i) {
+    scheduler.tick(tickMicros, onGrant);
+  }
+  std::fill(received.begin(), received.end(), 0);
+  total = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < numTicks; ++i) {
+    scheduler.tick(tickMicros, onGrant);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+
+  // Jain's fairness index over connections of the congested peer class
+  double sum = 0, sumSquares = 0;
+  size_t count = 0;
+  for (size_t i = 0; i < numConnections; ++i) {
+    if (i % 10 == 0) {
+      continue;
+    }
+    sum += static_cast<double>(received[i]);
+    sumSquares += static_cast<double>(received[i]) * received[i];
+    ++count;
+  }
+  double fairness = sumSquares > 0 ? sum * sum / (count * sumSquares) : 1.0;
+
+  double simulatedSeconds = numTicks * tickMicros / 1e6;
+  std::cout << "Connections:          " << numConnections << '\n';
+  std::cout << "Ticks:                " << numTicks << '\n';
+  std::cout << "Time per tick:        " << ns / numTicks / 1000 << " us\n";
+  std::cout << "Time per connection:  " << ns / numTicks / numConnections
+            << " ns\n";
+  std::cout << "Achieved rate:        " << total / simulatedSeconds / 1048576
+            << " MiB/s (limit " << globalRate / 1048576 << " MiB/s)\n";
+  std::cout << "Jain fairness index:  " << fairness << '\n';
+  return 0;
+}
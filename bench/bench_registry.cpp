@@ -0,0 +1,215 @@
+/**
+ * @brief Benchmark of TorrentRegistry lookups under many reader threads
+ *
+ * Fills a registry with random 20-byte info hashes, all mapped to one
+ * shared torrent, then measures lookup throughput of many threads doing
+ * one guarded lookup at a time (one in eight for an absent key), as
+ * handshake handlers do:
+ * - with no writers,
+ * - while one thread erases and re-inserts random keys, which exercises
+ *   tombstones, rebuilds and epoch reclamation,
+ * - against std::unordered_map behind a std::shared_mutex, for comparison.
+ *
+ * Throughput is summed over all readers; on fewer cores than readers it
+ * measures the cost per lookup rather than scaling.
+ *
+ * Usage: bench_registry [entries] [reader threads] [seconds per phase]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <torrentgen.hpp>
+#include <torrentregistry.hpp>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+constexpr size_t kAbsentKeys = 65536; // Keys looked up but never inserted
+
+/**
+ * @brief SplitMix64 step, used to derive keys and lookup sequences
+ */
+uint64_t splitMix(uint64_t &state) {
+  uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/**
+ * @brief Derive the 20-byte digest of key number index
+ */
+std::string makeDigest(uint64_t index) {
+  uint64_t state = index;
+  std::string digest(20, '\0');
+  for (size_t i = 0; i < digest.size(); i += 8) {
+    uint64_t word = splitMix(state);
+    std::memcpy(&digest[i], &word, std::min<size_t>(8, digest.size() - i));
+  }
+  return digest;
+}
+
+/**
+ * @brief Run readers, and optionally one writer, for a fixed time
+ * @param lookup Lookup of key number index; returns whether it was found
+ * @param writer Called in a loop on its own thread, or nullptr
+ * @return Lookups per second over all readers
+ */
+template <typename Lookup>
+double runReaders(size_t readers, double seconds, size_t entries,
+                  const Lookup &lookup, void (*writer)(void *) = nullptr,
+                  void *writerContext = nullptr) {
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> total{0};
+  std::atomic<uint64_t> wrong{0};
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < readers; ++t) {
+    threads.emplace_back([&, t] {
+      uint64_t state = t * 7919 + 1;
+      uint64_t done = 0;
+      uint64_t errors = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int i = 0; i < 256; ++i) {
+          uint64_t r = splitMix(state);
+          // Indexes past the inserted keys pick from the absent keys
+          bool present = (r & 7) != 0;
+          uint64_t index = present ? (r >> 3) % entries
+                                   : entries + (r >> 3) % kAbsentKeys;
+          if (lookup(index) != present && !writer) {
+            errors++;
+          }
+        }
+        done += 256;
+      }
+      total.fetch_add(done);
+      wrong.fetch_add(errors);
+    });
+  }
+  std::thread writerThread;
+  if (writer != nullptr) {
+    writerThread = std::thread([&] {
+      while (!stop.load(std::memory_order_relaxed)) {
+        writer(writerContext);
+      }
+    });
+  }
+  auto start = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop.store(true);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  if (writerThread.joinable()) {
+    writerThread.join();
+  }
+  double elapsed = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  if (wrong.load() > 0) {
+    std::cerr << "Wrong lookup results: " << wrong.load() << '\n';
+    std::exit(1);
+  }
+  return total.load() / elapsed;
+}
+
+struct Churn {
+  TorrentRegistry *registry;
+  const std::vector<InfoHash> *keys;
+  size_t entries; // Keys that are inserted
+  std::shared_ptr<const TorrentFile> torrent;
+  uint64_t state = 42;
+  uint64_t operations = 0;
+};
+
+/**
+ * @brief Erase a random key and insert it again
+ */
+void churn(void *context) {
+  auto &c = *static_cast<Churn *>(context);
+  const InfoHash &key = (*c.keys)[splitMix(c.state) % c.entries];
+  c.registry->erase(key);
+  c.registry->insert(key, c.torrent);
+  c.operations++;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const size_t entries = argc > 1 ? std::atoll(argv[1]) : 10000000;
+  const size_t readers = argc > 2 ? std::atoi(argv[2]) : 32;
+  const double seconds = argc > 3 ? std::atof(argv[3]) : 2;
+
+  TorrentGenerator::Options options;
+  TorrentGenerator generator(options);
+  auto torrent = std::make_shared<const TorrentFile>(
+      TorrentFile::fromBencode(generator.generate(0)));
+
+  // Present keys first, then the absent ones
+  std::vector<InfoHash> keys;
+  keys.reserve(entries + kAbsentKeys);
+  for (size_t i = 0; i < entries + kAbsentKeys; ++i) {
+    keys.emplace_back(makeDigest(i));
+  }
+  std::cout << std::fixed << std::setprecision(1) << "Entries: " << entries
+            << ", readers: " << readers << "\n\n";
+
+  {
+    TorrentRegistry registry;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < entries; ++i) {
+      registry.insert(keys[i], torrent);
+    }
+    double insertNanos = std::chrono::duration<double, std::nano>(
+                             std::chrono::steady_clock::now() - start)
+                             .count() /
+                         entries;
+    std::cout << "Insert (growing from empty): " << insertNanos
+              << " ns per entry, " << Epoch::pending()
+              << " outgrown tables awaiting reclamation\n";
+    Epoch::collect();
+
+    auto lookup = [&](uint64_t index) {
+      Epoch::Guard guard;
+      return registry.find(guard, keys[index]) != nullptr;
+    };
+    double rate = runReaders(readers, seconds, entries, lookup);
+    std::cout << "Registry, readers only:     " << rate / 1e6
+              << " M lookups/s (" << 1e9 / rate << " ns per lookup)\n";
+
+    Churn context{&registry, &keys, entries, torrent};
+    rate = runReaders(readers, seconds, entries, lookup, churn, &context);
+    size_t pending = Epoch::pending();
+    Epoch::collect();
+    std::cout << "Registry, one writer:       " << rate / 1e6
+              << " M lookups/s, " << context.operations / seconds
+              << " erase+insert/s, " << pending << " pending -> "
+              << Epoch::pending() << " after collect\n";
+  }
+
+  // Keys are views into the key vector, so neither side allocates
+  std::unordered_map<std::string_view, std::shared_ptr<const TorrentFile>>
+      map;
+  std::shared_mutex mutex;
+  map.reserve(entries);
+  for (size_t i = 0; i < entries; ++i) {
+    map.emplace(keys[i].view(), torrent);
+  }
+  auto lookup = [&](uint64_t index) {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return map.find(keys[index].view()) != map.end();
+  };
+  double rate = runReaders(readers, seconds, entries, lookup);
+  std::cout << "unordered_map+shared_mutex: " << rate / 1e6
+            << " M lookups/s (" << 1e9 / rate << " ns per lookup)\n";
+  return 0;
+}
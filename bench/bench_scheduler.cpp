@@ -0,0 +1,139 @@
+/**
+ * @brief Benchmark of Scheduler task spawn and steal overhead
+ *
+ * Measures, per task:
+ * - spawning and running empty tasks from a worker, which only touches the
+ *   worker's own deque unless others steal (the spawning worker runs its
+ *   own tasks newest first while it waits),
+ * - submitting empty tasks from an outside thread through the injection
+ *   queue,
+ * - recursive fork-join (naive Fibonacci), where nearly every task spawns
+ *   two more and idle workers live off steals,
+ * - parallelFor over a range of cheap iterations.
+ *
+ * Each run prints the scheduler's counters, which show how much of the work
+ * was stolen or injected and how often workers parked. On a single core the
+ * steal figures mostly reflect time slicing rather than parallel thieves.
+ *
+ * Usage: bench_scheduler [threads] [tasks]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <scheduler.hpp>
+#include <string>
+
+namespace {
+
+/**
+ * @brief Time a function
+ * @return Seconds taken
+ */
+template <typename Function> double timeIt(Function &&function) {
+  auto start = std::chrono::steady_clock::now();
+  function();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+/**
+ * @brief Naive Fibonacci with one task per call above the cutoff
+ */
+uint64_t fib(Scheduler &scheduler, unsigned n) {
+  if (n < 2) {
+    return n;
+  }
+  uint64_t left = 0;
+  uint64_t right = 0;
+  Scheduler::TaskGroup group(scheduler);
+  group.spawn([&] { left = fib(scheduler, n - 1); });
+  right = fib(scheduler, n - 2);
+  group.wait();
+  return left + right;
+}
+
+/**
+ * @brief Number of calls fib(n) makes
+ */
+uint64_t fibCalls(unsigned n) {
+  return n < 2 ? 1 : 1 + fibCalls(n - 1) + fibCalls(n - 2);
+}
+
+void report(const std::string &name, double seconds, uint64_t tasks,
+            const Scheduler::Stats &before, const Scheduler::Stats &after) {
+  std::cout << std::left << std::setw(22) << name << std::right << std::fixed
+            << std::setprecision(1) << std::setw(8)
+            << seconds * 1e9 / tasks << " ns/task  executed "
+            << after.executed - before.executed << ", stolen "
+            << after.stolen - before.stolen << ", injected "
+            << after.injected - before.injected << ", parks "
+            << after.parks - before.parks << '\n';
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const size_t threads = argc > 1 ? std::atoi(argv[1]) : 0;
+  const size_t tasks = argc > 2 ? std::atoi(argv[2]) : 1000000;
+  constexpr unsigned kFib = 25;
+
+  Scheduler scheduler(threads);
+  std::cout << "Threads: " << scheduler.numThreads() << ", tasks: " << tasks
+            << "\n\n";
+  std::atomic<uint64_t> counter{0};
+
+  // Spawn from inside a worker so the tasks go to its own deque
+  Scheduler::Stats before = scheduler.stats();
+  double seconds = timeIt([&] {
+    Scheduler::TaskGroup outer(scheduler);
+    outer.spawn([&] {
+      Scheduler::TaskGroup group(scheduler);
+      for (size_t i = 0; i < tasks; ++i) {
+        group.spawn([&] { counter.fetch_add(1, std::memory_order_relaxed); });
+      }
+      group.wait();
+    });
+    outer.wait();
+  });
+  report("spawn from worker", seconds, tasks, before, scheduler.stats());
+
+  before = scheduler.stats();
+  seconds = timeIt([&] {
+    Scheduler::TaskGroup group(scheduler);
+    for (size_t i = 0; i < tasks; ++i) {
+      group.spawn([&] { counter.fetch_add(1, std::memory_order_relaxed); });
+    }
+    group.wait();
+  });
+  report("submit from outside", seconds, tasks, before, scheduler.stats());
+
+  before = scheduler.stats();
+  uint64_t result = 0;
+  seconds = timeIt([&] {
+    Scheduler::TaskGroup group(scheduler);
+    group.spawn([&] { result = fib(scheduler, kFib); });
+    group.wait();
+  });
+  report("fork-join fib(" + std::to_string(kFib) + ")", seconds,
+         fibCalls(kFib), before, scheduler.stats());
+
+  before = scheduler.stats();
+  seconds = timeIt([&] {
+    scheduler.parallelFor(0, tasks, [&](size_t) {
+      counter.fetch_add(1, std::memory_order_relaxed);
+    });
+  });
+  report("parallelFor (per index)", seconds, tasks, before, scheduler.stats());
+
+  if (counter.load() != 3 * tasks || result != 75025) {
+    std::cerr << "Lost tasks: counter " << counter.load() << ", fib "
+              << result << '\n';
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,122 @@
+/**
+ * @brief Benchmark of TrigramIndex building and substring queries
+ *
+ * Indexes the names and file paths of a synthetic corpus, then runs
+ * queries cut from random documents' strings at several lengths, plus
+ * two-byte queries, which have no trigram and scan every document. Reports
+ * build rate, memory and per-query latency with the work each query did.
+ *
+ * Usage: bench_search [torrents] [max files per torrent] [queries]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <torrentfile.hpp>
+#include <torrentgen.hpp>
+#include <trigramindex.hpp>
+#include <vector>
+
+namespace {
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const size_t count = argc > 1 ? std::atoll(argv[1]) : 1000000;
+  const uint32_t maxFiles = argc > 2 ? std::atoi(argv[2]) : 8;
+  const size_t queries = argc > 3 ? std::atoi(argv[3]) : 200;
+
+  // Few pieces per torrent: the benchmark is about names, not hashes
+  TorrentGenerator::Options options;
+  options.maxFiles = maxFiles;
+  options.maxFileSize = 1 << 20;
+  options.targetPieces = 4;
+  options.announceList = false;
+  TorrentGenerator generator(options);
+
+  TrigramIndex index;
+  std::vector<std::string> samples; // Strings queries are cut from
+  std::string data;
+  double indexSeconds = 0;
+  for (size_t i = 0; i < count; ++i) {
+    generator.generate(i, data);
+    TorrentFile torrent = TorrentFile::fromBencode(data);
+    auto indexStart = std::chrono::steady_clock::now();
+    index.add(torrent);
+    indexSeconds += secondsSince(indexStart);
+    if (i % std::max<size_t>(1, count / queries) == 0) {
+      const auto &files = torrent.getFiles();
+      samples.push_back(i % 2 == 0 ? torrent.getName()
+                                   : files[i % files.size()].path);
+    }
+  }
+  auto commitStart = std::chrono::steady_clock::now();
+  index.commit();
+  indexSeconds += secondsSince(commitStart);
+  index.shrinkToFit();
+  auto [stringBytes, postingBytes] = index.memoryUsage();
+  std::cout << std::fixed << std::setprecision(1) << "Indexed " << count
+            << " torrents (1-" << maxFiles << " files) in " << indexSeconds
+            << " s: " << count / indexSeconds / 1e3 << "k torrents/s\n"
+            << index.numTrigrams() << " trigrams, strings "
+            << stringBytes / 1048576.0 << " MiB, postings "
+            << postingBytes / 1048576.0 << " MiB\n\n";
+
+  std::cout << "query length  avg ms   max ms  lists  blocks  candidates  "
+               "matches\n";
+  for (size_t length : {2, 3, 4, 6, 10, 16}) {
+    double total = 0;
+    double worst = 0;
+    TrigramIndex::SearchStats sum;
+    size_t runs = 0;
+    for (size_t i = 0; i < samples.size(); ++i) {
+      const std::string &sample = samples[i];
+      if (sample.size() < length) {
+        continue;
+      }
+      // Upper-case the query to exercise case folding
+      std::string query = sample.substr((i * 7) % (sample.size() - length + 1),
+                                        length);
+      std::transform(query.begin(), query.end(), query.begin(), ::toupper);
+      TrigramIndex::SearchStats stats;
+      auto queryStart = std::chrono::steady_clock::now();
+      std::vector<uint32_t> result =
+          index.search(query, std::numeric_limits<size_t>::max(), &stats);
+      double ms = secondsSince(queryStart) * 1e3;
+      if (result.empty()) {
+        std::cerr << "Query \"" << query << "\" found nothing\n";
+        return 1;
+      }
+      total += ms;
+      worst = std::max(worst, ms);
+      sum.lists += stats.lists;
+      sum.blocks += stats.blocks;
+      sum.candidates += stats.candidates;
+      sum.matches += stats.matches;
+      runs++;
+      if (length == 2 && runs == 5) {
+        break; // Scans: a few are enough
+      }
+    }
+    if (runs == 0) {
+      continue;
+    }
+    std::cout << std::setw(12) << length << std::setprecision(3)
+              << std::setw(8) << total / runs << std::setw(9) << worst
+              << std::setprecision(1) << std::setw(7)
+              << double(sum.lists) / runs << std::setw(8)
+              << double(sum.blocks) / runs << std::setw(12)
+              << double(sum.candidates) / runs << std::setw(9)
+              << double(sum.matches) / runs << '\n';
+  }
+  return 0;
+}
@@ -0,0 +1,193 @@
+/**
+ * @brief Benchmark of batched UDP I/O on the shared UdpSocket
+ *
+ * A sender thread blasts datagrams over loopback at a receiving UdpSocket
+ * that dispatches them to three routes, as a client's one UDP port does
+ * for uTP, DHT and UDP tracker traffic: the datagrams take turns looking
+ * like each protocol. The sender keeps a bounded number in flight so that
+ * none are lost to a full receive buffer.
+ *
+ * Each run compares one system call per datagram (batches of 1) with
+ * recvmmsg()/sendmmsg() batches of 64, and those batches with sends
+ * coalesced by UDP_SEGMENT, for DHT-sized and uTP-sized datagrams. The
+ * rate is reported against wall time and against the CPU time of both
+ * threads, which on one core is the rate per core.
+ *
+ * Usage: bench_udp [datagrams]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sched.h>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <udpsocket.hpp>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint64_t kInFlight = 1024; // Datagrams sent, not yet received
+
+void check(bool ok, const std::string &what) {
+  if (!ok) {
+    std::cerr << "Check failed: " << what << '\n';
+    std::exit(1);
+  }
+}
+
+double cpuSeconds() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  auto seconds = [](const timeval &t) { return t.tv_sec + t.tv_usec / 1e6; };
+  return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+}
+
+/**
+ * @brief Build datagrams of one size that look like each protocol
+ * @param size Bytes per datagram, at least 20
+ * @return A uTP DATA packet, a DHT message and a tracker response
+ */
+std::vector<std::string> samples(size_t size) {
+  std::string utp(size, 'u');
+  utp[0] = 0x01; // DATA, version 1
+  std::string dht(size, '0');
+  std::memcpy(&dht[0], "d1:y1:r1:p", 10);
+  dht[size - 1] = 'e';
+  std::string tracker(size, '\0');
+  tracker[3] = 1; // Announce response
+  return {utp, dht, tracker};
+}
+
+struct Result {
+  double seconds = 0;
+  double cpu = 0;
+  uint64_t received = 0;
+  uint64_t perRoute[3] = {0, 0, 0};
+  UdpSocket::Stats sender;
+  UdpSocket::Stats receiver;
+};
+
+Result run(uint64_t count, size_t size, size_t batch, bool segmentation) {
+  UdpSocket::Options options;
+  options.address = "127.0.0.1";
+  options.batchSize = batch;
+  options.segmentation = segmentation;
+  UdpSocket receiverSocket(options);
+  UdpSocket senderSocket(options);
+  if (segmentation) {
+    check(senderSocket.segmenting(), "kernel accepts UDP_SEGMENT");
+  }
+
+  Result result;
+  std::atomic<uint64_t> received{0};
+  std::atomic<bool> done{false};
+  receiverSocket.route(UdpSocket::isUtp, [&](const char *, size_t,
+                                             const sockaddr_in &) {
+    ++result.perRoute[0];
+  });
+  receiverSocket.route(UdpSocket::isBencode, [&](const char *, size_t,
+                                                 const sockaddr_in &) {
+    ++result.perRoute[1];
+  });
+  receiverSocket.route([](const char *, size_t) { return true; },
+                       [&](const char *, size_t, const sockaddr_in &) {
+                         ++result.perRoute[2];
+                       });
+  std::thread receiver([&] {
+    while (!done) {
+      size_t got = receiverSocket.receive();
+      if (got == 0) {
+        receiverSocket.wait(10000);
+      } else {
+        received.fetch_add(got, std::memory_order_release);
+      }
+    }
+  });
+
+  const std::vector<std::string> datagrams = samples(size);
+  const sockaddr_in to =
+      UdpSocket::endpoint("127.0.0.1", receiverSocket.port());
+  const double cpuStart = cpuSeconds();
+  const auto start = Clock::now();
+  for (uint64_t sent = 0; sent < count; ++sent) {
+    if (sent - received.load(std::memory_order_acquire) >= kInFlight) {
+      senderSocket.flush();
+      while (sent - received.load(std::memory_order_acquire) >=
+             kInFlight / 2) {
+        sched_yield();
+      }
+    }
+    const std::string &datagram = datagrams[sent % 3];
+    senderSocket.send(to, datagram.data(), datagram.size());
+  }
+  senderSocket.flush();
+  const auto deadline = Clock::now() + std::chrono::seconds(2);
+  while (received.load() < count && Clock::now() < deadline) {
+    sched_yield();
+  }
+  result.seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  result.cpu = cpuSeconds() - cpuStart;
+  done = true;
+  receiver.join();
+  result.received = received;
+  result.sender = senderSocket.stats();
+  result.receiver = receiverSocket.stats();
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const uint64_t count =
+      argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+  std::cout << std::fixed << count << " datagrams over loopback, "
+            << "dispatched to uTP, DHT and tracker routes\n";
+
+  struct Mode {
+    const char *name;
+    size_t batch;
+    bool segmentation;
+  };
+  const Mode modes[] = {{"one call per datagram", 1, false},
+                        {"batches of 64       ", 64, false},
+                        {"batches of 64 + GSO ", 64, true}};
+  for (size_t size : {size_t(120), size_t(1420)}) {
+    std::cout << size << "-byte datagrams\n";
+    double baseline = 0;
+    for (const Mode &mode : modes) {
+      Result r = run(count, size, mode.batch, mode.segmentation);
+      check(r.received == count, "every datagram received");
+      check(r.perRoute[0] == (count + 2) / 3 &&
+                r.perRoute[1] == (count + 1) / 3 &&
+                r.perRoute[2] == count / 3,
+            "datagrams dispatched to their protocol's route");
+      const double perCore = count / r.cpu;
+      if (baseline == 0) {
+        baseline = perCore;
+      }
+      const uint64_t calls = r.sender.sendCalls + r.receiver.receiveCalls;
+      std::cout << "  " << mode.name << ": " << std::setprecision(0)
+                << std::setw(8) << count / r.seconds << " datagrams/s, "
+                << std::setw(8) << perCore << " per CPU second ("
+                << std::setprecision(1) << perCore / baseline << "x), "
+                << std::setprecision(2) << double(calls) / count
+                << " calls per datagram";
+      if (r.sender.segmented > 0) {
+        std::cout << ", " << std::setprecision(0)
+                  << 100.0 * r.sender.segmented / count << "% in GSO sends";
+      }
+      std::cout << '\n';
+    }
+  }
+  return 0;
+}
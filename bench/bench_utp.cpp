@@ -0,0 +1,546 @@
+/**
+ * @brief Benchmark of the uTP transport and its LEDBAT congestion control
+ *
+ * First in virtual time: UtpConnection pairs exchange datagrams through a
+ * simulated bottleneck (a rate, a drop-tail queue, a one-way delay and
+ * optional random loss) without any socket. This shows what LEDBAT is
+ * for: one flow fills the link while keeping the queue near its delay
+ * target, where a loss-driven flow (LEDBAT with an unreachable target)
+ * fills the queue until it overflows; a loss-driven flow starting later
+ * takes the link over from a LEDBAT flow; random loss is repaired by
+ * selective ACKs with the data intact; and a transfer against a trickle
+ * of small writes the other way needs no resends on a lossless link.
+ *
+ * Then over loopback: two UtpSockets on threads of their own move real
+ * datagrams, once at full speed with batches of 1 and of 64 datagrams per
+ * recvmmsg()/sendmmsg() call, the latter with and without UDP_SEGMENT,
+ * and once through the socket's emulated link with a rate and a delay
+ * injected.
+ *
+ * Usage: bench_utp [loopback MiB] [simulated MiB]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <udpsocket.hpp>
+#include <utpconnection.hpp>
+#include <utpsocket.hpp>
+#include <vector>
+
+namespace {
+
+constexpr int64_t kSecond = 1000000;
+constexpr size_t kPatternSize = 1 << 20;
+
+void check(bool ok, const std::string &what) {
+  if (!ok) {
+    std::cerr << "Check failed: " << what << '\n';
+    std::exit(1);
+  }
+}
+
+// Content every sender writes, repeated, so receivers can check each byte
+const std::string &pattern() {
+  static const std::string bytes = [] {
+    std::mt19937 random(29);
+    std::string out(kPatternSize, '\0');
+    for (char &c : out) {
+      c = static_cast<char>(random());
+    }
+    return out;
+  }();
+  return bytes;
+}
+
+// Writes the pattern into a connection until total bytes are written
+struct Source {
+  uint64_t total;
+  uint64_t written = 0;
+
+  bool pump(UtpConnection &connection) {
+    bool progress = false;
+    while (written < total && connection.writable() > 0) {
+      size_t offset = written % kPatternSize;
+      size_t length = std::min<uint64_t>(kPatternSize - offset,
+                                         total - written);
+      size_t accepted =
+          connection.write(pattern().data() + offset, length);
+      if (accepted == 0) {
+        break;
+      }
+      written += accepted;
+      progress = true;
+    }
+    return progress;
+  }
+};
+
+// Reads a connection and compares the bytes with the pattern
+struct Sink {
+  uint64_t received = 0;
+  bool intact = true;
+  std::vector<char> buffer = std::vector<char>(1 << 16);
+
+  bool drain(UtpConnection &connection) {
+    bool progress = false;
+    while (size_t length = connection.read(buffer.data(), buffer.size())) {
+      for (size_t i = 0; i < length;) {
+        size_t offset = (received + i) % kPatternSize;
+        size_t run = std::min(length - i, kPatternSize - offset);
+        intact = intact && std::equal(buffer.data() + i,
+                                      buffer.data() + i + run,
+                                      pattern().data() + offset);
+        i += run;
+      }
+      received += length;
+      progress = true;
+    }
+    return progress;
+  }
+};
+
+// A one-way link: a bottleneck rate with a drop-tail queue, then a delay
+class SimLink {
+public:
+  SimLink(int64_t rate, int64_t delay, int64_t queueBytes, double loss)
+      : rate(rate), delay(delay), queueBytes(queueBytes), loss(loss) {}
+
+  struct Arrival {
+    int64_t time;
+    size_t to;
+    std::string data;
+  };
+
+  void send(int64_t now, size_t to, const char *data, size_t length) {
+    int64_t departure = now;
+    if (rate > 0) {
+      int64_t start = std::max(now, freeAt);
+      if ((start - now) * rate / kSecond + int64_t(length) > queueBytes) {
+        ++drops;
+        return;
+      }
+      waited += start - now;
+      ++packets;
+      departure = start + int64_t(length) * kSecond / rate;
+      freeAt = departure;
+    }
+    if (loss > 0 && std::uniform_real_distribution<>(0, 1)(random) < loss) {
+      ++drops;
+      return;
+    }
+    queue.push_back({departure + delay, to, std::string(data, length)});
+  }
+
+  int64_t next() const {
+    return queue.empty() ? UtpConnection::kNever : queue.front().time;
+  }
+
+  std::deque<Arrival> queue;
+  uint64_t drops = 0;
+  uint64_t packets = 0; // Through the bottleneck
+  int64_t waited = 0;   // Their total time in its queue
+
+private:
+  int64_t rate;
+  int64_t delay;
+  int64_t queueBytes;
+  double loss;
+  int64_t freeAt = 0;
+  std::mt19937 random{73};
+};
+
+// One transfer in the simulation
+struct SimFlow {
+  UtpConnection::Settings settings;
+  int64_t start = 0; // When the sender connects
+  uint64_t bytes = 0;
+};
+
+struct SimResult {
+  std::vector<double> seconds;      // Transfer time per flow
+  std::vector<UtpConnection::Stats> senders;
+  std::vector<bool> intact;
+  std::vector<uint64_t> receivedAt; // Bytes received by the sample time
+  double meanQueueMillis = 0;       // Wait in the bottleneck queue
+  uint64_t drops = 0;
+};
+
+/**
+ * @brief Run transfers over a shared simulated bottleneck
+ *
+ * Senders share the forward link; ACKs return over a link with only the
+ * delay. Endpoint 2i sends flow i and 2i + 1 receives it.
+ */
+SimResult simulate(const std::vector<SimFlow> &flows, int64_t rate,
+                   int64_t delay, int64_t queueBytes, double loss,
+                   int64_t sampleAt) {
+  const size_t n = flows.size();
+  std::vector<std::unique_ptr<UtpConnection>> ends;
+  for (const SimFlow &flow : flows) {
+    ends.push_back(std::make_unique<UtpConnection>(flow.settings));
+    ends.push_back(std::make_unique<UtpConnection>(flow.settings));
+  }
+  std::vector<Source> sources;
+  for (const SimFlow &flow : flows) {
+    sources.push_back({flow.bytes});
+  }
+  std::vector<Sink> sinks(n);
+  SimLink forward(rate, delay, queueBytes, loss);
+  SimLink backward(0, delay, 0, 0);
+  SimResult result;
+  result.seconds.assign(n, 0);
+  result.receivedAt.assign(n, 0);
+
+  int64_t now = 0;
+  const int64_t limit = 3600 * kSecond;
+  size_t finished = 0;
+  while (finished < n && now < limit) {
+    for (SimLink *link : {&forward, &backward}) {
+      while (!link->queue.empty() && link->queue.front().time <= now) {
+        SimLink::Arrival &arrival = link->queue.front();
+        UtpConnection &end = *ends[arrival.to];
+        if (end.state() == UtpConnection::State::Idle) {
+          end.accept(arrival.data.data(), arrival.data.size(), 1000, now);
+        } else {
+          end.receive(arrival.data.data(), arrival.data.size(), now);
+        }
+        link->queue.pop_front();
+      }
+    }
+    int64_t wake = UtpConnection::kNever;
+    for (size_t i = 0; i < n; ++i) {
+      UtpConnection &sender = *ends[2 * i];
+      UtpConnection &receiver = *ends[2 * i + 1];
+      if (now < flows[i].start) {
+        wake = std::min(wake, flows[i].start);
+        continue;
+      }
+      if (sender.state() == UtpConnection::State::Idle) {
+        sender.connect(static_cast<uint16_t>(100 * i), now);
+      }
+      sources[i].pump(sender);
+      if (sources[i].written == sources[i].total) {
+        sender.close();
+      }
+      sinks[i].drain(receiver);
+      if (now <= sampleAt) {
+        result.receivedAt[i] = sinks[i].received;
+      }
+      if (sinks[i].received == flows[i].bytes && result.seconds[i] == 0) {
+        result.seconds[i] = double(now - flows[i].start) / kSecond;
+        ++finished;
+      }
+      wake = std::min(wake, sender.poll(now, [&](const char *d, size_t l) {
+        forward.send(now, 2 * i + 1, d, l);
+      }));
+      wake = std::min(wake, receiver.poll(now, [&](const char *d, size_t l) {
+        backward.send(now, 2 * i, d, l);
+      }));
+    }
+    int64_t next = std::min({wake, forward.next(), backward.next()});
+    if (next == UtpConnection::kNever) {
+      break; // Stalled
+    }
+    now = std::max(now + 1, next);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    result.senders.push_back(ends[2 * i]->stats());
+    result.intact.push_back(sinks[i].intact &&
+                            sinks[i].received == flows[i].bytes);
+  }
+  result.meanQueueMillis =
+      forward.packets ? forward.waited / 1000.0 / forward.packets : 0;
+  result.drops = forward.drops;
+  return result;
+}
+
+struct TwoWayResult {
+  double seconds = 0;        // Transfer time of the large flow
+  UtpConnection::Stats sender;
+  bool intact = false;       // Both directions complete and correct
+  uint64_t reverseBytes = 0; // Sent back in small writes
+};
+
+/**
+ * @brief Run one transfer with small writes going the other way
+ *
+ * The receiver writes 17 bytes every 5 ms from the moment it accepts, as
+ * a peer's requests and haves would, over links with only a delay. Its
+ * data packets carry no new ACK most of the time and must not be taken
+ * for duplicate ACKs.
+ */
+TwoWayResult simulateTwoWay(uint64_t bytes, int64_t delay) {
+  constexpr size_t kSmallWrite = 17;
+  constexpr int64_t kWriteEvery = 5000;
+  UtpConnection sender, receiver;
+  Source forward{bytes};
+  Source reverse{0};
+  Sink forwardSink, reverseSink;
+  SimLink out(0, delay, 0, 0), back(0, delay, 0, 0);
+  TwoWayResult result;
+
+  int64_t now = 0;
+  int64_t nextWrite = 0;
+  const int64_t limit = 600 * kSecond;
+  sender.connect(1, now);
+  while (now < limit && (forwardSink.received < bytes ||
+                         reverseSink.received < reverse.total)) {
+    while (!out.queue.empty() && out.queue.front().time <= now) {
+      const std::string &data = out.queue.front().data;
+      if (receiver.state() == UtpConnection::State::Idle) {
+        receiver.accept(data.data(), data.size(), 1000, now);
+        nextWrite = now;
+      } else {
+        receiver.receive(data.data(), data.size(), now);
+      }
+      out.queue.pop_front();
+    }
+    while (!back.queue.empty() && back.queue.front().time <= now) {
+      const std::string &data = back.queue.front().data;
+      sender.receive(data.data(), data.size(), now);
+      back.queue.pop_front();
+    }
+    int64_t wake = UtpConnection::kNever;
+    if (receiver.state() != UtpConnection::State::Idle &&
+        forwardSink.received < bytes) {
+      if (now >= nextWrite) {
+        reverse.total += kSmallWrite;
+        nextWrite += kWriteEvery;
+      }
+      wake = nextWrite;
+    }
+    forward.pump(sender);
+    reverse.pump(receiver);
+    forwardSink.drain(receiver);
+    reverseSink.drain(sender);
+    if (forwardSink.received == bytes && result.seconds == 0) {
+      result.seconds = double(now) / kSecond;
+    }
+    wake = std::min(wake, sender.poll(now, [&](const char *d, size_t l) {
+      out.send(now, 0, d, l);
+    }));
+    wake = std::min(wake, receiver.poll(now, [&](const char *d, size_t l) {
+      back.send(now, 0, d, l);
+    }));
+    int64_t next = std::min({wake, out.next(), back.next()});
+    if (next == UtpConnection::kNever) {
+      break; // Stalled
+    }
+    now = std::max(now + 1, next);
+  }
+  result.sender = sender.stats();
+  result.intact = forwardSink.intact && forwardSink.received == bytes &&
+                  reverseSink.intact &&
+                  reverseSink.received == reverse.total;
+  result.reverseBytes = reverse.total;
+  return result;
+}
+
+struct LoopResult {
+  double seconds = 0;
+  UdpSocket::Stats sender;
+  UdpSocket::Stats receiver;
+  UtpConnection::Stats connection;
+  uint64_t linkDrops = 0;
+  double meanDelayMillis = 0; // LEDBAT's queuing delay, sampled
+  int64_t rttMicros = 0;
+};
+
+/**
+ * @brief Move bytes between two UtpSockets on their own threads
+ * @return Seconds taken, with the sockets' counters
+ */
+LoopResult loopback(uint64_t bytes, size_t batch, bool segmentation,
+                    int64_t delay, int64_t rate) {
+  UtpSocket::Options options;
+  options.batchSize = batch;
+  options.segmentation = segmentation;
+  options.delayMicros = delay;
+  UtpSocket receiverSocket(options);
+  options.rateBytesPerSecond = rate;
+  options.queueBytes = rate / 5; // 200 ms of queue
+  UtpSocket senderSocket(options);
+
+  std::atomic<bool> done{false};
+  Sink sink;
+  std::thread receiver([&] {
+    std::shared_ptr<UtpConnection> connection;
+    receiverSocket.onAccept(
+        [&](const std::shared_ptr<UtpConnection> &c) { connection = c; });
+    while (!done) {
+      int64_t now = UtpSocket::now();
+      int64_t wake = receiverSocket.process(now);
+      if (connection && sink.drain(*connection)) {
+        continue;
+      }
+      if (connection && connection->eof()) {
+        connection->close();
+      }
+      if (connection && (connection->state() ==
+                             UtpConnection::State::Closed ||
+                         connection->state() == UtpConnection::State::Reset)) {
+        receiverSocket.process(UtpSocket::now()); // Last ACK
+        break;
+      }
+      receiverSocket.wait(now, std::min(wake, now + 10000));
+    }
+  });
+
+  auto start = std::chrono::steady_clock::now();
+  auto connection = senderSocket.connect("127.0.0.1", receiverSocket.port(),
+                                         UtpSocket::now());
+  Source source{bytes};
+  double delaySum = 0;
+  uint64_t samples = 0;
+  while (connection->state() != UtpConnection::State::Reset &&
+         connection->state() != UtpConnection::State::Closed) {
+    int64_t now = UtpSocket::now();
+    bool wrote = source.pump(*connection);
+    if (source.written == bytes) {
+      connection->close();
+    }
+    int64_t wake = senderSocket.process(now);
+    delaySum += connection->queuingDelayMicros();
+    ++samples;
+    if (!wrote) {
+      senderSocket.wait(now, std::min(wake, now + 10000));
+    }
+  }
+  LoopResult result;
+  result.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  done = true;
+  receiver.join();
+  check(connection->state() == UtpConnection::State::Closed,
+        "loopback connection closed cleanly");
+  check(sink.intact && sink.received == bytes, "loopback data intact");
+  result.sender = senderSocket.socket().stats();
+  result.receiver = receiverSocket.socket().stats();
+  result.linkDrops = senderSocket.stats().linkDrops;
+  result.connection = connection->stats();
+  result.meanDelayMillis = samples ? delaySum / samples / 1000 : 0;
+  result.rttMicros = connection->rttMicros();
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const uint64_t loopMiB = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                    : 128;
+  const uint64_t simMiB = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 16;
+  std::cout << std::fixed << std::setprecision(1);
+
+  // 10 Mbit/s bottleneck, 25 ms each way, 200 ms of queue
+  const int64_t rate = 1250000;
+  const int64_t delay = 25000;
+  const int64_t queue = rate / 5;
+  UtpConnection::Settings ledbat;
+  UtpConnection::Settings lossDriven;
+  lossDriven.targetDelayMicros = 3600 * kSecond;
+  const uint64_t simBytes = simMiB << 20;
+  auto mibps = [](uint64_t bytes, double seconds) {
+    return seconds > 0 ? bytes / seconds / (1 << 20) : 0.0;
+  };
+
+  std::cout << "Simulated link: 10 Mbit/s, 25 ms one way, "
+            << queue / 1000 << " KB queue (200 ms), " << simMiB
+            << " MiB per flow\n";
+  for (auto [name, settings] :
+       {std::pair{"LEDBAT, 100 ms target", ledbat},
+        std::pair{"loss-driven         ", lossDriven}}) {
+    SimResult r = simulate({{settings, 0, simBytes}}, rate, delay, queue, 0,
+                           0);
+    check(r.intact[0], "simulated data intact");
+    std::cout << "  " << name << ": " << std::setw(5)
+              << mibps(simBytes, r.seconds[0]) * 1024 << " KiB/s ("
+              << std::setw(3)
+              << int(100.0 * simBytes / r.seconds[0] / rate) << "% of link),"
+              << " queue wait " << std::setw(5) << r.meanQueueMillis
+              << " ms, " << r.drops << " drops, "
+              << r.senders[0].resends << " resends\n";
+  }
+
+  SimResult lossy = simulate({{ledbat, 0, simBytes}}, rate, delay, queue,
+                             0.01, 0);
+  check(lossy.intact[0], "data intact under 1% loss");
+  std::cout << "  LEDBAT, 1% random loss: " << std::setw(5)
+            << mibps(simBytes, lossy.seconds[0]) * 1024 << " KiB/s, "
+            << lossy.senders[0].resends << " resends ("
+            << lossy.senders[0].fastResends << " fast, "
+            << lossy.senders[0].timeouts << " timeouts), data intact\n";
+
+  // A second flow joins after 10 s; compare what each got in 10 s more
+  const int64_t join = 10 * kSecond;
+  for (auto [name, late] : {std::pair{"LEDBAT", ledbat},
+                            std::pair{"loss-driven", lossDriven}}) {
+    const uint64_t bytes = 64ull << 20; // Still running when sampled
+    SimResult both = simulate({{ledbat, 0, bytes}, {late, join, bytes}},
+                              rate, delay, queue, 0, 2 * join);
+    SimResult alone = simulate({{ledbat, 0, bytes}}, rate, delay, queue, 0,
+                               join);
+    uint64_t first = both.receivedAt[0] - alone.receivedAt[0];
+    uint64_t second = both.receivedAt[1];
+    std::cout << "  LEDBAT flow, then a " << name << " flow from 10 s: "
+              << "next 10 s split " << std::setw(3)
+              << int(100.0 * first / (first + second)) << "% / "
+              << std::setw(3) << int(100.0 * second / (first + second))
+              << "%, queue wait " << both.meanQueueMillis << " ms\n";
+  }
+
+  // Two-way traffic on a lossless link: 4 MiB one way, small writes back
+  const uint64_t twoWayBytes = 4ull << 20;
+  TwoWayResult twoWay = simulateTwoWay(twoWayBytes, 20000);
+  check(twoWay.intact, "two-way data intact");
+  check(twoWay.sender.fastResends == 0,
+        "no fast resends on a lossless two-way link");
+  std::cout << "  4 MiB against 17 bytes back every 5 ms, lossless, "
+            << "40 ms RTT: " << std::setw(5)
+            << mibps(twoWayBytes, twoWay.seconds) << " MiB/s, "
+            << twoWay.sender.resends << " resends, " << twoWay.reverseBytes
+            << " bytes back\n";
+
+  const uint64_t loopBytes = loopMiB << 20;
+  std::cout << "\nLoopback, " << loopMiB << " MiB, 1400-byte payloads\n";
+  for (auto [batch, segmentation] :
+       {std::pair{size_t(1), false}, std::pair{size_t(64), false},
+        std::pair{size_t(64), true}}) {
+    LoopResult r = loopback(loopBytes, batch, segmentation, 0, 0);
+    uint64_t datagrams = r.sender.datagramsSent + r.receiver.datagramsSent +
+                         r.sender.datagramsReceived +
+                         r.receiver.datagramsReceived;
+    uint64_t calls = r.sender.sendCalls + r.receiver.sendCalls +
+                     r.sender.receiveCalls + r.receiver.receiveCalls;
+    std::cout << "  batch " << std::setw(2) << batch
+              << (segmentation ? " + GSO" : "      ") << ": " << std::setw(6)
+              << mibps(loopBytes, r.seconds) << " MiB/s, "
+              << std::setprecision(0) << std::setw(7)
+              << r.sender.datagramsSent / r.seconds << " data datagrams/s, "
+              << std::setprecision(1) << double(datagrams) / calls
+              << " datagrams per call, " << r.connection.resends
+              << " resends\n";
+  }
+
+  // 100 Mbit/s sender link, 20 ms each way
+  const int64_t loopRate = 12500000;
+  const uint64_t shapedBytes = std::min<uint64_t>(loopBytes, 64ull << 20);
+  LoopResult shaped = loopback(shapedBytes, 64, true, 20000, loopRate);
+  std::cout << "  100 Mbit/s, 20 ms each way: " << std::setw(5)
+            << mibps(shapedBytes, shaped.seconds) << " MiB/s ("
+            << int(100.0 * shapedBytes / shaped.seconds / loopRate)
+            << "% of link), RTT " << shaped.rttMicros / 1000
+            << " ms, mean queuing delay " << shaped.meanDelayMillis
+            << " ms, " << shaped.linkDrops << " link drops\n";
+  return 0;
+}
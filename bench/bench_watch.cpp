@@ -0,0 +1,211 @@
+/**
+ * @brief Benchmark of WatchFolder ingestion into a TorrentRegistry
+ *
+ * Fills a temporary directory with synthetic torrents and measures:
+ * - the initial scan and load of the whole directory,
+ * - what a periodic rescan costs per pass (listing and stat() of every
+ *   file, without loading anything), the work the watcher avoids,
+ * - the latency from the last write of a new file to its registration,
+ *   for files written in two halves with a pause shorter than the settle
+ *   time, which must never be loaded half-written,
+ * - rewrites and deletions, which must update the registry,
+ * - a copy of a loaded torrent, which keeps it registered after the
+ *   original is deleted.
+ *
+ * Usage: bench_watch [existing files] [new files] [settle ms]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <torrentgen.hpp>
+#include <torrentregistry.hpp>
+#include <unordered_map>
+#include <vector>
+#include <watchfolder.hpp>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double millisSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+void writeFile(const std::string &path, std::string_view data) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(data.data(), data.size());
+}
+
+void check(bool ok, const std::string &what) {
+  if (!ok) {
+    std::cerr << "Check failed: " << what << '\n';
+    std::exit(1);
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const size_t existing = argc > 1 ? std::atoll(argv[1]) : 20000;
+  const size_t fresh = argc > 2 ? std::atoll(argv[2]) : 50;
+  const auto settle =
+      std::chrono::milliseconds(argc > 3 ? std::atoi(argv[3]) : 100);
+
+  std::string directory =
+      (std::filesystem::temp_directory_path() / "bench_watch.XXXXXX")
+          .string();
+  check(mkdtemp(directory.data()) != nullptr, "mkdtemp");
+
+  TorrentGenerator::Options generatorOptions;
+  generatorOptions.targetPieces = 64;
+  TorrentGenerator generator(generatorOptions);
+  auto pathOf = [&](size_t i) {
+    return directory + "/" + std::to_string(i) + ".torrent";
+  };
+  for (size_t i = 0; i < existing; ++i) {
+    writeFile(pathOf(i), generator.generate(i));
+  }
+
+  TorrentRegistry registry;
+  WatchFolder::Callbacks callbacks = WatchFolder::registryCallbacks(registry);
+  std::mutex mutex;
+  std::unordered_map<std::string, Clock::time_point> written;
+  std::vector<double> latencies;
+  size_t errors = 0;
+  auto addToRegistry = callbacks.onAdded;
+  callbacks.onAdded = [&](const std::string &path,
+                          std::shared_ptr<const TorrentFile> torrent,
+                          const InfoHash &infoHash) {
+    addToRegistry(path, std::move(torrent), infoHash);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = written.find(path);
+    if (found != written.end()) {
+      latencies.push_back(millisSince(found->second));
+      written.erase(found);
+    }
+  };
+  callbacks.onError = [&](const std::string &path, const std::string &error) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cerr << path << ": " << error << '\n';
+    errors++;
+  };
+
+  WatchFolder::Options options;
+  options.settle = settle;
+  std::cout << std::fixed << std::setprecision(2) << "Files: " << existing
+            << ", settle " << settle.count() << " ms\n\n";
+
+  auto start = Clock::now();
+  WatchFolder watcher(directory, callbacks, options);
+  while (registry.size() < existing && millisSince(start) < 600000) {
+    watcher.waitIdle(std::chrono::milliseconds(10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  check(registry.size() == existing, "initial load");
+  std::cout << "Initial scan and load:  " << millisSince(start) << " ms\n";
+
+  // One pass of a polling rescan: list and stat everything
+  start = Clock::now();
+  size_t listed = 0;
+  for (const auto &entry : std::filesystem::directory_iterator(directory)) {
+    struct stat info;
+    listed += ::stat(entry.path().c_str(), &info) == 0;
+  }
+  std::cout << "Polling rescan pass:    " << millisSince(start) << " ms for "
+            << listed << " files, without loading any\n";
+
+  // New files written in two halves with a pause in between
+  const auto pause = settle / 2;
+  std::vector<std::thread> writers;
+  for (size_t i = existing; i < existing + fresh; ++i) {
+    writers.emplace_back([&, i] {
+      std::string data = generator.generate(i);
+      std::string path = pathOf(i);
+      std::ofstream file(path, std::ios::binary);
+      file.write(data.data(), data.size() / 2);
+      file.flush();
+      std::this_thread::sleep_for(pause);
+      file.write(data.data() + data.size() / 2,
+                 data.size() - data.size() / 2);
+      file.close();
+      std::lock_guard<std::mutex> lock(mutex);
+      written[path] = Clock::now();
+    });
+  }
+  for (auto &writer : writers) {
+    writer.join();
+  }
+  start = Clock::now();
+  while (registry.size() < existing + fresh && millisSince(start) < 10000) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  check(registry.size() == existing + fresh, "new files");
+  check(errors == 0, "no half-written file loaded");
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << "New file to registered: median "
+            << latencies[latencies.size() / 2] << " ms, max "
+            << latencies.back() << " ms (" << fresh
+            << " files written in two halves " << pause.count()
+            << " ms apart)\n";
+
+  // Rewrite some files with other torrents, delete others
+  const size_t changed = std::min<size_t>(10, existing / 2);
+  for (size_t i = 0; i < changed; ++i) {
+    writeFile(pathOf(i), generator.generate(existing + fresh + i));
+    std::filesystem::remove(pathOf(existing - 1 - i));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  check(watcher.waitIdle(std::chrono::seconds(10)), "idle after changes");
+  check(registry.size() == existing + fresh - changed, "changes applied");
+  for (size_t i = 0; i < changed; ++i) {
+    Epoch::Guard guard;
+    std::string old = generator.generate(i);
+    std::string now = generator.generate(existing + fresh + i);
+    check(!registry.find(guard, InfoHash(TorrentFile::computeInfoHash(old))),
+          "rewritten file's old torrent removed");
+    check(registry.find(guard, InfoHash(TorrentFile::computeInfoHash(now))),
+          "rewritten file's new torrent added");
+  }
+
+  // A copy of a loaded torrent keeps it registered when the original goes
+  const std::string original = pathOf(changed);
+  const std::string copy = directory + "/copy.torrent";
+  const InfoHash duplicated(
+      TorrentFile::computeInfoHash(generator.generate(changed)));
+  const size_t registered = registry.size();
+  std::filesystem::copy_file(original, copy);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  check(watcher.waitIdle(std::chrono::seconds(10)), "idle after copy");
+  std::filesystem::remove(original);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  check(watcher.waitIdle(std::chrono::seconds(10)), "idle after removal");
+  check(registry.get(duplicated) != nullptr &&
+            registry.size() == registered,
+        "torrent kept while a copy remains");
+  std::filesystem::remove(copy);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  check(watcher.waitIdle(std::chrono::seconds(10)), "idle after last copy");
+  check(registry.get(duplicated) == nullptr &&
+            registry.size() == registered - 1,
+        "torrent removed with its last copy");
+
+  WatchFolder::Stats stats = watcher.stats();
+  std::cout << "Rewrites and deletions applied: " << changed << " + "
+            << changed << "\n\nEvents " << stats.events << ", loads "
+            << stats.loads << ", failures " << stats.failures
+            << ", removals " << stats.removals << ", rescans "
+            << stats.rescans << ", overflows " << stats.overflows << '\n';
+  watcher.stop();
+  std::filesystem::remove_all(directory);
+  return 0;
+}
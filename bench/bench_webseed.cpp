@@ -0,0 +1,348 @@
+/**
+ * @brief Benchmark of WebSeed downloads from local stand-in seeds
+ *
+ * Builds a multi-file torrent with a padding file and real piece hashes,
+ * stores its content, and serves it two ways on localhost: a RangeServer
+ * stands in for a BEP 19 (url-list) seed and a small thread-per-connection
+ * server for a BEP 17 (httpseeds) seed, which closes every connection
+ * after a few responses and answers its first request with 503.
+ *
+ * Downloads the whole torrent from the BEP 19 seed over 1, 2 and 4
+ * keep-alive connections and reports the throughput in total and per
+ * connection; then checks a partial download, a corrupted piece on the
+ * seed, the BEP 17 seed with its reconnects and retry delay, a seed that
+ * refuses connections and one that never completes them.
+ *
+ * Usage: bench_webseed [content MiB] [piece KiB]
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <bencode.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <rangeserver.hpp>
+#include <sha1.hpp>
+#include <storage.hpp>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <torrentfile.hpp>
+#include <unistd.h>
+#include <vector>
+#include <webseed.hpp>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void check(bool ok, const std::string &what) {
+  if (!ok) {
+    std::cerr << "Check failed: " << what << '\n';
+    std::exit(1);
+  }
+}
+
+size_t countTrue(const std::vector<bool> &bits) {
+  return std::count(bits.begin(), bits.end(), true);
+}
+
+/**
+ * @brief Stand-in BEP 17 seed: answers ?piece=N with the piece
+ *
+ * Each connection gets its own thread and Storage. The first request of
+ * all gets a 503 asking for a one second wait, and every connection is
+ * closed after closeEvery responses.
+ */
+class HttpSeedServer {
+public:
+  HttpSeedServer(const TorrentFile &torrent, const std::string &root,
+                 int closeEvery)
+      : torrent(torrent), root(root), closeEvery(closeEvery) {
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    check(listenFd >= 0 &&
+              bind(listenFd, reinterpret_cast<sockaddr *>(&address),
+                   sizeof(address)) == 0 &&
+              listen(listenFd, 64) == 0 &&
+              getsockname(listenFd, reinterpret_cast<sockaddr *>(&address),
+                          &length) == 0,
+          "seed listens");
+    port = ntohs(address.sin_port);
+    acceptor = std::thread([this] {
+      int fd;
+      while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+        workers.emplace_back(&HttpSeedServer::serve, this, fd);
+      }
+    });
+  }
+
+  ~HttpSeedServer() {
+    shutdown(listenFd, SHUT_RDWR);
+    acceptor.join();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    close(listenFd);
+  }
+
+  uint16_t port = 0;
+  std::atomic<int> responses{0};
+
+private:
+  const TorrentFile &torrent;
+  const std::string root;
+  const int closeEvery;
+  int listenFd;
+  std::thread acceptor;
+  std::vector<std::thread> workers;
+  std::atomic<bool> refused{false};
+
+  void serve(int fd) {
+    Storage storage(torrent, root);
+    std::string in;
+    std::string piece(storage.getPieceLength(), '\0');
+    char buffer[4096];
+    for (int served = 0; served < closeEvery;) {
+      size_t end = in.find("\r\n\r\n");
+      if (end == std::string::npos) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+          break;
+        }
+        in.append(buffer, n);
+        continue;
+      }
+      size_t at = in.find("&piece=");
+      uint32_t index = std::strtoul(in.c_str() + at + 7, nullptr, 10);
+      in.erase(0, end + 4);
+      std::string head;
+      uint32_t length = 0;
+      if (!refused.exchange(true)) {
+        head = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 1\r\n"
+               "\r\n1";
+      } else {
+        length = storage.pieceSize(index);
+        storage.readBlock(index, 0, length, piece.data());
+        ++served;
+        head = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(length) +
+               (served == closeEvery ? "\r\nConnection: close\r\n\r\n"
+                                     : "\r\n\r\n");
+      }
+      ++responses;
+      send(fd, head.data(), head.size(), MSG_NOSIGNAL | MSG_MORE);
+      send(fd, piece.data(), length, MSG_NOSIGNAL);
+    }
+    close(fd);
+  }
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const int64_t contentBytes =
+      int64_t(argc > 1 ? std::atoll(argv[1]) : 128) << 20;
+  const int64_t pieceLength =
+      int64_t(argc > 2 ? std::atoll(argv[2]) : 256) * 1024;
+
+  // Files: most of the content, padded to a piece boundary, then a second
+  // file not aligned at its end, then a small one
+  const int64_t first = contentBytes * 5 / 8 + 777;
+  const int64_t pad = (pieceLength - first % pieceLength) % pieceLength;
+  const int64_t second = contentBytes * 3 / 8 + 3;
+  const int64_t third = 5000;
+  std::string content(first + pad + second + third, '\0');
+  uint64_t state = 1;
+  for (int64_t k = 0; k < int64_t(content.size()); k += 8) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    std::memcpy(&content[k], &state,
+                std::min<int64_t>(8, content.size() - k));
+  }
+  std::fill_n(&content[first], pad, '\0');
+
+  std::string info = "d5:filesld6:length";
+  BencodeEncoder::encodeInt(first, info);
+  info += "4:pathl5:movie9:video.mkveed4:attr1:p6:length";
+  BencodeEncoder::encodeInt(pad, info);
+  info += "4:pathl4:.pad1:0eed6:length";
+  BencodeEncoder::encodeInt(second, info);
+  info += "4:pathl6:extras9:b roll.mpeed6:length";
+  BencodeEncoder::encodeInt(third, info);
+  info += "4:pathl9:notes.txteee4:name4:film12:piece length";
+  BencodeEncoder::encodeInt(pieceLength, info);
+  std::string hashes;
+  for (size_t offset = 0; offset < content.size(); offset += pieceLength) {
+    hashes += Sha1::hash(std::string_view(content).substr(offset, pieceLength));
+  }
+  info += "6:pieces";
+  BencodeEncoder::encodeString(hashes, info);
+  info += "e";
+  TorrentFile served = TorrentFile::fromBencode("d4:info" + info + "e");
+  const uint32_t pieceCount = served.getPieces().size();
+
+  const auto temp = std::filesystem::temp_directory_path();
+  std::string base = (temp / "bench_webseed.XXXXXX").string();
+  check(mkdtemp(base.data()) != nullptr, "mkdtemp");
+  const std::string seedRoot = base + "/seed";
+  {
+    Storage storage(served, seedRoot);
+    for (uint32_t piece = 0; piece < pieceCount; ++piece) {
+      storage.writeBlock(piece, 0, storage.pieceSize(piece),
+                         content.data() + int64_t(piece) * pieceLength);
+    }
+  }
+
+  RangeServer rangeServer(served, seedRoot,
+                          std::vector<bool>(pieceCount, true), {});
+  HttpSeedServer httpSeed(served, seedRoot, 7);
+  std::string data = "d9:httpseedsl";
+  BencodeEncoder::encodeString(
+      "http://127.0.0.1:" + std::to_string(httpSeed.port) + "/seed", data);
+  data += "e4:info" + info + "8:url-list";
+  BencodeEncoder::encodeString(
+      "http://127.0.0.1:" + std::to_string(rangeServer.port()) + "/", data);
+  data += "e";
+  TorrentFile torrent = TorrentFile::fromBencode(data);
+  auto sources = WebSeed::sources(torrent);
+  check(sources.size() == 2 &&
+            sources[0].protocol == WebSeed::Protocol::UrlList &&
+            sources[1].protocol == WebSeed::Protocol::HttpSeed,
+        "web seeds listed");
+
+  int run = 0;
+  auto download = [&](const WebSeed::Source &source,
+                      const WebSeed::Options &options,
+                      const std::vector<bool> &wanted, WebSeed::Stats &stats,
+                      double &seconds) {
+    std::string root = base + "/get" + std::to_string(run++);
+    Storage storage(torrent, root);
+    WebSeed seed(torrent, storage, source, options);
+    size_t callbacks = 0;
+    auto start = Clock::now();
+    auto have = seed.download(wanted, [&](uint32_t, bool) { ++callbacks; });
+    seconds = secondsSince(start);
+    stats = seed.stats();
+    check(callbacks == stats.verified + stats.corrupt, "callbacks");
+    std::filesystem::remove_all(root);
+    return have;
+  };
+  const std::vector<bool> all(pieceCount, true);
+  WebSeed::Stats stats;
+  double seconds;
+
+  std::cout << std::fixed << std::setprecision(1) << "Content "
+            << content.size() / double(1 << 20) << " MiB, " << pieceCount
+            << " pieces of " << pieceLength / 1024 << " KiB, 3 files and "
+            << "a padding file\n";
+  for (size_t connections : {1, 2, 4}) {
+    WebSeed::Options options;
+    options.connections = connections;
+    auto have = download(sources[0], options, all, stats, seconds);
+    check(countTrue(have) == pieceCount && stats.corrupt == 0 &&
+              stats.failed == 0,
+          "BEP 19 download verifies");
+    double mib = stats.bytesReceived / double(1 << 20);
+    std::cout << "BEP 19, " << connections << " connection"
+              << (connections > 1 ? "s: " : ":  ") << std::setw(6)
+              << mib / seconds << " MiB/s, " << std::setw(6)
+              << mib / seconds / connections << " MiB/s per connection, "
+              << stats.requests << " requests\n";
+  }
+
+  // Every third piece: one request per piece and file part
+  std::vector<bool> some(pieceCount, false);
+  for (uint32_t piece = 0; piece < pieceCount; piece += 3) {
+    some[piece] = true;
+  }
+  auto have = download(sources[0], {}, some, stats, seconds);
+  check(have == some && stats.verified == countTrue(some),
+        "partial download");
+
+  // A corrupted byte on the seed fails one piece, the rest verify
+  const int64_t corruptAt = first + pad + 12345;
+  {
+    int fd = ::open((seedRoot + "/film/extras/b roll.mp").c_str(), O_WRONLY);
+    char bad = ~content[corruptAt];
+    check(fd >= 0 && pwrite(fd, &bad, 1, 12345) == 1, "corrupt seed");
+    close(fd);
+  }
+  have = download(sources[0], {}, all, stats, seconds);
+  check(stats.corrupt == 1 && !have[corruptAt / pieceLength] &&
+            countTrue(have) == pieceCount - 1,
+        "corrupt piece reported");
+  {
+    int fd = ::open((seedRoot + "/film/extras/b roll.mp").c_str(), O_WRONLY);
+    check(fd >= 0 && pwrite(fd, &content[corruptAt], 1, 12345) == 1,
+          "restore seed");
+    close(fd);
+  }
+
+  // BEP 17: a 503 delays the start, closed connections are reopened
+  WebSeed::Options options;
+  options.connections = 2;
+  have = download(sources[1], options, all, stats, seconds);
+  check(countTrue(have) == pieceCount && stats.retries >= 1 &&
+            stats.connects > 2,
+        "BEP 17 download verifies");
+  std::cout << "BEP 17, 2 connections: " << std::setw(6)
+            << stats.bytesReceived / double(1 << 20) / seconds
+            << " MiB/s after a 1 s retry delay, " << stats.connects
+            << " connections opened, " << stats.retries << " retries\n";
+
+  // A seed that refuses connections: give up after the retries
+  WebSeed::Source dead{"http://127.0.0.1:1/", WebSeed::Protocol::UrlList};
+  have = download(dead, {}, all, stats, seconds);
+  check(countTrue(have) == 0 && stats.failed > 0, "dead seed fails");
+  std::cout << "Dead seed given up on after " << seconds * 1000 << " ms, "
+            << stats.connects << " connection attempts\n";
+
+  // A seed that never accepts: its one-slot backlog is taken, so further
+  // connects are left unanswered and must time out
+  int stalled = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int queued = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  check(stalled >= 0 && queued >= 0 &&
+            bind(stalled, reinterpret_cast<sockaddr *>(&address),
+                 sizeof(address)) == 0 &&
+            listen(stalled, 0) == 0 &&
+            getsockname(stalled, reinterpret_cast<sockaddr *>(&address),
+                        &length) == 0 &&
+            connect(queued, reinterpret_cast<sockaddr *>(&address),
+                    length) == 0,
+        "stalled seed listens");
+  WebSeed::Source silent{"http://127.0.0.1:" +
+                             std::to_string(ntohs(address.sin_port)) + "/",
+                         WebSeed::Protocol::UrlList};
+  WebSeed::Options impatient;
+  impatient.connections = 1;
+  impatient.timeoutMillis = 200;
+  impatient.maxRetries = 1;
+  have = download(silent, impatient, all, stats, seconds);
+  check(countTrue(have) == 0 && stats.failed > 0, "stalled seed fails");
+  std::cout << "Stalled seed given up on after " << seconds * 1000
+            << " ms, " << stats.connects << " connection attempts of "
+            << impatient.timeoutMillis << " ms\n";
+  close(queued);
+  close(stalled);
+
+  std::filesystem::remove_all(base);
+  return 0;
+}
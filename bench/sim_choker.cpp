@@ -0,0 +1,267 @@
+/**
+ * @brief Deterministic swarm simulation comparing choking policies
+ *
+ * Models a fully connected swarm of one initial seed and a number of leechers
+ * with heterogeneous upload capacities. Time advances in one second steps;
+ * each peer splits its upload capacity evenly among the interested peers its
+ * Choker has unchoked, and downloaders fetch the rarest piece the uploader
+ * has. Peers that finish stay in the swarm as seeds.
+ *
+ * The same swarm (capacities and random seeds) is replayed under each policy
+ * and the completion times and aggregate throughput are printed, so policy
+ * changes can be compared run to run.
+ *
+ * Usage: sim_choker [leechers] [pieces]
+ */
+
+#include <algorithm>
+#include <choker.hpp>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr int64_t kPieceSize = 256 * 1024;
+constexpr int64_t kStepMicros = 1000 * 1000;
+constexpr int kMaxSteps = 100000;
+
+// A choking configuration to evaluate
+struct Policy {
+  std::string name;
+  Choker::Settings settings;
+  bool seedMode; // Whether seeds switch the choker to Mode::Seed
+};
+
+// A simulated peer
+struct SimPeer {
+  int64_t uploadCapacity;          // Bytes per second
+  std::vector<bool> have;          // Pieces this peer has
+  size_t haveCount = 0;            // Number of pieces this peer has
+  std::unique_ptr<Choker> choker;  // Decides whom this peer uploads to
+  std::vector<Choker::PeerId> ids; // Choker id of every other peer
+  std::vector<int> current;        // Piece being fetched from each peer
+  std::vector<int64_t> progress;   // Bytes of that piece received so far
+  int completedAt = -1;            // Step the download finished
+};
+
+// Results of one simulated run
+struct Result {
+  std::vector<int> completionTimes; // Seconds until each leecher finished
+  int64_t bytesTransferred = 0;     // Payload exchanged among all peers
+  int duration = 0;                 // Seconds until the last leecher finished
+};
+
+/**
+ * @brief Pick the rarest piece `from` has that `to` lacks and is not already
+ * fetching from another peer
+ * @return Piece index, or -1 if there is nothing to fetch
+ */
+int pickPiece(const std::vector<SimPeer> &swarm, const std::vector<int> &avail,
+              size_t from, size_t to) {
+  const SimPeer &src = swarm[from];
+  const SimPeer &dst = swarm[to];
+  int best = -1;
+  for (size_t p = 0; p < avail.size(); ++p) {
+    if (!src.have[p] || dst.have[p]) {
+      continue;
+    }
+    auto fetching = std::find(dst.current.begin(), dst.current.end(),
+                              static_cast<int>(p));
+    if (fetching != dst.current.end()) {
+      continue;
+    }
+    if (best < 0 || avail[p] < avail[best]) {
+      best = static_cast<int>(p);
+    }
+  }
+  return best;
+}
+
+/**
+ * @brief Simulate a swarm under one policy
+ * @param policy Choking policy applied by every peer
+ * @param capacities Upload capacity of each peer; peer 0 is the initial seed
+ * @param numPieces Number of pieces in the torrent
+ */
+Result simulate(const Policy &policy, const std::vector<int64_t> &capacities,
+                size_t numPieces) {
+  const size_t n = capacities.size();
+  std::vector<SimPeer> swarm(n);
+  std::vector<int> avail(numPieces, 1);
+
+  for (size_t i = 0; i < n; ++i) {
+    SimPeer &peer = swarm[i];
+    Choker::Settings settings = policy.settings;
+    settings.randomSeed = policy.settings.randomSeed + i;
+    peer.uploadCapacity = capacities[i];
+    peer.have.assign(numPieces, i == 0);
+    peer.haveCount = i == 0 ? numPieces : 0;
+    peer.choker = std::make_unique<Choker>(settings);
+    peer.current.assign(n, -1);
+    peer.progress.assign(n, 0);
+    peer.ids.resize(n);
+    for (size_t j = 0; j < n; ++j) {
+      peer.ids[j] = j == i ? 0 : peer.choker->addPeer();
+    }
+  }
+  if (policy.seedMode) {
+    swarm[0].choker->setMode(Choker::Mode::Seed);
+  }
+
+  Result result;
+  size_t remaining = n - 1;
+  int step = 0;
+  for (; remaining > 0 && step < kMaxSteps; ++step) {
+    // Interest: j wants pieces from i if i has something j lacks
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        if (i == j) {
+          continue;
+        }
+        bool interested = false;
+        if (swarm[j].haveCount < numPieces) {
+          for (size_t p = 0; p < numPieces && !interested; ++p) {
+            interested = swarm[i].have[p] && !swarm[j].have[p];
+          }
+        }
+        swarm[i].choker->setInterested(swarm[i].ids[j], interested);
+      }
+    }
+
+    // Transfers: split each uploader's capacity over its unchoked peers
+    for (size_t i = 0; i < n; ++i) {
+      SimPeer &up = swarm[i];
+      std::vector<size_t> targets;
+      for (size_t j = 0; j < n; ++j) {
+        if (j != i && up.choker->isUnchoked(up.ids[j]) &&
+            swarm[j].haveCount < numPieces) {
+          targets.push_back(j);
+        }
+      }
+      if (targets.empty()) {
+        continue;
+      }
+      int64_t share = up.uploadCapacity / static_cast<int64_t>(targets.size());
+
+      for (size_t j : targets) {
+        SimPeer &down = swarm[j];
+        int64_t budget = share;
+        int64_t sent = 0;
+        while (budget > 0) {
+          if (down.current[i] < 0) {
+            down.current[i] = pickPiece(swarm, avail, i, j);
+            down.progress[i] = 0;
+            if (down.current[i] < 0) {
+              break;
+            }
+          }
+          int64_t chunk = std::min(budget, kPieceSize - down.progress[i]);
+          budget -= chunk;
+          sent += chunk;
+          down.progress[i] += chunk;
+          if (down.progress[i] == kPieceSize) {
+            int piece = down.current[i];
+            down.current[i] = -1;
+            if (!down.have[piece]) {
+              down.have[piece] = true;
+              ++down.haveCount;
+              ++avail[piece];
+            }
+          }
+        }
+        up.choker->uploadCounter(up.ids[j]).add(sent);
+        down.choker->downloadCounter(down.ids[i]).add(sent);
+        result.bytesTransferred += sent;
+
+        if (down.haveCount == numPieces && down.completedAt < 0) {
+          down.completedAt = step + 1;
+          result.completionTimes.push_back(step + 1);
+          --remaining;
+          if (policy.seedMode) {
+            down.choker->setMode(Choker::Mode::Seed);
+          }
+        }
+      }
+    }
+
+    for (auto &peer : swarm) {
+      peer.choker->tick(kStepMicros);
+    }
+  }
+  result.duration = step;
+  return result;
+}
+
+/**
+ * @brief Get a percentile of a sorted list of completion times
+ */
+int percentile(const std::vector<int> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t idx = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[idx];
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const size_t numLeechers = argc > 1 ? std::atoi(argv[1]) : 40;
+  const size_t numPieces = argc > 2 ? std::atoi(argv[2]) : 256;
+
+  // Heterogeneous upload capacities drawn once so every policy sees the same
+  // swarm: a fast initial seed, then a mix of slow, medium and fast peers
+  std::mt19937_64 rng(42);
+  const int64_t tiers[] = {64 * 1024, 256 * 1024, 1024 * 1024};
+  std::vector<int64_t> capacities = {1024 * 1024};
+  for (size_t i = 0; i < numLeechers; ++i) {
+    capacities.push_back(tiers[rng() % 3]);
+  }
+
+  Policy leechOnly{"leech ranking everywhere", {}, false};
+  Policy seedMode{"seed mode", {}, true};
+  Policy seedRotation{"seed mode, rotate every 3 rechokes", {}, true};
+  seedRotation.settings.seedRotation = 3;
+  Policy noOptimistic{"seed mode, no optimistic unchoke", {}, true};
+  noOptimistic.settings.regularSlots = 4;
+  noOptimistic.settings.optimisticSlots = 0;
+
+  std::cout << "Swarm: 1 seed, " << numLeechers << " leechers, " << numPieces
+            << " pieces of " << kPieceSize / 1024 << " KiB\n\n";
+  std::cout << std::left << std::setw(36) << "Policy" << std::right
+            << std::setw(8) << "mean" << std::setw(8) << "p50"
+            << std::setw(8) << "p90" << std::setw(8) << "max"
+            << std::setw(14) << "MiB/s\n";
+
+  for (const Policy &policy :
+       {leechOnly, seedMode, seedRotation, noOptimistic}) {
+    Result result = simulate(policy, capacities, numPieces);
+    std::vector<int> times = result.completionTimes;
+    std::sort(times.begin(), times.end());
+    double mean = 0;
+    for (int t : times) {
+      mean += t;
+    }
+    mean = times.empty() ? 0 : mean / times.size();
+    double throughput =
+        result.duration > 0
+            ? result.bytesTransferred / 1048576.0 / result.duration
+            : 0;
+
+    std::cout << std::left << std::setw(36) << policy.name << std::right
+              << std::fixed << std::setprecision(1) << std::setw(8) << mean
+              << std::setw(8) << percentile(times, 0.5) << std::setw(8)
+              << percentile(times, 0.9) << std::setw(8)
+              << percentile(times, 1.0) << std::setw(13) << throughput;
+    if (times.size() < numLeechers) {
+      std::cout << "  (" << numLeechers - times.size() << " unfinished)";
+    }
+    std::cout << '\n';
+  }
+  return 0;
+}
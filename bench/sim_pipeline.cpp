@@ -0,0 +1,253 @@
+/**
+ * @brief Simulation of request pipelining over links with injected latency
+ *
+ * One downloader fetches a torrent from a handful of seeds over links with
+ * different bandwidth and latency. Time is virtual: requests, cancels and
+ * blocks are events delivered after the link's one-way latency, and each seed
+ * serves its requests first in, first out at its link rate.
+ *
+ * The download is repeated with a fixed queue depth and with the adaptive
+ * RequestPipeline, each with and without endgame duplicate requests, and the
+ * completion time and wasted (duplicate) bytes are printed.
+ *
+ * Usage: sim_pipeline [size in MiB]
+ */
+
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <piecepicker.hpp>
+#include <queue>
+#include <requestpipeline.hpp>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Block = PiecePicker::Block;
+
+constexpr int64_t kTickMicros = 100 * 1000;
+constexpr int64_t kPieceLength = 256 * 1024;
+
+// A seed and the link to it
+struct LinkSpec {
+  std::string name;
+  int64_t bytesPerSecond;
+  int64_t latencyMicros; // One-way delay
+};
+
+// A configuration to evaluate
+struct Strategy {
+  std::string name;
+  RequestPipeline::Settings pipeline;
+  unsigned maxDuplicates; // 1 disables endgame duplicates
+};
+
+// Kinds of simulated events
+enum class EventType {
+  RequestArrives, // A request reached the seed
+  CancelArrives,  // A cancel reached the seed
+  ServiceDone,    // The seed finished sending a block
+  BlockArrives    // A block reached the downloader
+};
+
+// A simulated event, ordered by time and then by creation order
+struct Event {
+  int64_t time;
+  uint64_t seq;
+  EventType type;
+  size_t peer;
+  Block block;
+
+  bool operator>(const Event &other) const {
+    return time != other.time ? time > other.time : seq > other.seq;
+  }
+};
+
+// Seed side of a connection
+struct SeedState {
+  std::deque<Block> queue; // Requests waiting to be served
+  bool busy = false;       // A block is being sent
+};
+
+// Results of one download
+struct Result {
+  double seconds;            // Time to download every block
+  int64_t wastedBytes;       // Duplicate blocks received in endgame
+  std::vector<double> depth; // Average target depth per peer
+};
+
+/**
+ * @brief Download a torrent of the given size with one strategy
+ */
+Result download(const Strategy &strategy, const std::vector<LinkSpec> &links,
+                int64_t totalSize) {
+  PiecePicker picker(totalSize, kPieceLength, strategy.maxDuplicates);
+  std::vector<bool> allPieces(picker.numPieces(), true);
+  std::deque<RequestPipeline> pipelines; // Not movable: rate counters
+  std::vector<SeedState> seeds(links.size());
+  for (size_t i = 0; i < links.size(); ++i) {
+    pipelines.emplace_back(strategy.pipeline);
+    picker.addPeerPieces(allPieces);
+  }
+
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  uint64_t seq = 0;
+  int64_t now = 0;
+  auto schedule = [&](int64_t at, EventType type, size_t peer, Block block) {
+    events.push({at, seq++, type, peer, block});
+  };
+
+  // Start serving the next queued request at a seed
+  auto serveNext = [&](size_t peer) {
+    SeedState &seed = seeds[peer];
+    if (seed.busy || seed.queue.empty()) {
+      return;
+    }
+    Block block = seed.queue.front();
+    seed.queue.pop_front();
+    seed.busy = true;
+    int64_t sendTime =
+        int64_t{block.length} * 1000000 / links[peer].bytesPerSecond;
+    schedule(now + sendTime, EventType::ServiceDone, peer, block);
+  };
+
+  // Top up a peer's pipeline to its target depth
+  auto fill = [&](size_t peer) {
+    RequestPipeline &pipeline = pipelines[peer];
+    for (const Block &block :
+         picker.pickBlocks(static_cast<PiecePicker::PeerId>(peer), allPieces,
+                           pipeline.wanted())) {
+      pipeline.requestSent(block, now);
+      schedule(now + links[peer].latencyMicros, EventType::RequestArrives,
+               peer, block);
+    }
+  };
+
+  Result result{0, 0, std::vector<double>(links.size(), 0)};
+  int64_t ticks = 0;
+  for (size_t peer = 0; peer < links.size(); ++peer) {
+    fill(peer);
+  }
+  int64_t nextTick = kTickMicros;
+
+  while (!picker.isFinished() && !events.empty()) {
+    Event event = events.top();
+    if (event.time >= nextTick) {
+      // Periodic tick: sample throughput and refill with the new depths
+      now = nextTick;
+      nextTick += kTickMicros;
+      ++ticks;
+      for (size_t peer = 0; peer < links.size(); ++peer) {
+        pipelines[peer].tick(kTickMicros);
+        result.depth[peer] += pipelines[peer].targetDepth();
+        fill(peer);
+      }
+      continue;
+    }
+    events.pop();
+    now = event.time;
+
+    switch (event.type) {
+    case EventType::RequestArrives:
+      seeds[event.peer].queue.push_back(event.block);
+      serveNext(event.peer);
+      break;
+
+    case EventType::CancelArrives: {
+      auto &queue = seeds[event.peer].queue;
+      for (auto it = queue.begin(); it != queue.end(); ++it) {
+        if (*it == event.block) {
+          queue.erase(it);
+          break;
+        }
+      }
+      break;
+    }
+
+    case EventType::ServiceDone:
+      seeds[event.peer].busy = false;
+      schedule(now + links[event.peer].latencyMicros, EventType::BlockArrives,
+               event.peer, event.block);
+      serveNext(event.peer);
+      break;
+
+    case EventType::BlockArrives: {
+      pipelines[event.peer].blockReceived(event.block, now);
+      bool duplicate = picker.hasBlock(event.block);
+      auto cancels = picker.blockReceived(
+          static_cast<PiecePicker::PeerId>(event.peer), event.block);
+      if (duplicate) {
+        result.wastedBytes += event.block.length;
+      }
+      for (PiecePicker::PeerId other : cancels) {
+        pipelines[other].cancel(event.block);
+        schedule(now + links[other].latencyMicros, EventType::CancelArrives,
+                 other, event.block);
+      }
+      fill(event.peer);
+      for (PiecePicker::PeerId other : cancels) {
+        fill(other);
+      }
+      break;
+    }
+    }
+  }
+
+  result.seconds = now / 1e6;
+  for (double &depth : result.depth) {
+    depth = ticks > 0 ? depth / ticks : 0;
+  }
+  return result;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const int64_t sizeMiB = argc > 1 ? std::atoll(argv[1]) : 64;
+  const int64_t totalSize = sizeMiB * 1024 * 1024;
+
+  const std::vector<LinkSpec> links = {
+      {"lan", 2 * 1024 * 1024, 5 * 1000},
+      {"fast-far", 8 * 1024 * 1024, 150 * 1000},
+      {"medium", 1024 * 1024, 80 * 1000},
+      {"slow", 128 * 1024, 250 * 1000},
+  };
+
+  RequestPipeline::Settings fixed;
+  fixed.minDepth = fixed.maxDepth = fixed.initialDepth = 5;
+  RequestPipeline::Settings adaptive;
+
+  const std::vector<Strategy> strategies = {
+      {"fixed depth 5", fixed, 1},
+      {"fixed depth 5 + endgame", fixed, 2},
+      {"adaptive BDP depth", adaptive, 1},
+      {"adaptive BDP depth + endgame", adaptive, 2},
+  };
+
+  std::cout << "Downloading " << sizeMiB << " MiB from " << links.size()
+            << " seeds:\n";
+  for (const auto &link : links) {
+    std::cout << "  " << std::left << std::setw(10) << link.name << std::right
+              << std::setw(6) << link.bytesPerSecond / 1024 << " KiB/s  "
+              << std::setw(4) << link.latencyMicros / 1000 << " ms one-way\n";
+  }
+  std::cout << '\n'
+            << std::left << std::setw(32) << "Strategy" << std::right
+            << std::setw(10) << "seconds" << std::setw(12) << "wasted KiB"
+            << "  avg depth per peer\n";
+
+  for (const auto &strategy : strategies) {
+    Result result = download(strategy, links, totalSize);
+    std::cout << std::left << std::setw(32) << strategy.name << std::right
+              << std::fixed << std::setprecision(2) << std::setw(10)
+              << result.seconds << std::setw(12) << result.wastedBytes / 1024
+              << " ";
+    for (double depth : result.depth) {
+      std::cout << ' ' << std::setprecision(0) << depth;
+    }
+    std::cout << '\n';
+  }
+  return 0;
+}
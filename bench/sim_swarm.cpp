@@ -0,0 +1,1073 @@
+/**
+ * @brief Deterministic in-process swarm simulation
+ *
+ * A swarm of virtual peers downloads a synthetic torrent from a few seeds.
+ * The peers run the real components (PiecePicker, RequestPipeline, Choker)
+ * and talk the real peer wire protocol (PeerWire) to each other; only the
+ * network is simulated. Every connection is an in-memory byte stream with the
+ * latency of its two endpoints, every peer has a limited upload rate shared
+ * round-robin between its connections, and lost segments are modelled as a
+ * TCP retransmission delay with head-of-line blocking.
+ *
+ * Time is virtual and all randomness comes from one seed, so a run is
+ * reproducible: the same configuration always yields the same completion
+ * times and run digest, whatever the machine. The wall-clock time spent in
+ * each component is also reported, to compare the CPU cost of algorithm
+ * changes.
+ *
+ * The first leechers can stream the file instead: they play it from the
+ * start at a fixed bitrate as soon as its first byte is verified, and
+ * stall whenever playback reaches a piece they do not have yet. With
+ * deadlines on, a StreamWindow keeps the pieces ahead of playback
+ * time-critical in the picker and late requests for them are duplicated
+ * to other peers; with deadlines off the same players run on plain
+ * rarest-first picking, for comparison. Reported are time to first byte,
+ * stalls, and when playback ends: first byte, plus the file's play time,
+ * plus the time stalled.
+ *
+ * Usage: sim_swarm [key=value ...]
+ *   peers=40 seeds=2 size=16 (MiB) piece=256 (KiB) degree=16 seed=1
+ *   loss=0.0 depth=0 (0 = adaptive) duplicates=2 (1 = no endgame)
+ *   slots=3 (regular unchoke slots) limit=3600 (seconds)
+ *   stream=0 (streaming leechers) bitrate=256 (KiB/s) window=4096 (KiB)
+ *   deadlines=1 timeout=1000 (ms before a deadline request is duplicated)
+ */
+
+#include <algorithm>
+#include <bencode.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <peerwire.hpp>
+#include <piecepicker.hpp>
+#include <queue>
+#include <random>
+#include <requestpipeline.hpp>
+#include <set>
+#include <sha1.hpp>
+#include <stdexcept>
+#include <streamwindow.hpp>
+#include <string>
+#include <torrentfile.hpp>
+#include <vector>
+
+namespace {
+
+using Block = PiecePicker::Block;
+using MessageId = PeerWire::MessageId;
+
+constexpr int64_t kTickMicros = 10 * 1000;
+constexpr size_t kSegmentSize = 16 * 1024; // Bytes handed to a link at once
+constexpr int64_t kMinRtoMicros = 200 * 1000;
+
+// Simulation parameters, set from key=value arguments
+struct Config {
+  size_t peers = 40;          // Leechers
+  size_t seeds = 2;           // Peers that start with every piece
+  int64_t sizeMiB = 16;       // Torrent size
+  int64_t pieceKiB = 256;     // Piece length
+  size_t degree = 16;         // Connections each peer initiates at most
+  uint64_t seed = 1;          // Random seed for the whole run
+  double loss = 0.0;          // Probability a segment is retransmitted
+  size_t depth = 0;           // Fixed request depth, 0 for adaptive
+  unsigned duplicates = 2;    // Endgame requests per block, 1 = no endgame
+  size_t slots = 3;           // Regular unchoke slots
+  double limitSeconds = 3600; // Virtual time limit
+  size_t streams = 0;         // Leechers that stream the file
+  int64_t bitrateKiB = 256;   // Playback rate of streaming leechers
+  int64_t windowKiB = 4096;   // Read-ahead with deadlines
+  bool deadlines = true;      // Streaming leechers set piece deadlines
+  int64_t timeoutMillis = 1000; // Age of a late deadline request
+};
+
+// Components whose CPU time is reported
+enum Component {
+  kWire,      // Message encoding and decoding
+  kPicker,    // PiecePicker
+  kPipeline,  // RequestPipeline
+  kChoker,    // Choker
+  kHashing,   // Piece verification
+  kContent,   // Generating and assembling block data
+  kNumComponents
+};
+
+const char *const kComponentNames[kNumComponents] = {
+    "peer wire", "piece picker", "request pipeline",
+    "choker",    "sha1 verify",  "block data"};
+
+// Accumulated wall-clock time per component
+struct Profile {
+  int64_t nanos[kNumComponents] = {};
+};
+
+/**
+ * @brief Adds the lifetime of a scope to a component's time
+ */
+class Timed {
+public:
+  Timed(Profile &profile, Component component)
+      : profile(profile), component(component),
+        start(std::chrono::steady_clock::now()) {}
+  ~Timed() {
+    profile.nanos[component] +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+  }
+
+private:
+  Profile &profile;
+  Component component;
+  std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * @brief Mix a 64-bit value (splitmix64 finalizer)
+ */
+uint64_t mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+/**
+ * @brief Generate torrent content, a pure function of seed and position
+ * @param seed Content seed
+ * @param position Offset of the first byte in the torrent
+ * @param length Number of bytes
+ * @param out Buffer of at least length bytes
+ */
+void generateContent(uint64_t seed, int64_t position, size_t length,
+                     char *out) {
+  uint64_t word = mix(seed ^ static_cast<uint64_t>(position >> 3));
+  for (size_t i = 0; i < length; ++i, ++position) {
+    if ((position & 7) == 0) {
+      word = mix(seed ^ static_cast<uint64_t>(position >> 3));
+    }
+    out[i] = static_cast<char>(word >> ((position & 7) * 8));
+  }
+}
+
+// A generated torrent
+struct SyntheticTorrent {
+  std::string data;     // Bencoded .torrent file
+  std::string infoHash; // SHA-1 of the bencoded info dictionary
+};
+
+/**
+ * @brief Build a single-file torrent whose piece hashes match the content
+ * @param config Simulation parameters
+ * @return The .torrent data and its info hash
+ */
+SyntheticTorrent makeTorrent(const Config &config) {
+  const int64_t totalSize = config.sizeMiB * 1024 * 1024;
+  const int64_t pieceLength = config.pieceKiB * 1024;
+  std::string pieces;
+  std::string data;
+  for (int64_t start = 0; start < totalSize; start += pieceLength) {
+    data.resize(std::min(pieceLength, totalSize - start));
+    generateContent(config.seed, start, data.size(), data.data());
+    pieces += Sha1::hash(data);
+  }
+
+  BencodeValue::Dict info;
+  info["name"] = std::make_unique<BencodeValue>(std::string("synthetic.bin"));
+  info["length"] = std::make_unique<BencodeValue>(totalSize);
+  info["piece length"] = std::make_unique<BencodeValue>(pieceLength);
+  info["pieces"] = std::make_unique<BencodeValue>(pieces);
+  auto infoValue = std::make_unique<BencodeValue>(std::move(info));
+  std::string infoHash = Sha1::hash(BencodeEncoder::encode(*infoValue));
+
+  BencodeValue::Dict root;
+  root["announce"] =
+      std::make_unique<BencodeValue>(std::string("http://sim.invalid/"));
+  root["info"] = std::move(infoValue);
+  return {BencodeEncoder::encode(BencodeValue(std::move(root))), infoHash};
+}
+
+// Access link of a peer
+struct LinkClass {
+  const char *name;
+  int64_t uploadRate;    // Bytes per second
+  int64_t latencyMicros; // One-way delay to the core of the network
+};
+
+const LinkClass kSeedLink = {"seed", 2 * 1024 * 1024, 10 * 1000};
+const LinkClass kLinkClasses[] = {
+    {"fiber", 4 * 1024 * 1024, 5 * 1000},
+    {"cable", 1024 * 1024, 20 * 1000},
+    {"dsl", 256 * 1024, 40 * 1000},
+    {"mobile", 128 * 1024, 80 * 1000},
+};
+
+// One side of a connection
+struct Connection {
+  Connection(size_t node, const RequestPipeline::Settings &settings)
+      : node(node), pipeline(settings) {}
+
+  size_t node;                 // Owning peer
+  size_t remote = 0;           // Index of the other side
+  Choker::PeerId chokerId = 0; // Id in the owning peer's choker
+  int64_t latency = 0;         // One-way delay to the remote side
+  PeerWire::Reader reader;     // Decoder for received bytes
+  std::string outbox;          // Encoded bytes not yet sent
+  size_t outboxSent = 0;       // Bytes of outbox already sent
+  int64_t lastDelivery = 0;    // Delivery time of the last segment sent
+  std::deque<Block> uploads;   // Requests from the remote side to serve
+  RequestPipeline pipeline;    // Our requests to the remote side
+  std::vector<bool> peerHas;   // Pieces the remote side has
+  uint32_t wantedPieces = 0;   // Pieces the remote has and we lack
+  bool handshaken = false;     // Remote handshake received
+  bool amChoking = true;
+  bool amInterested = false;
+  bool peerChoking = true;
+  bool peerInterested = false;
+};
+
+// Playback of a streaming leecher
+struct Playback {
+  int64_t position = 0;      // Bytes of the file played
+  int64_t firstByteAt = -1;  // Time the first byte became readable
+  int64_t stalledSince = -1; // Start of the current stall, -1 if none
+  int64_t stallMicros = 0;   // Time spent stalled after the first byte
+  uint32_t stalls = 0;       // Number of stalls
+};
+
+// A simulated peer
+struct Node {
+  Node(const TorrentFile &torrent, const Config &config,
+       const Choker::Settings &chokerSettings)
+      : picker(torrent, config.duplicates), choker(chokerSettings),
+        have(picker.numPieces(), false) {}
+
+  LinkClass link{};
+  PiecePicker picker;
+  Choker choker;
+  std::string peerId;
+  std::vector<bool> have;                  // Verified pieces
+  uint32_t havePieces = 0;                 // Number of verified pieces
+  std::map<uint32_t, std::string> partial; // Pieces being assembled
+  std::vector<size_t> connections;         // Connection indices
+  std::vector<size_t> chokerToConnection;  // Choker::PeerId to connection
+  int64_t budget = 0;                      // Upload bytes available
+  size_t cursor = 0;                       // Round-robin position
+  int64_t completedAt = -1;                // Virtual time of completion
+  bool seed = false;
+  bool streaming = false;                  // Plays the file while loading
+  Playback playback;
+  std::unique_ptr<StreamWindow> stream;    // Deadlines, if enabled
+};
+
+// A segment arriving at a connection
+struct Delivery {
+  int64_t time;
+  uint64_t seq;
+  size_t connection; // Receiving side
+  std::string bytes;
+
+  bool operator>(const Delivery &other) const {
+    return time != other.time ? time > other.time : seq > other.seq;
+  }
+};
+
+/**
+ * @brief The swarm and its event loop
+ */
+class Swarm {
+public:
+  Swarm(const Config &config, const TorrentFile &torrent,
+        const std::string &infoHash)
+      : config(config), torrent(torrent), infoHash(infoHash),
+        random(config.seed) {
+    Choker::Settings chokerSettings;
+    chokerSettings.regularSlots = config.slots;
+    RequestPipeline::Settings pipelineSettings;
+    if (config.depth > 0) {
+      pipelineSettings.minDepth = pipelineSettings.maxDepth =
+          pipelineSettings.initialDepth = config.depth;
+    }
+
+    size_t total = config.seeds + config.peers;
+    nodes.reserve(total);
+    for (size_t i = 0; i < total; ++i) {
+      chokerSettings.randomSeed = mix(config.seed + i);
+      nodes.emplace_back(torrent, config, chokerSettings);
+      Node &node = nodes.back();
+      node.seed = i < config.seeds;
+      node.link = node.seed ? kSeedLink
+                            : kLinkClasses[random() % std::size(kLinkClasses)];
+      node.peerId = "-SM0001-" + std::to_string(100000000000ull + i);
+      if (node.seed) {
+        for (uint32_t p = 0; p < node.picker.numPieces(); ++p) {
+          node.picker.setHave(p);
+          node.have[p] = true;
+        }
+        node.havePieces = node.picker.numPieces();
+        node.completedAt = 0;
+        node.choker.setMode(Choker::Mode::Seed);
+      }
+    }
+
+    StreamWindow::Settings streamSettings;
+    streamSettings.bitrate = config.bitrateKiB * 1024;
+    streamSettings.windowBytes = config.windowKiB * 1024;
+    for (size_t i = config.seeds;
+         i < std::min(total, config.seeds + config.streams); ++i) {
+      nodes[i].streaming = true;
+      if (config.deadlines) {
+        nodes[i].stream = std::make_unique<StreamWindow>(
+            nodes[i].picker, torrent, 0, streamSettings);
+      }
+    }
+
+    // Random overlay: every peer initiates up to degree connections
+    std::set<std::pair<size_t, size_t>> linked;
+    for (size_t a = 0; a < total; ++a) {
+      for (size_t k = 0; k < config.degree && total > 1; ++k) {
+        size_t b = random() % total;
+        if (b == a || !linked.insert({std::min(a, b), std::max(a, b)}).second) {
+          continue;
+        }
+        connect(a, b, pipelineSettings);
+      }
+    }
+    remaining = config.peers;
+  }
+
+  /**
+   * @brief Run until every peer completes or the time limit passes
+   * @return Virtual end time in microseconds
+   */
+  int64_t run() {
+    const int64_t limit = static_cast<int64_t>(config.limitSeconds * 1e6);
+    int64_t nextTick = 0;
+    while (remaining > 0 && now < limit) {
+      while (!deliveries.empty() && deliveries.top().time < nextTick) {
+        Delivery delivery = deliveries.top();
+        deliveries.pop();
+        now = delivery.time;
+        receive(delivery.connection, delivery.bytes);
+      }
+      now = nextTick;
+      nextTick += kTickMicros;
+      for (size_t i = 0; i < nodes.size(); ++i) {
+        tickNode(i);
+      }
+    }
+    for (Node &node : nodes) {
+      Playback &playback = node.playback;
+      if (playback.stalledSince >= 0) {
+        playback.stallMicros += now - playback.stalledSince;
+        playback.stalledSince = -1;
+      }
+    }
+    return now;
+  }
+
+  std::vector<Node> &getNodes() { return nodes; }
+  const Profile &getProfile() const { return profile; }
+  int64_t payloadBytes = 0; // Block data delivered
+  int64_t wastedBytes = 0;  // Block data received twice
+  int64_t wireBytes = 0;    // All bytes delivered
+  int64_t hashFailures = 0; // Pieces that failed verification
+
+private:
+  const Config &config;
+  const TorrentFile &torrent;
+  std::string infoHash;
+  std::mt19937_64 random;
+  std::vector<Node> nodes;
+  std::deque<Connection> connections; // Not movable: rate counters
+  std::priority_queue<Delivery, std::vector<Delivery>,
+                      std::greater<Delivery>>
+      deliveries;
+  uint64_t seq = 0;
+  int64_t now = 0;
+  size_t remaining = 0; // Peers still downloading
+  Profile profile;
+
+  /**
+   * @brief Open a connection between two peers and queue the handshakes
+   */
+  void connect(size_t a, size_t b,
+               const RequestPipeline::Settings &settings) {
+    size_t ia = connections.size();
+    connections.emplace_back(a, settings);
+    connections.emplace_back(b, settings);
+    size_t ib = ia + 1;
+    int64_t latency = nodes[a].link.latencyMicros + nodes[b].link.latencyMicros;
+    for (auto [self, other] : {std::pair{ia, ib}, std::pair{ib, ia}}) {
+      Connection &conn = connections[self];
+      Node &node = nodes[conn.node];
+      conn.remote = other;
+      conn.latency = latency;
+      conn.peerHas.assign(node.picker.numPieces(), false);
+      conn.chokerId = node.choker.addPeer();
+      if (node.chokerToConnection.size() <= conn.chokerId) {
+        node.chokerToConnection.resize(conn.chokerId + 1);
+      }
+      node.chokerToConnection[conn.chokerId] = self;
+      node.connections.push_back(self);
+
+      Timed timed(profile, kWire);
+      PeerWire::appendHandshake(conn.outbox, infoHash, node.peerId);
+      if (node.havePieces > 0) {
+        PeerWire::appendBitfield(conn.outbox, node.have);
+      }
+    }
+  }
+
+  /**
+   * @brief Advance one peer by a tick: choking, rates and uploading
+   */
+  void tickNode(size_t index) {
+    Node &node = nodes[index];
+    Choker::Decision decision;
+    {
+      Timed timed(profile, kChoker);
+      decision = node.choker.tick(kTickMicros);
+    }
+    for (Choker::PeerId id : decision.unchoke) {
+      Connection &conn = connections[node.chokerToConnection[id]];
+      conn.amChoking = false;
+      Timed timed(profile, kWire);
+      PeerWire::appendMessage(conn.outbox, MessageId::Unchoke);
+    }
+    for (Choker::PeerId id : decision.choke) {
+      Connection &conn = connections[node.chokerToConnection[id]];
+      conn.amChoking = true;
+      conn.uploads.clear(); // Pending requests are dropped on choke
+      Timed timed(profile, kWire);
+      PeerWire::appendMessage(conn.outbox, MessageId::Choke);
+    }
+    {
+      Timed timed(profile, kPipeline);
+      for (size_t c : node.connections) {
+        connections[c].pipeline.tick(kTickMicros);
+      }
+    }
+    if (node.streaming) {
+      play(node);
+    }
+    for (size_t c : node.connections) {
+      requestMore(c); // Depths change as rates are sampled
+    }
+    upload(node);
+  }
+
+  /**
+   * @brief Advance a streaming leecher's playback by a tick
+   *
+   * Playback starts once the first byte is readable and consumes the
+   * bitrate every tick; a tick that finds too few verified bytes ahead
+   * starts a stall, which lasts until playback can move at full rate again.
+   * With deadlines, the stream window then follows the new position and
+   * late requests for deadline pieces are reported to the picker.
+   */
+  void play(Node &node) {
+    Playback &playback = node.playback;
+    const int64_t fileSize = torrent.getTotalSize();
+    const int64_t pieceLength = torrent.getPieceLength();
+    if (playback.position >= fileSize) {
+      return;
+    }
+    int64_t readable = playback.position;
+    while (readable < fileSize && node.have[readable / pieceLength]) {
+      readable = std::min(fileSize, (readable / pieceLength + 1) * pieceLength);
+    }
+    readable -= playback.position;
+
+    const int64_t perTick = config.bitrateKiB * 1024 * kTickMicros / 1000000;
+    if (playback.firstByteAt < 0) {
+      if (readable > 0) {
+        playback.firstByteAt = now;
+      }
+    } else {
+      int64_t step =
+          std::min({perTick, readable, fileSize - playback.position});
+      playback.position += step;
+      if (step < perTick && playback.position < fileSize) {
+        if (playback.stalledSince < 0) {
+          playback.stalledSince = now;
+          ++playback.stalls;
+        }
+      } else if (playback.stalledSince >= 0) {
+        playback.stallMicros += now - playback.stalledSince;
+        playback.stalledSince = -1;
+      }
+    }
+    if (!node.stream) {
+      return;
+    }
+
+    Timed timed(profile, kPicker);
+    if (playback.position >= fileSize) {
+      node.stream->stop();
+      return;
+    }
+    node.stream->read(playback.position, perTick, now);
+    for (size_t c : node.connections) {
+      for (const Block &block : connections[c].pipeline.timedOut(
+               now, config.timeoutMillis * 1000)) {
+        node.picker.requestTimedOut(static_cast<PiecePicker::PeerId>(c),
+                                    block);
+      }
+    }
+  }
+
+  /**
+   * @brief Hand the peer's upload budget to its connections round-robin
+   */
+  void upload(Node &node) {
+    const int64_t perTick = node.link.uploadRate * kTickMicros / 1000000;
+    node.budget = std::min(node.budget + perTick, 2 * perTick);
+    const size_t count = node.connections.size();
+    bool progress = true;
+    while (node.budget > 0 && progress) {
+      progress = false;
+      for (size_t k = 0; k < count && node.budget > 0; ++k) {
+        size_t c = node.connections[(node.cursor + k) % count];
+        if (sendSegment(node, c)) {
+          progress = true;
+        }
+      }
+      node.cursor = (node.cursor + 1) % std::max<size_t>(count, 1);
+    }
+  }
+
+  /**
+   * @brief Send up to one segment of a connection's pending bytes
+   * @return true if anything was sent
+   */
+  bool sendSegment(Node &node, size_t c) {
+    Connection &conn = connections[c];
+    if (conn.outboxSent == conn.outbox.size()) {
+      conn.outbox.clear();
+      conn.outboxSent = 0;
+      if (conn.amChoking || conn.uploads.empty()) {
+        return false;
+      }
+      // Encode the next requested block only when the link can take it
+      Block block = conn.uploads.front();
+      conn.uploads.pop_front();
+      std::string data(block.length, '\0');
+      {
+        Timed timed(profile, kContent);
+        int64_t position =
+            int64_t{block.piece} * torrent.getPieceLength() + block.offset;
+        generateContent(config.seed, position, block.length, data.data());
+      }
+      {
+        Timed timed(profile, kWire);
+        PeerWire::appendPiece(conn.outbox, block.piece, block.offset, data);
+      }
+      node.choker.uploadCounter(conn.chokerId).add(block.length);
+    }
+
+    size_t length = std::min({conn.outbox.size() - conn.outboxSent,
+                              kSegmentSize,
+                              static_cast<size_t>(node.budget)});
+    node.budget -= static_cast<int64_t>(length);
+
+    // A lost segment arrives after a retransmission timeout, and everything
+    // behind it on the connection waits for it
+    int64_t time = now + conn.latency;
+    if (config.loss > 0 &&
+        std::uniform_real_distribution<double>(0, 1)(random) < config.loss) {
+      time += 2 * conn.latency + kMinRtoMicros;
+    }
+    time = std::max(time, conn.lastDelivery);
+    conn.lastDelivery = time;
+    deliveries.push({time, seq++, conn.remote,
+                     conn.outbox.substr(conn.outboxSent, length)});
+    conn.outboxSent += length;
+    wireBytes += static_cast<int64_t>(length);
+    return true;
+  }
+
+  /**
+   * @brief Feed a delivered segment to the receiving side
+   */
+  void receive(size_t c, const std::string &bytes) {
+    Connection &conn = connections[c];
+    PeerWire::Message message;
+    for (bool fed = false;;) {
+      {
+        Timed timed(profile, kWire);
+        if (!fed) {
+          conn.reader.feed(bytes.data(), bytes.size());
+          fed = true;
+        }
+        if (!conn.handshaken) {
+          PeerWire::Handshake handshake;
+          if (!conn.reader.handshake(handshake)) {
+            return;
+          }
+          if (handshake.infoHash != infoHash) {
+            throw std::runtime_error("Handshake for a different torrent");
+          }
+          conn.handshaken = true;
+        }
+        if (!conn.reader.next(message)) {
+          return;
+        }
+      }
+      handle(c, message);
+    }
+  }
+
+  /**
+   * @brief Apply one received message
+   */
+  void handle(size_t c, const PeerWire::Message &message) {
+    Connection &conn = connections[c];
+    Node &node = nodes[conn.node];
+    if (message.keepAlive) {
+      return;
+    }
+    switch (message.id) {
+    case MessageId::Choke: {
+      conn.peerChoking = true;
+      std::vector<Block> dropped;
+      {
+        Timed timed(profile, kPipeline);
+        dropped = conn.pipeline.clear();
+      }
+      Timed timed(profile, kPicker);
+      for (const Block &block : dropped) {
+        node.picker.abortRequest(static_cast<PiecePicker::PeerId>(c), block);
+      }
+      break;
+    }
+    case MessageId::Unchoke:
+      conn.peerChoking = false;
+      requestMore(c);
+      break;
+    case MessageId::Interested:
+    case MessageId::NotInterested: {
+      conn.peerInterested = message.id == MessageId::Interested;
+      Timed timed(profile, kChoker);
+      node.choker.setInterested(conn.chokerId, conn.peerInterested);
+      break;
+    }
+    case MessageId::Have:
+      if (message.piece < conn.peerHas.size() && !conn.peerHas[message.piece]) {
+        conn.peerHas[message.piece] = true;
+        conn.wantedPieces += node.have[message.piece] ? 0 : 1;
+        Timed timed(profile, kPicker);
+        node.picker.addPeerPiece(message.piece);
+      }
+      updateInterest(c);
+      break;
+    case MessageId::Bitfield: {
+      {
+        Timed timed(profile, kWire);
+        conn.peerHas =
+            PeerWire::decodeBitfield(message.data, node.picker.numPieces());
+      }
+      for (uint32_t p = 0; p < conn.peerHas.size(); ++p) {
+        conn.wantedPieces += conn.peerHas[p] && !node.have[p] ? 1 : 0;
+      }
+      {
+        Timed timed(profile, kPicker);
+        node.picker.addPeerPieces(conn.peerHas);
+      }
+      updateInterest(c);
+      break;
+    }
+    case MessageId::Request:
+      if (!conn.amChoking && message.piece < node.have.size() &&
+          node.have[message.piece]) {
+        conn.uploads.push_back({message.piece, message.offset, message.length});
+      }
+      break;
+    case MessageId::Cancel: {
+      Block block{message.piece, message.offset, message.length};
+      auto it = std::find(conn.uploads.begin(), conn.uploads.end(), block);
+      if (it != conn.uploads.end()) {
+        conn.uploads.erase(it);
+      }
+      break;
+    }
+    case MessageId::Piece:
+      receiveBlock(c, message);
+      break;
+    case MessageId::Extended:
+      break; // Simulated peers negotiate no extensions
+    default:
+      break; // Unknown ids are ignored, as BEP 3 asks
+    }
+  }
+
+  /**
+   * @brief Store a received block, cancel duplicates and verify the piece
+   */
+  void receiveBlock(size_t c, const PeerWire::Message &message) {
+    Connection &conn = connections[c];
+    Node &node = nodes[conn.node];
+    Block block{message.piece, message.offset, message.length};
+    payloadBytes += block.length;
+    {
+      Timed timed(profile, kPipeline);
+      conn.pipeline.blockReceived(block, now);
+    }
+    {
+      Timed timed(profile, kChoker);
+      node.choker.downloadCounter(conn.chokerId).add(block.length);
+    }
+
+    std::vector<PiecePicker::PeerId> cancels;
+    bool duplicate = false;
+    {
+      Timed timed(profile, kPicker);
+      duplicate = block.piece >= node.have.size() || node.have[block.piece] ||
+                  node.picker.hasBlock(block);
+      if (!duplicate) {
+        cancels = node.picker.blockReceived(
+            static_cast<PiecePicker::PeerId>(c), block);
+      }
+    }
+    if (duplicate) {
+      wastedBytes += block.length;
+      requestMore(c);
+      return;
+    }
+
+    {
+      Timed timed(profile, kContent);
+      std::string &data = node.partial[block.piece];
+      data.resize(node.picker.pieceSize(block.piece));
+      std::copy(message.data.begin(), message.data.end(),
+                data.begin() + block.offset);
+    }
+    for (PiecePicker::PeerId other : cancels) {
+      Connection &otherConn = connections[other];
+      {
+        Timed timed(profile, kPipeline);
+        otherConn.pipeline.cancel(block);
+      }
+      Timed timed(profile, kWire);
+      PeerWire::appendBlockMessage(otherConn.outbox, MessageId::Cancel,
+                                   block.piece, block.offset, block.length);
+    }
+
+    bool complete;
+    {
+      Timed timed(profile, kPicker);
+      complete = node.picker.isPieceComplete(block.piece);
+    }
+    if (complete) {
+      verifyPiece(node, block.piece);
+    }
+    requestMore(c);
+    for (PiecePicker::PeerId other : cancels) {
+      requestMore(other);
+    }
+  }
+
+  /**
+   * @brief Check a complete piece against its hash and announce it
+   */
+  void verifyPiece(Node &node, uint32_t piece) {
+    bool valid;
+    {
+      Timed timed(profile, kHashing);
+      valid = Sha1::hash(node.partial[piece]) == torrent.getPieces()[piece];
+    }
+    node.partial.erase(piece);
+    if (!valid) {
+      ++hashFailures;
+      Timed timed(profile, kPicker);
+      node.picker.pieceFailed(piece);
+      return;
+    }
+
+    node.have[piece] = true;
+    ++node.havePieces;
+    for (size_t c : node.connections) {
+      Connection &conn = connections[c];
+      if (conn.peerHas[piece]) {
+        --conn.wantedPieces;
+      }
+      {
+        Timed timed(profile, kWire);
+        PeerWire::appendHave(conn.outbox, piece);
+      }
+      updateInterest(c);
+    }
+    if (node.havePieces == node.picker.numPieces()) {
+      node.completedAt = now;
+      --remaining;
+      Timed timed(profile, kChoker);
+      node.choker.setMode(Choker::Mode::Seed);
+    }
+  }
+
+  /**
+   * @brief Send interested or not interested when our interest changes
+   */
+  void updateInterest(size_t c) {
+    Connection &conn = connections[c];
+    bool interested = conn.wantedPieces > 0;
+    if (interested == conn.amInterested) {
+      return;
+    }
+    conn.amInterested = interested;
+    {
+      Timed timed(profile, kWire);
+      PeerWire::appendMessage(conn.outbox, interested
+                                               ? MessageId::Interested
+                                               : MessageId::NotInterested);
+    }
+    requestMore(c);
+  }
+
+  /**
+   * @brief Top up the connection's requests to the pipeline's target depth
+   */
+  void requestMore(size_t c) {
+    Connection &conn = connections[c];
+    if (conn.peerChoking || !conn.amInterested) {
+      return;
+    }
+    size_t wanted;
+    {
+      Timed timed(profile, kPipeline);
+      wanted = conn.pipeline.wanted();
+    }
+    if (wanted == 0) {
+      return;
+    }
+    Node &node = nodes[conn.node];
+    std::vector<Block> blocks;
+    {
+      Timed timed(profile, kPicker);
+      blocks = node.picker.pickBlocks(static_cast<PiecePicker::PeerId>(c),
+                                      conn.peerHas, wanted);
+    }
+    for (const Block &block : blocks) {
+      {
+        Timed timed(profile, kPipeline);
+        conn.pipeline.requestSent(block, now);
+      }
+      Timed timed(profile, kWire);
+      PeerWire::appendBlockMessage(conn.outbox, MessageId::Request,
+                                   block.piece, block.offset, block.length);
+    }
+  }
+};
+
+/**
+ * @brief Parse key=value arguments into the configuration
+ * @throws std::invalid_argument on an unknown key
+ */
+Config parseArguments(int argc, char *argv[]) {
+  Config config;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto equals = arg.find('=');
+    if (equals == std::string::npos) {
+      throw std::invalid_argument("Expected key=value: " + arg);
+    }
+    std::string key = arg.substr(0, equals);
+    const char *value = argv[i] + equals + 1;
+    if (key == "peers") {
+      config.peers = std::strtoull(value, nullptr, 10);
+    } else if (key == "seeds") {
+      config.seeds = std::strtoull(value, nullptr, 10);
+    } else if (key == "size") {
+      config.sizeMiB = std::atoll(value);
+    } else if (key == "piece") {
+      config.pieceKiB = std::atoll(value);
+    } else if (key == "degree") {
+      config.degree = std::strtoull(value, nullptr, 10);
+    } else if (key == "seed") {
+      config.seed = std::strtoull(value, nullptr, 10);
+    } else if (key == "loss") {
+      config.loss = std::atof(value);
+    } else if (key == "depth") {
+      config.depth = std::strtoull(value, nullptr, 10);
+    } else if (key == "duplicates") {
+      config.duplicates = static_cast<unsigned>(std::atoi(value));
+    } else if (key == "slots") {
+      config.slots = std::strtoull(value, nullptr, 10);
+    } else if (key == "limit") {
+      config.limitSeconds = std::atof(value);
+    } else if (key == "stream") {
+      config.streams = std::strtoull(value, nullptr, 10);
+    } else if (key == "bitrate") {
+      config.bitrateKiB = std::atoll(value);
+    } else if (key == "window") {
+      config.windowKiB = std::atoll(value);
+    } else if (key == "deadlines") {
+      config.deadlines = std::atoi(value) != 0;
+    } else if (key == "timeout") {
+      config.timeoutMillis = std::atoll(value);
+    } else {
+      throw std::invalid_argument("Unknown option: " + key);
+    }
+  }
+  if (config.seeds == 0 || config.sizeMiB <= 0 || config.pieceKiB <= 0) {
+    throw std::invalid_argument("Need at least one seed and positive sizes");
+  }
+  if (config.bitrateKiB <= 0 || config.windowKiB <= 0) {
+    throw std::invalid_argument("Need a positive bitrate and window");
+  }
+  return config;
+}
+
+/**
+ * @brief Get a percentile of sorted values by nearest rank
+ */
+double percentile(const std::vector<double> &sorted, double p) {
+  size_t rank = static_cast<size_t>(p / 100 * (sorted.size() - 1) + 0.5);
+  return sorted[rank];
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    Config config = parseArguments(argc, argv);
+
+    auto start = std::chrono::steady_clock::now();
+    SyntheticTorrent synthetic = makeTorrent(config);
+    TorrentFile torrent = TorrentFile::fromBencode(synthetic.data);
+
+    Swarm swarm(config, torrent, synthetic.infoHash);
+    int64_t end = swarm.run();
+    double wall = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+
+    std::vector<double> times;
+    std::map<std::string, std::vector<double>> byClass;
+    size_t unfinished = 0;
+    uint64_t digest = config.seed;
+    for (const Node &node : swarm.getNodes()) {
+      if (node.seed) {
+        continue;
+      }
+      if (node.completedAt < 0) {
+        ++unfinished;
+        continue;
+      }
+      times.push_back(node.completedAt / 1e6);
+      byClass[node.link.name].push_back(node.completedAt / 1e6);
+      digest = mix(digest ^ static_cast<uint64_t>(node.completedAt));
+    }
+    std::sort(times.begin(), times.end());
+
+    std::cout << "Swarm: " << config.peers << " leechers, " << config.seeds
+              << " seeds, " << config.sizeMiB << " MiB in "
+              << torrent.getPieces().size() << " pieces, seed "
+              << config.seed << ", loss " << config.loss << ", depth "
+              << (config.depth ? std::to_string(config.depth) : "adaptive")
+              << ", endgame duplicates " << config.duplicates << "\n\n";
+
+    std::cout << std::fixed << std::setprecision(2);
+    if (!times.empty()) {
+      double mean = 0;
+      for (double t : times) {
+        mean += t / times.size();
+      }
+      std::cout << "Completion time (virtual seconds)\n"
+                << "  min " << times.front() << "  p10 "
+                << percentile(times, 10) << "  p50 " << percentile(times, 50)
+                << "  p90 " << percentile(times, 90) << "  max "
+                << times.back() << "  mean " << mean << '\n';
+      for (auto &[name, classTimes] : byClass) {
+        std::sort(classTimes.begin(), classTimes.end());
+        std::cout << "  " << std::left << std::setw(8) << name << std::right
+                  << std::setw(4) << classTimes.size() << " peers  p50 "
+                  << percentile(classTimes, 50) << "  max "
+                  << classTimes.back() << '\n';
+      }
+    }
+    if (unfinished > 0) {
+      std::cout << "  " << unfinished << " peers unfinished at "
+                << end / 1e6 << " s\n";
+    }
+
+    std::vector<const Node *> streamers;
+    for (const Node &node : swarm.getNodes()) {
+      if (node.streaming) {
+        streamers.push_back(&node);
+      }
+    }
+    if (!streamers.empty()) {
+      const double playSeconds =
+          torrent.getTotalSize() / (config.bitrateKiB * 1024.0);
+      std::vector<double> firstByte;
+      std::vector<double> stallTimes;
+      std::vector<double> ends;
+      uint64_t stalls = 0;
+      std::cout << "\nStreaming at " << config.bitrateKiB << " KiB/s, "
+                << (config.deadlines
+                        ? "deadlines over " + std::to_string(config.windowKiB) +
+                              " KiB, timeout " +
+                              std::to_string(config.timeoutMillis) + " ms"
+                        : std::string("no deadlines"))
+                << " (virtual seconds)\n";
+      for (const Node *node : streamers) {
+        const Playback &playback = node->playback;
+        firstByte.push_back(playback.firstByteAt / 1e6);
+        stallTimes.push_back(playback.stallMicros / 1e6);
+        ends.push_back(firstByte.back() + playSeconds + stallTimes.back());
+        stalls += playback.stalls;
+        std::cout << "  " << std::left << std::setw(8) << node->link.name
+                  << std::right << "first byte " << std::setw(6)
+                  << playback.firstByteAt / 1e6 << "  stalls "
+                  << std::setw(4) << playback.stalls << "  stalled "
+                  << std::setw(6) << playback.stallMicros / 1e6
+                  << "  played " << std::setw(6) << ends.back()
+                  << "  complete " << std::setw(6)
+                  << node->completedAt / 1e6 << '\n';
+      }
+      std::sort(firstByte.begin(), firstByte.end());
+      std::sort(stallTimes.begin(), stallTimes.end());
+      std::sort(ends.begin(), ends.end());
+      std::cout << "  time to first byte p50 " << percentile(firstByte, 50)
+                << "  max " << firstByte.back() << "; stalls " << stalls
+                << ", stalled p50 " << percentile(stallTimes, 50) << "  max "
+                << stallTimes.back() << "; played p50 "
+                << percentile(ends, 50) << "  max " << ends.back() << '\n';
+    }
+
+    std::cout << "\nTraffic: " << swarm.payloadBytes / (1024 * 1024)
+              << " MiB payload, " << swarm.wastedBytes / 1024
+              << " KiB duplicate, protocol overhead "
+              << std::setprecision(3)
+              << 100.0 * (swarm.wireBytes - swarm.payloadBytes) /
+                     std::max<int64_t>(swarm.wireBytes, 1)
+              << "%, hash failures " << swarm.hashFailures << '\n';
+    std::cout << "Run digest: " << std::hex << digest << std::dec << "\n\n";
+
+    const Profile &profile = swarm.getProfile();
+    int64_t measured = 0;
+    for (int64_t nanos : profile.nanos) {
+      measured += nanos;
+    }
+    int64_t total = static_cast<int64_t>(wall * 1e9);
+    std::cout << std::setprecision(1) << "CPU time (wall " << wall
+              << " s)\n";
+    for (int i = 0; i <= kNumComponents; ++i) {
+      const char *name = i < kNumComponents ? kComponentNames[i]
+                                            : "simulator and other";
+      int64_t nanos =
+          i < kNumComponents ? profile.nanos[i] : total - measured;
+      std::cout << "  " << std::left << std::setw(20) << name << std::right
+                << std::setw(10) << nanos / 1e6 << " ms" << std::setw(8)
+                << 100.0 * nanos / std::max<int64_t>(total, 1) << "%\n";
+    }
+    return unfinished > 0 || swarm.hashFailures > 0 ? 1 : 0;
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -3,6 +3,7 @@
 
 #include <map>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <variant>
@@ -93,6 +94,50 @@ public:
    */
   static BencodeValue parse(std::string_view input);
 
+  /**
+   * @brief Skip over one value without decoding it
+   * @param input The Bencode-encoded data
+   * @param pos Position of the value, advanced past it
+   * @throws std::runtime_error if the value is invalid
+   */
+  static void skipValue(std::string_view input, size_t &pos);
+
+  /**
+   * @brief Find the encoding of an entry of the root dictionary
+   * @param input Bencode data whose root is a dictionary
+   * @param key Key of the entry
+   * @return The bytes encoding the entry's value, as a view into input, or
+   * an empty view if the key is absent
+   * @throws std::runtime_error if input is invalid before the entry
+   *
+   * Digests over a value, such as the info hash, must cover its bytes
+   * exactly as they appear in the file, which re-encoding a parsed value
+   * only reproduces for canonical input.
+   */
+  static std::string_view findRaw(std::string_view input,
+                                  std::string_view key);
+
+  /**
+   * @brief Entry of a dictionary as it appears in the data
+   */
+  struct RawEntry {
+    std::string_view key;   // Key, without its length prefix
+    std::string_view value; // Encoding of the value
+  };
+
+  /**
+   * @brief List the entries of a dictionary without decoding them
+   * @param input Bencode data starting with a dictionary; bytes after it
+   * are ignored
+   * @return The entries in the order they appear, as views into input
+   * @throws std::runtime_error if the dictionary is invalid
+   *
+   * Consecutive entries are contiguous: each one's key prefix starts where
+   * the previous value ends, which lets callers copy runs of entries
+   * verbatim.
+   */
+  static std::vector<RawEntry> dictEntries(std::string_view input);
+
 private:
   /**
    * @brief Helper methods for parsing specific Bencode types
@@ -111,6 +156,63 @@ private:
                                       size_t &pos); // Parse list (l...e)
   static BencodeValue::Dict parseDict(std::string_view input,
                                       size_t &pos); // Parse dict (d...e)
+  static std::string_view parseStringView(std::string_view input,
+                                          size_t &pos); // Without copying
+};
+
+/**
+ * @brief Encoder class for producing Bencode format
+ *
+ * This is the inverse of BencodeParser: encoding a parsed value yields the
+ * canonical form, with dictionary keys in sorted order (std::map keeps them
+ * sorted) and integers without leading zeros.
+ */
+class BencodeEncoder {
+public:
+  /**
+   * @brief Encode a value as Bencode
+   * @param value The value to encode
+   * @return The Bencode-encoded data
+   */
+  static std::string encode(const BencodeValue &value);
+
+  /**
+   * @brief Append the encoding of a value to a buffer
+   * @param value The value to encode
+   * @param out Buffer the encoding is appended to
+   */
+  static void encode(const BencodeValue &value, std::string &out);
+
+  /**
+   * @brief Helpers appending a single encoded element to a buffer
+   * @param out Buffer the encoding is appended to
+   */
+  static void encodeInt(int64_t i, std::string &out); // i42e
+  static void encodeString(std::string_view s,
+                           std::string &out); // 4:spam
+
+  /**
+   * @brief Changes to dictionary entries: key to new value encoding, or
+   * nullopt to remove the entry
+   */
+  using Edits = std::map<std::string, std::optional<std::string>, std::less<>>;
+
+  /**
+   * @brief Copy a dictionary with some entries replaced, removed or added
+   * @param input Bencode data starting with a dictionary
+   * @param entries Its entries, from BencodeParser::dictEntries(input)
+   * @param edits Changes to apply
+   * @param out Buffer the new data is appended to, including any bytes of
+   * input after the dictionary
+   *
+   * Runs of unedited entries are copied from input in one piece, so values
+   * that are not edited keep their exact bytes. A key added by an edit
+   * goes in front of the first entry whose key sorts after it, which is
+   * its sorted place if the input's keys are sorted, as Bencode requires.
+   */
+  static void spliceDict(std::string_view input,
+                         const std::vector<BencodeParser::RawEntry> &entries,
+                         const Edits &edits, std::string &out);
 };
 
 #endif // BENCODE_HPP
@@ -0,0 +1,213 @@
+#ifndef CATALOGSTORE_HPP
+#define CATALOGSTORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <torrentfile.hpp>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Column-oriented store of catalog metadata for analytic scans
+ *
+ * Each torrent is a row; each attribute is kept in its own contiguous
+ * array, so a query reads only the columns it uses, a cache line at a
+ * time. Strings (created-by, tracker host) are dictionary-encoded into
+ * 32-bit codes, turning string predicates into integer compares.
+ *
+ * Filters are conjunctions of predicates and produce a selection bitmap,
+ * one bit per row. Predicates are evaluated 64 rows at a time with AVX2
+ * compares when the processor has them (checked at run time, so the build
+ * needs no special flags) and scalar code otherwise; 64-row words already
+ * rejected by earlier predicates are skipped. Aggregates over a selection
+ * use masked AVX2 adds and blends.
+ *
+ * Rows are appended only. Not thread-safe for writers; concurrent queries
+ * are fine.
+ */
+class CatalogStore {
+public:
+  /**
+   * @brief Queryable columns
+   *
+   * TotalSize, PieceLength and CreationDate hold 64-bit values, the others
+   * 32-bit values; CreatedBy and TrackerHost hold dictionary codes.
+   */
+  enum class Column {
+    TotalSize,    // Bytes of all files
+    PieceLength,  // Bytes per piece
+    CreationDate, // Unix time, 0 if absent
+    FileCount,    // Number of files
+    CreatedBy,    // Code of the creating client, "" if absent
+    TrackerHost,  // Code of the announce URL's lower-cased host
+  };
+
+  /**
+   * @brief Comparison of a column against a constant
+   */
+  enum class Op { Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual };
+
+  /**
+   * @brief One predicate: column op value
+   */
+  struct Predicate {
+    Column column;
+    Op op;
+    int64_t value; // Dictionary code for dictionary columns
+  };
+
+  /**
+   * @brief Metadata of one row, for adding rows without a TorrentFile
+   */
+  struct Row {
+    int64_t totalSize = 0;
+    int64_t pieceLength = 0;
+    int64_t creationDate = 0;
+    uint32_t fileCount = 0;
+    std::string_view createdBy;
+    std::string_view trackerHost;
+  };
+
+  /**
+   * @brief Result of aggregate()
+   */
+  struct Aggregate {
+    uint64_t rows = 0; // Selected rows
+    int64_t sum = 0;   // Sum over the selected rows
+    int64_t min = 0;   // Minimum, 0 if no row is selected
+    int64_t max = 0;   // Maximum, 0 if no row is selected
+  };
+
+  /**
+   * @brief Rows and column sum for one dictionary code, see groupBy()
+   */
+  struct Group {
+    uint32_t code;
+    uint64_t rows;
+    int64_t sum;
+  };
+
+  /**
+   * @brief Selection bitmap: bit i % 64 of word i / 64 selects row i
+   */
+  using Selection = std::vector<uint64_t>;
+
+  CatalogStore();
+
+  /**
+   * @brief Append a torrent's metadata
+   * @param torrent The torrent
+   * @return Row number
+   */
+  uint32_t add(const TorrentFile &torrent);
+
+  /**
+   * @brief Append a row
+   * @param row The row's values
+   * @return Row number
+   * @throws std::length_error past 2^32 - 1 rows
+   * @throws std::out_of_range if fileCount does not fit 31 bits
+   */
+  uint32_t add(const Row &row);
+
+  /**
+   * @brief Get the number of rows
+   * @return Row count
+   */
+  size_t size() const { return totalSizes.size(); }
+
+  /**
+   * @brief Find the code of a dictionary value
+   * @param column CreatedBy or TrackerHost
+   * @param value The string
+   * @return Its code, or -1 if no row has it (which no Equal predicate
+   * matches)
+   * @throws std::invalid_argument for other columns
+   */
+  int64_t code(Column column, std::string_view value) const;
+
+  /**
+   * @brief Get the string of a dictionary code
+   * @param column CreatedBy or TrackerHost
+   * @param code A code returned by code() or groupBy()
+   * @return The string
+   * @throws std::invalid_argument for other columns
+   * @throws std::out_of_range for unknown codes
+   */
+  const std::string &value(Column column, uint32_t code) const;
+
+  /**
+   * @brief Select the rows matching all predicates
+   * @param predicates Conjunction of predicates; empty selects all rows
+   * @return Selection bitmap of size() bits
+   */
+  Selection filter(const std::vector<Predicate> &predicates) const;
+
+  /**
+   * @brief Count the selected rows
+   * @param selection Selection returned by filter()
+   * @return Number of set bits
+   */
+  static uint64_t count(const Selection &selection);
+
+  /**
+   * @brief Compute count, sum, minimum and maximum of a column
+   * @param column Column to aggregate
+   * @param selection Selection returned by filter()
+   * @return The aggregate over the selected rows
+   */
+  Aggregate aggregate(Column column, const Selection &selection) const;
+
+  /**
+   * @brief Count rows and sum a column per value of a dictionary column
+   * @param key CreatedBy or TrackerHost
+   * @param column Column summed per group
+   * @param selection Selection returned by filter()
+   * @return One group per code with selected rows, by decreasing row count
+   * @throws std::invalid_argument if key is not a dictionary column
+   */
+  std::vector<Group> groupBy(Column key, Column column,
+                             const Selection &selection) const;
+
+  /**
+   * @brief Enable or disable the AVX2 kernels
+   * @param enabled false forces the scalar code, for testing and
+   * benchmarks; true uses AVX2 where the processor has it
+   */
+  static void useSimd(bool enabled);
+
+  /**
+   * @brief Extract the host of an announce URL
+   * @param url Tracker URL such as udp://tracker.example.org:1337/announce
+   * @return The host, lower-cased, or the whole URL if it has no scheme
+   */
+  static std::string trackerHostOf(std::string_view url);
+
+private:
+  struct Dictionary {
+    std::vector<std::string> values;
+    std::unordered_map<std::string, uint32_t> codes;
+    uint32_t encode(std::string_view value);
+  };
+
+  // 64-bit columns
+  std::vector<int64_t> totalSizes;
+  std::vector<int64_t> pieceLengths;
+  std::vector<int64_t> creationDates;
+
+  // 32-bit columns
+  std::vector<int32_t> fileCounts;
+  std::vector<int32_t> createdByCodes;
+  std::vector<int32_t> trackerHostCodes;
+
+  Dictionary createdByDictionary;
+  Dictionary trackerHostDictionary;
+
+  const std::vector<int64_t> *wideColumn(Column column) const;
+  const std::vector<int32_t> *narrowColumn(Column column) const;
+  const Dictionary &dictionary(Column column) const;
+};
+
+#endif // CATALOGSTORE_HPP
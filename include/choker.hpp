@@ -0,0 +1,231 @@
+#ifndef CHOKER_HPP
+#define CHOKER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+/**
+ * @brief Transfer rate estimator based on a fixed-point moving average
+ *
+ * The I/O path calls add() for every chunk of data transferred. add() is a
+ * single relaxed atomic increment, so it needs no locks and can be called from
+ * any thread. Once per sampling interval, the owner calls sample(), which
+ * folds the bytes accumulated since the last sample into an exponentially
+ * weighted moving average kept in 16.16 fixed point:
+ *
+ *   avg += (sample - avg) >> shift
+ *
+ * A shift of 2 weighs each new sample by 1/4; larger shifts smooth more.
+ */
+class RateCounter {
+public:
+  /**
+   * @brief Construct a rate counter
+   * @param shift Smoothing factor as a power of two (weight 1 / 2^shift)
+   */
+  explicit RateCounter(unsigned shift = 2);
+
+  /**
+   * @brief Record transferred bytes (lock-free, callable from any thread)
+   * @param bytes Number of bytes transferred
+   */
+  void add(uint64_t bytes);
+
+  /**
+   * @brief Fold the bytes recorded since the last sample into the average
+   * @param elapsedMicros Length of the sampling interval in microseconds
+   *
+   * Must only be called from one thread at a time.
+   */
+  void sample(int64_t elapsedMicros);
+
+  /**
+   * @brief Get the smoothed transfer rate
+   * @return Rate in bytes per second
+   */
+  uint64_t rate() const;
+
+  /**
+   * @brief Get the number of bytes recorded over the counter's lifetime
+   * @return Total bytes including those not yet sampled
+   */
+  uint64_t total() const;
+
+  /**
+   * @brief Reset the counter to its initial state
+   */
+  void reset();
+
+private:
+  unsigned shift;                   // EWMA weight as a power of two
+  std::atomic<uint64_t> pending{0}; // Bytes added since the last sample
+  std::atomic<uint64_t> average{0}; // Smoothed rate in 16.16 fixed point
+  std::atomic<uint64_t> sampled{0}; // Bytes folded into the average so far
+};
+
+/**
+ * @brief Choking algorithm deciding which peers we upload to
+ *
+ * Implements the tit-for-tat choker described in the BitTorrent
+ * specification. Every rechoke interval (10 seconds by default), the peers
+ * that are interested in our data are ranked and the best ones are unchoked:
+ *
+ * - Leech mode: peers are ranked by how fast they upload to us, rewarding the
+ *   peers that reciprocate.
+ * - Seed mode: we no longer download, so peers are ranked by how fast they
+ *   take data from us. Fast downloaders pass pieces on soonest, which
+ *   maximizes how quickly data spreads through the swarm. Optionally, each
+ *   peer keeps its slot for a limited number of rechokes before it is rotated
+ *   out in favor of the peer that has waited longest, trading some
+ *   throughput for serving more distinct peers.
+ *
+ * On top of the regular slots, a number of optimistic unchoke slots are given
+ * to random choked peers and rotated every few rechokes (30 seconds by
+ * default), giving new peers a chance to prove themselves. Newly connected
+ * peers are three times as likely to be picked.
+ *
+ * Rates are measured by a pair of RateCounters per peer, which the I/O path
+ * updates without locking. All other methods must be called from the thread
+ * that owns the choker. Optimistic picks use a seeded generator, so a run is
+ * fully reproducible.
+ */
+class Choker {
+public:
+  using PeerId = uint32_t;
+
+  // Ranking policy used for regular unchoke slots
+  enum class Mode {
+    Leech, // Rank by download rate from the peer (tit-for-tat)
+    Seed   // Rank by upload rate to the peer, rotating slots round-robin
+  };
+
+  // Tunable parameters of the choking algorithm
+  struct Settings {
+    size_t regularSlots = 3;    // Peers unchoked by rank
+    size_t optimisticSlots = 1; // Peers unchoked at random
+    int64_t rechokeIntervalMicros = 10 * 1000 * 1000; // Time between rechokes
+    int64_t sampleIntervalMicros = 1000 * 1000;       // Rate sampling period
+    unsigned optimisticRotation = 3; // Rechokes between optimistic rotations
+    unsigned seedRotation = 0;       // Seed-mode slot tenure, 0 = no rotation
+    unsigned newPeerRechokes = 3;    // Rechokes a peer is considered new
+    unsigned rateShift = 2;          // EWMA smoothing of the rate counters
+    uint64_t randomSeed = 0x5eed;    // Seed for optimistic unchoke picks
+  };
+
+  // Choke state changes to apply to peer connections
+  struct Decision {
+    std::vector<PeerId> unchoke; // Peers to send an unchoke message to
+    std::vector<PeerId> choke;   // Peers to send a choke message to
+  };
+
+  /**
+   * @brief Construct a choker
+   * @param settings Parameters of the choking algorithm
+   */
+  explicit Choker(const Settings &settings);
+  Choker();
+
+  /**
+   * @brief Register a newly connected peer; peers start out choked
+   * @return Identifier of the peer
+   */
+  PeerId addPeer();
+
+  /**
+   * @brief Unregister a disconnected peer
+   * @param peer The peer to remove
+   *
+   * Its unchoke slot is filled at the next rechoke. The peer's rate counters
+   * must no longer be used once this returns.
+   */
+  void removePeer(PeerId peer);
+
+  /**
+   * @brief Update whether a peer is interested in our pieces
+   * @param peer The peer whose state changed
+   * @param interested true if the peer sent interested, false if not
+   * interested
+   */
+  void setInterested(PeerId peer, bool interested);
+
+  /**
+   * @brief Switch the ranking policy, e.g. when the download completes
+   * @param mode The new policy, applied from the next rechoke
+   */
+  void setMode(Mode mode);
+
+  /**
+   * @brief Get the counter the I/O path updates when receiving from a peer
+   * @param peer The peer to look up
+   * @return Counter of payload bytes downloaded from the peer
+   */
+  RateCounter &downloadCounter(PeerId peer);
+
+  /**
+   * @brief Get the counter the I/O path updates when sending to a peer
+   * @param peer The peer to look up
+   * @return Counter of payload bytes uploaded to the peer
+   */
+  RateCounter &uploadCounter(PeerId peer);
+
+  /**
+   * @brief Advance time, sampling rates and rechoking when due
+   * @param elapsedMicros Time since the previous call in microseconds
+   * @return Choke state changes, empty if no rechoke happened
+   */
+  Decision tick(int64_t elapsedMicros);
+
+  /**
+   * @brief Recompute the unchoke set immediately
+   * @return Choke state changes relative to the previous unchoke set
+   */
+  Decision rechoke();
+
+  bool isUnchoked(PeerId peer) const;   // Check if a peer is unchoked
+  bool isOptimistic(PeerId peer) const; // Check if unchoked optimistically
+  Mode getMode() const;                 // Get the current ranking policy
+
+private:
+  // Choker state for one connected peer
+  struct Peer {
+    Peer(unsigned shift) : download(shift), upload(shift) {}
+
+    RateCounter download;        // Payload received from the peer
+    RateCounter upload;          // Payload sent to the peer
+    bool active = true;          // Slot is in use
+    bool interested = false;     // Peer wants our data
+    bool unchoked = false;       // Peer is currently unchoked
+    bool optimistic = false;     // Unchoked through an optimistic slot
+    uint64_t connectedRound = 0; // Rechoke round when the peer connected
+    uint64_t unchokedRound = 0;  // Round the current unchoke started
+    uint64_t lastUnchoked = 0;   // Last round unchoked, 0 if never
+  };
+
+  Settings settings;
+  Mode mode = Mode::Leech;
+  std::vector<std::unique_ptr<Peer>> peers; // Indexed by PeerId
+  std::vector<PeerId> freeSlots;            // Reusable peer ids
+  std::mt19937_64 random;                   // Optimistic unchoke picks
+  uint64_t round = 1;       // Number of the next rechoke round
+  int64_t sinceSample = 0;  // Microseconds since the last rate sample
+  int64_t sinceRechoke = 0; // Microseconds since the last rechoke
+
+  /**
+   * @brief Rank interested peers for the regular unchoke slots
+   * @return Interested peers ordered from most to least deserving
+   */
+  std::vector<PeerId> rankPeers() const;
+
+  /**
+   * @brief Pick random peers for the optimistic slots
+   * @param selected Per-peer flags of peers already unchoked this round;
+   * updated with the picks
+   * @param count Number of peers to pick
+   */
+  void pickOptimistic(std::vector<bool> &selected, size_t count);
+};
+
+#endif // CHOKER_HPP
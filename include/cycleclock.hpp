@@ -0,0 +1,56 @@
+#ifndef CYCLECLOCK_HPP
+#define CYCLECLOCK_HPP
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * @brief Cheap timestamps for timing short code paths
+ *
+ * On x86 this reads the time stamp counter, which on bare metal costs a few
+ * nanoseconds against a few tens for a steady_clock call (virtual machines
+ * may trap it and narrow the gap). Modern x86 processors have an invariant
+ * TSC that ticks at a constant rate on all cores, so intervals are converted
+ * to nanoseconds with a rate measured once against steady_clock.
+ * Elsewhere the clock falls back to steady_clock and a tick is a nanosecond.
+ */
+class CycleClock {
+public:
+  /**
+   * @brief Read the clock
+   * @return Current tick count
+   *
+   * Defined in the header so the read is inlined into the timed code.
+   */
+  static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  /**
+   * @brief Get the length of a tick
+   * @return Nanoseconds per tick
+   *
+   * The first call calibrates the clock, which takes about 10 ms; call it
+   * before timing anything to keep the calibration out of the measurements.
+   */
+  static double nanosPerTick();
+
+  /**
+   * @brief Convert an interval to nanoseconds
+   * @param ticks Difference of two now() readings
+   * @return Interval in nanoseconds
+   */
+  static uint64_t toNanos(uint64_t ticks);
+};
+
+#endif // CYCLECLOCK_HPP
@@ -0,0 +1,165 @@
+#ifndef DEDUPINDEX_HPP
+#define DEDUPINDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <torrentfile.hpp>
+#include <vector>
+
+/**
+ * @brief Content deduplication across torrents through their piece hashes
+ *
+ * Torrents describe their content only by piece hashes, so identical data
+ * shows up as identical hashes. The index keeps the first occurrence of
+ * every piece hash (piece hash to torrent and piece) and of every
+ * piece-aligned file, and reports what a newly added torrent shares with
+ * the torrents before it.
+ *
+ * A file is comparable when it starts on a piece boundary and spans at
+ * least one whole piece; BEP 47 padding, which exists to put files on
+ * piece boundaries, makes that the rule, and is itself never compared.
+ * Two such files are taken as identical when they have the same length
+ * and piece length and the same hashes for all pieces wholly inside them.
+ * The bytes after the last whole piece are not covered by those hashes:
+ * whoever links the data, such as a verifier reusing an existing file for
+ * a new torrent, checks them through the pieces that span the end of the
+ * file.
+ *
+ * Both tables are open-addressed arrays of 16-byte slots with linear
+ * probing, holding a 64-bit key and a (torrent, index) pair, and nothing
+ * else: no per-entry allocation and no stored strings, so a billion unique
+ * piece hashes take 16 to 32 GiB depending on where the table is in its
+ * growth. Piece hashes are SHA-1 digests, so their first eight bytes serve
+ * as key and slot hash without mixing. Two distinct pieces share a key
+ * with probability about n^2 / 2^65 for n pieces, which a verifier catches
+ * when it hashes the data it links.
+ *
+ * Not thread-safe for writers; concurrent lookups are fine.
+ */
+class DedupIndex {
+public:
+  using TorrentId = uint32_t; // Torrents are numbered in order of add()
+
+  /**
+   * @brief A piece of an indexed torrent
+   */
+  struct PieceRef {
+    TorrentId torrent;
+    uint32_t piece; // Index into the torrent's getPieces()
+  };
+
+  /**
+   * @brief A file of an indexed torrent
+   */
+  struct FileRef {
+    TorrentId torrent;
+    uint32_t file; // Index into the torrent's getFiles()
+  };
+
+  /**
+   * @brief A file whose content an indexed torrent already has
+   */
+  struct FileMatch {
+    uint32_t file;        // Index into the torrent looked up
+    FileRef existing;     // First indexed file with the same content
+    int64_t length;       // Bytes of the file
+    int64_t coveredBytes; // Leading bytes covered by matching piece hashes
+  };
+
+  /**
+   * @brief Totals over all added torrents
+   */
+  struct Stats {
+    uint64_t torrents = 0;
+    uint64_t pieces = 0;              // Pieces of all torrents
+    uint64_t uniquePieces = 0;        // Distinct piece hashes
+    uint64_t pieceBytes = 0;          // Bytes of all pieces
+    uint64_t duplicatePieceBytes = 0; // Bytes of pieces seen before
+    uint64_t files = 0;               // Files of all torrents
+    uint64_t alignedFiles = 0;        // Files that could be compared
+    uint64_t duplicateFiles = 0;      // Aligned files seen before
+    uint64_t duplicateFileBytes = 0;  // Bytes of those files
+    size_t memoryBytes = 0;           // Size of both tables
+  };
+
+  /**
+   * @brief Create an empty index
+   * @param expectedPieces Distinct piece hashes to size the table for, so
+   * that building a large index does not rehash; tables grow as needed
+   * either way
+   */
+  explicit DedupIndex(size_t expectedPieces = 0);
+
+  /**
+   * @brief Index a torrent
+   * @param torrent The torrent
+   * @param matches If not nullptr, receives the torrent's files already
+   * indexed, earlier files of the same torrent included
+   * @return The torrent's number
+   * @throws std::length_error past 2^32 - 1 torrents or pieces per torrent
+   */
+  TorrentId add(const TorrentFile &torrent,
+                std::vector<FileMatch> *matches = nullptr);
+
+  /**
+   * @brief Find indexed files with the content of a torrent's files
+   * @param torrent A torrent, indexed or not; the index is not changed
+   * @return One match per comparable file with a match, in file order
+   */
+  std::vector<FileMatch> matchFiles(const TorrentFile &torrent) const;
+
+  /**
+   * @brief Find the first indexed piece with a hash
+   * @param hash 20-byte SHA-1 piece hash
+   * @return The piece, or nullopt if no indexed torrent has it
+   * @throws std::invalid_argument if the hash is shorter than 8 bytes
+   */
+  std::optional<PieceRef> findPiece(std::string_view hash) const;
+
+  /**
+   * @brief Get the totals over all added torrents
+   * @return Counters and memory use
+   */
+  Stats stats() const;
+
+private:
+  struct Slot {
+    uint64_t key = 0;     // 0 marks an empty slot
+    uint32_t torrent = 0;
+    uint32_t index = 0;   // Piece or file
+  };
+
+  /**
+   * @brief Open-addressed map from nonzero 64-bit key to a slot
+   */
+  class Table {
+  public:
+    explicit Table(size_t expected);
+    const Slot *find(uint64_t key) const;
+    // Insert unless present; returns the slot holding the key and whether
+    // it was inserted
+    std::pair<const Slot *, bool> insert(uint64_t key, uint32_t torrent,
+                                         uint32_t index);
+    size_t size() const { return count; }
+    size_t memoryBytes() const { return slots.size() * sizeof(Slot); }
+
+  private:
+    std::vector<Slot> slots; // Power-of-two size
+    size_t count = 0;
+    void grow();
+  };
+
+  Table pieces;
+  Table files;
+  Stats totals;
+
+  /**
+   * @brief Visit the comparable files of a torrent with their keys
+   */
+  template <typename Visit>
+  static void forEachAlignedFile(const TorrentFile &torrent, Visit &&visit);
+};
+
+#endif // DEDUPINDEX_HPP
@@ -0,0 +1,77 @@
+#ifndef EPOCH_HPP
+#define EPOCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Epoch-based reclamation of memory shared with lock-free readers
+ *
+ * Readers bracket their accesses with a Guard. A writer that unlinks an
+ * object from a shared structure hands it to retire() instead of deleting
+ * it; the object is deleted once every guard that was active when it was
+ * retired has ended, so readers never touch freed memory.
+ *
+ * A global epoch counter advances when every active guard has observed its
+ * current value. An object retired in epoch e is deleted once the epoch
+ * reaches e + 2. Entering and leaving a guard costs a store and a fence on
+ * a cache line owned by the calling thread; readers never write shared
+ * memory.
+ *
+ * Keep guards short: a thread that stays inside one holds back the deletion
+ * of everything retired meanwhile.
+ */
+class Epoch {
+public:
+  /**
+   * @brief Marks the calling thread as reading shared objects
+   *
+   * Guards nest; only the outermost one announces the thread.
+   */
+  class Guard {
+  public:
+    Guard();
+    ~Guard();
+
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+  };
+
+  /**
+   * @brief Delete an unlinked object once no reader can hold it
+   * @param object The object, no longer reachable by new readers
+   * @param deleter Function deleting the object
+   */
+  static void retire(void *object, void (*deleter)(void *));
+
+  /**
+   * @brief Delete an unlinked object with delete once no reader can hold it
+   * @param object The object, no longer reachable by new readers
+   */
+  template <typename T> static void retire(T *object) {
+    retire(object, [](void *pointer) { delete static_cast<T *>(pointer); });
+  }
+
+  /**
+   * @brief Try to advance the epoch and delete what has become safe
+   *
+   * retire() does this on its own every few retirements; call it to
+   * reclaim memory after a burst of removals. Must not be called inside a
+   * guard, which would hold the epoch back.
+   */
+  static void collect();
+
+  /**
+   * @brief Get the number of retired objects not yet deleted
+   * @return Object count
+   */
+  static size_t pending();
+
+  /**
+   * @brief Get the current global epoch
+   * @return Epoch counter, starting at 2
+   */
+  static uint64_t current();
+};
+
+#endif // EPOCH_HPP
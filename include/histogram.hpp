@@ -0,0 +1,103 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Lock-free log-linear histogram of non-negative integers
+ *
+ * Values are counted in buckets whose width grows with the value: every
+ * power of two is split into kSubBuckets equal buckets, so a bucket's bounds
+ * are within 1 / kSubBuckets of any value in it. Values below kSubBuckets
+ * are counted exactly. This covers the whole uint64_t range in a fixed 4 KiB
+ * array, which suits nanosecond latencies and byte counts alike.
+ *
+ * Recording is two relaxed atomic additions, so any number of threads can
+ * record into the same histogram without locks. Snapshots taken while other
+ * threads record may be off by the in-flight samples.
+ */
+class Histogram {
+public:
+  static constexpr int kSubBucketBits = 3; // log2 of buckets per power of 2
+  static constexpr size_t kSubBuckets = size_t{1} << kSubBucketBits;
+  static constexpr size_t kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  /**
+   * @brief Point-in-time copy of a histogram
+   */
+  struct Snapshot {
+    std::vector<uint64_t> buckets; // Count per bucket
+    uint64_t count = 0;            // Number of values
+    uint64_t sum = 0;              // Sum of all values
+
+    /**
+     * @brief Get the mean value
+     * @return The mean, or 0 if the histogram is empty
+     */
+    double mean() const;
+
+    /**
+     * @brief Estimate a quantile
+     * @param quantile Fraction of values at or below the result, in [0, 1]
+     * @return Upper bound of the bucket holding the quantile, or 0 if the
+     * histogram is empty
+     */
+    uint64_t percentile(double quantile) const;
+
+    /**
+     * @brief Get the largest value
+     * @return Upper bound of the highest non-empty bucket, or 0 if empty
+     */
+    uint64_t max() const;
+  };
+
+  /**
+   * @brief Count a value
+   * @param value The value to count
+   *
+   * Defined in the header so recording on hot paths is inlined.
+   */
+  void record(uint64_t value) {
+    buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Copy the current counts
+   * @return The snapshot
+   */
+  Snapshot snapshot() const;
+
+  /**
+   * @brief Clear all counts
+   */
+  void reset();
+
+  /**
+   * @brief Find the bucket a value is counted in
+   * @param value The value
+   * @return Bucket index below kNumBuckets
+   */
+  static size_t bucketIndex(uint64_t value) {
+    if (value < kSubBuckets) {
+      return static_cast<size_t>(value);
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - kSubBucketBits;
+    return static_cast<size_t>(shift + 1) * kSubBuckets +
+           static_cast<size_t>((value >> shift) & (kSubBuckets - 1));
+  }
+
+  static uint64_t bucketLowerBound(size_t index); // Smallest value in bucket
+  static uint64_t bucketUpperBound(size_t index); // Largest value in bucket
+
+private:
+  std::array<std::atomic<uint64_t>, kNumBuckets> buckets{};
+  std::atomic<uint64_t> sum{0};
+};
+
+#endif // HISTOGRAM_HPP
@@ -0,0 +1,55 @@
+#ifndef HTTPUTIL_HPP
+#define HTTPUTIL_HPP
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Helpers shared by the HTTP range server and web seed downloader
+ *
+ * Part of the http library; header fields are ASCII and parsed without
+ * locales.
+ */
+class HttpUtil {
+public:
+  /**
+   * @brief Build an exception for a failed system call
+   * @param what Description of the operation
+   * @return Exception carrying the errno description
+   */
+  static std::runtime_error systemError(const std::string &what);
+
+  /**
+   * @brief Read the monotonic clock
+   * @return Milliseconds since an arbitrary epoch
+   */
+  static int64_t nowMillis();
+
+  /**
+   * @brief Compare ASCII strings ignoring case
+   */
+  static bool equalsIgnoreCase(std::string_view a, std::string_view b);
+
+  /**
+   * @brief Remove leading and trailing spaces and tabs
+   */
+  static std::string_view trim(std::string_view text);
+
+  /**
+   * @brief Parse a non-negative decimal number filling a whole string
+   * @param text Digits only, at most 18 of them
+   * @return The number, or -1 if the text is anything else
+   */
+  static int64_t parseWholeNumber(std::string_view text);
+
+  /**
+   * @brief Parse the non-negative decimal number a string starts with
+   * @param text Digits, possibly followed by anything; at most 18 are read
+   * @return The number, or -1 if the text does not start with a digit
+   */
+  static int64_t parseLeadingNumber(std::string_view text);
+};
+
+#endif // HTTPUTIL_HPP
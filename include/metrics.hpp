@@ -0,0 +1,225 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <histogram.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Registry of named counters, gauges and histograms
+ *
+ * Metrics are registered once by name and label set and then updated
+ * through the returned reference, which stays valid for the lifetime of the
+ * registry. Registering the same name and labels again returns the same
+ * metric, so code can look up its metrics in function-local statics without
+ * coordinating with other modules.
+ *
+ * Counters and histograms are sharded: each thread updates its own cache
+ * line (threads beyond the shard count share shards round-robin), and the
+ * shards are summed when the registry is scraped. Updates are relaxed atomic
+ * additions on lines no other thread writes, so hot paths do not contend.
+ *
+ * render() produces the Prometheus text exposition format (version 0.0.4).
+ */
+class MetricsRegistry {
+public:
+  static constexpr size_t kShards = 16;         // Shards per counter
+  static constexpr size_t kHistogramShards = 8; // Shards per histogram
+
+  // Label names and values of one metric, e.g. {{"phase", "decode"}}
+  using Labels = std::vector<std::pair<std::string, std::string>>;
+
+  /**
+   * @brief Monotonic counter
+   */
+  class Counter {
+  public:
+    /**
+     * @brief Add to the counter
+     * @param amount The amount to add
+     */
+    void add(uint64_t amount = 1) {
+      shards[shardIndex()].value.fetch_add(amount, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Get the total of all shards
+     * @return The counter value
+     */
+    uint64_t value() const;
+
+  private:
+    struct alignas(64) Shard {
+      std::atomic<uint64_t> value{0};
+    };
+    std::array<Shard, kShards> shards;
+  };
+
+  /**
+   * @brief Value that can go up and down, such as connected peers
+   *
+   * A gauge is a single atomic; use it for values that change at
+   * connection or torrent granularity rather than per block.
+   */
+  class Gauge {
+  public:
+    // Set, adjust and read the value
+    void set(int64_t value) { current.store(value, std::memory_order_relaxed); }
+    void add(int64_t amount) {
+      current.fetch_add(amount, std::memory_order_relaxed);
+    }
+    int64_t value() const { return current.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<int64_t> current{0};
+  };
+
+  /**
+   * @brief Exported buckets of a histogram metric
+   *
+   * Values are recorded as integers in a base unit (for example
+   * nanoseconds) and exported multiplied by scale (for example 1e-9 for
+   * seconds, the Prometheus convention). The exported bucket bounds sit
+   * one base unit below the powers of two from 2^minExponent to
+   * 2^maxExponent: each is the largest value of a bucket of the underlying
+   * log-linear histogram, so counts are exact under Prometheus' inclusive
+   * "le" and a value of exactly 2^e falls above the bound.
+   */
+  struct HistogramSpec {
+    double scale = 1e-9;  // Export unit per base unit
+    int minExponent = 10; // First bound, 2^10 - 1 ns, about 1 us
+    int maxExponent = 34; // Last bound, 2^34 - 1 ns, about 17 s
+  };
+
+  /**
+   * @brief Sharded log-linear histogram, HDR-style
+   */
+  class Histogram {
+  public:
+    /**
+     * @brief Count a value
+     * @param value The value in base units
+     */
+    void record(uint64_t value) {
+      shards[shardIndex() % kHistogramShards].histogram.record(value);
+    }
+
+    /**
+     * @brief Merge all shards
+     * @return The combined snapshot
+     */
+    ::Histogram::Snapshot snapshot() const;
+
+  private:
+    struct alignas(64) Shard {
+      ::Histogram histogram;
+    };
+    std::array<Shard, kHistogramShards> shards; // 4 KiB each
+  };
+
+  /**
+   * @brief Get the registry shared by the whole library
+   * @return The global registry
+   */
+  static MetricsRegistry &global();
+
+  /**
+   * @brief Register or look up a counter
+   * @param name Metric name; by convention ends in _total
+   * @param help One-line description
+   * @param labels Label names and values
+   * @return The counter
+   * @throws std::invalid_argument if the name or a label name is invalid,
+   * or the name is registered with another type
+   */
+  Counter &counter(const std::string &name, const std::string &help,
+                   const Labels &labels = {});
+
+  /**
+   * @brief Register or look up a gauge
+   * @param name Metric name
+   * @param help One-line description
+   * @param labels Label names and values
+   * @return The gauge
+   * @throws std::invalid_argument if the name or a label name is invalid,
+   * or the name is registered with another type
+   */
+  Gauge &gauge(const std::string &name, const std::string &help,
+               const Labels &labels = {});
+
+  /**
+   * @brief Register or look up a histogram of nanosecond latencies
+   * @param name Metric name; by convention ends in _seconds
+   * @param help One-line description
+   * @param labels Label names and values
+   * @return The histogram, exported in seconds with the default buckets
+   * @throws std::invalid_argument if the name or a label name is invalid,
+   * or the name is registered with another type
+   */
+  Histogram &histogram(const std::string &name, const std::string &help,
+                       const Labels &labels = {});
+
+  /**
+   * @brief Register or look up a histogram
+   * @param name Metric name; by convention ends in the unit, e.g. _bytes
+   * @param help One-line description
+   * @param labels Label names and values
+   * @param spec Export unit and bucket bounds; the first registration of a
+   * name sets them for all its label sets
+   * @return The histogram
+   * @throws std::invalid_argument if the name or a label name is invalid,
+   * the name is registered with another type, or the spec is invalid
+   */
+  Histogram &histogram(const std::string &name, const std::string &help,
+                       const Labels &labels, const HistogramSpec &spec);
+
+  /**
+   * @brief Render all metrics in the Prometheus text format
+   * @return The exposition, metric families sorted by name
+   */
+  std::string render() const;
+
+private:
+  enum class Type { Counter, Gauge, Histogram };
+
+  // All metrics sharing a name
+  struct Family {
+    Type type;
+    std::string help;
+    HistogramSpec spec; // Only used by histograms
+    std::map<Labels, std::unique_ptr<Counter>> counters;
+    std::map<Labels, std::unique_ptr<Gauge>> gauges;
+    std::map<Labels, std::unique_ptr<Histogram>> histograms;
+  };
+
+  mutable std::mutex mutex; // Guards families, not the metric values
+  std::map<std::string, Family> families;
+
+  /**
+   * @brief Find or create the family of a name
+   * @throws std::invalid_argument if the name or a label name is invalid,
+   * or the family has another type
+   */
+  Family &family(const std::string &name, const std::string &help, Type type,
+                 const Labels &labels);
+
+  /**
+   * @brief Get the calling thread's shard
+   * @return Index below kShards, fixed per thread
+   */
+  static size_t shardIndex() {
+    thread_local size_t index = nextShard();
+    return index;
+  }
+  static size_t nextShard(); // Hand out shard indices round-robin
+};
+
+#endif // METRICS_HPP
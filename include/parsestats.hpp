@@ -0,0 +1,143 @@
+#ifndef PARSESTATS_HPP
+#define PARSESTATS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <histogram.hpp>
+#include <string>
+
+/**
+ * @brief Optional instrumentation of TorrentFile construction
+ *
+ * When enabled, every TorrentFile records how long each phase of loading
+ * took, how many bytes it read, how many Bencode nodes the data held and,
+ * if the program counts allocations, how many allocations each phase made.
+ * The samples are aggregated into process-wide histograms, so slow loads can
+ * be attributed to reading the file, decoding the Bencode or extracting the
+ * metadata.
+ *
+ * Disabled (the default), a construction pays one relaxed load of the
+ * enabled flag. Enabled, it pays a cycle counter read per phase and a few
+ * relaxed atomic additions, plus a walk of the decoded tree to count nodes.
+ * Failed loads are only counted, since their phase times are not comparable.
+ */
+class ParseStats {
+public:
+  /**
+   * @brief Phases of loading a torrent
+   */
+  enum class Phase {
+    Read,    // readTorrentFile, only for torrents loaded from disk
+    Decode,  // BencodeParser::parse
+    Extract, // Extraction of the metadata and freeing the decoded tree
+  };
+  static constexpr size_t kNumPhases = 3;
+
+  /**
+   * @brief Function returning the calling thread's allocation count so far
+   */
+  using AllocationCounter = uint64_t (*)();
+
+  /**
+   * @brief Start recording
+   *
+   * Calibrates the cycle clock on the first call.
+   */
+  static void enable();
+
+  /**
+   * @brief Stop recording; the histograms keep their counts
+   */
+  static void disable();
+
+  /**
+   * @brief Check whether recording is enabled
+   * @return true if constructions are recorded
+   */
+  static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Install the source of allocation counts
+   * @param counter Function returning a per-thread running count of
+   * allocations, or nullptr to stop counting
+   *
+   * The library cannot see allocations itself; programs that replace
+   * operator new to count them pass their counter here.
+   */
+  static void setAllocationCounter(AllocationCounter counter);
+
+  /**
+   * @brief Histograms of recorded loads
+   * @param phase The phase
+   * @return Histogram of the phase in nanoseconds, or of its allocations
+   */
+  static const Histogram &phaseNanos(Phase phase);
+  static const Histogram &phaseAllocations(Phase phase);
+  static const Histogram &totalNanos(); // Whole load in nanoseconds
+  static const Histogram &bytes();      // Size of the Bencode data
+  static const Histogram &nodes();      // Number of decoded Bencode values
+
+  /**
+   * @brief Get the number of loads that threw
+   * @return Failed load count
+   */
+  static uint64_t failures();
+
+  /**
+   * @brief Clear all histograms and the failure count
+   */
+  static void reset();
+
+  /**
+   * @brief Format the histograms as a table
+   * @return One line per histogram with count, mean and percentiles
+   */
+  static std::string report();
+
+  /**
+   * @brief Measurements of a single load
+   *
+   * Created by TorrentFile when recording is enabled. Each phase runs from
+   * the previous mark to the call of endPhase. A sample that is destroyed
+   * without commit counts as a failure.
+   */
+  class Sample {
+  public:
+    Sample();
+    ~Sample();
+    Sample(const Sample &) = delete;
+    Sample &operator=(const Sample &) = delete;
+
+    /**
+     * @brief End a phase that started at the previous mark
+     * @param phase The phase that just ended
+     */
+    void endPhase(Phase phase);
+
+    /**
+     * @brief Move the mark to now, leaving the time since out of all phases
+     */
+    void skip();
+
+    /**
+     * @brief Record the sample into the histograms
+     * @param byteCount Size of the Bencode data
+     * @param nodeCount Number of decoded Bencode values
+     */
+    void commit(size_t byteCount, size_t nodeCount);
+
+  private:
+    uint64_t mark;                         // Ticks at the last mark
+    uint64_t markAllocations;              // Allocations at the mark
+    uint64_t ticks[kNumPhases] = {};       // Duration of each phase
+    uint64_t allocations[kNumPhases] = {}; // Allocations of each phase
+    bool ended[kNumPhases] = {};           // Phases that ran
+    bool committed = false;                // Whether commit was called
+  };
+
+private:
+  static inline std::atomic<bool> enabled{false};
+};
+
+#endif // PARSESTATS_HPP
@@ -0,0 +1,179 @@
+#ifndef PEEREXCHANGE_HPP
+#define PEEREXCHANGE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Peer exchange (BEP 11, ut_pex) for one torrent
+ *
+ * Holds the torrent's connected peers and tells each peer that supports
+ * ut_pex which peers were added and dropped since its previous message.
+ * Peers are kept in their compact form: 4 address bytes and 2 port bytes
+ * for IPv4, 16 and 2 for IPv6, as the messages carry them.
+ *
+ * Every connect, disconnect or flag change takes the next generation
+ * number and is appended to an event log, and each recipient remembers
+ * the generation it was told up to. Its next delta is read from the log
+ * past that point, so building a message costs the changes since the
+ * last one rather than a diff of two peer sets; with thousands of peers
+ * per torrent the set diffs, one per recipient per message, would make
+ * every round quadratic. Only a peer's latest event counts: one first
+ * added and dropped again since a recipient's last message is not
+ * mentioned. A peer that reconnects while still known keeps its first
+ * connect, so a recipient may be told of a drop it never saw added; that
+ * is harmless, as the recipient has nothing to remove.
+ *
+ * Messages carry at most 50 added and 50 dropped peers, as BEP 11
+ * requires; a recipient that is further behind, such as a new one with
+ * the whole swarm to learn, catches up over several messages.
+ *
+ * Not thread-safe.
+ */
+class PeerExchange {
+public:
+  // Peer flags of the added.f and added6.f lists
+  enum Flag : uint8_t {
+    kEncryption = 0x01, // Prefers encrypted connections
+    kSeed = 0x02,       // Uploads only
+    kUtp = 0x04,        // Supports uTP
+    kHolepunch = 0x08,  // Supports ut_holepunch
+    kReachable = 0x10,  // Accepted an outgoing connection
+  };
+
+  /**
+   * @brief Limits of the messages built
+   */
+  struct Options {
+    size_t maxAdded = 50;   // Added peers per message, both families
+    size_t maxDropped = 50; // Dropped peers per message
+  };
+
+  // A decoded or built message; peers in compact form
+  struct Message {
+    std::vector<std::string> added;
+    std::vector<uint8_t> addedFlags; // One per added peer
+    std::vector<std::string> dropped;
+  };
+
+  // Handle of a connected peer, valid until it is disconnected
+  using PeerId = uint32_t;
+
+  explicit PeerExchange(const Options &options);
+  PeerExchange();
+
+  /**
+   * @brief Record a new connection
+   * @param compact The peer's address and port, 6 or 18 bytes
+   * @param flags Its Flag bits
+   * @return Handle of the peer
+   * @throws std::invalid_argument if compact has another length
+   * @throws std::logic_error if the peer is already connected
+   */
+  PeerId connect(std::string_view compact, uint8_t flags);
+
+  /**
+   * @brief Record the end of a connection
+   * @param peer Handle from connect(), invalid afterwards
+   */
+  void disconnect(PeerId peer);
+
+  /**
+   * @brief Change the flags of a peer, which is then announced again
+   * @param peer Handle from connect()
+   * @param flags Its new Flag bits
+   */
+  void setFlags(PeerId peer, uint8_t flags);
+
+  /**
+   * @brief Start exchanging with a peer that negotiated ut_pex
+   * @param peer Handle from connect()
+   *
+   * Its first messages list the connected peers.
+   */
+  void enable(PeerId peer);
+
+  /**
+   * @brief Build a peer's next message, advancing it past the changes sent
+   * @param peer Handle of an enabled peer
+   * @param message Filled in with the changes it was not told about
+   * @return false if there is nothing to tell, and no message is due
+   * @throws std::logic_error if the peer is not enabled
+   */
+  bool next(PeerId peer, Message &message);
+
+  size_t size() const;             // Connected peers
+  const std::string &compact(PeerId peer) const;
+  uint64_t generation() const;     // Changes so far
+  size_t logSize() const;          // Events held, for tests and benchmarks
+
+  /**
+   * @brief Encode a ut_pex message payload
+   * @param message The message
+   * @return The bencoded dictionary, to follow the extended message id
+   */
+  static std::string encode(const Message &message);
+
+  /**
+   * @brief Decode a ut_pex message payload
+   * @param payload The bencoded dictionary
+   * @return The message; flags missing or of the wrong count read as 0
+   * @throws std::runtime_error if the payload is not a dictionary or a
+   * peer list is not a whole number of compact peers
+   */
+  static Message decode(std::string_view payload);
+
+  /**
+   * @brief Build the compact form of an address
+   * @param address Dotted IPv4 or textual IPv6 address
+   * @param port Port
+   * @return 6 or 18 bytes
+   * @throws std::invalid_argument if the address does not parse
+   */
+  static std::string compactPeer(const std::string &address, uint16_t port);
+
+  /**
+   * @brief Format a compact peer for humans
+   * @param compact 6 or 18 bytes
+   * @return "1.2.3.4:6881" or "[2001:db8::1]:6881"
+   * @throws std::invalid_argument if compact has another length
+   */
+  static std::string formatPeer(std::string_view compact);
+
+private:
+  static constexpr uint64_t kDisabled = UINT64_MAX; // Cursor of non-PEX peers
+
+  struct Entry {
+    std::string compact;
+    uint8_t flags = 0;
+    bool live = false;           // Connected
+    uint64_t firstAdded = 0;     // Generation of the entry's first connect
+    uint64_t changed = 0;        // Generation of the latest event
+    uint64_t cursor = kDisabled; // Generation this peer was told up to
+  };
+
+  // A change: the entry's state as of this generation, if still latest
+  struct Event {
+    uint64_t generation;
+    PeerId peer;
+  };
+
+  Options options;
+  std::vector<Entry> entries;
+  std::vector<PeerId> freeEntries; // Dropped and forgotten
+  std::unordered_map<std::string, PeerId> byCompact;
+  std::vector<Event> log;          // In generation order
+  size_t liveEvents = 0;           // Events that are their entry's latest
+  uint64_t currentGeneration = 0;
+  size_t connected = 0;
+
+  void record(PeerId peer);
+  void compactLog();
+  Entry &live(PeerId peer);
+};
+
+#endif // PEEREXCHANGE_HPP
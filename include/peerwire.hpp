@@ -0,0 +1,218 @@
+#ifndef PEERWIRE_HPP
+#define PEERWIRE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Encoding and decoding of BitTorrent peer wire protocol messages
+ *
+ * A connection starts with a 68-byte handshake carrying the info hash and
+ * the peer id. Every message after it is a 4-byte big-endian length prefix
+ * followed by a one-byte message id and the payload. The length counts the
+ * id and the payload but not the prefix itself; a length of zero is a
+ * keep-alive.
+ *
+ * The append* functions add encoded messages to an output buffer. Reader
+ * splits a received byte stream back into messages.
+ */
+class PeerWire {
+public:
+  // Message ids defined by BEP 3
+  enum class MessageId : uint8_t {
+    Choke = 0,
+    Unchoke = 1,
+    Interested = 2,
+    NotInterested = 3,
+    Have = 4,
+    Bitfield = 5,
+    Request = 6,
+    Piece = 7,
+    Cancel = 8,
+    Extended = 20 // BEP 10
+  };
+
+  static constexpr size_t kHandshakeSize = 68;    // Fixed handshake length
+  static constexpr size_t kMessageHeaderSize = 5; // Length prefix and id
+  static constexpr size_t kPieceHeaderSize = 13;  // Plus index and begin
+
+  // A decoded message; views point into the Reader's buffer
+  struct Message {
+    MessageId id = MessageId::Choke; // May be an id not listed in MessageId
+    bool keepAlive = false; // Zero-length message, id is meaningless
+    uint32_t piece = 0;     // Have, Request, Piece, Cancel
+    uint32_t offset = 0;    // Request, Piece, Cancel
+    uint32_t length = 0;    // Request, Cancel: requested length
+    uint8_t extendedId = 0; // Extended: 0 for its handshake
+    std::string_view data;  // Bitfield, Piece, Extended or unknown payload
+  };
+
+  // The fields of a handshake
+  struct Handshake {
+    std::string infoHash; // 20-byte info hash of the torrent
+    std::string peerId;   // 20-byte id of the sending peer
+  };
+
+  /**
+   * @brief Incremental decoder for one direction of a connection
+   *
+   * Received bytes are fed in arbitrary chunks; next() returns complete
+   * messages in order. The views in a returned message stay valid until the
+   * next call to feed().
+   */
+  class Reader {
+  public:
+    /**
+     * @brief Construct a reader
+     * @param expectHandshake Whether the stream starts with a handshake
+     * @param maxMessageSize Largest accepted message length
+     */
+    explicit Reader(bool expectHandshake = true,
+                    uint32_t maxMessageSize = 1024 * 1024 + 13);
+
+    /**
+     * @brief Add received bytes to the stream
+     * @param data Pointer to the received bytes
+     * @param length Number of bytes
+     */
+    void feed(const char *data, size_t length);
+
+    /**
+     * @brief Decode the handshake once enough bytes have arrived
+     * @param handshake Filled in on success
+     * @return true if the handshake was decoded by this call
+     * @throws std::runtime_error if the protocol string is wrong
+     */
+    bool handshake(Handshake &handshake);
+
+    /**
+     * @brief Decode the next complete message
+     * @param message Filled in on success; an unknown id comes with its
+     * whole payload in data
+     * @return true if a message was decoded, false if more bytes are needed
+     * @throws std::runtime_error on a malformed message or if the handshake
+     * has not been read yet
+     */
+    bool next(Message &message);
+
+    size_t buffered() const; // Bytes received but not yet decoded
+
+  private:
+    std::string buffer;      // Received bytes
+    size_t position = 0;     // Start of the first undecoded byte
+    bool awaitingHandshake;  // The handshake has not been decoded yet
+    uint32_t maxMessageSize; // Largest accepted length prefix
+  };
+
+  /**
+   * @brief Append a handshake
+   * @param out Buffer the message is appended to
+   * @param infoHash 20-byte info hash
+   * @param peerId 20-byte peer id
+   * @throws std::invalid_argument if a field is not 20 bytes long
+   */
+  static void appendHandshake(std::string &out, std::string_view infoHash,
+                              std::string_view peerId);
+
+  /**
+   * @brief Append a message without payload (choke, unchoke, interested,
+   * not interested)
+   * @param out Buffer the message is appended to
+   * @param id The message id
+   */
+  static void appendMessage(std::string &out, MessageId id);
+
+  /**
+   * @brief Append a have message
+   * @param out Buffer the message is appended to
+   * @param piece The piece the sender now has
+   */
+  static void appendHave(std::string &out, uint32_t piece);
+
+  /**
+   * @brief Append a bitfield message
+   * @param out Buffer the message is appended to
+   * @param pieces Pieces the sender has, high bit of the first byte first
+   */
+  static void appendBitfield(std::string &out, const std::vector<bool> &pieces);
+
+  /**
+   * @brief Append a request or cancel message
+   * @param out Buffer the message is appended to
+   * @param id MessageId::Request or MessageId::Cancel
+   * @param piece Piece index
+   * @param offset Byte offset within the piece
+   * @param length Block length in bytes
+   */
+  static void appendBlockMessage(std::string &out, MessageId id,
+                                 uint32_t piece, uint32_t offset,
+                                 uint32_t length);
+
+  /**
+   * @brief Append a piece message with its block data
+   * @param out Buffer the message is appended to
+   * @param piece Piece index
+   * @param offset Byte offset within the piece
+   * @param data Block data
+   */
+  static void appendPiece(std::string &out, uint32_t piece, uint32_t offset,
+                          std::string_view data);
+
+  /**
+   * @brief Append a BEP 10 extended message
+   * @param out Buffer the message is appended to
+   * @param extendedId 0 for the extension handshake, else the id the
+   * receiving peer assigned to the extension in its handshake
+   * @param payload The extension's payload, a bencoded dictionary
+   */
+  static void appendExtended(std::string &out, uint8_t extendedId,
+                             std::string_view payload);
+
+  /**
+   * @brief Decode the pieces of a bitfield message
+   * @param data Bitfield payload
+   * @param numPieces Number of pieces in the torrent
+   * @return One flag per piece
+   * @throws std::runtime_error if the payload has the wrong length
+   */
+  static std::vector<bool> decodeBitfield(std::string_view data,
+                                          uint32_t numPieces);
+
+  /**
+   * @brief Encode the length prefix and id of a message
+   * @param id The message id
+   * @param payloadLength Length of the payload following the id
+   * @param out Buffer of at least kMessageHeaderSize bytes
+   */
+  static void encodeMessageHeader(MessageId id, uint32_t payloadLength,
+                                  uint8_t *out);
+
+  /**
+   * @brief Encode everything of a piece message that precedes the block data
+   * @param piece Piece index
+   * @param offset Byte offset of the block within the piece
+   * @param length Length of the block data that will follow
+   * @param out Buffer of at least kPieceHeaderSize bytes
+   */
+  static void encodePieceHeader(uint32_t piece, uint32_t offset,
+                                uint32_t length, uint8_t *out);
+
+  /**
+   * @brief Write a 32-bit integer in network byte order
+   * @param value The value to write
+   * @param out Buffer of at least 4 bytes
+   */
+  static void writeUint32(uint32_t value, uint8_t *out);
+
+  /**
+   * @brief Read a 32-bit integer in network byte order
+   * @param in Buffer of at least 4 bytes
+   * @return The decoded value
+   */
+  static uint32_t readUint32(const uint8_t *in);
+};
+
+#endif // PEERWIRE_HPP
@@ -0,0 +1,279 @@
+#ifndef PIECEPICKER_HPP
+#define PIECEPICKER_HPP
+
+#include <cstdint>
+#include <limits>
+#include <torrentfile.hpp>
+#include <vector>
+
+/**
+ * @brief Decides which blocks to request from which peer
+ *
+ * Pieces are split into blocks of kBlockSize bytes, the unit of a request
+ * message. The picker tracks, for every block, whether it is still free,
+ * requested from one or more peers, or received, and hands out blocks with
+ * the following preferences:
+ *
+ * 1. Blocks of pieces that are already partially requested, so pieces
+ *    complete and can be verified as early as possible.
+ * 2. Blocks of the rarest piece the peer has, so rare pieces spread before
+ *    their owners leave.
+ *
+ * Once every missing block has been requested at least once, the picker
+ * enters endgame mode: blocks still in flight may be requested again from
+ * other peers, and when a block arrives the picker reports which other peers
+ * must be sent a cancel for it. This avoids waiting on a single slow peer for
+ * the last few blocks.
+ *
+ * For streaming, pieces can be given deadlines (see StreamWindow). Pieces
+ * with a deadline come before both of the above, earliest deadline first.
+ * When a request for one of their blocks times out, requestTimedOut()
+ * lets the block be requested from another peer as well, without waiting
+ * for endgame; the first copy to arrive wins and the others are cancelled.
+ */
+class PiecePicker {
+public:
+  using PeerId = uint32_t;
+
+  static constexpr uint32_t kBlockSize = 16 * 1024; // Standard request size
+  static constexpr int64_t kNoDeadline = std::numeric_limits<int64_t>::max();
+
+  // A single block request (index, begin, length of a request message)
+  struct Block {
+    uint32_t piece;  // Piece index
+    uint32_t offset; // Byte offset within the piece
+    uint32_t length; // Length in bytes
+
+    bool operator==(const Block &other) const;
+  };
+
+  /**
+   * @brief Construct a picker for a torrent of the given size
+   * @param totalSize Total size of the torrent content in bytes
+   * @param pieceLength Nominal piece length in bytes
+   * @param maxDuplicates Maximum number of peers a block may be requested
+   * from at once in endgame mode
+   * @throws std::invalid_argument if the sizes are not positive
+   */
+  PiecePicker(int64_t totalSize, int64_t pieceLength,
+              unsigned maxDuplicates = 2);
+
+  /**
+   * @brief Construct a picker for a parsed torrent
+   * @param torrent The torrent whose pieces are picked
+   * @param maxDuplicates Maximum concurrent requests per block in endgame
+   */
+  explicit PiecePicker(const TorrentFile &torrent, unsigned maxDuplicates = 2);
+
+  /**
+   * @brief Count the pieces of a peer's bitfield towards availability
+   * @param bitfield Pieces the peer has
+   */
+  void addPeerPieces(const std::vector<bool> &bitfield);
+
+  /**
+   * @brief Remove a disconnected peer's pieces from availability
+   * @param bitfield Pieces the peer had
+   */
+  void removePeerPieces(const std::vector<bool> &bitfield);
+
+  /**
+   * @brief Count a single piece announced with a have message
+   * @param piece The piece the peer now has
+   */
+  void addPeerPiece(uint32_t piece);
+
+  /**
+   * @brief Pick blocks to request from a peer
+   * @param peer The peer the requests will be sent to
+   * @param peerHas Pieces the peer has
+   * @param count Maximum number of blocks to pick
+   * @return Blocks to request; they are marked as requested by the peer
+   */
+  std::vector<Block> pickBlocks(PeerId peer, const std::vector<bool> &peerHas,
+                                size_t count);
+
+  /**
+   * @brief Record that a block arrived
+   * @param peer The peer that sent the block
+   * @param block The received block
+   * @return Other peers that also requested the block and should be sent a
+   * cancel message
+   */
+  std::vector<PeerId> blockReceived(PeerId peer, const Block &block);
+
+  /**
+   * @brief Return a block that will not arrive (choked, rejected, cancelled)
+   * @param peer The peer the block was requested from
+   * @param block The block to release
+   */
+  void abortRequest(PeerId peer, const Block &block);
+
+  /**
+   * @brief Release every block requested from a peer
+   * @param peer The peer that disconnected
+   */
+  void peerDisconnected(PeerId peer);
+
+  /**
+   * @brief Reset a piece that failed hash verification so it is fetched again
+   * @param piece The failed piece
+   */
+  void pieceFailed(uint32_t piece);
+
+  /**
+   * @brief Make a piece time-critical, or normal again
+   * @param piece The piece index
+   * @param deadlineMicros Time the piece is needed by, in the caller's
+   * clock, or kNoDeadline to clear it; completed pieces drop their deadline
+   */
+  void setDeadline(uint32_t piece, int64_t deadlineMicros);
+
+  /**
+   * @brief Get the deadline of a piece
+   * @param piece The piece index
+   * @return The deadline, or kNoDeadline if the piece has none
+   */
+  int64_t deadline(uint32_t piece) const;
+
+  /**
+   * @brief Report that a request has been outstanding for too long
+   * @param peer The peer the block was requested from
+   * @param block The late block
+   * @return true if the block may now be picked for another peer as well;
+   * false if its piece has no deadline, the block is not requested from the
+   * peer or already requested from max(2, maxDuplicates) peers
+   *
+   * The request to the slow peer stays in flight.
+   */
+  bool requestTimedOut(PeerId peer, const Block &block);
+
+  /**
+   * @brief Check if all blocks of a piece have been received
+   * @param piece The piece to check
+   * @return true if the piece is ready for verification
+   */
+  bool isPieceComplete(uint32_t piece) const;
+
+  /**
+   * @brief Check if a block has been received
+   * @param block The block to check
+   * @return true if the block's data has arrived
+   */
+  bool hasBlock(const Block &block) const;
+
+  /**
+   * @brief Mark a piece as already present, e.g. after resuming from disk
+   * @param piece The piece we have
+   */
+  void setHave(uint32_t piece);
+
+  bool isEndgame() const;     // Every missing block has been requested
+  bool isFinished() const;    // Every block has been received
+  uint32_t numPieces() const; // Number of pieces in the torrent
+
+  /**
+   * @brief Get the number of blocks in a piece
+   * @param piece The piece index
+   * @return Block count (the last block of the last piece may be short)
+   */
+  uint32_t blocksInPiece(uint32_t piece) const;
+
+  /**
+   * @brief Get the size of a piece
+   * @param piece The piece index
+   * @return Size in bytes; only the last piece may be shorter than the
+   * nominal piece length
+   */
+  uint32_t pieceSize(uint32_t piece) const;
+
+  /**
+   * @brief Get the number of connected peers that have a piece
+   * @param piece The piece index
+   * @return Availability count
+   */
+  int availability(uint32_t piece) const;
+
+private:
+  // Download state of one block
+  struct BlockState {
+    bool received = false;          // Data has arrived
+    bool late = false;              // Timed out, may be requested again
+    std::vector<PeerId> requesters; // Peers the block is requested from
+  };
+
+  // Download state of one piece
+  struct PieceState {
+    int availability = 0;           // Number of peers with the piece
+    uint32_t freeBlocks = 0;        // Blocks neither requested nor received
+    uint32_t receivedBlocks = 0;    // Blocks received so far
+    bool inPartialList = false;     // Listed in partialPieces
+    int64_t deadline = kNoDeadline; // Listed in deadlinePieces unless none
+    std::vector<BlockState> blocks; // Allocated on first request
+  };
+
+  int64_t totalSize;
+  int64_t pieceLength;
+  unsigned maxDuplicates;
+  std::vector<PieceState> pieces;
+  std::vector<uint32_t> partialPieces; // Pieces that may have free blocks
+  std::vector<uint32_t> deadlinePieces; // Pieces with a deadline
+  bool deadlinesSorted = true;          // deadlinePieces in deadline order
+  uint64_t freeBlocks = 0;             // Free blocks across all pieces
+  uint64_t missingBlocks = 0;          // Blocks not yet received
+
+  /**
+   * @brief Get the block list of a piece, allocating it on first use
+   * @param piece The piece index
+   * @return Per-block state of the piece
+   */
+  std::vector<BlockState> &blocksOf(uint32_t piece);
+
+  /**
+   * @brief Pick free blocks from one piece
+   * @param peer The requesting peer
+   * @param piece The piece to pick from
+   * @param count Maximum number of blocks to add
+   * @param out Picked blocks are appended here
+   */
+  void pickFromPiece(PeerId peer, uint32_t piece, size_t count,
+                     std::vector<Block> &out);
+
+  /**
+   * @brief Pick blocks of pieces with a deadline, earliest first
+   * @param peer The requesting peer
+   * @param peerHas Pieces the peer has
+   * @param count Maximum number of blocks to add
+   * @param out Picked blocks are appended here
+   */
+  void pickDeadline(PeerId peer, const std::vector<bool> &peerHas,
+                    size_t count, std::vector<Block> &out);
+
+  /**
+   * @brief Pick in-flight blocks for duplicate requests in endgame mode
+   * @param peer The requesting peer
+   * @param peerHas Pieces the peer has
+   * @param count Maximum number of blocks to add
+   * @param out Picked blocks are appended here
+   */
+  void pickEndgame(PeerId peer, const std::vector<bool> &peerHas, size_t count,
+                   std::vector<Block> &out);
+
+  /**
+   * @brief Make a block description for a block index within a piece
+   * @param piece The piece index
+   * @param index The block index within the piece
+   * @return Request parameters of the block
+   */
+  Block makeBlock(uint32_t piece, uint32_t index) const;
+
+  /**
+   * @brief Locate a block's state, validating the request parameters
+   * @param block The block to look up
+   * @return Pointer to the block state, or nullptr if the block is invalid or
+   * its piece has no block state yet
+   */
+  BlockState *findBlock(const Block &block);
+};
+
+#endif // PIECEPICKER_HPP
@@ -0,0 +1,161 @@
+#ifndef RANGESERVER_HPP
+#define RANGESERVER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <storage.hpp>
+#include <string>
+#include <thread>
+#include <torrentfile.hpp>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief HTTP server for the files of a torrent, with Range support
+ *
+ * Media players open a URL and seek with Range requests; the server lets
+ * them play files of a torrent that is still downloading. Each file is
+ * served at its path within the torrent, percent-encoded, with GET and
+ * HEAD, one byte range per request (a request for several ranges gets the
+ * whole file), and persistent, pipelined HTTP/1.1 connections.
+ *
+ * A range is mapped onto the torrent's pieces through the file layout.
+ * Bytes of pieces that are available go out with sendfile(), straight from
+ * the page cache; when the response reaches a piece that is not, the
+ * connection waits on that piece until pieceCompleted() reports it, while
+ * the headers and everything before it are already on their way. Nothing
+ * but the response headers is copied through user space.
+ *
+ * One thread runs an edge-triggered epoll loop over all connections, so
+ * thousands of concurrent requests cost a few hundred bytes of state each.
+ * A connection writes at most a chunk per turn before the others get
+ * theirs, and idle connections are closed after a timeout; connections
+ * waiting on a piece are never idle. The server reads through a Storage of
+ * its own, so the downloader's Storage is not shared between threads.
+ */
+class RangeServer {
+public:
+  /**
+   * @brief Settings of a server
+   */
+  struct Options {
+    std::string address = "127.0.0.1"; // IPv4 address to listen on
+    uint16_t port = 0;                 // 0 picks a free port
+    size_t maxConnections = 16384;     // Further connections are refused
+    int64_t idleTimeoutMillis = 30000; // Close connections idle this long
+    int64_t chunkBytes = 1 << 20;      // Bytes sent per connection and turn
+  };
+
+  /**
+   * @brief Counters of server activity since construction
+   */
+  struct Stats {
+    uint64_t accepted = 0;    // Connections accepted
+    uint64_t refused = 0;     // Connections over maxConnections
+    uint64_t open = 0;        // Connections currently open
+    uint64_t requests = 0;    // Requests parsed
+    uint64_t ranges = 0;      // Requests answered with 206
+    uint64_t errors = 0;      // Requests answered with 4xx
+    uint64_t waits = 0;       // Times a response waited on a piece
+    uint64_t bytesSent = 0;   // Body bytes sent
+  };
+
+  /**
+   * @brief Start serving a torrent's files
+   * @param torrent The torrent; must outlive the server
+   * @param rootDir Directory the content is stored in, as for Storage
+   * @param have Pieces available now; missing entries count as absent
+   * @param options Settings
+   * @throws std::runtime_error if the socket, epoll or thread cannot be set
+   * up
+   */
+  RangeServer(const TorrentFile &torrent, const std::string &rootDir,
+              std::vector<bool> have, const Options &options);
+
+  /**
+   * @brief Stop serving, see stop()
+   */
+  ~RangeServer();
+
+  RangeServer(const RangeServer &) = delete;
+  RangeServer &operator=(const RangeServer &) = delete;
+
+  /**
+   * @brief Stop the server thread and close every connection
+   */
+  void stop();
+
+  /**
+   * @brief Report that a piece is now available on disk (thread-safe)
+   * @param piece The verified piece; responses waiting on it resume
+   */
+  void pieceCompleted(uint32_t piece);
+
+  /**
+   * @brief Get the port the server listens on
+   * @return Port number, also when Options::port was 0
+   */
+  uint16_t port() const;
+
+  /**
+   * @brief Get the URL path of a file
+   * @param fileIndex Index into the torrent's getFiles()
+   * @return Path such as /name/dir/file.mkv, percent-encoded
+   * @throws std::out_of_range if the file does not exist
+   */
+  std::string urlPath(size_t fileIndex) const;
+
+  Stats stats() const; // Activity counters
+
+private:
+  struct Connection;
+
+  const TorrentFile &torrent;
+  const Options options;
+  Storage storage; // Read by the server thread only
+  std::unordered_map<std::string, size_t> filesByPath; // Decoded URL paths
+  std::vector<int64_t> fileStarts; // Offset of each file in the content
+
+  int listenFd = -1;
+  int epollFd = -1;
+  int wakeFd = -1; // eventfd for completed pieces and stop
+  uint16_t listenPort = 0;
+  std::thread thread;
+  std::atomic<bool> stopping{false};
+
+  // Guarded by mutex: pieces reported by pieceCompleted(), not yet applied
+  std::mutex mutex;
+  std::vector<uint32_t> completed;
+
+  // Owned by the server thread
+  std::vector<bool> have;
+  std::vector<std::unique_ptr<Connection>> connections; // By descriptor
+  std::vector<std::vector<std::pair<int, uint64_t>>> waiters; // By piece
+  std::vector<int> ready; // Connections with more to send this turn
+  uint64_t nextId = 1;    // Tells apart connections reusing a descriptor
+
+  std::atomic<uint64_t> accepted{0};
+  std::atomic<uint64_t> refused{0};
+  std::atomic<uint64_t> open{0};
+  std::atomic<uint64_t> requests{0};
+  std::atomic<uint64_t> ranges{0};
+  std::atomic<uint64_t> errors{0};
+  std::atomic<uint64_t> waits{0};
+  std::atomic<uint64_t> bytesSent{0};
+
+  void run();
+  void acceptAll();
+  void applyCompleted();
+  void closeIdle(int64_t nowMillis);
+  void readFrom(Connection &conn);
+  void progress(Connection &conn);
+  bool startResponse(Connection &conn);
+  void sendError(Connection &conn, int status, const std::string &extra);
+  bool sendBody(Connection &conn);
+  void closeConnection(int fd);
+};
+
+#endif // RANGESERVER_HPP
@@ -0,0 +1,206 @@
+#ifndef RATELIMITER_HPP
+#define RATELIMITER_HPP
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief A single token bucket refilled at a fixed rate
+ *
+ * Tokens are bytes. The bucket gains `rate` tokens per second up to `burst`
+ * tokens. A rate of zero means the bucket is unlimited and never runs dry.
+ */
+class TokenBucket {
+public:
+  /**
+   * @brief Construct a token bucket
+   * @param rate Refill rate in bytes per second (0 = unlimited)
+   * @param burst Maximum number of tokens the bucket can hold (0 = one second
+   * worth of tokens)
+   */
+  explicit TokenBucket(int64_t rate = 0, int64_t burst = 0);
+
+  /**
+   * @brief Change the refill rate and capacity, clamping the current tokens
+   * @param rate Refill rate in bytes per second (0 = unlimited)
+   * @param burst Maximum number of tokens (0 = one second worth of tokens)
+   */
+  void setRate(int64_t rate, int64_t burst = 0);
+
+  /**
+   * @brief Add the tokens earned over an elapsed interval
+   * @param elapsedMicros Time since the last refill in microseconds
+   */
+  void refill(int64_t elapsedMicros);
+
+  /**
+   * @brief Remove tokens from the bucket
+   * @param bytes Number of tokens to remove (must not exceed available())
+   */
+  void consume(int64_t bytes);
+
+  bool isUnlimited() const;  // Check if the bucket has no rate limit
+  int64_t available() const; // Tokens currently available
+  int64_t getRate() const;   // Refill rate in bytes per second
+  int64_t getBurst() const;  // Maximum number of tokens
+
+private:
+  int64_t rate;          // Bytes per second, 0 for unlimited
+  int64_t burst;         // Capacity of the bucket in bytes
+  int64_t tokens = 0;    // Tokens currently in the bucket
+  int64_t remainder = 0; // Sub-token remainder carried between refills
+};
+
+/**
+ * @brief Hierarchical token-bucket bandwidth scheduler
+ *
+ * Bandwidth is organized as a tree of channels, each with its own token
+ * bucket. A typical setup has one global channel at the root, one channel per
+ * torrent and one per peer class below it. A connection is attached to one or
+ * more channels and may only transfer data when every channel on the path from
+ * its attached channels up to the root has tokens left.
+ *
+ * Connections ask for quota with request(). Requests are not served
+ * immediately; instead, the event loop calls tick() once per iteration, which
+ * refills all buckets and distributes the available quota among waiting
+ * connections in round-robin order. Each connection receives at most one grant
+ * callback per tick, so the cost of rate limiting is paid per connection per
+ * tick rather than per byte transferred.
+ *
+ * One scheduler limits a single direction; use one instance for uploads and
+ * another for downloads.
+ */
+class BandwidthScheduler {
+public:
+  using ChannelId = uint32_t;
+  using ConnectionId = uint32_t;
+
+  /**
+   * @brief Callback receiving the quota granted to a connection in a tick
+   * @param connection The connection that was granted quota
+   * @param bytes Number of bytes the connection may now transfer
+   */
+  using GrantCallback =
+      std::function<void(ConnectionId connection, int64_t bytes)>;
+
+  static constexpr ChannelId kNoParent = UINT32_MAX; // Marks a root channel
+  static constexpr size_t kMaxChainLength = 8; // Max channels per connection
+
+  /**
+   * @brief Construct a scheduler
+   * @param quantum Bytes handed to each waiting connection per round-robin
+   * pass; small values give finer fairness, large values fewer passes
+   */
+  explicit BandwidthScheduler(int64_t quantum = 16 * 1024);
+
+  /**
+   * @brief Create a bandwidth channel
+   * @param parent Parent channel, or kNoParent for a root channel
+   * @param rate Rate limit in bytes per second (0 = unlimited)
+   * @param burst Bucket capacity in bytes (0 = one second worth of tokens)
+   * @return Identifier of the new channel
+   * @throws std::invalid_argument if the parent does not exist
+   */
+  ChannelId addChannel(ChannelId parent, int64_t rate, int64_t burst = 0);
+
+  /**
+   * @brief Change the rate limit of an existing channel
+   * @param channel The channel to update
+   * @param rate Rate limit in bytes per second (0 = unlimited)
+   * @param burst Bucket capacity in bytes (0 = one second worth of tokens)
+   * @throws std::out_of_range if the channel does not exist
+   */
+  void setChannelRate(ChannelId channel, int64_t rate, int64_t burst = 0);
+
+  /**
+   * @brief Register a connection limited by the given channels
+   * @param channelList Channels the connection belongs to; their ancestors
+   * are included automatically
+   * @return Identifier of the new connection
+   * @throws std::invalid_argument if a channel does not exist or the combined
+   * chain exceeds kMaxChainLength
+   */
+  ConnectionId addConnection(std::initializer_list<ChannelId> channelList);
+
+  /**
+   * @brief Unregister a connection, dropping any pending request
+   * @param connection The connection to remove
+   */
+  void removeConnection(ConnectionId connection);
+
+  /**
+   * @brief Ask for quota on behalf of a connection
+   * @param connection The connection that wants to transfer data
+   * @param bytes Additional bytes the connection wants to transfer
+   *
+   * Repeated calls before the request is satisfied accumulate.
+   */
+  void request(ConnectionId connection, int64_t bytes);
+
+  /**
+   * @brief Refill all buckets and hand out quota to waiting connections
+   * @param elapsedMicros Time since the previous tick in microseconds
+   * @param grant Callback invoked once per connection that received quota
+   */
+  void tick(int64_t elapsedMicros, const GrantCallback &grant);
+
+  /**
+   * @brief Get the number of bytes a connection is still waiting for
+   * @param connection The connection to query
+   * @return Outstanding requested bytes (0 if not waiting)
+   */
+  int64_t pending(ConnectionId connection) const;
+
+  /**
+   * @brief Get the number of connections waiting for quota
+   * @return Size of the wait queue
+   */
+  size_t queueSize() const;
+
+  /**
+   * @brief Get the token bucket backing a channel
+   * @param channel The channel to query
+   * @return Reference to the channel's bucket
+   */
+  const TokenBucket &getChannel(ChannelId channel) const;
+
+private:
+  // A node in the channel tree
+  struct Channel {
+    ChannelId parent; // Parent channel or kNoParent
+    TokenBucket bucket;
+  };
+
+  // Per-connection scheduling state
+  struct Connection {
+    std::array<ChannelId, kMaxChainLength> chain; // Channels to charge
+    uint8_t chainLength = 0;                      // Used entries of chain
+    bool active = false;                          // Slot is in use
+    bool queued = false;                          // Waiting for quota
+    int64_t wanted = 0;                           // Outstanding bytes
+    int64_t granted = 0;                          // Quota granted this tick
+  };
+
+  int64_t quantum;                     // Bytes per round-robin pass
+  std::vector<Channel> channels;       // All channels, indexed by id
+  std::vector<Connection> connections; // All connections, indexed by id
+  std::vector<ConnectionId> freeSlots; // Reusable connection ids
+  std::vector<ConnectionId> queue;     // Connections waiting for quota
+
+  // Scratch buffers reused by tick() to avoid per-tick allocations
+  std::vector<ConnectionId> served;
+  std::vector<std::pair<ConnectionId, int64_t>> grants;
+
+  /**
+   * @brief Get the smallest token count along a connection's chain
+   * @param conn The connection whose chain to inspect
+   * @return Tokens the connection may use right now
+   */
+  int64_t chainTokens(const Connection &conn) const;
+};
+
+#endif // RATELIMITER_HPP
@@ -0,0 +1,121 @@
+#ifndef REQUESTPIPELINE_HPP
+#define REQUESTPIPELINE_HPP
+
+#include <choker.hpp>
+#include <cstdint>
+#include <deque>
+#include <piecepicker.hpp>
+#include <vector>
+
+/**
+ * @brief Per-peer queue of outstanding block requests with adaptive depth
+ *
+ * To keep a connection busy, enough requests must be in flight to cover the
+ * bandwidth-delay product of the link: while a block travels back to us, the
+ * peer should already be sending the next ones. A fixed queue depth is too
+ * shallow for fast, high-latency links and needlessly deep for slow peers,
+ * whose queued requests then block pieces other peers could serve.
+ *
+ * The pipeline measures the peer's throughput with a RateCounter and its
+ * round-trip time as the smallest request-to-block latency seen (larger
+ * samples include time spent queued behind other requests). The target depth
+ * is
+ *
+ *   depth = gain * throughput * rtt / blockSize
+ *
+ * clamped to [minDepth, maxDepth]. A gain above one lets the depth grow
+ * while the connection is limited by the number of requests rather than by
+ * bandwidth: the measured throughput then rises with every increase, until
+ * it levels off at the link rate.
+ */
+class RequestPipeline {
+public:
+  using Block = PiecePicker::Block;
+
+  // Tunable parameters of the depth calculation
+  struct Settings {
+    size_t minDepth = 2;         // Lower bound on outstanding requests
+    size_t maxDepth = 500;       // Upper bound on outstanding requests
+    size_t initialDepth = 4;     // Depth before any measurement is available
+    unsigned gain = 2;           // Multiplier applied to the BDP
+    unsigned rateShift = 1;      // EWMA smoothing of the throughput estimate
+    int64_t rttWindowMicros = 0; // Lifetime of an RTT minimum, 0 = forever
+  };
+
+  /**
+   * @brief Construct a pipeline
+   * @param settings Parameters of the depth calculation
+   */
+  explicit RequestPipeline(const Settings &settings);
+  RequestPipeline();
+
+  /**
+   * @brief Record that a request was sent
+   * @param block The requested block
+   * @param nowMicros Current time in microseconds
+   */
+  void requestSent(const Block &block, int64_t nowMicros);
+
+  /**
+   * @brief Record that a block arrived, updating throughput and RTT
+   * @param block The received block
+   * @param nowMicros Current time in microseconds
+   * @return true if the block was outstanding on this pipeline
+   */
+  bool blockReceived(const Block &block, int64_t nowMicros);
+
+  /**
+   * @brief Forget an outstanding request, e.g. after sending a cancel
+   * @param block The block no longer expected
+   * @return true if the block was outstanding on this pipeline
+   */
+  bool cancel(const Block &block);
+
+  /**
+   * @brief Drop all outstanding requests, e.g. when the peer chokes us
+   * @return The blocks that were outstanding, for returning to the picker
+   */
+  std::vector<Block> clear();
+
+  /**
+   * @brief Sample the throughput estimate
+   * @param elapsedMicros Time since the previous call in microseconds
+   */
+  void tick(int64_t elapsedMicros);
+
+  /**
+   * @brief Get requests that have been outstanding for too long
+   * @param nowMicros Current time in microseconds
+   * @param timeoutMicros Age after which a request counts as timed out
+   * @return Timed out blocks, oldest first; they stay outstanding
+   */
+  std::vector<Block> timedOut(int64_t nowMicros, int64_t timeoutMicros) const;
+
+  size_t targetDepth() const; // Desired number of outstanding requests
+  size_t outstanding() const; // Current number of outstanding requests
+  size_t wanted() const;      // Requests to send to reach the target depth
+  int64_t rtt() const;        // Round-trip estimate in microseconds (0 = none)
+  uint64_t rate() const;      // Throughput estimate in bytes per second
+
+private:
+  // A request on the wire
+  struct Outstanding {
+    Block block;    // The requested block
+    int64_t sentAt; // Time the request was sent in microseconds
+  };
+
+  Settings settings;
+  RateCounter throughput;        // Payload received from the peer
+  std::deque<Outstanding> queue; // Outstanding requests, oldest first
+  int64_t minRtt = 0;            // Smallest latency seen (0 = no sample)
+  int64_t minRttAt = 0;          // Time the minimum was taken
+
+  /**
+   * @brief Find an outstanding request
+   * @param block The block to look up
+   * @return Iterator to the request, or queue.end() if not outstanding
+   */
+  std::deque<Outstanding>::iterator find(const Block &block);
+};
+
+#endif // REQUESTPIPELINE_HPP
@@ -0,0 +1,218 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Work-stealing task scheduler shared by parsing, hashing and I/O
+ *
+ * Every worker thread owns one Chase-Lev deque per priority. Tasks spawned
+ * by a worker go to the bottom of its own deque and are popped from there
+ * (newest first, which keeps nested work cache-hot); idle workers steal from
+ * the top of other workers' deques (oldest first, which moves the largest
+ * pieces of work). Tasks submitted from other threads go to a shared
+ * injection queue. Higher priorities are always looked for first, across
+ * all workers.
+ *
+ * Idle workers spin briefly and then park on a condition variable; spawning
+ * only takes the lock to wake one when some worker is parked.
+ *
+ * Use one scheduler per process (shared()) for CPU-bound work, so separate
+ * components do not oversubscribe the cores with their own pools.
+ */
+class Scheduler {
+public:
+  /**
+   * @brief Task priorities, highest first
+   */
+  enum class Priority { High, Normal, Low };
+  static constexpr size_t kNumPriorities = 3;
+
+  /**
+   * @brief Counters of scheduler activity since construction
+   */
+  struct Stats {
+    uint64_t executed = 0; // Tasks run by workers
+    uint64_t stolen = 0;   // Tasks taken from another worker's deque
+    uint64_t injected = 0; // Tasks taken from the injection queue
+    uint64_t parks = 0;    // Times a worker went to sleep
+  };
+
+  class TaskGroup;
+
+  /**
+   * @brief Start the worker threads
+   * @param numThreads Number of workers, 0 for one per hardware thread
+   */
+  explicit Scheduler(size_t numThreads = 0);
+
+  /**
+   * @brief Run all queued tasks, then stop and join the workers
+   */
+  ~Scheduler();
+
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  /**
+   * @brief Get the scheduler shared by the whole process
+   * @return A scheduler with one worker per hardware thread, created on
+   * first use and never destroyed
+   */
+  static Scheduler &shared();
+
+  /**
+   * @brief Queue a task that nobody waits for
+   * @param task The task; an exception escaping it terminates the program
+   * @param priority Task priority
+   */
+  void submit(std::function<void()> task, Priority priority = Priority::Normal);
+
+  /**
+   * @brief Run fn(i) for every i in [begin, end) and wait for all of them
+   * @param begin First index
+   * @param end One past the last index
+   * @param fn Function called once per index, from any thread
+   * @param grain Indices per task, 0 to pick one from the range and the
+   * number of workers
+   * @param priority Task priority
+   * @throws The first exception thrown by fn, after all tasks finished
+   */
+  void parallelFor(size_t begin, size_t end,
+                   const std::function<void(size_t)> &fn, size_t grain = 0,
+                   Priority priority = Priority::Normal);
+
+  size_t numThreads() const; // Number of worker threads
+  Stats stats() const;       // Activity counters summed over the workers
+
+  /**
+   * @brief Find the calling thread's worker index
+   * @return Index in [0, numThreads()), or numThreads() if the caller is not
+   * a worker of this scheduler
+   */
+  size_t currentWorker() const;
+
+private:
+  struct Task {
+    std::function<void()> fn;
+    TaskGroup *group; // Group to notify on completion, or nullptr
+  };
+
+  /**
+   * @brief Chase-Lev work-stealing deque of task pointers
+   *
+   * The owner pushes and takes at the bottom, thieves steal at the top. The
+   * ring grows when full; retired rings are kept until destruction because
+   * a thief may still be reading one.
+   */
+  class Deque {
+  public:
+    Deque();
+    ~Deque();
+    void push(Task *task);         // Owner only
+    Task *take();                  // Owner only, nullptr if empty
+    Task *steal(bool &contended);  // Any thread, nullptr if empty or lost
+    bool empty() const;
+
+  private:
+    struct Ring {
+      explicit Ring(size_t capacity);
+      size_t mask;
+      std::unique_ptr<std::atomic<Task *>[]> slots;
+    };
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<Ring *> ring;
+    std::vector<std::unique_ptr<Ring>> rings; // Owner only
+  };
+
+  struct Worker {
+    Deque deques[kNumPriorities];
+    uint64_t random = 0; // State for picking steal victims
+    std::atomic<uint64_t> executed{0};
+    std::atomic<uint64_t> stolen{0};
+    std::atomic<uint64_t> injected{0};
+    std::atomic<uint64_t> parks{0};
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+
+  // Tasks submitted from threads that are not workers
+  std::mutex injectMutex;
+  std::deque<Task *> injectQueues[kNumPriorities];
+  std::atomic<size_t> injectedCount{0};
+
+  // Parking of idle workers
+  std::mutex parkMutex;
+  std::condition_variable parkCondition;
+  std::atomic<uint64_t> wakeEpoch{0};
+  std::atomic<size_t> sleepers{0};
+  std::atomic<bool> stopping{false};
+
+  void enqueue(Task *task, Priority priority); // Local deque or injection
+  void wakeOne();                              // Unpark a worker if any
+  Task *findTask(size_t self);                 // Workers only
+  Task *popInjected(size_t priority);
+  bool hasWork() const;
+  void run(Task *task);
+  void workerLoop(size_t index);
+  void park(Worker &worker);
+};
+
+/**
+ * @brief Set of tasks that can be waited for together
+ *
+ * wait() inside a task helps: the waiting worker runs queued tasks (of any
+ * group) until the group is done, so nested fork-join does not tie up
+ * workers. Threads outside the scheduler block in wait().
+ */
+class Scheduler::TaskGroup {
+public:
+  explicit TaskGroup(Scheduler &scheduler);
+
+  /**
+   * @brief Wait for outstanding tasks; exceptions they threw are dropped
+   */
+  ~TaskGroup();
+
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  /**
+   * @brief Queue a task in this group
+   * @param task The task
+   * @param priority Task priority
+   */
+  void spawn(std::function<void()> task, Priority priority = Priority::Normal);
+
+  /**
+   * @brief Wait until every task of the group has finished, running queued
+   * tasks meanwhile if the caller is a worker
+   * @throws The first exception thrown by a task of the group
+   */
+  void wait();
+
+private:
+  friend class Scheduler;
+
+  Scheduler &scheduler;
+  std::atomic<size_t> pending{0};
+  std::mutex mutex; // Guards error and the completion notification
+  std::condition_variable done;
+  std::exception_ptr error;
+
+  void finish(std::exception_ptr taskError); // Called after each task
+};
+
+#endif // SCHEDULER_HPP
@@ -0,0 +1,83 @@
+#ifndef SHA1_HPP
+#define SHA1_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Incremental SHA-1 hash (FIPS 180-4)
+ *
+ * BitTorrent v1 identifies torrents by the SHA-1 of their info dictionary and
+ * verifies every piece against a SHA-1 hash stored in the torrent. Data can
+ * be fed in chunks of any size; finish() pads the message and returns the
+ * 20-byte binary digest.
+ */
+class Sha1 {
+public:
+  static constexpr size_t kDigestSize = 20; // Digest length in bytes
+
+  Sha1();
+
+  /**
+   * @brief Add data to the message being hashed
+   * @param data Pointer to the data
+   * @param length Number of bytes
+   */
+  void update(const void *data, size_t length);
+
+  /**
+   * @brief Add data to the message being hashed
+   * @param data The data
+   */
+  void update(std::string_view data);
+
+  /**
+   * @brief Add zero bytes to the message being hashed, as for BEP 47
+   * padding, without reading them from anywhere
+   * @param count Number of zero bytes
+   */
+  void updateZeros(uint64_t count);
+
+  /**
+   * @brief Complete the hash; the object must not be updated afterwards
+   * @return The 20-byte binary digest
+   */
+  std::string finish();
+
+  /**
+   * @brief Hash a complete message
+   * @param data The message
+   * @return The 20-byte binary digest
+   */
+  static std::string hash(std::string_view data);
+
+  /**
+   * @brief Format a binary digest as lowercase hexadecimal
+   * @param digest The binary digest
+   * @return Hexadecimal representation, two characters per byte
+   */
+  static std::string toHex(std::string_view digest);
+
+private:
+  // Zero blocks at the start of a message skipped through a table
+  static constexpr size_t kZeroStates = 4096;
+
+  uint32_t state[5];   // Intermediate hash value
+  uint64_t length = 0; // Bytes hashed so far
+  uint8_t buffer[64];  // Partial block waiting for more data
+  size_t buffered = 0; // Bytes in buffer
+
+  /**
+   * @brief Mix one 64-byte block into the state
+   * @param block The block to process
+   */
+  void processBlock(const uint8_t *block);
+
+  void processZeroBlock(); // processBlock of 64 zero bytes
+
+  static const uint32_t *zeroStates(); // States after 0..kZeroStates blocks
+};
+
+#endif // SHA1_HPP
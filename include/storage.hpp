@@ -0,0 +1,151 @@
+#ifndef STORAGE_HPP
+#define STORAGE_HPP
+
+#include <cstdint>
+#include <string>
+#include <torrentfile.hpp>
+#include <vector>
+
+/**
+ * @brief Maps torrent pieces onto the files they are stored in
+ *
+ * The content of a torrent is the concatenation of its files in the order
+ * they are listed, cut into pieces of a fixed length. A block of a piece can
+ * therefore span several files, and each part of it is described by a
+ * FileSlice. Storage computes those slices, reads and writes blocks through
+ * them, and keeps a small pool of open file descriptors so the slices can
+ * also be handed to the kernel directly (see Uploader).
+ *
+ * BEP 47 padding files take their place in the layout but never exist on
+ * disk: their slices read as zeros, writes to them are dropped, and
+ * hashPiece() feeds them to SHA-1 as zeros without reading anything.
+ */
+class Storage {
+public:
+  // The part of a block that lives in one file
+  struct FileSlice {
+    size_t fileIndex; // Index into the file list
+    int64_t offset;   // Byte offset within the file
+    int64_t length;   // Length in bytes
+    bool padding;     // Part of a padding file: zeros, nothing on disk
+  };
+
+  /**
+   * @brief Construct storage for a parsed torrent
+   * @param torrent The torrent whose content is stored
+   * @param rootDir Directory the torrent's name is resolved against
+   *
+   * A single-file torrent is stored as rootDir/name, a multi-file torrent as
+   * rootDir/name/path for each file.
+   */
+  Storage(const TorrentFile &torrent, const std::string &rootDir);
+
+  /**
+   * @brief Construct storage for an explicit file layout
+   * @param files Files in torrent order, paths relative to rootDir;
+   * padding files are kept out of the file system
+   * @param pieceLength Nominal piece length in bytes
+   * @param rootDir Directory the file paths are resolved against
+   * @param maxOpenFiles Maximum number of file descriptors kept open
+   * @throws std::invalid_argument if the piece length is not positive, a
+   * file length is negative or a path leaves rootDir
+   */
+  Storage(const std::vector<TorrentFile::FileInfo> &files,
+          int64_t pieceLength, const std::string &rootDir,
+          size_t maxOpenFiles = 64);
+
+  ~Storage();
+  Storage(const Storage &) = delete;
+  Storage &operator=(const Storage &) = delete;
+
+  /**
+   * @brief Split a block into the file slices that hold it
+   * @param piece Piece index
+   * @param offset Byte offset within the piece
+   * @param length Length of the block in bytes
+   * @return Slices in content order; zero-length files are skipped
+   * @throws std::out_of_range if the block extends past its piece or the end
+   * of the content
+   */
+  std::vector<FileSlice> mapBlock(uint32_t piece, uint32_t offset,
+                                  uint32_t length) const;
+
+  /**
+   * @brief Read a block into memory
+   * @param piece Piece index
+   * @param offset Byte offset within the piece
+   * @param length Length of the block in bytes
+   * @param out Buffer of at least length bytes
+   * @throws std::runtime_error if a file cannot be read
+   */
+  void readBlock(uint32_t piece, uint32_t offset, uint32_t length,
+                 char *out);
+
+  /**
+   * @brief Write a block to its files, creating files and directories
+   * @param piece Piece index
+   * @param offset Byte offset within the piece
+   * @param length Length of the block in bytes
+   * @param data The block data
+   * @throws std::runtime_error if a file cannot be written
+   */
+  void writeBlock(uint32_t piece, uint32_t offset, uint32_t length,
+                  const char *data);
+
+  /**
+   * @brief Compute the SHA-1 of a piece as stored
+   * @param piece Piece index
+   * @return The 20-byte digest, to compare with the torrent's piece hash
+   * @throws std::out_of_range if the piece does not exist
+   * @throws std::runtime_error if a file cannot be read
+   */
+  std::string hashPiece(uint32_t piece);
+
+  /**
+   * @brief Get an open descriptor for a file
+   * @param fileIndex Index into the file list
+   * @param forWrite Open for writing, creating the file if needed
+   * @return A descriptor owned by the storage; it stays valid until the
+   * storage is destroyed or more than maxOpenFiles other files are used
+   * @throws std::runtime_error if the file cannot be opened
+   * @throws std::invalid_argument for padding files
+   */
+  int fileDescriptor(size_t fileIndex, bool forWrite = false);
+
+  int64_t getTotalSize() const;   // Combined size of all files
+  int64_t getPieceLength() const; // Nominal piece length in bytes
+  uint32_t numPieces() const;     // Number of pieces
+
+  /**
+   * @brief Get the size of a piece
+   * @param piece The piece index
+   * @return Size in bytes; only the last piece may be shorter
+   */
+  uint32_t pieceSize(uint32_t piece) const;
+
+private:
+  // A file of the torrent and its place in the content
+  struct File {
+    std::string path; // Path on disk
+    int64_t start;    // Offset of the file's first byte in the content
+    int64_t length;   // Size in bytes
+    bool padding;     // BEP 47 padding file, never opened
+    int fd = -1;      // Open descriptor, -1 if closed
+    bool writable = false;
+    uint64_t lastUse = 0; // Value of useCounter when last used
+  };
+
+  std::vector<File> files;
+  int64_t pieceLength;
+  int64_t totalSize = 0;
+  size_t maxOpenFiles;
+  size_t openFiles = 0;
+  uint64_t useCounter = 0;
+
+  /**
+   * @brief Close the least recently used descriptor
+   */
+  void evictOne();
+};
+
+#endif // STORAGE_HPP
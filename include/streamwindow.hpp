@@ -0,0 +1,98 @@
+#ifndef STREAMWINDOW_HPP
+#define STREAMWINDOW_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <piecepicker.hpp>
+#include <torrentfile.hpp>
+
+/**
+ * @brief Sliding window of piece deadlines for playing a file while it
+ * downloads
+ *
+ * A media player reads a file of the torrent front to back, at roughly its
+ * bitrate, and stalls when the next bytes are missing. Rarest-first picking
+ * ignores the player entirely, so the window turns each read into piece
+ * deadlines instead: the pieces holding the bytes being read are due now,
+ * and the pieces after them, up to windowBytes ahead, are due when
+ * playback at the bitrate will reach them. The picker serves deadline
+ * pieces first, earliest first, and everything else rarest-first as
+ * before, so the rest of the torrent keeps downloading in the background.
+ *
+ * Pieces that fall behind the read position, after a seek for instance,
+ * lose their deadline again. Whoever owns the connections reports requests
+ * for deadline pieces that take too long through
+ * PiecePicker::requestTimedOut(), so a slow peer cannot hold up playback.
+ */
+class StreamWindow {
+public:
+  // Piece indices [first, last] covering a byte range
+  struct PieceRange {
+    uint32_t first;
+    uint32_t last;
+  };
+
+  // How far ahead the window reaches and how fast it moves
+  struct Settings {
+    int64_t bitrate = 256 * 1024;  // Playback rate in bytes per second
+    int64_t windowBytes = 4 << 20; // Bytes with deadlines ahead
+  };
+
+  /**
+   * @brief Stream one file of a torrent
+   * @param picker Picker for the torrent; must outlive the window
+   * @param torrent The torrent, for its file layout
+   * @param fileIndex Index into torrent.getFiles()
+   * @param settings Bitrate and window size
+   * @throws std::out_of_range if the file does not exist
+   * @throws std::invalid_argument if it is a padding file or empty, or the
+   * bitrate or window is not positive
+   */
+  StreamWindow(PiecePicker &picker, const TorrentFile &torrent,
+               size_t fileIndex, const Settings &settings);
+
+  ~StreamWindow();
+  StreamWindow(const StreamWindow &) = delete;
+  StreamWindow &operator=(const StreamWindow &) = delete;
+
+  /**
+   * @brief Announce a read and move the window to it
+   * @param offset Byte offset of the read within the file
+   * @param length Bytes wanted now, at least one
+   * @param nowMicros Current time in the picker's deadline clock
+   * @return The pieces holding the read, clipped to the end of the file;
+   * the caller reads once it has verified all of them
+   * @throws std::out_of_range if the offset is outside the file
+   * @throws std::invalid_argument if the length is not positive
+   */
+  PieceRange read(int64_t offset, int64_t length, int64_t nowMicros);
+
+  /**
+   * @brief Remove every deadline the window has set
+   */
+  void stop();
+
+  /**
+   * @brief Get the pieces holding a byte range of the file
+   * @param offset Byte offset within the file
+   * @param length Length of the range, at least one byte
+   * @return Piece range, clipped to the end of the file
+   * @throws std::out_of_range if the offset is outside the file
+   * @throws std::invalid_argument if the length is not positive
+   */
+  PieceRange pieces(int64_t offset, int64_t length) const;
+
+  int64_t fileSize() const;  // Size of the streamed file in bytes
+  int64_t fileStart() const; // Offset of its first byte in the torrent
+
+private:
+  PiecePicker &picker;
+  Settings settings;
+  int64_t start;       // Offset of the file in the torrent content
+  int64_t size;        // Size of the file
+  int64_t pieceLength; // Nominal piece length
+  PieceRange window{0, 0};
+  bool active = false; // Deadlines set for window
+};
+
+#endif // STREAMWINDOW_HPP
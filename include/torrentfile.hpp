@@ -2,7 +2,13 @@
 #define TORRENTFILE_HPP
 
 #include <bencode.hpp>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <parsestats.hpp>
+#include <scheduler.hpp>
 #include <string>
+#include <string_view>
 #include <vector>
 
 /**
@@ -21,6 +27,12 @@ std::string readTorrentFile(const std::string &filepath);
  * for the BitTorrent protocol. The metadata is stored in Bencode format and
  * includes both required and optional fields as specified in the BitTorrent
  * protocol specification.
+ *
+ * The parsed data is kept, shared between copies, so that keys this class
+ * does not interpret stay available as raw byte spans and toBencode() can
+ * write the torrent back: unchanged entries are copied verbatim and only
+ * fields changed through the setters are encoded again. The info
+ * dictionary is never re-encoded, so the info hash is preserved.
  */
 class TorrentFile {
 public:
@@ -29,10 +41,18 @@ public:
    *
    * For single-file torrents, only one FileInfo is used.
    * For multi-file torrents, each file in the torrent has its own FileInfo.
+   * Padding files are listed too, since pieces span them, and are marked
+   * so that storage and verification can treat them as zeros.
    */
   struct FileInfo {
     std::string path; // Full path of the file within the torrent
     int64_t length;   // Size of the file in bytes
+
+    // BEP 47 attributes
+    bool padding = false;    // p: zeros aligning the next file, not stored
+    bool executable = false; // x
+    bool hidden = false;     // h
+    std::string symlink{};   // l: target path joined with '/', else empty
   };
 
   /**
@@ -43,6 +63,46 @@ public:
    */
   explicit TorrentFile(const std::string &filepath);
 
+  /**
+   * @brief Construct a TorrentFile from Bencode data already in memory
+   * @param torrentData Content of a .torrent file
+   * @return The parsed torrent
+   * @throws std::runtime_error if the data is invalid or required fields are
+   * missing
+   */
+  static TorrentFile fromBencode(std::string_view torrentData);
+
+  /**
+   * @brief Compute the v1 info hash of a torrent
+   * @param torrentData Content of a .torrent file
+   * @return The 20-byte SHA-1 of the info dictionary, hashed as it appears
+   * in the data
+   * @throws std::runtime_error if the data has no info dictionary
+   */
+  static std::string computeInfoHash(std::string_view torrentData);
+
+  /**
+   * @brief Callback receiving the result of one load of loadMany
+   * @param index Index of the file in the path list
+   * @param torrent The parsed torrent, or nullptr if the load failed
+   * @param error Why the load failed, empty on success
+   */
+  using LoadCallback = std::function<void(
+      size_t index, const TorrentFile *torrent, const std::string &error)>;
+
+  /**
+   * @brief Load many .torrent files in parallel
+   * @param paths Files to load
+   * @param onLoad Called once per file, from whichever thread loaded it;
+   * must be thread-safe
+   * @param scheduler Scheduler the loads run on; the call blocks until all
+   * loads are done
+   * @throws Whatever onLoad throws, after all other loads finished
+   */
+  static void loadMany(const std::vector<std::string> &paths,
+                       const LoadCallback &onLoad,
+                       Scheduler &scheduler = Scheduler::shared());
+
   // Getter methods for torrent metadata
 
   /**
@@ -77,10 +137,16 @@ public:
 
   /**
    * @brief Get the total size of all files in the torrent
-   * @return Combined size in bytes of all files
+   * @return Combined size in bytes of all files, padding files included
    */
   int64_t getTotalSize() const;
 
+  /**
+   * @brief Get the size of the padding files (BEP 47)
+   * @return Combined size in bytes of the files marked as padding
+   */
+  int64_t getPaddingSize() const;
+
   /**
    * @brief Get the client that created the torrent (optional)
    * @return Name/version of the client that created the torrent
@@ -100,6 +166,67 @@ public:
    */
   bool isSingleFile() const;
 
+  /**
+   * @brief Get the free-form comment of the torrent (optional)
+   * @return The comment, empty if not specified
+   */
+  const std::string &getComment() const;
+
+  /**
+   * @brief Bencode entry of the original data, see getExtraFields()
+   */
+  using RawField = BencodeParser::RawEntry;
+
+  /**
+   * @brief Get the root entries this class does not interpret
+   * @return Entries such as announce-list or custom keys, in file order, as
+   * views into the parsed data; later edits are not reflected
+   */
+  const std::vector<RawField> &getExtraFields() const;
+
+  /**
+   * @brief Get the info dictionary entries this class does not interpret
+   * @return Entries such as private or source, in file order, as views into
+   * the parsed data
+   */
+  const std::vector<RawField> &getExtraInfoFields() const;
+
+  /**
+   * @brief Get the info dictionary exactly as it appears in the data
+   * @return Its encoding, which the info hash is computed over
+   */
+  std::string_view getRawInfo() const;
+
+  // Editing, for toBencode(); an empty string or a zero date removes the key
+
+  void setAnnounce(const std::string &url);      // announce
+  void setComment(const std::string &text);      // comment
+  void setCreatedBy(const std::string &client);  // created by
+  void setCreationDate(int64_t date);            // creation date
+
+  /**
+   * @brief Set a root entry that has no typed setter
+   * @param key The key, such as announce-list
+   * @param encodedValue Its new value, Bencode-encoded
+   * @throws std::invalid_argument if the key is info or has a typed setter,
+   * or the value is not exactly one Bencode value
+   */
+  void setField(std::string_view key, std::string_view encodedValue);
+
+  /**
+   * @brief Remove a root entry that has no typed setter
+   * @param key The key
+   * @throws std::invalid_argument if the key is info or has a typed setter
+   */
+  void removeField(std::string_view key);
+
+  /**
+   * @brief Encode the torrent, with its edits, as Bencode
+   * @return The parsed data with edited entries replaced, removed or
+   * inserted at their sorted place; byte-identical to it without edits
+   */
+  std::string toBencode() const;
+
 private:
   // Torrent metadata fields
   std::string announce;            // Tracker URL
@@ -108,9 +235,37 @@ private:
   std::vector<std::string> pieces; // SHA-1 hashes of all pieces
   std::vector<FileInfo> files;     // Information about each file
   int64_t totalSize = 0;           // Combined size of all files
+  int64_t paddingSize = 0;         // Combined size of padding files
   std::string createdBy;           // Client that created the torrent
   int64_t creationDate = 0;        // Creation timestamp
   bool singleFile = true; // Whether torrent contains one or multiple files
+  std::string comment;     // Free-form comment
+
+  // The data parsed from, shared by copies so that the views stay valid
+  std::shared_ptr<const std::string> source;
+  std::vector<RawField> rootFields;      // All root entries, in file order
+  std::vector<RawField> extraFields;     // Root entries not interpreted
+  std::vector<RawField> extraInfoFields; // Info entries not interpreted
+  std::string_view rawInfo;              // Encoding of the info dictionary
+
+  // Root keys changed since parsing, to their new encoding or nullopt if
+  // removed
+  BencodeEncoder::Edits edits;
+
+  /**
+   * @brief Construct an empty TorrentFile, filled in by parseTorrentData
+   */
+  TorrentFile() = default;
+
+  /**
+   * @brief Parse Bencode-encoded torrent data into this object
+   * @param torrentData Content of a .torrent file
+   * @param sample Measurements of this load, or nullptr if not recording
+   * @throws std::runtime_error if the data is invalid or required fields are
+   * missing
+   */
+  void parseTorrentData(std::string_view torrentData,
+                        ParseStats::Sample *sample = nullptr);
 
   /**
    * @brief Parse the main dictionary of the torrent file
@@ -132,6 +287,19 @@ private:
    * @throws std::runtime_error if file information is invalid
    */
   void parseFilesList(const BencodeValue::List &filesList);
+
+  /**
+   * @brief Record the raw entries of the root and info dictionaries
+   * @throws std::runtime_error if the data is not a dictionary
+   */
+  void indexRawFields();
+
+  /**
+   * @brief Record an edit of a root key
+   * @param key The key
+   * @param encodedValue Its new encoding, or nullopt to remove it
+   */
+  void edit(std::string_view key, std::optional<std::string> encodedValue);
 };
 
 #endif // TORRENTFILE_HPP
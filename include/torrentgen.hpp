@@ -0,0 +1,129 @@
+#ifndef TORRENTGEN_HPP
+#define TORRENTGEN_HPP
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Generates synthetic but valid .torrent files for scale testing
+ *
+ * Every torrent is a pure function of the seed and its index, so a corpus can
+ * be regenerated exactly, split across processes, or extended later without
+ * changing earlier files. Torrents carry no real content: piece hashes are
+ * random bytes of the right length, which is all a metadata parser sees.
+ *
+ * The output is written directly as canonical Bencode (sorted keys) without
+ * building a BencodeValue tree, so generating millions of torrents is limited
+ * by the file system rather than the generator.
+ *
+ * With v2 enabled the torrents are hybrid v1/v2 (BEP 52): the info dictionary
+ * has "meta version", a "file tree" and the v1 "files" list padded with BEP 47
+ * pad files so every file starts on a piece boundary, and the root has
+ * "piece layers".
+ */
+class TorrentGenerator {
+public:
+  /**
+   * @brief Shape of the generated torrents; ranges are inclusive
+   *
+   * Piece lengths are powers of two. With targetPieces set, each torrent
+   * uses the smallest allowed piece length that gives at most that many
+   * pieces, as torrent creators do; otherwise the length is random.
+   */
+  struct Options {
+    uint64_t seed = 1;                  // Seed of the whole corpus
+    uint32_t minFiles = 1;              // Fewest files per torrent
+    uint32_t maxFiles = 1;              // Most files, 1 = single-file
+    uint32_t maxPathDepth = 3;          // Most directories above a file
+    uint32_t minNameLength = 4;         // Shortest name in bytes
+    uint32_t maxNameLength = 40;        // Longest name, log-uniform
+    int64_t minFileSize = 1024;         // Smallest file in bytes
+    int64_t maxFileSize = 64LL << 20;   // Largest file, log-uniform
+    int64_t minPieceLength = 16 * 1024; // Smallest piece length
+    int64_t maxPieceLength = 16 << 20;  // Largest piece length
+    uint32_t targetPieces = 1500;       // Piece count to aim for, 0 = random
+    uint32_t extraKeys = 0;             // Unknown keys in root and info
+    bool v2 = false;                    // Hybrid v1/v2 torrents
+    bool announceList = true;           // Add a tiered announce-list
+  };
+
+  /**
+   * @brief Construct a generator
+   * @param options Shape of the generated torrents
+   * @throws std::invalid_argument if a range is empty or a size is not
+   * positive
+   */
+  explicit TorrentGenerator(const Options &options);
+
+  /**
+   * @brief Generate one torrent
+   * @param index Position of the torrent in the corpus
+   * @return Bencoded .torrent data
+   */
+  std::string generate(uint64_t index) const;
+
+  /**
+   * @brief Generate one torrent into a reusable buffer
+   * @param index Position of the torrent in the corpus
+   * @param out Buffer that receives the .torrent data (cleared first)
+   */
+  void generate(uint64_t index, std::string &out) const;
+
+  const Options &getOptions() const; // The generator's options
+
+private:
+  // A file of the generated torrent
+  struct File {
+    std::vector<std::string> path; // Path components
+    int64_t length;                // Size in bytes
+    bool padding;                  // BEP 47 pad file
+  };
+
+  // Keys and encoded values of a dictionary under construction
+  using Entries = std::vector<std::pair<std::string, std::string>>;
+
+  Options options;
+
+  /**
+   * @brief Small deterministic random number generator (splitmix64)
+   */
+  class Random {
+  public:
+    explicit Random(uint64_t seed) : state(seed) {}
+    uint64_t next();
+    uint64_t below(uint64_t bound);                // Uniform in [0, bound)
+    int64_t logUniform(int64_t low, int64_t high); // Log-uniform in range
+    void bytes(std::string &out, size_t count);    // Append random bytes
+
+  private:
+    uint64_t state;
+  };
+
+  /**
+   * @brief Append a random name without dots
+   * @param random Random source
+   * @param out Buffer the name is appended to
+   */
+  void appendName(Random &random, std::string &out) const;
+
+  /**
+   * @brief Choose the files of a torrent
+   * @param random Random source
+   * @param name Torrent name, used as path for single-file torrents
+   * @return Files in torrent order
+   */
+  std::vector<File> makeFiles(Random &random, const std::string &name) const;
+
+  /**
+   * @brief Add unknown keys with random values to a dictionary
+   * @param random Random source
+   * @param prefix Key prefix
+   * @param entries Keys and encoded values of the dictionary
+   */
+  void addExtraKeys(Random &random, const std::string &prefix,
+                    Entries &entries) const;
+};
+
+#endif // TORRENTGEN_HPP
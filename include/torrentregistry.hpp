@@ -0,0 +1,185 @@
+#ifndef TORRENTREGISTRY_HPP
+#define TORRENTREGISTRY_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <epoch.hpp>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <torrentfile.hpp>
+
+/**
+ * @brief Info hash identifying a torrent: 20-byte SHA-1 (v1) or 32-byte
+ * SHA-256 (v2)
+ */
+class InfoHash {
+public:
+  static constexpr size_t kMaxSize = 32;
+
+  InfoHash() = default;
+
+  /**
+   * @brief Wrap a binary digest
+   * @param digest 20 or 32 bytes
+   * @throws std::invalid_argument for any other length
+   */
+  explicit InfoHash(std::string_view digest);
+
+  /**
+   * @brief Get the digest
+   * @return The 20 or 32 bytes, empty for a default-constructed hash
+   */
+  std::string_view view() const {
+    return {reinterpret_cast<const char *>(bytes), length};
+  }
+
+  /**
+   * @brief Get a 64-bit hash for table lookups
+   * @return The first eight bytes of the digest, which are already uniform
+   */
+  uint64_t hash() const {
+    uint64_t value;
+    std::memcpy(&value, bytes, sizeof(value));
+    return value;
+  }
+
+  bool operator==(const InfoHash &other) const {
+    return length == other.length &&
+           std::memcmp(bytes, other.bytes, kMaxSize) == 0;
+  }
+  bool operator!=(const InfoHash &other) const { return !(*this == other); }
+
+private:
+  uint8_t bytes[kMaxSize] = {}; // Digest, zero-padded
+  uint8_t length = 0;
+};
+
+/**
+ * @brief Concurrent map from info hash to loaded torrent
+ *
+ * Built for lookups on every peer handshake and tracker request while
+ * torrents are added and removed now and then. Lookups take no locks and
+ * write no shared memory: the map is split into 64 shards, each an
+ * open-addressing table with linear probing, and readers probe a shard's
+ * current table under an Epoch::Guard. Writers lock one shard. Removed
+ * entries and outgrown tables are reclaimed through Epoch, so a reader
+ * holding a guard may keep using what it found.
+ *
+ * Info hashes are cryptographic digests, so their first bytes serve as the
+ * hash without mixing: the top bits pick the shard and the low bits the
+ * slot. Each slot keeps the hash next to the entry pointer so that probing
+ * past other keys does not touch their entries.
+ */
+class TorrentRegistry {
+public:
+  /**
+   * @brief Create an empty registry
+   * @param expected Number of torrents to size the tables for; tables
+   * grow as needed either way
+   */
+  explicit TorrentRegistry(size_t expected = 0);
+
+  /**
+   * @brief Delete all entries; no other thread may use the registry
+   */
+  ~TorrentRegistry();
+
+  TorrentRegistry(const TorrentRegistry &) = delete;
+  TorrentRegistry &operator=(const TorrentRegistry &) = delete;
+
+  /**
+   * @brief Add a torrent
+   * @param key The torrent's info hash
+   * @param torrent The torrent
+   * @return true if added, false if the key was present (the registry is
+   * left unchanged)
+   */
+  bool insert(const InfoHash &key, std::shared_ptr<const TorrentFile> torrent);
+
+  /**
+   * @brief Add a torrent or replace the one under its key
+   * @param key The torrent's info hash
+   * @param torrent The torrent
+   * @return true if added, false if an entry was replaced
+   *
+   * A replaced key stays present throughout: concurrent lookups find
+   * either the old torrent or the new one.
+   */
+  bool assign(const InfoHash &key, std::shared_ptr<const TorrentFile> torrent);
+
+  /**
+   * @brief Remove a torrent
+   * @param key The torrent's info hash
+   * @return true if it was present
+   *
+   * Readers that found the torrent before the removal may keep using it
+   * until their guard ends.
+   */
+  bool erase(const InfoHash &key);
+
+  /**
+   * @brief Look up a torrent without touching its reference count
+   * @param guard Guard of the calling thread, which must outlive any use
+   * of the result
+   * @param key Info hash to look up
+   * @return The torrent, or nullptr if absent
+   */
+  const TorrentFile *find(const Epoch::Guard &guard,
+                          const InfoHash &key) const;
+
+  /**
+   * @brief Look up a torrent and take a reference to it
+   * @param key Info hash to look up
+   * @return The torrent, or nullptr if absent
+   */
+  std::shared_ptr<const TorrentFile> get(const InfoHash &key) const;
+
+  /**
+   * @brief Get the number of torrents
+   * @return Torrent count at some point during the call
+   */
+  size_t size() const { return count.load(std::memory_order_relaxed); }
+
+private:
+  static constexpr unsigned kShardBits = 6;
+  static constexpr size_t kShards = size_t(1) << kShardBits;
+
+  struct Entry {
+    InfoHash key;
+    std::shared_ptr<const TorrentFile> torrent;
+  };
+
+  struct Slot {
+    std::atomic<uint64_t> hash{0};          // key.hash() of the entry
+    std::atomic<Entry *> entry{nullptr};    // nullptr ends a probe
+  };
+
+  struct Table {
+    explicit Table(size_t capacity);
+    size_t mask;
+    std::unique_ptr<Slot[]> slots;
+  };
+
+  struct alignas(64) Shard {
+    std::mutex mutex;             // Held by writers
+    std::atomic<Table *> table{nullptr};
+    size_t live = 0;              // Entries, under mutex
+    size_t removed = 0;           // Tombstone slots, under mutex
+  };
+
+  Shard shards[kShards];
+  std::atomic<size_t> count{0};
+
+  static Entry tombstone;         // Marks a slot whose entry was removed
+
+  // Body of insert() and assign()
+  bool store(const InfoHash &key, std::shared_ptr<const TorrentFile> torrent,
+             bool replace);
+  const Entry *lookup(const InfoHash &key) const; // Caller holds a guard
+  void rebuild(Shard &shard, size_t capacity);    // Caller holds the mutex
+};
+
+#endif // TORRENTREGISTRY_HPP
@@ -0,0 +1,139 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cycleclock.hpp>
+#include <ostream>
+#include <string>
+
+/**
+ * @brief Span recording in the Chrome trace event format
+ *
+ * Spans are recorded with TRACE_SCOPE into a ring buffer owned by the
+ * recording thread, so recording takes no locks and threads never write to
+ * each other's memory. Each buffer keeps the most recent events; older ones
+ * are overwritten. writeChromeJson() copies all buffers on demand and writes
+ * JSON that chrome://tracing and Perfetto (ui.perfetto.dev) open directly.
+ *
+ * Recording is compiled in and off by default. Disabled, a span costs one
+ * relaxed load of the enabled flag. Enabled, it costs two cycle counter reads
+ * and seven stores into the thread's buffer: tens of nanoseconds, little
+ * enough to stay on in production for spans of microseconds or more, such as
+ * parses, hashes and disk reads. bench_parse measures it.
+ *
+ * Span names, categories and argument names must be string literals or
+ * otherwise outlive the trace, since only the pointers are recorded.
+ */
+class Trace {
+public:
+  /**
+   * @brief Start recording
+   * @param eventsPerThread Capacity of each thread's ring buffer, rounded
+   * up to a power of two; applies to threads that record their first span
+   * after this call
+   *
+   * Calibrates the cycle clock on the first call.
+   */
+  static void enable(size_t eventsPerThread = 16384);
+
+  /**
+   * @brief Stop recording; recorded events are kept
+   */
+  static void disable();
+
+  /**
+   * @brief Check whether spans are recorded
+   * @return true if recording is enabled
+   */
+  static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Name the calling thread in the trace
+   * @param name Thread name shown by the viewer
+   */
+  static void setThreadName(const std::string &name);
+
+  /**
+   * @brief Drop all recorded events
+   *
+   * Events recorded concurrently with the call may survive it.
+   */
+  static void clear();
+
+  /**
+   * @brief Write all buffered events as Chrome trace JSON
+   * @param out Stream the JSON object is written to
+   *
+   * Safe to call while other threads record; events they overwrite during
+   * the copy are left out.
+   */
+  static void writeChromeJson(std::ostream &out);
+
+  /**
+   * @brief Write all buffered events as Chrome trace JSON to a file
+   * @param path Output file
+   * @throws std::runtime_error if the file cannot be written
+   */
+  static void writeChromeJson(const std::string &path);
+
+  /**
+   * @brief Span from construction to destruction, see TRACE_SCOPE
+   */
+  class Scope {
+  public:
+    /**
+     * @brief Start a span if recording is enabled
+     * @param name Span name
+     * @param category Comma-separated categories, for filtering in viewers
+     * @param argName Name of a numeric argument shown with the span, or
+     * nullptr for none
+     * @param arg Value of the argument
+     */
+    Scope(const char *name, const char *category,
+          const char *argName = nullptr, int64_t arg = 0)
+        : name(name), category(category), argName(argName), arg(arg),
+          start(isEnabled() ? CycleClock::now() : 0) {}
+
+    ~Scope() {
+      if (start != 0) {
+        record(name, category, argName, arg, start, CycleClock::now());
+      }
+    }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    const char *name;
+    const char *category;
+    const char *argName;
+    int64_t arg;
+    uint64_t start; // Ticks at construction, 0 when not recording
+  };
+
+private:
+  static inline std::atomic<bool> enabled{false};
+
+  /**
+   * @brief Append a finished span to the calling thread's buffer
+   */
+  static void record(const char *name, const char *category,
+                     const char *argName, int64_t arg, uint64_t start,
+                     uint64_t end);
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+/**
+ * @brief Record the enclosing block as a span
+ *
+ * TRACE_SCOPE("sha1.hash", "hash") or, with a numeric argument,
+ * TRACE_SCOPE("storage.read", "disk", "bytes", length).
+ */
+#define TRACE_SCOPE(...)                                                       \
+  Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
+
+#endif // TRACE_HPP
@@ -0,0 +1,74 @@
+#ifndef TRACKERREWRITER_HPP
+#define TRACKERREWRITER_HPP
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Tracker migration over raw .torrent data
+ *
+ * Rewrites the announce and announce-list entries of a torrent without
+ * building a TorrentFile: the root dictionary is split into byte spans,
+ * only the two tracker values are decoded, and every other entry is
+ * copied verbatim. The info dictionary is skipped by its length prefixes,
+ * never decoded, and is checked to be byte-identical in the output, so
+ * the info hash cannot change.
+ *
+ * A rewriter is immutable once built and can be shared between threads.
+ */
+class TrackerRewriter {
+public:
+  /**
+   * @brief Tracker changes to apply
+   */
+  struct Options {
+    // Tracker URL to its replacement, applied to announce and to every
+    // announce-list URL; an empty replacement removes the URL
+    std::unordered_map<std::string, std::string> replace;
+    // Announce URL to set after replacing, empty to remove the key
+    std::optional<std::string> announce;
+    // Announce-list tiers to set after replacing, empty to remove the key
+    std::optional<std::vector<std::vector<std::string>>> announceList;
+    bool computeInfoHash = false; // Fill Result::infoHash
+  };
+
+  /**
+   * @brief Outcome of one rewrite
+   */
+  struct Result {
+    bool changed = false; // Output differs from the input
+    std::string infoHash; // 20-byte v1 info hash, if requested
+  };
+
+  /**
+   * @brief Build a rewriter
+   * @param options Changes to apply
+   */
+  explicit TrackerRewriter(Options options);
+
+  /**
+   * @brief Rewrite the trackers of one torrent
+   * @param input Content of a .torrent file
+   * @param out Receives the rewritten torrent, or a copy of input if
+   * nothing changed
+   * @return What was done
+   * @throws std::runtime_error if the input is not a torrent, its tracker
+   * entries are malformed, or its info dictionary would change
+   *
+   * Entries other than announce and announce-list, unknown keys and
+   * non-canonical encodings included, are kept byte for byte. Tiers left
+   * empty by removals are dropped, and so is an announce-list left empty;
+   * tiers and announce-lists that were empty in the input are kept.
+   */
+  Result rewrite(std::string_view input, std::string &out) const;
+
+private:
+  Options options;
+
+  std::optional<std::string> mapUrl(const std::string &url) const;
+};
+
+#endif // TRACKERREWRITER_HPP
@@ -0,0 +1,146 @@
+#ifndef TRIGRAMINDEX_HPP
+#define TRIGRAMINDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <torrentfile.hpp>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Substring search over torrent names and file paths
+ *
+ * Each added torrent becomes a document numbered in insertion order. For
+ * every trigram (three consecutive bytes) of a document's strings the index
+ * keeps a posting list of the documents containing it. A query looks up the
+ * lists of its own trigrams, intersects them into candidates and verifies
+ * each candidate against the stored strings, so results are exact: a query
+ * matches a document if it is a substring of its name or of one of its
+ * paths (not across two of them). Matching ignores ASCII case.
+ *
+ * Posting lists are split into blocks of kBlockSize documents. A block is
+ * stored as the gaps between its document numbers in LEB128 varints (one
+ * byte for most gaps in common trigrams) and is found through a skip entry
+ * holding its first document, so an intersection decodes only the blocks
+ * that can hold a candidate. Decoded blocks are intersected with SSE2
+ * compares where available.
+ *
+ * Adding a document only buffers its (trigram, document) pairs. commit()
+ * sorts the buffer by trigram and appends each list's new documents in one
+ * go, so building touches every posting list once per commit instead of
+ * once per document; add() commits on its own every kCommitPairs pairs.
+ * Searches see the documents added up to the last commit.
+ *
+ * Queries shorter than three bytes have no trigrams and scan all strings.
+ * The index is not thread-safe for writers; concurrent searches are fine.
+ */
+class TrigramIndex {
+public:
+  static constexpr size_t kBlockSize = 128;        // Documents per block
+  static constexpr size_t kCommitPairs = 1 << 22;  // Pairs buffered at most
+
+  /**
+   * @brief Counters describing one search
+   */
+  struct SearchStats {
+    size_t lists = 0;      // Posting lists intersected
+    size_t blocks = 0;     // Posting blocks decoded
+    size_t candidates = 0; // Documents verified against their strings
+    size_t matches = 0;    // Documents that contained the query
+  };
+
+  /**
+   * @brief Add a torrent's name and file paths
+   * @param torrent The torrent
+   * @return The torrent's document number, searchable after the next
+   * commit
+   * @throws std::length_error past 2^31 documents
+   */
+  uint32_t add(const TorrentFile &torrent);
+
+  /**
+   * @brief Add a document made of arbitrary strings
+   * @param strings Strings searched independently of each other
+   * @return The document number, searchable after the next commit
+   * @throws std::length_error past 2^31 documents
+   */
+  uint32_t add(const std::vector<std::string_view> &strings);
+
+  /**
+   * @brief Make all added documents searchable
+   */
+  void commit();
+
+  /**
+   * @brief Find the documents containing a substring
+   * @param query Substring to look for; ASCII case is ignored
+   * @param limit Most documents to return
+   * @param stats If not nullptr, receives counters describing the search
+   * @return Matching committed document numbers in increasing order; all
+   * of them for an empty query
+   */
+  std::vector<uint32_t>
+  search(std::string_view query,
+         size_t limit = std::numeric_limits<size_t>::max(),
+         SearchStats *stats = nullptr) const;
+
+  /**
+   * @brief Get the number of documents
+   * @return Document count, including those not committed yet
+   */
+  size_t size() const { return textOffsets.size(); }
+
+  /**
+   * @brief Get the number of distinct trigrams
+   * @return Posting list count
+   */
+  size_t numTrigrams() const { return lists.size(); }
+
+  /**
+   * @brief Get the memory held by strings and postings
+   * @return Pair of byte counts: stored strings, then posting lists with
+   * their skip entries
+   */
+  std::pair<size_t, size_t> memoryUsage() const;
+
+  /**
+   * @brief Release spare capacity left by adding documents
+   */
+  void shrinkToFit();
+
+private:
+  struct Skip {
+    uint32_t firstDoc; // First document of the block
+    uint32_t offset;   // Offset of the block's gaps in bytes
+  };
+
+  struct PostingList {
+    std::vector<uint8_t> bytes; // Varint gaps, block after block
+    std::vector<Skip> skips;    // One entry per block
+    uint32_t count = 0;         // Documents in the list
+    uint32_t lastDoc = 0;       // Most recent document, for the next gap
+  };
+
+  // Case-folded strings of all documents, each followed by a zero byte
+  std::string text;
+  std::vector<uint64_t> textOffsets; // Start of each document in text
+
+  std::unordered_map<uint32_t, uint32_t> trigramLists; // Trigram to list
+  std::vector<PostingList> lists;
+
+  // (trigram << 32 | document) of documents added since the last commit,
+  // in document order
+  std::vector<uint64_t> pending;
+  uint32_t committed = 0; // Documents covered by the posting lists
+
+  std::string_view documentText(uint32_t doc) const;
+  size_t decodeBlock(const PostingList &list, size_t block,
+                     uint32_t *out) const;
+  void intersect(const PostingList &list, std::vector<uint32_t> &candidates,
+                 SearchStats &stats) const;
+};
+
+#endif // TRIGRAMINDEX_HPP
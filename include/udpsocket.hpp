@@ -0,0 +1,192 @@
+#ifndef UDPSOCKET_HPP
+#define UDPSOCKET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+/**
+ * @brief A UDP socket shared by the protocols of one event loop
+ *
+ * DHT, UDP trackers and uTP all exchange small datagrams on the client's
+ * one UDP port. Sending and receiving them one system call each costs
+ * more than the protocols' own work, so this socket moves them in
+ * batches: receive() drains the socket with recvmmsg() into a slab of
+ * preallocated slots, and send() gathers datagrams into a second slab
+ * that flush() hands to sendmmsg(). Runs of datagrams of one size to one
+ * destination, such as a uTP connection's full data packets, are further
+ * coalesced into single UDP_SEGMENT (GSO) messages that the kernel splits
+ * as late as possible, when the kernel supports it.
+ *
+ * Received datagrams are dispatched by protocol: routes are tried in the
+ * order they were added and the first whose match function accepts the
+ * datagram gets it. isUtp() and isBencode() tell uTP packets and DHT
+ * messages apart by their first bytes; UDP tracker responses have no
+ * such mark and take a catch-all route added last.
+ *
+ * IPv4 only. Not thread-safe: one thread sends, receives and handles.
+ */
+class UdpSocket {
+public:
+  /**
+   * @brief Settings of a socket
+   */
+  struct Options {
+    std::string address = "0.0.0.0"; // IPv4 address to bind
+    uint16_t port = 0;               // 0 picks a free port
+    size_t batchSize = 64;           // Datagrams per mmsg call
+    size_t slotSize = 2048;          // Largest datagram handled
+    bool segmentation = true;        // Coalesce sends with UDP_SEGMENT
+    int bufferBytes = 4 << 20;       // SO_RCVBUF and SO_SNDBUF
+  };
+
+  /**
+   * @brief Counters since construction
+   */
+  struct Stats {
+    uint64_t datagramsReceived = 0;
+    uint64_t datagramsSent = 0;
+    uint64_t receiveCalls = 0; // recvmmsg() calls
+    uint64_t sendCalls = 0;    // sendmmsg() calls
+    uint64_t segmented = 0;    // Datagrams sent inside GSO messages
+    uint64_t truncated = 0;    // Received datagrams larger than a slot
+    uint64_t unrouted = 0;     // Received datagrams no route matched
+    uint64_t dropped = 0;      // Datagrams the kernel refused to send
+  };
+
+  // Tells whether a datagram belongs to a route
+  using Match = std::function<bool(const char *data, size_t length)>;
+
+  // Handles a received datagram; data is valid during the call only
+  using Handler = std::function<void(const char *data, size_t length,
+                                     const sockaddr_in &from)>;
+
+  /**
+   * @brief Open and bind the socket
+   * @param options Settings
+   * @throws std::runtime_error if the socket cannot be bound
+   * @throws std::invalid_argument if batchSize or slotSize is 0, or the
+   * address is not IPv4
+   */
+  explicit UdpSocket(const Options &options);
+  ~UdpSocket();
+
+  UdpSocket(const UdpSocket &) = delete;
+  UdpSocket &operator=(const UdpSocket &) = delete;
+
+  /**
+   * @brief Add a route for received datagrams, after the existing ones
+   * @param match Accepts the route's datagrams
+   * @param handler Receives them
+   * @return Identifier of the route, for unroute()
+   */
+  size_t route(Match match, Handler handler);
+
+  /**
+   * @brief Stop dispatching to a route, as its handler goes away
+   * @param id Identifier route() returned
+   */
+  void unroute(size_t id);
+
+  /**
+   * @brief Receive waiting datagrams and dispatch them
+   * @param maxBatches recvmmsg() calls at most, so that a flood of
+   * datagrams cannot keep the caller from sending
+   * @return Datagrams received
+   */
+  size_t receive(size_t maxBatches = 16);
+
+  /**
+   * @brief Queue a datagram, sending the batch once it is full
+   * @param to Destination
+   * @param data The datagram
+   * @param length Its size, at most slotSize
+   * @throws std::invalid_argument if the datagram is larger than a slot
+   */
+  void send(const sockaddr_in &to, const char *data, size_t length);
+
+  /**
+   * @brief Send the queued datagrams
+   *
+   * Datagrams the kernel refuses, for a full buffer or an unreachable
+   * destination, are dropped and counted, as a router would drop them.
+   */
+  void flush();
+
+  /**
+   * @brief Block until a datagram arrives
+   * @param timeoutMicros Longest wait, negative to wait indefinitely
+   * @return true if a datagram is waiting
+   */
+  bool wait(int64_t timeoutMicros);
+
+  int fd() const;               // The socket, for an outer poll loop
+  uint16_t port() const;        // Bound port
+  bool segmenting() const;      // Whether sends use UDP_SEGMENT
+  size_t slotSize() const;      // Largest datagram handled
+  size_t pending() const;       // Datagrams queued by send()
+  const Stats &stats() const;
+
+  /**
+   * @brief Build an IPv4 socket address
+   * @param address Dotted IPv4 address
+   * @param port Port
+   * @return The address
+   * @throws std::invalid_argument if the address is not IPv4
+   */
+  static sockaddr_in endpoint(const std::string &address, uint16_t port);
+
+  /**
+   * @brief Check for a uTP (BEP 29) version 1 packet
+   * @param data The datagram
+   * @param length Its size
+   * @return true if its first byte is a uTP type and version and the
+   * datagram holds a uTP header
+   */
+  static bool isUtp(const char *data, size_t length);
+
+  /**
+   * @brief Check for a bencoded dictionary, as DHT (BEP 5) messages are
+   * @param data The datagram
+   * @param length Its size
+   * @return true if it starts with 'd' and ends with 'e'
+   */
+  static bool isBencode(const char *data, size_t length);
+
+private:
+  struct Route {
+    Match match;
+    Handler handler;
+  };
+
+  const Options options;
+  int socketFd = -1;
+  uint16_t boundPort = 0;
+  bool gso = false;
+  std::vector<Route> routes;
+  Stats counters;
+
+  // Receive slab and its message headers, built once
+  std::vector<char> receiveSlab;
+  std::vector<mmsghdr> receiveMessages;
+  std::vector<iovec> receiveVectors;
+  std::vector<sockaddr_in> senders;
+
+  // Send slab; the headers are rebuilt per flush as runs coalesce
+  std::vector<char> sendSlab;
+  std::vector<sockaddr_in> destinations;
+  std::vector<size_t> lengths;
+  size_t queued = 0;
+  std::vector<mmsghdr> sendMessages;
+  std::vector<iovec> sendVectors;
+  std::vector<size_t> messageDatagrams; // Datagrams per message
+  std::vector<char> control;            // UDP_SEGMENT cmsgs
+
+  size_t buildMessages(size_t first);
+};
+
+#endif // UDPSOCKET_HPP
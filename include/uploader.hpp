@@ -0,0 +1,109 @@
+#ifndef UPLOADER_HPP
+#define UPLOADER_HPP
+
+#include <cstdint>
+#include <storage.hpp>
+#include <vector>
+
+/**
+ * @brief Sends piece messages to peers straight from storage
+ *
+ * A piece message is a 13-byte header followed by the block data. The
+ * straightforward way to send one is to read the block into a user-space
+ * buffer and write header and buffer to the socket, which copies every byte
+ * twice: from the page cache into the buffer and from the buffer into the
+ * socket. The zero-copy methods instead send the header with sendmsg() and
+ * let the kernel move the block from the page cache to the socket, one file
+ * slice at a time, so the data never enters user space:
+ *
+ * - Sendfile uses sendfile(2) from each file slice.
+ * - Splice moves each slice into a pipe and from the pipe into the socket
+ *   with splice(2), which also works where sendfile is not available for the
+ *   socket type.
+ *
+ * The header is sent with MSG_MORE so it leaves in the same segment as the
+ * start of the data. BEP 47 padding has no file to send from and goes out
+ * from a static buffer of zeros. Sockets must be in blocking mode: a call
+ * returns only once the whole message has been handed to the kernel.
+ */
+class Uploader {
+public:
+  // How the block data reaches the socket
+  enum class Method {
+    Copy,     // pread into a buffer, then sendmsg header and buffer
+    Sendfile, // sendmsg header, then sendfile from each file slice
+    Splice    // sendmsg header, then splice each slice through a pipe
+  };
+
+  /**
+   * @brief Construct an uploader reading from the given storage
+   * @param storage Storage holding the torrent content
+   * @param method How the block data is sent
+   * @throws std::runtime_error if the splice pipe cannot be created
+   */
+  explicit Uploader(Storage &storage, Method method = Method::Sendfile);
+
+  ~Uploader();
+  Uploader(const Uploader &) = delete;
+  Uploader &operator=(const Uploader &) = delete;
+
+  /**
+   * @brief Send a piece message carrying one block
+   * @param socketFd Connected blocking socket
+   * @param piece Piece index
+   * @param offset Byte offset within the piece
+   * @param length Length of the block in bytes
+   * @return Number of bytes written to the socket, header included
+   * @throws std::out_of_range if the block is outside the torrent
+   * @throws std::runtime_error if reading or sending fails; the connection
+   * is then in an unknown state and should be closed
+   */
+  int64_t sendPiece(int socketFd, uint32_t piece, uint32_t offset,
+                    uint32_t length);
+
+  Method getMethod() const; // The configured send method
+
+private:
+  Storage &storage;
+  Method method;
+  std::vector<char> buffer;  // Block buffer of the copy path
+  int pipeFds[2] = {-1, -1}; // Read and write end of the splice pipe
+  size_t pipeCapacity = 0;   // Bytes the pipe holds before splice blocks
+
+  /**
+   * @brief Send the piece header and the data of the copy path
+   * @param socketFd Connected blocking socket
+   * @param header Encoded piece header
+   * @param length Block length in bytes; the data is in buffer
+   */
+  void sendCopy(int socketFd, const uint8_t *header, uint32_t length);
+
+  /**
+   * @brief Send a file slice with sendfile
+   * @param socketFd Connected blocking socket
+   * @param slice The slice to send
+   */
+  void sendSliceSendfile(int socketFd, const Storage::FileSlice &slice);
+
+  /**
+   * @brief Send a file slice through the splice pipe
+   * @param socketFd Connected blocking socket
+   * @param slice The slice to send
+   * @param last Whether the slice ends the message
+   */
+  void sendSliceSplice(int socketFd, const Storage::FileSlice &slice,
+                       bool last);
+
+  /**
+   * @brief Create the splice pipe, discarding any previous one
+   * @throws std::runtime_error if the pipe cannot be created
+   */
+  void resetPipe();
+
+  /**
+   * @brief Close the splice pipe
+   */
+  void closePipe();
+};
+
+#endif // UPLOADER_HPP
@@ -0,0 +1,277 @@
+#ifndef UTPCONNECTION_HPP
+#define UTPCONNECTION_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+/**
+ * @brief One uTP (BEP 29) connection, without any I/O of its own
+ *
+ * uTP carries a byte stream over UDP with congestion control that backs
+ * off before a shared link's queue fills: LEDBAT measures the one-way
+ * queuing delay its own packets see and grows the window while that delay
+ * is under a target (100 ms), shrinking it above. A TCP connection on the
+ * same link fills the queue, so uTP yields to it instead of starving it.
+ *
+ * The connection is a state machine driven by its owner: receive() takes
+ * the datagrams addressed to it and poll() hands back the datagrams it
+ * wants to send, together with the time it next needs to be polled. Time
+ * is passed in as microseconds, so the same code runs on a socket loop
+ * and in simulations with virtual time.
+ *
+ * Sent packets wait in a ring indexed by sequence number until they are
+ * acknowledged, cumulatively or by selective ACK; a packet that three
+ * later ones overtook is sent again at once, and a timeout resends from
+ * the oldest. Packets arriving out of order wait in a second ring until
+ * the gap before them closes. New packets are paced over the round trip
+ * rather than sent in bursts of a window.
+ */
+class UtpConnection {
+public:
+  /**
+   * @brief Tunable parameters
+   */
+  struct Settings {
+    size_t packetPayload = 1400;           // Data bytes per packet
+    size_t sendBufferBytes = 1 << 20;      // Written, not yet acknowledged
+    size_t receiveBufferBytes = 1 << 20;   // Received, not yet read
+    int64_t targetDelayMicros = 100000;    // LEDBAT queuing delay target
+    int64_t maxWindowIncrease = 3000;      // Bytes per RTT at zero delay
+    bool pacing = true;                    // Spread packets over the RTT
+  };
+
+  // Progress of the connection
+  enum class State {
+    Idle,      // Neither connect() nor accept() called
+    SynSent,   // Waiting for the reply to our SYN
+    Connected, // Data flows; also after one side sent FIN
+    Closed,    // Both FINs exchanged and acknowledged
+    Reset      // Reset by the peer, or the peer stopped answering
+  };
+
+  // Counters since construction
+  struct Stats {
+    uint64_t packetsSent = 0;     // All packets, resends and ACKs included
+    uint64_t packetsReceived = 0; // Packets accepted for this connection
+    uint64_t bytesSent = 0;       // Payload bytes, resends included
+    uint64_t bytesReceived = 0;   // Payload bytes delivered in order
+    uint64_t resends = 0;         // Packets sent again
+    uint64_t fastResends = 0;     // Resends for packets others overtook
+    uint64_t timeouts = 0;        // Retransmission timeouts
+    uint64_t duplicates = 0;      // Data packets received twice
+  };
+
+  // Receives a datagram to send
+  using Send = std::function<void(const char *data, size_t length)>;
+
+  // Time meaning "no need to poll"
+  static constexpr int64_t kNever = std::numeric_limits<int64_t>::max();
+
+  /**
+   * @brief Construct an idle connection
+   * @param settings Parameters
+   * @throws std::invalid_argument if a buffer is smaller than a packet
+   */
+  explicit UtpConnection(const Settings &settings);
+  UtpConnection();
+
+  /**
+   * @brief Open a connection: the next poll() sends a SYN
+   * @param connectionId Identifier the peer will address us with; the
+   * owner picks one not in use for the peer's address
+   * @param nowMicros Current time
+   * @throws std::logic_error if the connection is not idle
+   */
+  void connect(uint16_t connectionId, int64_t nowMicros);
+
+  /**
+   * @brief Accept a connection from its SYN
+   * @param packet The SYN datagram
+   * @param length Its size
+   * @param initialSeq Our first sequence number, best chosen at random
+   * @param nowMicros Current time
+   * @return false if the datagram is not a valid SYN
+   * @throws std::logic_error if the connection is not idle
+   *
+   * The next poll() answers with a STATE before any data written meanwhile.
+   */
+  bool accept(const char *packet, size_t length, uint16_t initialSeq,
+              int64_t nowMicros);
+
+  /**
+   * @brief Queue bytes to send
+   * @param data The bytes
+   * @param length Their number
+   * @return Bytes accepted, less than length when the send buffer is full
+   */
+  size_t write(const char *data, size_t length);
+
+  /**
+   * @brief Take received bytes, in order
+   * @param out Buffer for the bytes
+   * @param length Its size
+   * @return Bytes copied, 0 if none are waiting
+   */
+  size_t read(char *out, size_t length);
+
+  /**
+   * @brief Finish sending: a FIN follows the bytes written so far
+   */
+  void close();
+
+  /**
+   * @brief Process a datagram addressed to this connection
+   * @param packet The datagram
+   * @param length Its size
+   * @param nowMicros Current time, when it arrived
+   */
+  void receive(const char *packet, size_t length, int64_t nowMicros);
+
+  /**
+   * @brief Send what is due and run the timers
+   * @param nowMicros Current time
+   * @param send Receives each datagram to send
+   * @return Time of the next poll needed, kNever if none; receive(),
+   * write(), read() and close() may make an earlier poll worthwhile
+   */
+  int64_t poll(int64_t nowMicros, const Send &send);
+
+  State state() const;
+  bool eof() const;                  // The peer's FIN and all before it came
+  size_t readable() const;           // Bytes read() can return
+  size_t writable() const;           // Bytes write() can take
+  size_t unacknowledged() const;     // Written bytes not yet acknowledged
+  uint16_t receiveId() const;        // Connection ID of incoming packets
+  int64_t window() const;            // Congestion window in bytes
+  int64_t rttMicros() const;         // Smoothed round-trip time, 0 unknown
+  int64_t queuingDelayMicros() const; // Latest LEDBAT delay estimate
+  const Stats &stats() const;
+
+  // Packet types (BEP 29)
+  enum PacketType : uint8_t {
+    kData = 0,
+    kFin = 1,
+    kState = 2,
+    kReset = 3,
+    kSyn = 4,
+  };
+
+  static constexpr size_t kHeaderSize = 20;
+
+  /**
+   * @brief Read the fields a socket needs to dispatch a datagram
+   * @param packet The datagram
+   * @param length Its size
+   * @param type Set to the packet type
+   * @param connectionId Set to the connection ID field
+   * @return false if it is not a uTP version 1 packet
+   */
+  static bool peek(const char *packet, size_t length, uint8_t &type,
+                   uint16_t &connectionId);
+
+  /**
+   * @brief Build a RESET for a datagram that matches no connection
+   * @param packet The datagram
+   * @param length Its size
+   * @return The RESET, or empty if the datagram is itself a RESET or
+   * invalid
+   */
+  static std::string resetFor(const char *packet, size_t length);
+
+private:
+  // A packet we sent, kept until acknowledged
+  struct OutPacket {
+    std::string payload;      // Data bytes, empty for SYN and FIN
+    uint8_t type = kData;
+    bool inFlight = false;    // Sent and not yet acknowledged
+    bool resend = false;      // Must be sent again
+    uint32_t transmissions = 0;
+    int64_t sentMicros = 0;   // Time of the latest transmission
+  };
+
+  // A packet received ahead of the next expected one
+  struct InPacket {
+    std::string payload;
+    bool present = false;
+    bool fin = false;
+  };
+
+  static constexpr size_t kRingSize = 4096; // Packets in flight, each way
+
+  Settings settings;
+  State currentState = State::Idle;
+  Stats counters;
+
+  uint16_t recvId = 0;   // Connection ID in packets we receive
+  uint16_t sendId = 0;   // Connection ID in packets we send
+  uint16_t firstSeq = 1; // Sequence number of our first packet
+  uint16_t seqNr = 1;    // Sequence number of our next packet
+  uint16_t ackNr = 0;    // Last peer packet received in order
+  uint16_t oldest = 1;   // Oldest of our packets not yet acknowledged
+  uint16_t lastAckReceived = 0; // Latest cumulative ACK from the peer
+  int duplicateAcks = 0;
+
+  // Sending side
+  std::vector<OutPacket> sendRing; // By sequence number modulo kRingSize
+  std::string unsent;              // Written bytes not yet in a packet
+  size_t unsentOffset = 0;
+  size_t flightPackets = 0;        // Packets in sendRing not acknowledged
+  size_t resendPending = 0;        // Of those, packets marked resend
+  int64_t flightBytes = 0;         // Their payload
+  int64_t bufferedBytes = 0;       // Payload in sendRing, for writable()
+  bool finQueued = false;          // close() was called
+  bool finSent = false;            // The FIN has a sequence number
+  uint16_t finSeq = 0;
+  bool finAcked = false;
+
+  // Receiving side
+  std::vector<InPacket> recvRing;  // By sequence number modulo kRingSize
+  std::string received;            // In-order bytes not yet read
+  size_t receivedOffset = 0;
+  int64_t reorderBytes = 0;        // Payload waiting in recvRing
+  size_t heldPackets = 0;          // Packets waiting in recvRing
+  bool peerFin = false;            // FIN received in order
+  bool ackPending = false;         // A STATE should go out
+  bool synAckPending = false;      // A STATE should answer the SYN
+  int64_t lastWindowSent = 0;      // Receive window in our last packet
+  uint32_t peerWindow = 0;         // Receive window the peer advertised
+  uint32_t replyMicros = 0;        // Delay of the peer's last packet
+
+  // Congestion control
+  double cwnd = 0;                 // Congestion window in bytes
+  bool slowStart = true;
+  uint16_t recoverySeq = 0;        // No further window cut before this
+  bool inRecovery = false;
+  int64_t rtt = 0;                 // Smoothed RTT, 0 until measured
+  int64_t rttVar = 0;
+  int64_t rto = 1000000;           // Retransmission timeout
+  int64_t rtoDeadline = kNever;
+  int timeoutsInRow = 0;
+  int64_t nextSendMicros = 0;      // Pacing: earliest next new packet
+  std::array<uint32_t, 2> baseDelays{}; // Minimum delay, per minute
+  int64_t baseDelayMinute = -1;    // Minute of baseDelays[1]
+  int64_t ourDelay = 0;            // Latest delay above the base
+
+  std::string scratch;             // Datagram being built
+
+  int64_t receiveWindow() const;
+  void queuePacket(uint8_t type, std::string payload);
+  void sendPacket(uint16_t seq, int64_t now, const Send &send);
+  void sendState(uint16_t seq, int64_t now, const Send &send);
+  void writeHeader(uint8_t type, uint16_t seq, int64_t now, bool sack);
+  void handleAcks(uint16_t ack, const uint8_t *sack, size_t sackLength,
+                  bool pureAck, int64_t now);
+  void acknowledge(uint16_t seq, int64_t now, int64_t &bytesAcked);
+  void updateDelay(uint32_t delaySample, int64_t now);
+  void growWindow(int64_t bytesAcked);
+  void lose(uint16_t seq);
+  void deliver(const char *data, size_t length, bool fin);
+  void checkClosed();
+};
+
+#endif // UTPCONNECTION_HPP
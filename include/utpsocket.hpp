@@ -0,0 +1,169 @@
+#ifndef UTPSOCKET_HPP
+#define UTPSOCKET_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <netinet/in.h>
+#include <random>
+#include <string>
+#include <udpsocket.hpp>
+#include <unordered_map>
+#include <utpconnection.hpp>
+
+/**
+ * @brief Runs uTP connections over one UDP socket
+ *
+ * All connections of a loop share a UdpSocket: incoming datagrams are
+ * told apart by sender address and connection ID, and a SYN from an
+ * unknown sender becomes a new connection when an accept callback is set.
+ * Each process() call receives a batch of datagrams, polls every
+ * connection, and flushes what they produced as another batch, so a busy
+ * loop spends a few system calls per batch of packets rather than one per
+ * packet. The UdpSocket is either the socket's own or one shared with the
+ * loop's other UDP protocols, on which the uTP socket adds a route.
+ *
+ * The socket can also emulate a bottleneck link on what it sends: a rate,
+ * a drop-tail queue in front of it and a one-way delay. Two sockets in one
+ * process then talk over loopback as over a slow, distant link, which is
+ * how the congestion control is tested.
+ *
+ * IPv4 only. Not thread-safe: one thread runs process() and wait() and
+ * uses the connections.
+ */
+class UtpSocket {
+public:
+  /**
+   * @brief Settings of a socket
+   */
+  struct Options {
+    UtpConnection::Settings settings;  // For every connection
+
+    // For a UDP socket of its own only
+    std::string address = "127.0.0.1"; // IPv4 address to bind
+    uint16_t port = 0;                 // 0 picks a free port
+    size_t batchSize = 64;             // Datagrams per mmsg call
+    bool segmentation = true;          // Coalesce sends with UDP_SEGMENT
+
+    // Emulated link for sent datagrams, off by default
+    int64_t delayMicros = 0;        // One-way delay added
+    int64_t rateBytesPerSecond = 0; // Bottleneck rate, 0 for none
+    int64_t queueBytes = 1 << 20;   // Queue before the bottleneck
+  };
+
+  /**
+   * @brief Counters since construction
+   */
+  struct Stats {
+    uint64_t datagramsReceived = 0; // uTP datagrams only
+    uint64_t datagramsSent = 0;
+    uint64_t resets = 0;       // RESETs sent for unknown connections
+    uint64_t linkDrops = 0;    // Datagrams the emulated queue dropped
+  };
+
+  // Receives connections opened by peers
+  using AcceptCallback =
+      std::function<void(const std::shared_ptr<UtpConnection> &)>;
+
+  /**
+   * @brief Open and bind a UDP socket of its own
+   * @param options Settings
+   * @throws std::runtime_error if the socket cannot be bound
+   * @throws std::invalid_argument if batchSize is 0
+   */
+  explicit UtpSocket(const Options &options);
+
+  /**
+   * @brief Run on a shared UDP socket, routing its uTP datagrams here
+   * @param udp The socket, which must outlive this one and whose slots
+   * must hold a packet with its headers
+   * @param options Settings; those of the UDP socket are ignored
+   * @throws std::invalid_argument if a packet does not fit a slot
+   */
+  UtpSocket(UdpSocket &udp, const Options &options);
+  ~UtpSocket();
+
+  UtpSocket(const UtpSocket &) = delete;
+  UtpSocket &operator=(const UtpSocket &) = delete;
+
+  /**
+   * @brief Open a connection; the next process() sends its SYN
+   * @param address IPv4 address of the peer
+   * @param port Its port
+   * @param nowMicros Current time
+   * @return The connection, which the socket drops once it is closed or
+   * reset and no other reference is left
+   * @throws std::invalid_argument if the address is not IPv4
+   */
+  std::shared_ptr<UtpConnection>
+  connect(const std::string &address, uint16_t port, int64_t nowMicros);
+
+  /**
+   * @brief Accept connections; without a callback SYNs are reset
+   * @param callback Called from process() for each new connection
+   */
+  void onAccept(AcceptCallback callback);
+
+  /**
+   * @brief Receive, run every connection, and send
+   * @param nowMicros Current time
+   * @return Time the next call is due at the latest, kNever if none
+   */
+  int64_t process(int64_t nowMicros);
+
+  /**
+   * @brief Block until a datagram arrives or a time is reached
+   * @param nowMicros Current time
+   * @param untilMicros Time to return at, UtpConnection::kNever to wait
+   * for a datagram only
+   */
+  void wait(int64_t nowMicros, int64_t untilMicros);
+
+  uint16_t port() const;       // Bound port
+  size_t connections() const;  // Connections in use
+  UdpSocket &socket();         // The UDP socket, for its counters
+  const Stats &stats() const;
+
+  /**
+   * @brief Read the steady clock
+   * @return Microseconds, in the time base process() expects
+   */
+  static int64_t now();
+
+private:
+  // A connection and where its datagrams go
+  struct Entry {
+    std::shared_ptr<UtpConnection> connection;
+    sockaddr_in peer;
+  };
+
+  // A datagram held by the emulated link
+  struct Delayed {
+    int64_t releaseMicros;
+    sockaddr_in to;
+    std::string data;
+  };
+
+  const Options options;
+  std::unique_ptr<UdpSocket> ownSocket; // Null on a shared socket
+  UdpSocket &udp;
+  AcceptCallback acceptCallback;
+  std::unordered_map<uint64_t, Entry> entries; // By peer and receive ID
+  std::mt19937 random;
+  Stats counters;
+  int64_t processMicros = -1; // Time of the running process() call
+  size_t routeId = 0;         // Route on the UDP socket
+
+  std::deque<Delayed> link; // In release order
+  int64_t linkFreeMicros = 0; // When the bottleneck finishes its queue
+
+  void attach();
+  void dispatch(const char *data, size_t length, const sockaddr_in &from);
+  void emit(const sockaddr_in &to, const char *data, size_t length,
+            int64_t now);
+  static uint64_t key(const sockaddr_in &address, uint16_t connectionId);
+};
+
+#endif // UTPSOCKET_HPP
@@ -0,0 +1,205 @@
+#ifndef WATCHFOLDER_HPP
+#define WATCHFOLDER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <scheduler.hpp>
+#include <string>
+#include <thread>
+#include <torrentfile.hpp>
+#include <torrentregistry.hpp>
+#include <unordered_map>
+
+/**
+ * @brief Incremental ingestion of .torrent files dropped into a directory
+ *
+ * A background thread follows the directory with inotify, so the cost of
+ * a change is that of the files it touches rather than of the whole
+ * directory. A changed file is loaded once it has settled: after a close
+ * or rename into the directory, once no event arrived for the settle time;
+ * after writes without a close, once two checks a settle time apart see
+ * the same size and modification time. Loads run on a Scheduler, and
+ * each result is reported through callbacks, which keep a catalog such as
+ * a TorrentRegistry in step with the directory.
+ *
+ * The directory is scanned in full on start and again whenever the kernel
+ * event queue overflows; a scan loads only files whose size or
+ * modification time differs from what was last loaded, and reports files
+ * that disappeared. On start, a file last modified a settle time ago or
+ * earlier counts as settled and loads at once. Only regular files directly
+ * in the directory whose names end in the extension are followed.
+ */
+class WatchFolder {
+public:
+  /**
+   * @brief Settings of a watcher
+   */
+  struct Options {
+    std::chrono::milliseconds settle{200}; // Quiet time before loading
+    std::string extension = ".torrent";    // Suffix of followed files
+    Scheduler *scheduler = nullptr;        // nullptr for Scheduler::shared()
+  };
+
+  /**
+   * @brief Receivers of the catalog changes
+   *
+   * Called from scheduler workers and the watcher thread, one call at a
+   * time and in the order the changes happened. Any may be empty; none may
+   * throw.
+   */
+  struct Callbacks {
+    // A file was loaded for the first time or after it changed; the
+    // previous version, if any, was reported through onRemoved first
+    std::function<void(const std::string &path,
+                       std::shared_ptr<const TorrentFile> torrent,
+                       const InfoHash &infoHash)>
+        onAdded;
+    // A loaded file was deleted, moved away, changed or became invalid
+    std::function<void(const std::string &path, const InfoHash &infoHash)>
+        onRemoved;
+    // A file could not be read or parsed; it is retried once it changes
+    std::function<void(const std::string &path, const std::string &error)>
+        onError;
+  };
+
+  /**
+   * @brief Counters of watcher activity since construction
+   */
+  struct Stats {
+    uint64_t events = 0;    // inotify events read
+    uint64_t loads = 0;     // Files loaded successfully
+    uint64_t failures = 0;  // Files that could not be loaded
+    uint64_t removals = 0;  // Loaded files that went away
+    uint64_t rescans = 0;   // Full directory scans, the initial one included
+    uint64_t overflows = 0; // Kernel event queue overflows
+  };
+
+  /**
+   * @brief Start watching a directory
+   * @param directory Directory to watch
+   * @param callbacks Receivers of the changes
+   * @param options Settings
+   * @throws std::runtime_error if inotify or the directory is unavailable
+   */
+  WatchFolder(std::string directory, Callbacks callbacks,
+              Options options);
+
+  /**
+   * @brief Stop watching, see stop()
+   */
+  ~WatchFolder();
+
+  WatchFolder(const WatchFolder &) = delete;
+  WatchFolder &operator=(const WatchFolder &) = delete;
+
+  /**
+   * @brief Stop the watcher thread and wait for loads in flight
+   *
+   * No callback runs after stop() returns. Files still settling are not
+   * loaded.
+   */
+  void stop();
+
+  /**
+   * @brief Wait until no file is settling or loading
+   *
+   * Changes the watcher thread has not read from the kernel yet do not
+   * count.
+   *
+   * @param timeout Longest wait
+   * @return true if idle, false on timeout
+   */
+  bool waitIdle(std::chrono::milliseconds timeout);
+
+  /**
+   * @brief Get the number of loaded files
+   * @return Files currently reported as added
+   */
+  size_t size() const;
+
+  Stats stats() const; // Activity counters
+
+  /**
+   * @brief Make callbacks that mirror the directory into a registry
+   * @param registry Registry to update; must outlive the watcher
+   * @return Callbacks inserting added torrents, replacing any entry with
+   * the same info hash, and erasing removed ones
+   *
+   * Files with the same info hash share one entry, which shows the newest
+   * file's torrent and goes away with the last of them.
+   */
+  static Callbacks registryCallbacks(TorrentRegistry &registry);
+
+private:
+  struct FileState {
+    int64_t size = -1;   // -1 if absent
+    int64_t mtime = 0;   // Modification time in nanoseconds
+    bool operator==(const FileState &other) const {
+      return size == other.size && mtime == other.mtime;
+    }
+    bool operator!=(const FileState &other) const {
+      return !(*this == other);
+    }
+  };
+
+  struct Pending {
+    std::chrono::steady_clock::time_point deadline;
+    bool closed = false;  // Last event was a close or rename into the folder
+    bool checked = false; // seen holds the state at the previous deadline
+    FileState seen;
+  };
+
+  struct Loaded {
+    FileState state;    // State when loaded
+    bool valid = false; // false if the load failed
+    InfoHash infoHash;  // Set if valid
+  };
+
+  const std::string directory;
+  const Callbacks callbacks;
+  const Options options;
+  Scheduler &scheduler;
+
+  int inotifyFd = -1;
+  int stopFd = -1; // eventfd that wakes the watcher thread to stop
+  std::thread thread;
+
+  // Owned by the watcher thread
+  std::unordered_map<std::string, Pending> pending; // By file name
+
+  // Guarded by mutex; callbacks run under it
+  mutable std::mutex mutex;
+  std::condition_variable idle;
+  std::unordered_map<std::string, Loaded> loaded; // By file name
+  std::unordered_map<std::string, uint64_t> latest; // Newest load per file
+  uint64_t generation = 0;
+  size_t inFlight = 0;
+  size_t settling = 0; // pending.size(), readable by other threads
+  bool stopped = false;
+
+  std::atomic<uint64_t> events{0};
+  std::atomic<uint64_t> loads{0};
+  std::atomic<uint64_t> failures{0};
+  std::atomic<uint64_t> removals{0};
+  std::atomic<uint64_t> rescans{0};
+  std::atomic<uint64_t> overflows{0};
+
+  void run();
+  bool readEvents();
+  void rescan(bool initial);
+  void settle();
+  bool check(const std::string &name, Pending &entry);
+  void load(const std::string &name, uint64_t loadGeneration);
+  void remove(const std::string &name);
+  bool followed(const std::string &name) const;
+  std::string pathOf(const std::string &name) const;
+  FileState statFile(const std::string &name) const;
+};
+
+#endif // WATCHFOLDER_HPP
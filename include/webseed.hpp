@@ -0,0 +1,175 @@
+#ifndef WEBSEED_HPP
+#define WEBSEED_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <storage.hpp>
+#include <string>
+#include <torrentfile.hpp>
+#include <vector>
+
+/**
+ * @brief Downloads the content of a torrent from an HTTP web seed
+ *
+ * A web seed is a plain HTTP server holding the torrent's files. BEP 19
+ * seeds (url-list) serve the files at url/name/path and answer Range
+ * requests, so runs of wanted pieces are fetched as a few large ranges: a
+ * run is cut where it crosses a file boundary, one request per file part.
+ * BEP 17 seeds (httpseeds) are asked for one piece at a time with
+ * ?info_hash=...&piece=N.
+ *
+ * Each seed is fetched over a few keep-alive connections with requests
+ * pipelined on each, so a connection never idles between responses.
+ * Response bodies are written to the Storage as they arrive, at their place
+ * in the files, and each piece is verified against its hash once all of its
+ * bytes are in. A connection that fails or closes early is reopened and its
+ * unfinished requests are asked again, resuming where the body stopped.
+ *
+ * Only plain http:// URLs are supported, and response bodies must carry a
+ * Content-Length or end with the connection; chunked bodies are treated
+ * as a failure of the connection.
+ */
+class WebSeed {
+public:
+  /**
+   * @brief Kind of web seed
+   */
+  enum class Protocol {
+    UrlList,  // BEP 19, Range requests on the files
+    HttpSeed, // BEP 17, one request per piece
+  };
+
+  /**
+   * @brief A web seed listed in a torrent
+   */
+  struct Source {
+    std::string url;
+    Protocol protocol;
+  };
+
+  /**
+   * @brief Settings of a download
+   */
+  struct Options {
+    size_t connections = 2;         // Keep-alive connections to the seed
+    size_t pipelineDepth = 4;       // Requests in flight per connection
+    int64_t requestBytes = 4 << 20; // Longest run of pieces per request
+    int64_t timeoutMillis = 30000;  // Give up on a silent connection
+    int maxRetries = 3;             // Attempts per request after the first
+  };
+
+  /**
+   * @brief Counters of the last download
+   */
+  struct Stats {
+    uint64_t requests = 0;      // Requests sent, retries included
+    uint64_t retries = 0;       // Requests queued again after a failure
+    uint64_t failed = 0;        // Requests given up on
+    uint64_t connects = 0;      // Connections opened
+    uint64_t bytesReceived = 0; // Body bytes written to storage
+    uint32_t verified = 0;      // Pieces that matched their hash
+    uint32_t corrupt = 0;       // Pieces that did not
+  };
+
+  /**
+   * @brief Called when a piece is complete
+   * @param piece Piece index
+   * @param valid Whether it matched its hash
+   */
+  using PieceCallback = std::function<void(uint32_t piece, bool valid)>;
+
+  /**
+   * @brief List the web seeds of a torrent
+   * @param torrent The torrent
+   * @return Its url-list entries, then its httpseeds entries
+   */
+  static std::vector<Source> sources(const TorrentFile &torrent);
+
+  /**
+   * @brief Prepare a download from one web seed
+   * @param torrent The torrent; must outlive the web seed
+   * @param storage Where the content is written; must outlive it
+   * @param source The seed
+   * @param options Settings
+   * @throws std::invalid_argument if the URL is not http:// or the options
+   * are not positive
+   */
+  WebSeed(const TorrentFile &torrent, Storage &storage, const Source &source,
+          const Options &options);
+
+  WebSeed(const WebSeed &) = delete;
+  WebSeed &operator=(const WebSeed &) = delete;
+
+  /**
+   * @brief Download pieces, blocking until done
+   * @param wanted Pieces to fetch; missing entries count as not wanted
+   * @param onPiece Called for each completed piece, may be empty
+   * @return Pieces that were downloaded and verified
+   * @throws std::runtime_error if the host cannot be resolved or a file
+   * cannot be written
+   *
+   * Returns when every wanted piece is complete or its requests were given
+   * up on, which includes the seed refusing connections.
+   */
+  std::vector<bool> download(const std::vector<bool> &wanted,
+                             const PieceCallback &onPiece);
+
+  /**
+   * @brief Get the URL path a file is requested at (BEP 19)
+   * @param fileIndex Index into the torrent's getFiles()
+   * @return Path with percent-encoded components
+   * @throws std::out_of_range if the file does not exist
+   */
+  std::string filePath(size_t fileIndex) const;
+
+  const Stats &stats() const; // Counters of the last download
+
+private:
+  // A range of the content asked for in one HTTP request
+  struct Request {
+    int64_t begin;       // Content offset of the first byte
+    int64_t end;         // Content offset past the last byte
+    size_t file;         // BEP 19: the file holding the range
+    uint32_t piece;      // BEP 17: the piece
+    int64_t written = 0; // Bytes of the range already written
+    int tries = 0;       // Failed attempts so far
+  };
+  struct Connection;
+
+  const TorrentFile &torrent;
+  Storage &storage;
+  const Protocol protocol;
+  const Options options;
+  std::string host;
+  std::string port;
+  std::string path;     // Path of the URL, as given
+  std::string infoHash; // Percent-encoded, for BEP 17 requests
+  std::vector<int64_t> fileStarts; // Offset of each file in the content
+  Stats counters;
+
+  // State of the running download
+  std::deque<Request> pending; // Requests not yet sent
+  std::vector<int64_t> missingBytes; // Per piece, bytes not yet written
+  std::vector<bool> done;            // Verified pieces
+  const PieceCallback *callback = nullptr;
+  int64_t resumeMillis = 0; // A BEP 17 seed asked to wait until then
+
+  void plan(const std::vector<bool> &wanted);
+  std::string head(const Request &request) const;
+  void open(Connection &conn, const void *address, unsigned length,
+            int epollFd);
+  void fill(Connection &conn);
+  bool flush(Connection &conn);
+  bool receive(Connection &conn, char *buffer, size_t size);
+  bool process(Connection &conn, const char *data, size_t length);
+  bool parseHead(Connection &conn);
+  bool finish(Connection &conn);
+  void write(int64_t position, const char *data, int64_t length);
+  void verify(uint32_t piece);
+  void retry(Request request);
+  void drop(Connection &conn, bool failed);
+};
+
+#endif // WEBSEED_HPP
@@ -1,6 +1,9 @@
+#include <algorithm>
 #include <bencode.hpp>
 #include <cctype>
 #include <stdexcept>
+#include <string>
+#include <trace.hpp>
 
 /**
  * @brief Initialize a BencodeValue with an integer
@@ -132,10 +135,115 @@ const BencodeValue::Dict &BencodeValue::getDict() const {
  * It initializes parsing from position 0 and delegates to parseValue.
  */
 BencodeValue BencodeParser::parse(std::string_view input) {
+  TRACE_SCOPE("bencode.parse", "parse", "bytes", input.size());
   size_t pos = 0;
   return parseValue(input, pos);
 }
 
+/**
+ * @brief Skip over one value without decoding it
+ * @param input The Bencode-encoded data
+ * @param pos Position of the value, advanced past it
+ * @throws std::runtime_error if the value is invalid
+ *
+ * Validates what it skips with the same rules as parseValue, except that
+ * dictionary keys are not checked for duplicates, and allocates nothing.
+ */
+void BencodeParser::skipValue(std::string_view input, size_t &pos) {
+  if (pos >= input.size()) {
+    throw std::runtime_error("Unexpected end of input");
+  }
+  char c = input[pos];
+  if (std::isdigit(c)) {
+    parseStringView(input, pos);
+    return;
+  }
+  switch (c) {
+  case 'i':
+    parseInt(input, pos);
+    return;
+  case 'l':
+  case 'd':
+    pos++;
+    while (pos < input.size() && input[pos] != 'e') {
+      if (c == 'd') {
+        if (!std::isdigit(input[pos])) {
+          throw std::runtime_error("Invalid dictionary key: must be string");
+        }
+        parseStringView(input, pos);
+      }
+      skipValue(input, pos);
+    }
+    if (pos >= input.size()) {
+      throw std::runtime_error(c == 'l' ? "Invalid list format: missing 'e'"
+                                        : "Invalid dictionary format: "
+                                          "missing 'e'");
+    }
+    pos++;
+    return;
+  default:
+    throw std::runtime_error("Invalid value type");
+  }
+}
+
+/**
+ * @brief Find the encoding of an entry of the root dictionary
+ * @param input Bencode data whose root is a dictionary
+ * @param key Key of the entry
+ * @return The bytes encoding the entry's value, or an empty view if absent
+ * @throws std::runtime_error if input is invalid before the entry
+ *
+ * Skips the entries before the key without decoding them, so finding the
+ * info dictionary costs one scan of the bytes in front of it.
+ */
+std::string_view BencodeParser::findRaw(std::string_view input,
+                                        std::string_view key) {
+  size_t pos = 0;
+  if (input.empty() || input[pos++] != 'd') {
+    throw std::runtime_error("Invalid dictionary format");
+  }
+  while (pos < input.size() && input[pos] != 'e') {
+    if (!std::isdigit(input[pos])) {
+      throw std::runtime_error("Invalid dictionary key: must be string");
+    }
+    std::string_view entryKey = parseStringView(input, pos);
+    size_t start = pos;
+    skipValue(input, pos);
+    if (entryKey == key) {
+      return input.substr(start, pos - start);
+    }
+  }
+  return {};
+}
+
+/**
+ * @brief List the entries of a dictionary without decoding them
+ * @param input Bencode data starting with a dictionary
+ * @return The entries in file order, as views into input
+ * @throws std::runtime_error if the dictionary is invalid
+ */
+std::vector<BencodeParser::RawEntry>
+BencodeParser::dictEntries(std::string_view input) {
+  size_t pos = 0;
+  if (input.empty() || input[pos++] != 'd') {
+    throw std::runtime_error("Invalid dictionary format");
+  }
+  std::vector<RawEntry> entries;
+  while (pos < input.size() && input[pos] != 'e') {
+    if (!std::isdigit(input[pos])) {
+      throw std::runtime_error("Invalid dictionary key: must be string");
+    }
+    std::string_view key = parseStringView(input, pos);
+    size_t start = pos;
+    skipValue(input, pos);
+    entries.push_back({key, input.substr(start, pos - start)});
+  }
+  if (pos >= input.size()) {
+    throw std::runtime_error("Invalid dictionary format: missing 'e'");
+  }
+  return entries;
+}
+
 /**
  * @brief Parse a single Bencode value starting at the given position
  * @param input The complete Bencode-encoded input string
@@ -256,6 +364,20 @@ int64_t BencodeParser::parseInt(std::string_view input, size_t &pos) {
  * - String can contain any bytes (including nulls and non-printable chars)
  */
 std::string BencodeParser::parseString(std::string_view input, size_t &pos) {
+  return std::string(parseStringView(input, pos));
+}
+
+/**
+ * @brief Parse a Bencode-encoded string value without copying it
+ * @param input The complete Bencode-encoded input string
+ * @param pos Current parsing position (updated as parsing progresses)
+ * @return The string content, as a view into input
+ * @throws std::runtime_error if the string format is invalid
+ *
+ * Applies the same format rules as parseString.
+ */
+std::string_view BencodeParser::parseStringView(std::string_view input,
+                                                size_t &pos) {
   // Locate the colon separator between length and string content
   size_t colonPos = input.find(':', pos);
   if (colonPos == std::string_view::npos) {
@@ -284,12 +406,11 @@ std::string BencodeParser::parseString(std::string_view input, size_t &pos) {
   pos = colonPos + 1;
 
   // Verify we have enough remaining characters to satisfy the length
-  if (pos + length > input.size()) {
+  if (length > input.size() - pos) {
     throw std::runtime_error("Invalid string: insufficient characters");
   }
 
-  // Extract the actual string content based on the parsed length
-  std::string result(input.substr(pos, length));
+  std::string_view result = input.substr(pos, length);
   pos += length; // Advance position past the string content
 
   return result;
@@ -390,3 +511,125 @@ BencodeValue::Dict BencodeParser::parseDict(std::string_view input,
 
   return result;
 }
+
+/**
+ * @brief Encode a value as Bencode
+ * @param value The value to encode
+ * @return The Bencode-encoded data
+ */
+std::string BencodeEncoder::encode(const BencodeValue &value) {
+  std::string out;
+  encode(value, out);
+  return out;
+}
+
+/**
+ * @brief Append the encoding of a value to a buffer
+ * @param value The value to encode
+ * @param out Buffer the encoding is appended to
+ *
+ * Lists and dictionaries are encoded recursively. Dictionary entries are
+ * written in the map's order, which is the sorted key order Bencode requires.
+ */
+void BencodeEncoder::encode(const BencodeValue &value, std::string &out) {
+  if (value.isInt()) {
+    encodeInt(value.getInt(), out);
+  } else if (value.isString()) {
+    encodeString(value.getString(), out);
+  } else if (value.isList()) {
+    out += 'l';
+    for (const auto &item : value.getList()) {
+      encode(*item, out);
+    }
+    out += 'e';
+  } else {
+    out += 'd';
+    for (const auto &[key, item] : value.getDict()) {
+      encodeString(key, out);
+      encode(*item, out);
+    }
+    out += 'e';
+  }
+}
+
+/**
+ * @brief Append a Bencode integer to a buffer
+ * @param i The integer to encode
+ * @param out Buffer the encoding is appended to
+ */
+void BencodeEncoder::encodeInt(int64_t i, std::string &out) {
+  out += 'i';
+  out += std::to_string(i);
+  out += 'e';
+}
+
+/**
+ * @brief Append a Bencode string to a buffer
+ * @param s The string to encode
+ * @param out Buffer the encoding is appended to
+ */
+void BencodeEncoder::encodeString(std::string_view s, std::string &out) {
+  out += std::to_string(s.size());
+  out += ':';
+  out += s;
+}
+
+/**
+ * @brief Copy a dictionary with some entries replaced, removed or added
+ * @param input Bencode data starting with a dictionary
+ * @param entries Its entries, from BencodeParser::dictEntries(input)
+ * @param edits Changes to apply
+ * @param out Buffer the new data is appended to
+ *
+ * Entries are contiguous, so the bytes between edited entries, length
+ * prefixes of keys included, are copied with one append per run.
+ */
+void BencodeEncoder::spliceDict(
+    std::string_view input,
+    const std::vector<BencodeParser::RawEntry> &entries, const Edits &edits,
+    std::string &out) {
+  size_t copied = 0; // Bytes of input already copied or replaced
+  auto copyTo = [&](size_t end) {
+    out.append(input.data() + copied, end - copied);
+    copied = end;
+  };
+  auto present = [&](std::string_view key) {
+    return std::any_of(entries.begin(), entries.end(),
+                       [&](const BencodeParser::RawEntry &entry) {
+                         return entry.key == key;
+                       });
+  };
+  auto emit = [&](std::string_view key, const std::string &value) {
+    encodeString(key, out);
+    out += value;
+  };
+
+  auto next = edits.begin(); // Next edit that may add a key
+  size_t entryStart = 1;     // After the opening 'd'
+  for (const BencodeParser::RawEntry &entry : entries) {
+    for (; next != edits.end() && next->first < entry.key; ++next) {
+      if (next->second && !present(next->first)) {
+        copyTo(entryStart);
+        emit(next->first, *next->second);
+      }
+    }
+    size_t entryEnd =
+        static_cast<size_t>(entry.value.data() - input.data()) +
+        entry.value.size();
+    if (auto edit = edits.find(entry.key); edit != edits.end()) {
+      copyTo(entryStart);
+      if (edit->second) {
+        emit(entry.key, *edit->second);
+      }
+      copied = entryEnd;
+    }
+    entryStart = entryEnd;
+  }
+  for (; next != edits.end(); ++next) {
+    if (next->second && !present(next->first)) {
+      copyTo(entryStart);
+      emit(next->first, *next->second);
+    }
+  }
+  copyTo(input.size());
+}
@@ -0,0 +1,682 @@
+#include <algorithm>
+#include <atomic>
+#include <catalogstore.hpp>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CATALOGSTORE_AVX2 1
+#endif
+
+namespace {
+
+using Op = CatalogStore::Op;
+
+// Comparisons the kernels implement; the other operators negate them
+enum class Cmp { Less, Greater, Equal };
+
+std::atomic<bool> simdEnabled{true};
+
+/**
+ * @brief Check whether the AVX2 kernels may run
+ */
+bool avx2() {
+#if defined(CATALOGSTORE_AVX2)
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported && simdEnabled.load(std::memory_order_relaxed);
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief Split an operator into a kernel comparison and a negation
+ */
+std::pair<Cmp, bool> lower(Op op) {
+  switch (op) {
+  case Op::Less:
+    return {Cmp::Less, false};
+  case Op::LessEqual:
+    return {Cmp::Greater, true};
+  case Op::Greater:
+    return {Cmp::Greater, false};
+  case Op::GreaterEqual:
+    return {Cmp::Less, true};
+  case Op::Equal:
+    return {Cmp::Equal, false};
+  case Op::NotEqual:
+    return {Cmp::Equal, true};
+  }
+  throw std::invalid_argument("Unknown catalog operator");
+}
+
+/**
+ * @brief Evaluate an operator on one pair of values
+ */
+bool holds(int64_t x, Op op, int64_t value) {
+  switch (op) {
+  case Op::Less:
+    return x < value;
+  case Op::LessEqual:
+    return x <= value;
+  case Op::Greater:
+    return x > value;
+  case Op::GreaterEqual:
+    return x >= value;
+  case Op::Equal:
+    return x == value;
+  case Op::NotEqual:
+    return x != value;
+  }
+  return false;
+}
+
+template <Cmp cmp, typename T> bool test(T x, T value) {
+  if constexpr (cmp == Cmp::Less) {
+    return x < value;
+  } else if constexpr (cmp == Cmp::Greater) {
+    return x > value;
+  } else {
+    return x == value;
+  }
+}
+
+/**
+ * @brief AND a comparison into the selection, 64 rows per word
+ * @param column Column values, at least 64 * words of them
+ * @param words Selection words to update; zero words are skipped
+ */
+template <Cmp cmp, bool negate, typename T>
+void filterScalar(const T *column, size_t words, T value,
+                  uint64_t *selection) {
+  for (size_t w = 0; w < words; ++w) {
+    if (selection[w] == 0) {
+      continue;
+    }
+    const T *rows = column + w * 64;
+    uint64_t mask = 0;
+    for (size_t i = 0; i < 64; ++i) {
+      mask |= uint64_t(test<cmp>(rows[i], value)) << i;
+    }
+    selection[w] &= negate ? ~mask : mask;
+  }
+}
+
+#if defined(CATALOGSTORE_AVX2)
+
+/**
+ * @brief filterScalar() for 64-bit columns, four rows per compare
+ *
+ * Less is computed as Greater with the operands swapped, since AVX2 has
+ * only signed greater-than and equality compares.
+ */
+template <Cmp cmp, bool negate>
+__attribute__((target("avx2"))) void
+filterAvx2(const int64_t *column, size_t words, int64_t value,
+           uint64_t *selection) {
+  const __m256i constant = _mm256_set1_epi64x(value);
+  for (size_t w = 0; w < words; ++w) {
+    if (selection[w] == 0) {
+      continue;
+    }
+    const int64_t *rows = column + w * 64;
+    uint64_t mask = 0;
+    for (size_t i = 0; i < 64; i += 4) {
+      __m256i x =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows + i));
+      __m256i r;
+      if constexpr (cmp == Cmp::Less) {
+        r = _mm256_cmpgt_epi64(constant, x);
+      } else if constexpr (cmp == Cmp::Greater) {
+        r = _mm256_cmpgt_epi64(x, constant);
+      } else {
+        r = _mm256_cmpeq_epi64(x, constant);
+      }
+      mask |= uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(r))) << i;
+    }
+    selection[w] &= negate ? ~mask : mask;
+  }
+}
+
+/**
+ * @brief filterScalar() for 32-bit columns, eight rows per compare
+ */
+template <Cmp cmp, bool negate>
+__attribute__((target("avx2"))) void
+filterAvx2(const int32_t *column, size_t words, int32_t value,
+           uint64_t *selection) {
+  const __m256i constant = _mm256_set1_epi32(value);
+  for (size_t w = 0; w < words; ++w) {
+    if (selection[w] == 0) {
+      continue;
+    }
+    const int32_t *rows = column + w * 64;
+    uint64_t mask = 0;
+    for (size_t i = 0; i < 64; i += 8) {
+      __m256i x =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows + i));
+      __m256i r;
+      if constexpr (cmp == Cmp::Less) {
+        r = _mm256_cmpgt_epi32(constant, x);
+      } else if constexpr (cmp == Cmp::Greater) {
+        r = _mm256_cmpgt_epi32(x, constant);
+      } else {
+        r = _mm256_cmpeq_epi32(x, constant);
+      }
+      mask |= uint64_t(_mm256_movemask_ps(_mm256_castsi256_ps(r))) << i;
+    }
+    selection[w] &= negate ? ~mask : mask;
+  }
+}
+
+#endif
+
+/**
+ * @brief Pick the kernel for an operator and run it over whole words
+ */
+template <typename T>
+void filterWords(const T *column, size_t words, Op op, T value,
+                 uint64_t *selection) {
+  auto [cmp, negate] = lower(op);
+#if defined(CATALOGSTORE_AVX2)
+  if (avx2()) {
+    switch (cmp) {
+    case Cmp::Less:
+      return negate ? filterAvx2<Cmp::Less, true>(column, words, value,
+                                                  selection)
+                    : filterAvx2<Cmp::Less, false>(column, words, value,
+                                                   selection);
+    case Cmp::Greater:
+      return negate ? filterAvx2<Cmp::Greater, true>(column, words, value,
+                                                     selection)
+                    : filterAvx2<Cmp::Greater, false>(column, words, value,
+                                                      selection);
+    case Cmp::Equal:
+      return negate ? filterAvx2<Cmp::Equal, true>(column, words, value,
+                                                   selection)
+                    : filterAvx2<Cmp::Equal, false>(column, words, value,
+                                                    selection);
+    }
+  }
+#endif
+  switch (cmp) {
+  case Cmp::Less:
+    return negate ? filterScalar<Cmp::Less, true>(column, words, value,
+                                                  selection)
+                  : filterScalar<Cmp::Less, false>(column, words, value,
+                                                   selection);
+  case Cmp::Greater:
+    return negate ? filterScalar<Cmp::Greater, true>(column, words, value,
+                                                     selection)
+                  : filterScalar<Cmp::Greater, false>(column, words, value,
+                                                      selection);
+  case Cmp::Equal:
+    return negate ? filterScalar<Cmp::Equal, true>(column, words, value,
+                                                   selection)
+                  : filterScalar<Cmp::Equal, false>(column, words, value,
+                                                    selection);
+  }
+}
+
+/**
+ * @brief Running count, sum, minimum and maximum
+ */
+struct Accumulator {
+  uint64_t rows = 0;
+  uint64_t sum = 0; // Unsigned, so that overflow wraps instead of being UB
+  int64_t min = std::numeric_limits<int64_t>::max();
+  int64_t max = std::numeric_limits<int64_t>::min();
+
+  void add(int64_t x) {
+    rows++;
+    sum += uint64_t(x);
+    min = std::min(min, x);
+    max = std::max(max, x);
+  }
+};
+
+/**
+ * @brief Aggregate the rows selected by one word, one row at a time
+ */
+template <typename T>
+void aggregateWord(const T *rows, uint64_t word, Accumulator &acc) {
+  if (word == ~uint64_t(0)) {
+    for (size_t i = 0; i < 64; ++i) {
+      acc.add(rows[i]);
+    }
+    return;
+  }
+  while (word != 0) {
+    acc.add(rows[__builtin_ctzll(word)]);
+    word &= word - 1;
+  }
+}
+
+template <typename T>
+void aggregateScalar(const T *column, const uint64_t *selection,
+                     size_t words, Accumulator &acc) {
+  for (size_t w = 0; w < words; ++w) {
+    if (selection[w] != 0) {
+      aggregateWord(column + w * 64, selection[w], acc);
+    }
+  }
+}
+
+#if defined(CATALOGSTORE_AVX2)
+
+/**
+ * @brief Load four values of a column as 64-bit lanes
+ */
+__attribute__((target("avx2"))) inline __m256i load4(const int64_t *p) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+}
+
+__attribute__((target("avx2"))) inline __m256i load4(const int32_t *p) {
+  return _mm256_cvtepi32_epi64(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+}
+
+/**
+ * @brief aggregateScalar() with four rows per step and no branch per row
+ *
+ * Four selection bits become a lane mask; unselected lanes add zero and
+ * leave the minimum and maximum unchanged through blends.
+ */
+template <typename T>
+__attribute__((target("avx2"))) void
+aggregateAvx2(const T *column, const uint64_t *selection, size_t words,
+              Accumulator &acc) {
+  const __m256i bits = _mm256_set_epi64x(8, 4, 2, 1);
+  __m256i sum = _mm256_setzero_si256();
+  __m256i min = _mm256_set1_epi64x(acc.min);
+  __m256i max = _mm256_set1_epi64x(acc.max);
+  for (size_t w = 0; w < words; ++w) {
+    uint64_t word = selection[w];
+    if (word == 0) {
+      continue;
+    }
+    acc.rows += __builtin_popcountll(word);
+    const T *rows = column + w * 64;
+    for (size_t i = 0; i < 64; i += 4) {
+      __m256i lanes = _mm256_and_si256(
+          _mm256_set1_epi64x(int64_t((word >> i) & 15)), bits);
+      __m256i selected = _mm256_cmpeq_epi64(lanes, bits);
+      __m256i x = load4(rows + i);
+      sum = _mm256_add_epi64(sum, _mm256_and_si256(x, selected));
+      min = _mm256_blendv_epi8(
+          min, x, _mm256_and_si256(selected, _mm256_cmpgt_epi64(min, x)));
+      max = _mm256_blendv_epi8(
+          max, x, _mm256_and_si256(selected, _mm256_cmpgt_epi64(x, max)));
+    }
+  }
+  alignas(32) int64_t lanes[3][4];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes[0]), sum);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes[1]), min);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes[2]), max);
+  for (size_t i = 0; i < 4; ++i) {
+    acc.sum += uint64_t(lanes[0][i]);
+    acc.min = std::min(acc.min, lanes[1][i]);
+    acc.max = std::max(acc.max, lanes[2][i]);
+  }
+}
+
+#endif
+
+/**
+ * @brief Aggregate a column over a selection, the partial last word
+ * included
+ */
+template <typename T>
+void aggregateColumn(const std::vector<T> &column,
+                     const CatalogStore::Selection &selection,
+                     Accumulator &acc) {
+  size_t words = column.size() / 64;
+#if defined(CATALOGSTORE_AVX2)
+  if (avx2()) {
+    aggregateAvx2(column.data(), selection.data(), words, acc);
+  } else {
+    aggregateScalar(column.data(), selection.data(), words, acc);
+  }
+#else
+  aggregateScalar(column.data(), selection.data(), words, acc);
+#endif
+  if (words < selection.size()) {
+    uint64_t word = selection[words];
+    while (word != 0) {
+      acc.add(column[words * 64 + __builtin_ctzll(word)]);
+      word &= word - 1;
+    }
+  }
+}
+
+char lowerAscii(char c) {
+  return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+} // namespace
+
+/**
+ * @brief Create an empty store
+ *
+ * Code 0 of both dictionaries is the empty string, which stands for an
+ * absent value.
+ */
+CatalogStore::CatalogStore() {
+  createdByDictionary.encode("");
+  trackerHostDictionary.encode("");
+}
+
+/**
+ * @brief Append a torrent's metadata
+ * @param torrent The torrent
+ * @return Row number
+ */
+uint32_t CatalogStore::add(const TorrentFile &torrent) {
+  std::string host = trackerHostOf(torrent.getAnnounce());
+  Row row;
+  row.totalSize = torrent.getTotalSize();
+  row.pieceLength = torrent.getPieceLength();
+  row.creationDate = torrent.getCreationDate();
+  row.fileCount = static_cast<uint32_t>(torrent.getFiles().size());
+  row.createdBy = torrent.getCreatedBy();
+  row.trackerHost = host;
+  return add(row);
+}
+
+/**
+ * @brief Append a row
+ * @param row The row's values
+ * @return Row number
+ * @throws std::length_error past 2^32 - 1 rows
+ * @throws std::out_of_range if fileCount does not fit 31 bits
+ */
+uint32_t CatalogStore::add(const Row &row) {
+  if (size() >= std::numeric_limits<uint32_t>::max()) {
+    throw std::length_error("Catalog store is full");
+  }
+  if (row.fileCount > uint32_t(std::numeric_limits<int32_t>::max())) {
+    throw std::out_of_range("File count out of range: " +
+                            std::to_string(row.fileCount));
+  }
+  uint32_t createdBy = createdByDictionary.encode(row.createdBy);
+  uint32_t trackerHost = trackerHostDictionary.encode(row.trackerHost);
+  totalSizes.push_back(row.totalSize);
+  pieceLengths.push_back(row.pieceLength);
+  creationDates.push_back(row.creationDate);
+  fileCounts.push_back(static_cast<int32_t>(row.fileCount));
+  createdByCodes.push_back(static_cast<int32_t>(createdBy));
+  trackerHostCodes.push_back(static_cast<int32_t>(trackerHost));
+  return static_cast<uint32_t>(size() - 1);
+}
+
+/**
+ * @brief Find the code of a dictionary value
+ * @param column CreatedBy or TrackerHost
+ * @param value The string
+ * @return Its code, or -1 if no row has it
+ * @throws std::invalid_argument for other columns
+ */
+int64_t CatalogStore::code(Column column, std::string_view value) const {
+  const Dictionary &dict = dictionary(column);
+  auto it = dict.codes.find(std::string(value));
+  return it != dict.codes.end() ? int64_t(it->second) : -1;
+}
+
+/**
+ * @brief Get the string of a dictionary code
+ * @param column CreatedBy or TrackerHost
+ * @param code A code returned by code() or groupBy()
+ * @return The string
+ * @throws std::invalid_argument for other columns
+ * @throws std::out_of_range for unknown codes
+ */
+const std::string &CatalogStore::value(Column column, uint32_t code) const {
+  return dictionary(column).values.at(code);
+}
+
+/**
+ * @brief Select the rows matching all predicates
+ * @param predicates Conjunction of predicates; empty selects all rows
+ * @return Selection bitmap of size() bits
+ *
+ * Predicates run in the given order, each over the words the previous ones
+ * left non-zero, so the most selective predicate is best put first. Rows
+ * of the partial last word are compared one by one.
+ */
+CatalogStore::Selection
+CatalogStore::filter(const std::vector<Predicate> &predicates) const {
+  const size_t rows = size();
+  const size_t words = rows / 64;
+  const size_t tail = rows % 64;
+  Selection selection(words + (tail != 0), ~uint64_t(0));
+  if (tail != 0) {
+    selection.back() = (uint64_t(1) << tail) - 1;
+  }
+
+  for (const Predicate &predicate : predicates) {
+    if (const std::vector<int64_t> *column = wideColumn(predicate.column)) {
+      filterWords(column->data(), words, predicate.op, predicate.value,
+                  selection.data());
+    } else {
+      const std::vector<int32_t> &narrow = *narrowColumn(predicate.column);
+      int64_t value = predicate.value;
+      if (value < std::numeric_limits<int32_t>::min() ||
+          value > std::numeric_limits<int32_t>::max()) {
+        // Beyond the column's range, every row compares as 0 does
+        if (!holds(0, predicate.op, value)) {
+          std::fill(selection.begin(), selection.end(), 0);
+        }
+        continue;
+      }
+      filterWords(narrow.data(), words, predicate.op, int32_t(value),
+                  selection.data());
+    }
+  }
+
+  // The partial last word
+  if (tail != 0) {
+    uint64_t &word = selection.back();
+    for (size_t i = 0; i < tail && word != 0; ++i) {
+      size_t row = words * 64 + i;
+      for (const Predicate &predicate : predicates) {
+        const std::vector<int64_t> *column = wideColumn(predicate.column);
+        int64_t x = column != nullptr ? (*column)[row]
+                                      : (*narrowColumn(predicate.column))[row];
+        if (!holds(x, predicate.op, predicate.value)) {
+          word &= ~(uint64_t(1) << i);
+          break;
+        }
+      }
+    }
+  }
+  return selection;
+}
+
+/**
+ * @brief Count the selected rows
+ * @param selection Selection returned by filter()
+ * @return Number of set bits
+ */
+uint64_t CatalogStore::count(const Selection &selection) {
+  uint64_t total = 0;
+  for (uint64_t word : selection) {
+    total += __builtin_popcountll(word);
+  }
+  return total;
+}
+
+/**
+ * @brief Compute count, sum, minimum and maximum of a column
+ * @param column Column to aggregate
+ * @param selection Selection returned by filter()
+ * @return The aggregate over the selected rows
+ * @throws std::invalid_argument if the selection does not match the store
+ */
+CatalogStore::Aggregate
+CatalogStore::aggregate(Column column, const Selection &selection) const {
+  if (selection.size() != (size() + 63) / 64) {
+    throw std::invalid_argument("Selection does not match the catalog");
+  }
+  Accumulator acc;
+  if (const std::vector<int64_t> *values = wideColumn(column)) {
+    aggregateColumn(*values, selection, acc);
+  } else {
+    aggregateColumn(*narrowColumn(column), selection, acc);
+  }
+  Aggregate result;
+  result.rows = acc.rows;
+  if (acc.rows > 0) {
+    result.sum = int64_t(acc.sum);
+    result.min = acc.min;
+    result.max = acc.max;
+  }
+  return result;
+}
+
+/**
+ * @brief Count rows and sum a column per value of a dictionary column
+ * @param key CreatedBy or TrackerHost
+ * @param column Column summed per group
+ * @param selection Selection returned by filter()
+ * @return One group per code with selected rows, by decreasing row count
+ * @throws std::invalid_argument if key is not a dictionary column or the
+ * selection does not match the store
+ */
+std::vector<CatalogStore::Group>
+CatalogStore::groupBy(Column key, Column column,
+                      const Selection &selection) const {
+  const size_t groups = dictionary(key).values.size();
+  const std::vector<int32_t> &codes =
+      key == Column::CreatedBy ? createdByCodes : trackerHostCodes;
+  if (selection.size() != (size() + 63) / 64) {
+    throw std::invalid_argument("Selection does not match the catalog");
+  }
+  const std::vector<int64_t> *wide = wideColumn(column);
+  const std::vector<int32_t> *narrow = narrowColumn(column);
+
+  std::vector<uint64_t> rows(groups);
+  std::vector<uint64_t> sums(groups);
+  for (size_t w = 0; w < selection.size(); ++w) {
+    uint64_t word = selection[w];
+    while (word != 0) {
+      size_t row = w * 64 + __builtin_ctzll(word);
+      word &= word - 1;
+      uint32_t code = uint32_t(codes[row]);
+      rows[code]++;
+      sums[code] += uint64_t(wide != nullptr ? (*wide)[row] : (*narrow)[row]);
+    }
+  }
+
+  std::vector<Group> result;
+  for (size_t code = 0; code < groups; ++code) {
+    if (rows[code] > 0) {
+      result.push_back({uint32_t(code), rows[code], int64_t(sums[code])});
+    }
+  }
+  std::sort(result.begin(), result.end(),
+            [](const Group &a, const Group &b) {
+              return a.rows != b.rows ? a.rows > b.rows : a.code < b.code;
+            });
+  return result;
+}
+
+/**
+ * @brief Enable or disable the AVX2 kernels
+ * @param enabled false forces the scalar code
+ */
+void CatalogStore::useSimd(bool enabled) {
+  simdEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Extract the host of an announce URL
+ * @param url Tracker URL such as udp://tracker.example.org:1337/announce
+ * @return The host, lower-cased, or the whole URL if it has no scheme
+ *
+ * User info before an '@' is dropped and an IPv6 literal keeps its
+ * brackets.
+ */
+std::string CatalogStore::trackerHostOf(std::string_view url) {
+  size_t scheme = url.find("://");
+  if (scheme != std::string_view::npos) {
+    url.remove_prefix(scheme + 3);
+    url = url.substr(0, url.find_first_of("/?#"));
+    size_t at = url.rfind('@');
+    if (at != std::string_view::npos) {
+      url.remove_prefix(at + 1);
+    }
+    if (!url.empty() && url[0] == '[') {
+      url = url.substr(0, url.find(']') + 1);
+    } else {
+      url = url.substr(0, url.find(':'));
+    }
+  }
+  std::string host(url);
+  std::transform(host.begin(), host.end(), host.begin(), lowerAscii);
+  return host;
+}
+
+/**
+ * @brief Get the code of a value, adding it if new
+ * @param value The string
+ * @return Its code
+ */
+uint32_t CatalogStore::Dictionary::encode(std::string_view value) {
+  auto [it, added] =
+      codes.try_emplace(std::string(value), uint32_t(values.size()));
+  if (added) {
+    values.emplace_back(value);
+  }
+  return it->second;
+}
+
+/**
+ * @brief Get a 64-bit column
+ * @return The column, or nullptr if column holds 32-bit values
+ */
+const std::vector<int64_t> *CatalogStore::wideColumn(Column column) const {
+  switch (column) {
+  case Column::TotalSize:
+    return &totalSizes;
+  case Column::PieceLength:
+    return &pieceLengths;
+  case Column::CreationDate:
+    return &creationDates;
+  default:
+    return nullptr;
+  }
+}
+
+/**
+ * @brief Get a 32-bit column
+ * @return The column, or nullptr if column holds 64-bit values
+ */
+const std::vector<int32_t> *CatalogStore::narrowColumn(Column column) const {
+  switch (column) {
+  case Column::FileCount:
+    return &fileCounts;
+  case Column::CreatedBy:
+    return &createdByCodes;
+  case Column::TrackerHost:
+    return &trackerHostCodes;
+  default:
+    return nullptr;
+  }
+}
+
+/**
+ * @brief Get the dictionary of a dictionary-encoded column
+ * @throws std::invalid_argument for other columns
+ */
+const CatalogStore::Dictionary &
+CatalogStore::dictionary(Column column) const {
+  switch (column) {
+  case Column::CreatedBy:
+    return createdByDictionary;
+  case Column::TrackerHost:
+    return trackerHostDictionary;
+  default:
+    throw std::invalid_argument("Column is not dictionary-encoded");
+  }
+}
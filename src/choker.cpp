@@ -0,0 +1,375 @@
+#include <algorithm>
+#include <choker.hpp>
+#include <tuple>
+
+namespace {
+constexpr unsigned kFixedPointBits = 16; // Fraction bits of the EWMA
+constexpr uint64_t kMicrosPerSecond = 1000 * 1000;
+constexpr uint64_t kNewPeerWeight = 3; // Optimistic odds of a new peer
+} // namespace
+
+/**
+ * @brief Construct a rate counter
+ * @param shift Smoothing factor as a power of two (weight 1 / 2^shift)
+ */
+RateCounter::RateCounter(unsigned shift) : shift(shift) {}
+
+/**
+ * @brief Record transferred bytes
+ * @param bytes Number of bytes transferred
+ *
+ * A relaxed increment is enough: the counter carries no ordering with other
+ * memory, and sample() only needs to see each byte exactly once.
+ */
+void RateCounter::add(uint64_t bytes) {
+  pending.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Fold the bytes recorded since the last sample into the average
+ * @param elapsedMicros Length of the sampling interval in microseconds
+ *
+ * The pending bytes are taken with an atomic exchange so concurrent add()
+ * calls are never lost. The moving average only uses shifts, adds and one
+ * division per sample; when the rate drops, the step is rounded up so the
+ * average reaches zero instead of getting stuck one unit above it.
+ */
+void RateCounter::sample(int64_t elapsedMicros) {
+  if (elapsedMicros <= 0) {
+    return;
+  }
+  uint64_t bytes = pending.exchange(0, std::memory_order_relaxed);
+  sampled.fetch_add(bytes, std::memory_order_relaxed);
+
+  uint64_t current =
+      (bytes * kMicrosPerSecond / static_cast<uint64_t>(elapsedMicros))
+      << kFixedPointBits;
+  uint64_t avg = average.load(std::memory_order_relaxed);
+  if (current >= avg) {
+    avg += (current - avg) >> shift;
+  } else {
+    avg -= (avg - current + (uint64_t{1} << shift) - 1) >> shift;
+  }
+  average.store(avg, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Get the smoothed transfer rate
+ * @return Rate in bytes per second, rounded down
+ */
+uint64_t RateCounter::rate() const {
+  return average.load(std::memory_order_relaxed) >> kFixedPointBits;
+}
+
+/**
+ * @brief Get the number of bytes recorded over the counter's lifetime
+ * @return Total bytes including those not yet sampled
+ */
+uint64_t RateCounter::total() const {
+  return sampled.load(std::memory_order_relaxed) +
+         pending.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Reset the counter to its initial state
+ */
+void RateCounter::reset() {
+  pending.store(0, std::memory_order_relaxed);
+  average.store(0, std::memory_order_relaxed);
+  sampled.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Construct a choker
+ * @param settings Parameters of the choking algorithm
+ */
+Choker::Choker(const Settings &settings)
+    : settings(settings), random(settings.randomSeed) {}
+
+/**
+ * @brief Construct a choker with the default settings
+ */
+Choker::Choker() : Choker(Settings{}) {}
+
+/**
+ * @brief Register a newly connected peer
+ * @return Identifier of the peer, reusing ids of removed peers
+ */
+Choker::PeerId Choker::addPeer() {
+  auto peer = std::make_unique<Peer>(settings.rateShift);
+  peer->connectedRound = round;
+
+  if (!freeSlots.empty()) {
+    PeerId id = freeSlots.back();
+    freeSlots.pop_back();
+    peers[id] = std::move(peer);
+    return id;
+  }
+  peers.push_back(std::move(peer));
+  return static_cast<PeerId>(peers.size() - 1);
+}
+
+/**
+ * @brief Unregister a disconnected peer
+ * @param peer The peer to remove
+ */
+void Choker::removePeer(PeerId peer) {
+  if (peer >= peers.size() || !peers[peer]->active) {
+    return;
+  }
+  Peer &p = *peers[peer];
+  p.active = false;
+  p.unchoked = false;
+  p.optimistic = false;
+  freeSlots.push_back(peer);
+}
+
+/**
+ * @brief Update whether a peer is interested in our pieces
+ * @param peer The peer whose state changed
+ * @param interested The new interest state
+ * @throws std::out_of_range if the peer does not exist
+ */
+void Choker::setInterested(PeerId peer, bool interested) {
+  peers.at(peer)->interested = interested;
+}
+
+/**
+ * @brief Switch the ranking policy
+ * @param newMode The new policy, applied from the next rechoke
+ */
+void Choker::setMode(Mode newMode) { mode = newMode; }
+
+/**
+ * @brief Get the download rate counter of a peer
+ * @param peer The peer to look up
+ * @return Counter of payload bytes downloaded from the peer
+ * @throws std::out_of_range if the peer does not exist
+ */
+RateCounter &Choker::downloadCounter(PeerId peer) {
+  return peers.at(peer)->download;
+}
+
+/**
+ * @brief Get the upload rate counter of a peer
+ * @param peer The peer to look up
+ * @return Counter of payload bytes uploaded to the peer
+ * @throws std::out_of_range if the peer does not exist
+ */
+RateCounter &Choker::uploadCounter(PeerId peer) {
+  return peers.at(peer)->upload;
+}
+
+/**
+ * @brief Advance time, sampling rates and rechoking when due
+ * @param elapsedMicros Time since the previous call in microseconds
+ * @return Choke state changes, empty if no rechoke happened
+ */
+Choker::Decision Choker::tick(int64_t elapsedMicros) {
+  sinceSample += elapsedMicros;
+  if (sinceSample >= settings.sampleIntervalMicros) {
+    for (auto &peer : peers) {
+      if (peer->active) {
+        peer->download.sample(sinceSample);
+        peer->upload.sample(sinceSample);
+      }
+    }
+    sinceSample = 0;
+  }
+
+  sinceRechoke += elapsedMicros;
+  if (sinceRechoke < settings.rechokeIntervalMicros) {
+    return {};
+  }
+  sinceRechoke = 0;
+  return rechoke();
+}
+
+/**
+ * @brief Recompute the unchoke set immediately
+ * @return Choke state changes relative to the previous unchoke set
+ *
+ * The best ranked peers take the regular slots. Optimistic unchokes survive
+ * between rotations as long as the peer is still interested and did not earn
+ * a regular slot; otherwise the slot is handed to a new random peer.
+ */
+Choker::Decision Choker::rechoke() {
+  std::vector<bool> selected(peers.size(), false);
+  std::vector<PeerId> ranked = rankPeers();
+  size_t regular = std::min(settings.regularSlots, ranked.size());
+  for (size_t i = 0; i < regular; ++i) {
+    selected[ranked[i]] = true;
+  }
+
+  // Keep current optimistic unchokes unless it is time to rotate
+  bool rotate = (round - 1) % std::max(settings.optimisticRotation, 1u) == 0;
+  std::vector<bool> optimistic(peers.size(), false);
+  size_t keptOptimistic = 0;
+  for (PeerId id = 0; id < peers.size() && !rotate; ++id) {
+    const Peer &peer = *peers[id];
+    if (peer.active && peer.optimistic && peer.interested && !selected[id] &&
+        keptOptimistic < settings.optimisticSlots) {
+      selected[id] = true;
+      optimistic[id] = true;
+      ++keptOptimistic;
+    }
+  }
+
+  // Fill the remaining optimistic slots at random
+  std::vector<bool> before = selected;
+  pickOptimistic(selected, settings.optimisticSlots - keptOptimistic);
+  for (PeerId id = 0; id < peers.size(); ++id) {
+    if (selected[id] && !before[id]) {
+      optimistic[id] = true;
+    }
+  }
+
+  // Turn the new unchoke set into state changes
+  Decision decision;
+  for (PeerId id = 0; id < peers.size(); ++id) {
+    Peer &peer = *peers[id];
+    if (!peer.active) {
+      continue;
+    }
+    if (selected[id] && !peer.unchoked) {
+      peer.unchoked = true;
+      peer.unchokedRound = round;
+      decision.unchoke.push_back(id);
+    } else if (!selected[id] && peer.unchoked) {
+      peer.unchoked = false;
+      decision.choke.push_back(id);
+    }
+    if (selected[id]) {
+      peer.lastUnchoked = round;
+    }
+    peer.optimistic = optimistic[id];
+  }
+
+  ++round;
+  return decision;
+}
+
+/**
+ * @brief Check if a peer is currently unchoked
+ * @param peer The peer to query
+ * @return true if the peer is unchoked
+ */
+bool Choker::isUnchoked(PeerId peer) const {
+  return peer < peers.size() && peers[peer]->active && peers[peer]->unchoked;
+}
+
+/**
+ * @brief Check if a peer holds an optimistic unchoke slot
+ * @param peer The peer to query
+ * @return true if the peer is optimistically unchoked
+ */
+bool Choker::isOptimistic(PeerId peer) const {
+  return isUnchoked(peer) && peers[peer]->optimistic;
+}
+
+/**
+ * @brief Get the current ranking policy
+ * @return The active choking mode
+ */
+Choker::Mode Choker::getMode() const { return mode; }
+
+/**
+ * @brief Rank interested peers for the regular unchoke slots
+ * @return Interested peers ordered from most to least deserving
+ *
+ * Ties are broken by peer id so the order never depends on the sort
+ * implementation.
+ */
+std::vector<Choker::PeerId> Choker::rankPeers() const {
+  std::vector<PeerId> ranked;
+  for (PeerId id = 0; id < peers.size(); ++id) {
+    if (peers[id]->active && peers[id]->interested) {
+      ranked.push_back(id);
+    }
+  }
+
+  if (mode == Mode::Leech) {
+    // Tit-for-tat: reward the peers that give us the most
+    std::sort(ranked.begin(), ranked.end(), [this](PeerId a, PeerId b) {
+      const Peer &pa = *peers[a];
+      const Peer &pb = *peers[b];
+      return std::make_tuple(pa.download.rate(), pa.upload.rate(), b) >
+             std::make_tuple(pb.download.rate(), pb.upload.rate(), a);
+    });
+    return ranked;
+  }
+
+  // Seed mode: we get nothing back, so favor the peers that take our data
+  // fastest and will pass it on soonest
+  if (settings.seedRotation == 0) {
+    std::sort(ranked.begin(), ranked.end(), [this](PeerId a, PeerId b) {
+      return std::make_tuple(peers[a]->upload.rate(), b) >
+             std::make_tuple(peers[b]->upload.rate(), a);
+    });
+    return ranked;
+  }
+
+  // With rotation, peers are ranked in three groups: unchoked peers still
+  // within their tenure, then waiting peers (longest wait first), then peers
+  // whose tenure expired. Within the first and last group, faster uploads
+  // come first.
+  auto group = [this](const Peer &peer) {
+    if (!peer.unchoked) {
+      return 1;
+    }
+    return round - peer.unchokedRound < settings.seedRotation ? 0 : 2;
+  };
+  std::sort(ranked.begin(), ranked.end(), [&](PeerId a, PeerId b) {
+    const Peer &pa = *peers[a];
+    const Peer &pb = *peers[b];
+    int ga = group(pa);
+    int gb = group(pb);
+    if (ga != gb) {
+      return ga < gb;
+    }
+    if (ga == 1 && pa.lastUnchoked != pb.lastUnchoked) {
+      return pa.lastUnchoked < pb.lastUnchoked;
+    }
+    return std::make_tuple(pa.upload.rate(), b) >
+           std::make_tuple(pb.upload.rate(), a);
+  });
+  return ranked;
+}
+
+/**
+ * @brief Pick random peers for the optimistic slots
+ * @param selected Flags of peers already unchoked this round; updated with
+ * the picks
+ * @param count Number of peers to pick
+ *
+ * Candidates are interested peers that are not already unchoked. Peers that
+ * connected within the last few rechokes get a higher weight, since they
+ * have no download history that would earn them a regular slot.
+ */
+void Choker::pickOptimistic(std::vector<bool> &selected, size_t count) {
+  std::vector<std::pair<PeerId, uint64_t>> candidates;
+  uint64_t totalWeight = 0;
+  for (PeerId id = 0; id < peers.size(); ++id) {
+    const Peer &peer = *peers[id];
+    if (!peer.active || !peer.interested || selected[id]) {
+      continue;
+    }
+    uint64_t weight =
+        round - peer.connectedRound < settings.newPeerRechokes ? kNewPeerWeight
+                                                               : 1;
+    candidates.emplace_back(id, weight);
+    totalWeight += weight;
+  }
+
+  for (; count > 0 && !candidates.empty(); --count) {
+    uint64_t pick = random() % totalWeight;
+    auto it = candidates.begin();
+    while (pick >= it->second) {
+      pick -= it->second;
+      ++it;
+    }
+    selected[it->first] = true;
+    totalWeight -= it->second;
+    candidates.erase(it);
+  }
+}
@@ -0,0 +1,43 @@
+#include <cycleclock.hpp>
+#include <thread>
+
+namespace {
+
+/**
+ * @brief Measure the tick length against steady_clock
+ * @return Nanoseconds per tick
+ */
+double calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+  auto wallStart = std::chrono::steady_clock::now();
+  uint64_t tickStart = CycleClock::now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  auto wallEnd = std::chrono::steady_clock::now();
+  uint64_t tickEnd = CycleClock::now();
+  double nanos = std::chrono::duration<double, std::nano>(wallEnd - wallStart)
+                     .count();
+  return tickEnd > tickStart ? nanos / (tickEnd - tickStart) : 1.0;
+#else
+  return 1.0;
+#endif
+}
+
+} // namespace
+
+/**
+ * @brief Get the length of a tick
+ * @return Nanoseconds per tick
+ */
+double CycleClock::nanosPerTick() {
+  static const double value = calibrate();
+  return value;
+}
+
+/**
+ * @brief Convert an interval to nanoseconds
+ * @param ticks Difference of two now() readings
+ * @return Interval in nanoseconds
+ */
+uint64_t CycleClock::toNanos(uint64_t ticks) {
+  return static_cast<uint64_t>(ticks * nanosPerTick());
+}
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <cstring>
+#include <dedupindex.hpp>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+/**
+ * @brief splitmix64 finalizer, a bijective 64-bit mix
+ */
+uint64_t mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+/**
+ * @brief Make a table key: any value but 0, which marks empty slots
+ */
+uint64_t nonzero(uint64_t key) { return key == 0 ? 1 : key; }
+
+/**
+ * @brief Key of a piece hash: its first eight bytes, already uniform
+ */
+uint64_t pieceKey(std::string_view hash) {
+  uint64_t key;
+  std::memcpy(&key, hash.data(), sizeof(key));
+  return nonzero(key);
+}
+
+/**
+ * @brief Fold all bytes of a piece hash into a running file signature
+ */
+uint64_t fold(uint64_t signature, std::string_view hash) {
+  size_t i = 0;
+  for (; i + 8 <= hash.size(); i += 8) {
+    uint64_t word;
+    std::memcpy(&word, hash.data() + i, sizeof(word));
+    signature = mix(signature ^ word);
+  }
+  uint64_t tail = 0;
+  std::memcpy(&tail, hash.data() + i, hash.size() - i);
+  return mix(signature ^ tail ^ (uint64_t(hash.size()) << 56));
+}
+
+} // namespace
+
+/**
+ * @brief Create an empty index
+ * @param expectedPieces Distinct piece hashes to size the table for
+ */
+DedupIndex::DedupIndex(size_t expectedPieces)
+    : pieces(expectedPieces), files(expectedPieces / 16) {}
+
+/**
+ * @brief Index a torrent
+ * @param torrent The torrent
+ * @param matches If not nullptr, receives the torrent's files already
+ * indexed
+ * @return The torrent's number
+ * @throws std::length_error past 2^32 - 1 torrents or pieces per torrent
+ */
+DedupIndex::TorrentId DedupIndex::add(const TorrentFile &torrent,
+                                      std::vector<FileMatch> *matches) {
+  const auto &hashes = torrent.getPieces();
+  if (totals.torrents >= std::numeric_limits<TorrentId>::max() ||
+      hashes.size() > std::numeric_limits<uint32_t>::max()) {
+    throw std::length_error("Dedup index is full");
+  }
+  const TorrentId id = static_cast<TorrentId>(totals.torrents);
+
+  const int64_t pieceLength = torrent.getPieceLength();
+  const int64_t totalSize = torrent.getTotalSize();
+  for (size_t i = 0; i < hashes.size(); ++i) {
+    int64_t size = pieceLength;
+    if (i + 1 == hashes.size()) {
+      size = std::max<int64_t>(0, totalSize - int64_t(i) * pieceLength);
+    }
+    totals.pieceBytes += size;
+    if (!pieces.insert(pieceKey(hashes[i]), id, i).second) {
+      totals.duplicatePieceBytes += size;
+    }
+  }
+
+  forEachAlignedFile(torrent, [&](uint32_t file, uint64_t key,
+                                  int64_t length, int64_t coveredBytes) {
+    totals.alignedFiles++;
+    auto [slot, inserted] = files.insert(key, id, file);
+    if (inserted) {
+      return;
+    }
+    totals.duplicateFiles++;
+    totals.duplicateFileBytes += length;
+    if (matches != nullptr) {
+      matches->push_back(
+          {file, {slot->torrent, slot->index}, length, coveredBytes});
+    }
+  });
+
+  totals.torrents++;
+  totals.pieces += hashes.size();
+  totals.files += torrent.getFiles().size();
+  return id;
+}
+
+/**
+ * @brief Find indexed files with the content of a torrent's files
+ * @param torrent A torrent, indexed or not
+ * @return One match per comparable file with a match, in file order
+ */
+std::vector<DedupIndex::FileMatch>
+DedupIndex::matchFiles(const TorrentFile &torrent) const {
+  std::vector<FileMatch> matches;
+  forEachAlignedFile(torrent, [&](uint32_t file, uint64_t key,
+                                  int64_t length, int64_t coveredBytes) {
+    if (const Slot *slot = files.find(key)) {
+      matches.push_back(
+          {file, {slot->torrent, slot->index}, length, coveredBytes});
+    }
+  });
+  return matches;
+}
+
+/**
+ * @brief Find the first indexed piece with a hash
+ * @param hash 20-byte SHA-1 piece hash
+ * @return The piece, or nullopt if no indexed torrent has it
+ * @throws std::invalid_argument if the hash is shorter than 8 bytes
+ */
+std::optional<DedupIndex::PieceRef>
+DedupIndex::findPiece(std::string_view hash) const {
+  if (hash.size() < sizeof(uint64_t)) {
+    throw std::invalid_argument("Piece hash too short");
+  }
+  const Slot *slot = pieces.find(pieceKey(hash));
+  if (slot == nullptr) {
+    return std::nullopt;
+  }
+  return PieceRef{slot->torrent, slot->index};
+}
+
+/**
+ * @brief Get the totals over all added torrents
+ * @return Counters and memory use
+ */
+DedupIndex::Stats DedupIndex::stats() const {
+  Stats result = totals;
+  result.uniquePieces = pieces.size();
+  result.memoryBytes = pieces.memoryBytes() + files.memoryBytes();
+  return result;
+}
+
+/**
+ * @brief Visit the comparable files of a torrent with their keys
+ * @param torrent The torrent
+ * @param visit Called as visit(file, key, length, coveredBytes) for every
+ * file starting on a piece boundary and spanning a whole piece, padding
+ * files excepted
+ *
+ * The key is a signature of the file's length, the piece length and the
+ * full hashes of the pieces wholly inside the file.
+ */
+template <typename Visit>
+void DedupIndex::forEachAlignedFile(const TorrentFile &torrent,
+                                    Visit &&visit) {
+  const auto &hashes = torrent.getPieces();
+  const auto &fileList = torrent.getFiles();
+  const int64_t pieceLength = torrent.getPieceLength();
+  if (pieceLength <= 0) {
+    return;
+  }
+  int64_t offset = 0;
+  for (size_t file = 0; file < fileList.size(); ++file) {
+    const int64_t length = fileList[file].length;
+    const int64_t start = offset;
+    offset += length;
+    if (fileList[file].padding || start % pieceLength != 0 ||
+        length < pieceLength) {
+      continue;
+    }
+    const uint64_t first = start / pieceLength;
+    const uint64_t whole = length / pieceLength;
+    if (first + whole > hashes.size()) {
+      continue; // Malformed torrent: fewer pieces than its files need
+    }
+    uint64_t signature = mix(mix(uint64_t(length)) ^ uint64_t(pieceLength));
+    for (uint64_t piece = first; piece < first + whole; ++piece) {
+      signature = fold(signature, hashes[piece]);
+    }
+    visit(static_cast<uint32_t>(file), nonzero(signature), length,
+          static_cast<int64_t>(whole) * pieceLength);
+  }
+}
+
+/**
+ * @brief Create a table with room for a number of keys
+ * @param expected Keys to hold without growing
+ */
+DedupIndex::Table::Table(size_t expected) {
+  size_t capacity = 16;
+  while (capacity / 4 * 3 < expected) {
+    capacity *= 2;
+  }
+  slots.resize(capacity);
+}
+
+/**
+ * @brief Find the slot of a key
+ * @param key Nonzero key
+ * @return The slot, or nullptr if absent
+ */
+const DedupIndex::Slot *DedupIndex::Table::find(uint64_t key) const {
+  const size_t mask = slots.size() - 1;
+  for (size_t i = key & mask;; i = (i + 1) & mask) {
+    if (slots[i].key == key) {
+      return &slots[i];
+    }
+    if (slots[i].key == 0) {
+      return nullptr;
+    }
+  }
+}
+
+/**
+ * @brief Insert a key unless present
+ * @param key Nonzero key
+ * @param torrent Torrent of the first occurrence
+ * @param index Piece or file of the first occurrence
+ * @return The slot holding the key, and true if it was inserted
+ *
+ * The table grows by doubling once three quarters of it are used, which
+ * keeps linear probes short for uniform keys.
+ */
+std::pair<const DedupIndex::Slot *, bool>
+DedupIndex::Table::insert(uint64_t key, uint32_t torrent, uint32_t index) {
+  if ((count + 1) * 4 > slots.size() * 3) {
+    grow();
+  }
+  const size_t mask = slots.size() - 1;
+  for (size_t i = key & mask;; i = (i + 1) & mask) {
+    if (slots[i].key == key) {
+      return {&slots[i], false};
+    }
+    if (slots[i].key == 0) {
+      slots[i] = {key, torrent, index};
+      count++;
+      return {&slots[i], true};
+    }
+  }
+}
+
+/**
+ * @brief Double the table and reinsert every key
+ */
+void DedupIndex::Table::grow() {
+  std::vector<Slot> old(slots.size() * 2);
+  old.swap(slots);
+  const size_t mask = slots.size() - 1;
+  for (const Slot &slot : old) {
+    if (slot.key == 0) {
+      continue;
+    }
+    size_t i = slot.key & mask;
+    while (slots[i].key != 0) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = slot;
+  }
+}
@@ -0,0 +1,216 @@
+#include <atomic>
+#include <deque>
+#include <epoch.hpp>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+constexpr size_t kCollectEvery = 64; // Retirements between collections
+
+/**
+ * @brief Announcement of one thread, reused after the thread exits
+ *
+ * state is 0 outside guards and (epoch << 1) | 1 inside, where epoch is the
+ * global epoch the thread observed on entering its outermost guard.
+ */
+struct alignas(64) Record {
+  std::atomic<uint64_t> state{0};
+  std::atomic<bool> inUse{true};
+  Record *next = nullptr;
+};
+
+/**
+ * @brief An object waiting for its epoch to pass
+ */
+struct Retired {
+  uint64_t epoch;
+  void *object;
+  void (*deleter)(void *);
+};
+
+/**
+ * @brief Global reclamation state, never destroyed so that threads exiting
+ * during static destruction can still release their records
+ */
+struct Domain {
+  std::atomic<uint64_t> epoch{2};
+  std::atomic<Record *> records{nullptr};
+  std::mutex mutex; // Guards retired and sinceCollect
+  std::deque<Retired> retired;
+  size_t sinceCollect = 0;
+};
+
+Domain &domain() {
+  static Domain *instance = new Domain;
+  return *instance;
+}
+
+/**
+ * @brief The calling thread's record and guard nesting depth
+ */
+struct ThreadState {
+  Record *record = nullptr;
+  unsigned depth = 0;
+
+  ~ThreadState() {
+    if (record != nullptr) {
+      record->state.store(0, std::memory_order_release);
+      record->inUse.store(false, std::memory_order_release);
+    }
+  }
+};
+
+thread_local ThreadState threadState;
+
+/**
+ * @brief Claim a free record or add a new one to the list
+ */
+Record *acquireRecord() {
+  Domain &d = domain();
+  for (Record *r = d.records.load(std::memory_order_acquire); r != nullptr;
+       r = r->next) {
+    bool free = false;
+    if (!r->inUse.load(std::memory_order_relaxed) &&
+        r->inUse.compare_exchange_strong(free, true,
+                                         std::memory_order_acquire)) {
+      return r;
+    }
+  }
+  Record *record = new Record;
+  Record *head = d.records.load(std::memory_order_relaxed);
+  do {
+    record->next = head;
+  } while (!d.records.compare_exchange_weak(head, record,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed));
+  return record;
+}
+
+/**
+ * @brief Advance the global epoch if every active thread has observed it
+ */
+void tryAdvance() {
+  Domain &d = domain();
+  uint64_t epoch = d.epoch.load(std::memory_order_seq_cst);
+  for (Record *r = d.records.load(std::memory_order_acquire); r != nullptr;
+       r = r->next) {
+    uint64_t state = r->state.load(std::memory_order_seq_cst);
+    if ((state & 1) != 0 && (state >> 1) != epoch) {
+      return;
+    }
+  }
+  d.epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+}
+
+/**
+ * @brief Advance if possible and delete every object whose epoch has passed
+ *
+ * Deleters run outside the lock, since they may retire further objects.
+ */
+void reclaim() {
+  Domain &d = domain();
+  tryAdvance();
+  uint64_t epoch = d.epoch.load(std::memory_order_seq_cst);
+  std::vector<Retired> ready;
+  {
+    std::lock_guard<std::mutex> lock(d.mutex);
+    // Retirement epochs never decrease, so the safe objects are a prefix
+    while (!d.retired.empty() && d.retired.front().epoch + 2 <= epoch) {
+      ready.push_back(d.retired.front());
+      d.retired.pop_front();
+    }
+  }
+  for (const Retired &item : ready) {
+    item.deleter(item.object);
+  }
+}
+
+} // namespace
+
+/**
+ * @brief Announce the calling thread at the current epoch
+ *
+ * The announcement is repeated until the epoch read after it matches, so an
+ * epoch advance cannot slip between reading the epoch and announcing it.
+ */
+Epoch::Guard::Guard() {
+  ThreadState &state = threadState;
+  if (state.depth++ > 0) {
+    return;
+  }
+  if (state.record == nullptr) {
+    state.record = acquireRecord();
+  }
+  Domain &d = domain();
+  uint64_t epoch = d.epoch.load(std::memory_order_seq_cst);
+  while (true) {
+    state.record->state.store((epoch << 1) | 1, std::memory_order_seq_cst);
+    uint64_t now = d.epoch.load(std::memory_order_seq_cst);
+    if (now == epoch) {
+      break;
+    }
+    epoch = now;
+  }
+}
+
+/**
+ * @brief Withdraw the announcement when the outermost guard ends
+ */
+Epoch::Guard::~Guard() {
+  ThreadState &state = threadState;
+  if (--state.depth == 0) {
+    state.record->state.store(0, std::memory_order_release);
+  }
+}
+
+/**
+ * @brief Delete an unlinked object once no reader can hold it
+ * @param object The object, no longer reachable by new readers
+ * @param deleter Function deleting the object
+ */
+void Epoch::retire(void *object, void (*deleter)(void *)) {
+  Domain &d = domain();
+  bool collectNow = false;
+  {
+    std::lock_guard<std::mutex> lock(d.mutex);
+    d.retired.push_back(
+        {d.epoch.load(std::memory_order_seq_cst), object, deleter});
+    if (++d.sinceCollect >= kCollectEvery) {
+      d.sinceCollect = 0;
+      collectNow = true;
+    }
+  }
+  if (collectNow) {
+    reclaim();
+  }
+}
+
+/**
+ * @brief Try to advance the epoch and delete what has become safe
+ *
+ * Two advances are needed before the newest retirements become safe, so
+ * this tries twice.
+ */
+void Epoch::collect() {
+  reclaim();
+  reclaim();
+}
+
+/**
+ * @brief Get the number of retired objects not yet deleted
+ * @return Object count
+ */
+size_t Epoch::pending() {
+  Domain &d = domain();
+  std::lock_guard<std::mutex> lock(d.mutex);
+  return d.retired.size();
+}
+
+/**
+ * @brief Get the current global epoch
+ * @return Epoch counter
+ */
+uint64_t Epoch::current() {
+  return domain().epoch.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,99 @@
+#include <histogram.hpp>
+
+/**
+ * @brief Get the mean value
+ * @return The mean, or 0 if the histogram is empty
+ */
+double Histogram::Snapshot::mean() const {
+  return count == 0 ? 0.0 : static_cast<double>(sum) / count;
+}
+
+/**
+ * @brief Estimate a quantile
+ * @param quantile Fraction of values at or below the result, in [0, 1]
+ * @return Upper bound of the bucket holding the quantile, or 0 if the
+ * histogram is empty
+ *
+ * Reporting the upper bound errs on the pessimistic side, which is what a
+ * latency percentile should do.
+ */
+uint64_t Histogram::Snapshot::percentile(double quantile) const {
+  if (count == 0) {
+    return 0;
+  }
+  // Rank of the quantile, counting from 1
+  uint64_t rank = static_cast<uint64_t>(quantile * count + 0.5);
+  rank = rank == 0 ? 1 : (rank > count ? count : rank);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return bucketUpperBound(i);
+    }
+  }
+  return max();
+}
+
+/**
+ * @brief Get the largest value
+ * @return Upper bound of the highest non-empty bucket, or 0 if empty
+ */
+uint64_t Histogram::Snapshot::max() const {
+  for (size_t i = buckets.size(); i > 0; --i) {
+    if (buckets[i - 1] > 0) {
+      return bucketUpperBound(i - 1);
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Copy the current counts
+ * @return The snapshot
+ */
+Histogram::Snapshot Histogram::snapshot() const {
+  Snapshot result;
+  result.buckets.resize(kNumBuckets);
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    result.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+    result.count += result.buckets[i];
+  }
+  result.sum = sum.load(std::memory_order_relaxed);
+  return result;
+}
+
+/**
+ * @brief Clear all counts
+ */
+void Histogram::reset() {
+  for (auto &bucket : buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  sum.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Get the smallest value counted in a bucket
+ * @param index Bucket index below kNumBuckets
+ * @return The lower bound
+ */
+uint64_t Histogram::bucketLowerBound(size_t index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  size_t shift = index / kSubBuckets - 1;
+  return uint64_t{kSubBuckets + index % kSubBuckets} << shift;
+}
+
+/**
+ * @brief Get the largest value counted in a bucket
+ * @param index Bucket index below kNumBuckets
+ * @return The upper bound
+ */
+uint64_t Histogram::bucketUpperBound(size_t index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  size_t shift = index / kSubBuckets - 1;
+  return bucketLowerBound(index) + ((uint64_t{1} << shift) - 1);
+}
@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <httputil.hpp>
+
+/**
+ * @brief Build an exception for a failed system call
+ * @param what Description of the operation
+ * @return Exception carrying the errno description
+ */
+std::runtime_error HttpUtil::systemError(const std::string &what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+/**
+ * @brief Read the monotonic clock
+ * @return Milliseconds since an arbitrary epoch
+ */
+int64_t HttpUtil::nowMillis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * @brief Compare ASCII strings ignoring case
+ */
+bool HttpUtil::equalsIgnoreCase(std::string_view a, std::string_view b) {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return std::tolower(static_cast<unsigned char>(x)) ==
+                  std::tolower(static_cast<unsigned char>(y));
+         });
+}
+
+/**
+ * @brief Remove leading and trailing spaces and tabs
+ */
+std::string_view HttpUtil::trim(std::string_view text) {
+  while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+/**
+ * @brief Parse a non-negative decimal number filling a whole string
+ * @param text Digits only, at most 18 of them
+ * @return The number, or -1 if the text is anything else
+ *
+ * For values that must be nothing but a number, such as the bounds of a
+ * Range header.
+ */
+int64_t HttpUtil::parseWholeNumber(std::string_view text) {
+  if (text.empty() || text.size() > 18) {
+    return -1;
+  }
+  int64_t value = 0;
+  for (char c : text) {
+    if (c < '0' || c > '9') {
+      return -1;
+    }
+    value = value * 10 + (c - '0');
+  }
+  return value;
+}
+
+/**
+ * @brief Parse the non-negative decimal number a string starts with
+ * @param text Digits, possibly followed by anything; at most 18 are read
+ * @return The number, or -1 if the text does not start with a digit
+ *
+ * For fields where a number leads other text, such as a status line or
+ * the first byte of a Content-Range.
+ */
+int64_t HttpUtil::parseLeadingNumber(std::string_view text) {
+  int64_t value = -1;
+  for (size_t i = 0; i < text.size() && i < 18 &&
+                     std::isdigit(static_cast<unsigned char>(text[i]));
+       ++i) {
+    value = (value < 0 ? 0 : value * 10) + (text[i] - '0');
+  }
+  return value;
+}
@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <metrics.hpp>
+#include <stdexcept>
+
+namespace {
+
+/**
+ * @brief Check a metric name against [a-zA-Z_:][a-zA-Z0-9_:]*
+ */
+bool isValidName(const std::string &name) {
+  if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0]))) {
+    return false;
+  }
+  return std::all_of(name.begin(), name.end(), [](char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_' ||
+           c == ':';
+  });
+}
+
+/**
+ * @brief Check a label name against [a-zA-Z_][a-zA-Z0-9_]*, without the
+ * reserved __ prefix
+ */
+bool isValidLabelName(const std::string &name) {
+  if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])) ||
+      name.compare(0, 2, "__") == 0) {
+    return false;
+  }
+  return std::all_of(name.begin(), name.end(), [](char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+  });
+}
+
+/**
+ * @brief Append text escaped for a HELP line or, with quotes, a label value
+ */
+void appendEscaped(std::string &out, const std::string &text, bool quotes) {
+  for (char c : text) {
+    if (c == '\\') {
+      out += "\\\\";
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if (c == '"' && quotes) {
+      out += "\\\"";
+    } else {
+      out += c;
+    }
+  }
+}
+
+/**
+ * @brief Append a label set in braces, plus an optional extra label
+ */
+void appendLabels(std::string &out, const MetricsRegistry::Labels &labels,
+                  const std::string &extraName = "",
+                  const std::string &extraValue = "") {
+  if (labels.empty() && extraName.empty()) {
+    return;
+  }
+  out += '{';
+  bool first = true;
+  auto append = [&](const std::string &name, const std::string &value) {
+    if (!first) {
+      out += ',';
+    }
+    first = false;
+    out += name;
+    out += "=\"";
+    appendEscaped(out, value, true);
+    out += '"';
+  };
+  for (const auto &[name, value] : labels) {
+    append(name, value);
+  }
+  if (!extraName.empty()) {
+    append(extraName, extraValue);
+  }
+  out += '}';
+}
+
+/**
+ * @brief Format a floating-point sample value
+ */
+std::string formatDouble(double value) {
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.9g", value);
+  return text;
+}
+
+} // namespace
+
+/**
+ * @brief Get the total of all shards
+ * @return The counter value
+ */
+uint64_t MetricsRegistry::Counter::value() const {
+  uint64_t total = 0;
+  for (const auto &shard : shards) {
+    total += shard.value.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+/**
+ * @brief Merge all shards
+ * @return The combined snapshot
+ */
+::Histogram::Snapshot MetricsRegistry::Histogram::snapshot() const {
+  ::Histogram::Snapshot total = shards[0].histogram.snapshot();
+  for (size_t i = 1; i < shards.size(); ++i) {
+    ::Histogram::Snapshot shard = shards[i].histogram.snapshot();
+    for (size_t b = 0; b < shard.buckets.size(); ++b) {
+      total.buckets[b] += shard.buckets[b];
+    }
+    total.count += shard.count;
+    total.sum += shard.sum;
+  }
+  return total;
+}
+
+/**
+ * @brief Get the registry shared by the whole library
+ * @return The global registry
+ *
+ * The registry is never destroyed, so metrics can be updated from static
+ * destructors and detached threads until the process exits.
+ */
+MetricsRegistry &MetricsRegistry::global() {
+  static MetricsRegistry *registry = new MetricsRegistry;
+  return *registry;
+}
+
+/**
+ * @brief Register or look up a counter
+ * @param name Metric name; by convention ends in _total
+ * @param help One-line description
+ * @param labels Label names and values
+ * @return The counter
+ * @throws std::invalid_argument if the name or a label name is invalid, or
+ * the name is registered with another type
+ */
+MetricsRegistry::Counter &MetricsRegistry::counter(const std::string &name,
+                                                   const std::string &help,
+                                                   const Labels &labels) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Labels sorted = labels;
+  std::sort(sorted.begin(), sorted.end());
+  auto &slot = family(name, help, Type::Counter, sorted).counters[sorted];
+  if (!slot) {
+    slot = std::make_unique<Counter>();
+  }
+  return *slot;
+}
+
+/**
+ * @brief Register or look up a gauge
+ * @param name Metric name
+ * @param help One-line description
+ * @param labels Label names and values
+ * @return The gauge
+ * @throws std::invalid_argument if the name or a label name is invalid, or
+ * the name is registered with another type
+ */
+MetricsRegistry::Gauge &MetricsRegistry::gauge(const std::string &name,
+                                               const std::string &help,
+                                               const Labels &labels) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Labels sorted = labels;
+  std::sort(sorted.begin(), sorted.end());
+  auto &slot = family(name, help, Type::Gauge, sorted).gauges[sorted];
+  if (!slot) {
+    slot = std::make_unique<Gauge>();
+  }
+  return *slot;
+}
+
+/**
+ * @brief Register or look up a histogram of nanosecond latencies
+ * @param name Metric name; by convention ends in _seconds
+ * @param help One-line description
+ * @param labels Label names and values
+ * @return The histogram, exported in seconds with the default buckets
+ * @throws std::invalid_argument if the name or a label name is invalid, or
+ * the name is registered with another type
+ */
+MetricsRegistry::Histogram &
+MetricsRegistry::histogram(const std::string &name, const std::string &help,
+                           const Labels &labels) {
+  return histogram(name, help, labels, HistogramSpec{});
+}
+
+/**
+ * @brief Register or look up a histogram
+ * @param name Metric name; by convention ends in the unit, e.g. _bytes
+ * @param help One-line description
+ * @param labels Label names and values
+ * @param spec Export unit and bucket bounds; the first registration of a
+ * name sets them for all its label sets
+ * @return The histogram
+ * @throws std::invalid_argument if the name or a label name is invalid, the
+ * name is registered with another type, or the spec is invalid
+ */
+MetricsRegistry::Histogram &
+MetricsRegistry::histogram(const std::string &name, const std::string &help,
+                           const Labels &labels, const HistogramSpec &spec) {
+  if (spec.minExponent < 0 || spec.maxExponent > 63 ||
+      spec.minExponent > spec.maxExponent || !(spec.scale > 0)) {
+    throw std::invalid_argument("Invalid histogram buckets for " + name);
+  }
+  for (const auto &label : labels) {
+    if (label.first == "le") {
+      throw std::invalid_argument("Histogram label 'le' is reserved: " + name);
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  Labels sorted = labels;
+  std::sort(sorted.begin(), sorted.end());
+  bool isNew = families.find(name) == families.end();
+  Family &entry = family(name, help, Type::Histogram, sorted);
+  if (isNew) {
+    entry.spec = spec;
+  }
+  auto &slot = entry.histograms[sorted];
+  if (!slot) {
+    slot = std::make_unique<Histogram>();
+  }
+  return *slot;
+}
+
+/**
+ * @brief Render all metrics in the Prometheus text format
+ * @return The exposition, metric families sorted by name
+ *
+ * Histogram buckets are cumulative as the format requires; a bucket with
+ * bound 2^e counts the values below 2^e base units.
+ */
+std::string MetricsRegistry::render() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::string out;
+  for (const auto &[name, entry] : families) {
+    out += "# HELP " + name + ' ';
+    appendEscaped(out, entry.help, false);
+    out += "\n# TYPE " + name + ' ';
+
+    switch (entry.type) {
+    case Type::Counter:
+      out += "counter\n";
+      for (const auto &[labels, counter] : entry.counters) {
+        out += name;
+        appendLabels(out, labels);
+        out += ' ' + std::to_string(counter->value()) + '\n';
+      }
+      break;
+    case Type::Gauge:
+      out += "gauge\n";
+      for (const auto &[labels, gauge] : entry.gauges) {
+        out += name;
+        appendLabels(out, labels);
+        out += ' ' + std::to_string(gauge->value()) + '\n';
+      }
+      break;
+    case Type::Histogram:
+      out += "histogram\n";
+      for (const auto &[labels, histogram] : entry.histograms) {
+        ::Histogram::Snapshot snapshot = histogram->snapshot();
+        uint64_t cumulative = 0;
+        size_t bucket = 0;
+        for (int e = entry.spec.minExponent; e <= entry.spec.maxExponent;
+             ++e) {
+          // Buckets up to the one ending just below 2^e; le is inclusive,
+          // so the bound exported is that bucket's largest value
+          size_t end = ::Histogram::bucketIndex(uint64_t{1} << e);
+          for (; bucket < end; ++bucket) {
+            cumulative += snapshot.buckets[bucket];
+          }
+          const uint64_t bound = ::Histogram::bucketUpperBound(end - 1);
+          out += name + "_bucket";
+          appendLabels(out, labels, "le",
+                       formatDouble(static_cast<double>(bound) *
+                                    entry.spec.scale));
+          out += ' ' + std::to_string(cumulative) + '\n';
+        }
+        out += name + "_bucket";
+        appendLabels(out, labels, "le", "+Inf");
+        out += ' ' + std::to_string(snapshot.count) + '\n';
+        out += name + "_sum";
+        appendLabels(out, labels);
+        out += ' ' + formatDouble(snapshot.sum * entry.spec.scale) + '\n';
+        out += name + "_count";
+        appendLabels(out, labels);
+        out += ' ' + std::to_string(snapshot.count) + '\n';
+      }
+      break;
+    }
+  }
+  return out;
+}
+
+/**
+ * @brief Find or create the family of a name
+ * @param name Metric name
+ * @param help One-line description, kept from the first registration
+ * @param type Metric type
+ * @param labels Label names and values
+ * @return The family
+ * @throws std::invalid_argument if the name or a label name is invalid, or
+ * the family has another type
+ */
+MetricsRegistry::Family &MetricsRegistry::family(const std::string &name,
+                                                 const std::string &help,
+                                                 Type type,
+                                                 const Labels &labels) {
+  if (!isValidName(name)) {
+    throw std::invalid_argument("Invalid metric name: " + name);
+  }
+  for (const auto &label : labels) {
+    if (!isValidLabelName(label.first)) {
+      throw std::invalid_argument("Invalid label name for " + name + ": " +
+                                  label.first);
+    }
+  }
+  auto [it, inserted] = families.try_emplace(name);
+  if (inserted) {
+    it->second.type = type;
+    it->second.help = help;
+  } else if (it->second.type != type) {
+    throw std::invalid_argument("Metric registered with another type: " +
+                                name);
+  }
+  return it->second;
+}
+
+/**
+ * @brief Hand out shard indices round-robin
+ * @return Index below kShards for a new thread
+ */
+size_t MetricsRegistry::nextShard() {
+  static std::atomic<size_t> next{0};
+  return next.fetch_add(1, std::memory_order_relaxed) % kShards;
+}
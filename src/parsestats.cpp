@@ -0,0 +1,221 @@
+#include <cycleclock.hpp>
+#include <iomanip>
+#include <parsestats.hpp>
+#include <sstream>
+
+namespace {
+
+/**
+ * @brief Process-wide histograms of recorded loads
+ */
+struct Histograms {
+  Histogram phaseNanos[ParseStats::kNumPhases];
+  Histogram phaseAllocations[ParseStats::kNumPhases];
+  Histogram totalNanos;
+  Histogram bytes;
+  Histogram nodes;
+  std::atomic<uint64_t> failures{0};
+};
+
+Histograms histograms;
+std::atomic<ParseStats::AllocationCounter> allocationCounter{nullptr};
+
+const char *const kPhaseNames[ParseStats::kNumPhases] = {"read", "decode",
+                                                         "extract"};
+
+/**
+ * @brief Read the installed allocation counter
+ * @return The calling thread's allocation count, or 0 without a counter
+ */
+uint64_t currentAllocations() {
+  auto counter = allocationCounter.load(std::memory_order_relaxed);
+  return counter != nullptr ? counter() : 0;
+}
+
+/**
+ * @brief Append one row of the report
+ */
+void appendRow(std::ostringstream &out, const std::string &name,
+               const Histogram &histogram) {
+  Histogram::Snapshot snapshot = histogram.snapshot();
+  if (snapshot.count == 0) {
+    return;
+  }
+  out << std::left << std::setw(22) << name << std::right << std::setw(10)
+      << snapshot.count << std::setw(12) << std::fixed << std::setprecision(0)
+      << snapshot.mean() << std::setw(12) << snapshot.percentile(0.5)
+      << std::setw(12) << snapshot.percentile(0.9) << std::setw(12)
+      << snapshot.percentile(0.99) << std::setw(12) << snapshot.max() << '\n';
+}
+
+} // namespace
+
+/**
+ * @brief Start recording
+ */
+void ParseStats::enable() {
+  CycleClock::nanosPerTick();
+  enabled.store(true, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Stop recording; the histograms keep their counts
+ */
+void ParseStats::disable() { enabled.store(false, std::memory_order_relaxed); }
+
+/**
+ * @brief Install the source of allocation counts
+ * @param counter Function returning a per-thread running count of
+ * allocations, or nullptr to stop counting
+ */
+void ParseStats::setAllocationCounter(AllocationCounter counter) {
+  allocationCounter.store(counter, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Get the histogram of a phase's duration
+ * @param phase The phase
+ * @return Histogram in nanoseconds
+ */
+const Histogram &ParseStats::phaseNanos(Phase phase) {
+  return histograms.phaseNanos[static_cast<size_t>(phase)];
+}
+
+/**
+ * @brief Get the histogram of a phase's allocations
+ * @param phase The phase
+ * @return Histogram of allocation counts, empty without an allocation counter
+ */
+const Histogram &ParseStats::phaseAllocations(Phase phase) {
+  return histograms.phaseAllocations[static_cast<size_t>(phase)];
+}
+
+/**
+ * @brief Get the histogram of whole loads
+ * @return Histogram of the summed phase durations in nanoseconds
+ */
+const Histogram &ParseStats::totalNanos() { return histograms.totalNanos; }
+
+/**
+ * @brief Get the histogram of data sizes
+ * @return Histogram of Bencode data sizes in bytes
+ */
+const Histogram &ParseStats::bytes() { return histograms.bytes; }
+
+/**
+ * @brief Get the histogram of node counts
+ * @return Histogram of the number of decoded Bencode values
+ */
+const Histogram &ParseStats::nodes() { return histograms.nodes; }
+
+/**
+ * @brief Get the number of loads that threw
+ * @return Failed load count
+ */
+uint64_t ParseStats::failures() {
+  return histograms.failures.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Clear all histograms and the failure count
+ */
+void ParseStats::reset() {
+  for (size_t i = 0; i < kNumPhases; ++i) {
+    histograms.phaseNanos[i].reset();
+    histograms.phaseAllocations[i].reset();
+  }
+  histograms.totalNanos.reset();
+  histograms.bytes.reset();
+  histograms.nodes.reset();
+  histograms.failures.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Format the histograms as a table
+ * @return One line per non-empty histogram with count, mean and percentiles
+ *
+ * Percentiles are bucket upper bounds, so they overstate by at most 1/8.
+ */
+std::string ParseStats::report() {
+  std::ostringstream out;
+  out << std::left << std::setw(22) << "metric" << std::right << std::setw(10)
+      << "count" << std::setw(12) << "mean" << std::setw(12) << "p50"
+      << std::setw(12) << "p90" << std::setw(12) << "p99" << std::setw(12)
+      << "max" << '\n';
+  for (size_t i = 0; i < kNumPhases; ++i) {
+    appendRow(out, std::string(kPhaseNames[i]) + " ns",
+              histograms.phaseNanos[i]);
+  }
+  appendRow(out, "total ns", histograms.totalNanos);
+  for (size_t i = 0; i < kNumPhases; ++i) {
+    appendRow(out, std::string(kPhaseNames[i]) + " allocations",
+              histograms.phaseAllocations[i]);
+  }
+  appendRow(out, "bytes", histograms.bytes);
+  appendRow(out, "nodes", histograms.nodes);
+  out << "failures " << failures() << '\n';
+  return out.str();
+}
+
+/**
+ * @brief Start measuring a load
+ */
+ParseStats::Sample::Sample()
+    : mark(CycleClock::now()), markAllocations(currentAllocations()) {}
+
+/**
+ * @brief Count the load as failed unless it was committed
+ */
+ParseStats::Sample::~Sample() {
+  if (!committed) {
+    histograms.failures.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief End a phase that started at the previous mark
+ * @param phase The phase that just ended
+ */
+void ParseStats::Sample::endPhase(Phase phase) {
+  uint64_t now = CycleClock::now();
+  uint64_t allocationsNow = currentAllocations();
+  size_t index = static_cast<size_t>(phase);
+  ticks[index] += now - mark;
+  allocations[index] += allocationsNow - markAllocations;
+  ended[index] = true;
+  mark = now;
+  markAllocations = allocationsNow;
+}
+
+/**
+ * @brief Move the mark to now, leaving the time since out of all phases
+ */
+void ParseStats::Sample::skip() {
+  mark = CycleClock::now();
+  markAllocations = currentAllocations();
+}
+
+/**
+ * @brief Record the sample into the histograms
+ * @param byteCount Size of the Bencode data
+ * @param nodeCount Number of decoded Bencode values
+ */
+void ParseStats::Sample::commit(size_t byteCount, size_t nodeCount) {
+  bool countAllocations =
+      allocationCounter.load(std::memory_order_relaxed) != nullptr;
+  uint64_t totalTicks = 0;
+  for (size_t i = 0; i < kNumPhases; ++i) {
+    if (!ended[i]) {
+      continue;
+    }
+    totalTicks += ticks[i];
+    histograms.phaseNanos[i].record(CycleClock::toNanos(ticks[i]));
+    if (countAllocations) {
+      histograms.phaseAllocations[i].record(allocations[i]);
+    }
+  }
+  histograms.totalNanos.record(CycleClock::toNanos(totalTicks));
+  histograms.bytes.record(byteCount);
+  histograms.nodes.record(nodeCount);
+  committed = true;
+}
@@ -0,0 +1,398 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <bencode.hpp>
+#include <peerexchange.hpp>
+#include <stdexcept>
+
+namespace {
+
+constexpr size_t kCompactV4 = 6;
+constexpr size_t kCompactV6 = 18;
+constexpr size_t kMinLogSlack = 64; // Dead events tolerated at any size
+
+bool validCompact(std::string_view compact) {
+  return compact.size() == kCompactV4 || compact.size() == kCompactV6;
+}
+
+/**
+ * @brief Read a string entry of a ut_pex dictionary
+ * @param value Encoding of the entry's value
+ * @return The string
+ * @throws std::runtime_error if the value is not a string
+ */
+std::string stringValue(std::string_view value) {
+  BencodeValue parsed = BencodeParser::parse(value);
+  if (!parsed.isString()) {
+    throw std::runtime_error("ut_pex peer list is not a string");
+  }
+  return parsed.getString();
+}
+
+/**
+ * @brief Split a compact peer list into peers
+ * @param list Concatenated compact peers
+ * @param size Bytes per peer
+ * @param out Receives the peers
+ * @return Number of peers
+ * @throws std::runtime_error if list is not a whole number of peers
+ */
+size_t splitPeers(const std::string &list, size_t size,
+                  std::vector<std::string> &out) {
+  if (list.size() % size != 0) {
+    throw std::runtime_error("ut_pex peer list length " +
+                             std::to_string(list.size()) +
+                             " is not a multiple of " + std::to_string(size));
+  }
+  for (size_t i = 0; i < list.size(); i += size) {
+    out.push_back(list.substr(i, size));
+  }
+  return list.size() / size;
+}
+
+} // namespace
+
+PeerExchange::PeerExchange(const Options &options) : options(options) {}
+
+PeerExchange::PeerExchange() : PeerExchange(Options()) {}
+
+/**
+ * @brief Record a new connection
+ * @param compact The peer's address and port, 6 or 18 bytes
+ * @param flags Its Flag bits
+ * @return Handle of the peer
+ * @throws std::invalid_argument if compact has another length
+ * @throws std::logic_error if the peer is already connected
+ *
+ * A peer dropped recently enough to still be known takes its old entry
+ * back, so recipients that were not yet told of the drop see one add. The
+ * entry keeps its first connect's generation: a recipient told of the
+ * peer before must hear of a later drop, and one that was not gets a
+ * harmless extra drop at worst.
+ */
+PeerExchange::PeerId PeerExchange::connect(std::string_view compact,
+                                           uint8_t flags) {
+  if (!validCompact(compact)) {
+    throw std::invalid_argument("Compact peer must be 6 or 18 bytes");
+  }
+  std::string key(compact);
+  auto found = byCompact.find(key);
+  PeerId peer;
+  bool known = false;
+  if (found != byCompact.end()) {
+    known = true;
+    peer = found->second;
+    if (entries[peer].live) {
+      throw std::logic_error("Peer " + formatPeer(compact) +
+                             " is already connected");
+    }
+  } else if (!freeEntries.empty()) {
+    peer = freeEntries.back();
+    freeEntries.pop_back();
+    entries[peer].compact = key;
+    byCompact.emplace(std::move(key), peer);
+  } else {
+    peer = static_cast<PeerId>(entries.size());
+    entries.push_back(Entry());
+    entries[peer].compact = key;
+    byCompact.emplace(std::move(key), peer);
+  }
+  Entry &entry = entries[peer];
+  entry.live = true;
+  entry.flags = flags;
+  entry.cursor = kDisabled;
+  ++connected;
+  record(peer);
+  if (!known) {
+    entry.firstAdded = entry.changed;
+  }
+  return peer;
+}
+
+/**
+ * @brief Record the end of a connection
+ * @param peer Handle from connect(), invalid afterwards
+ */
+void PeerExchange::disconnect(PeerId peer) {
+  Entry &entry = live(peer);
+  entry.live = false;
+  entry.cursor = kDisabled;
+  --connected;
+  record(peer);
+}
+
+/**
+ * @brief Change the flags of a peer, which is then announced again
+ * @param peer Handle from connect()
+ * @param flags Its new Flag bits
+ */
+void PeerExchange::setFlags(PeerId peer, uint8_t flags) {
+  Entry &entry = live(peer);
+  if (entry.flags != flags) {
+    entry.flags = flags;
+    record(peer);
+  }
+}
+
+/**
+ * @brief Start exchanging with a peer that negotiated ut_pex
+ * @param peer Handle from connect()
+ */
+void PeerExchange::enable(PeerId peer) {
+  Entry &entry = live(peer);
+  if (entry.cursor == kDisabled) {
+    entry.cursor = 0;
+  }
+}
+
+/**
+ * @brief Build a peer's next message, advancing it past the changes sent
+ * @param peer Handle of an enabled peer
+ * @param message Filled in with the changes it was not told about
+ * @return false if there is nothing to tell
+ * @throws std::logic_error if the peer is not enabled
+ *
+ * Reads the log from the first event after the peer's cursor. Events
+ * superseded by a later one of the same peer are passed over, and so are
+ * drops of peers first added after the cursor, which the recipient never
+ * heard of. A full list stops the scan at the event that does not fit, which
+ * the next message starts from.
+ */
+bool PeerExchange::next(PeerId peer, Message &message) {
+  Entry &self = live(peer);
+  if (self.cursor == kDisabled) {
+    throw std::logic_error("Peer exchange not enabled for " +
+                           formatPeer(self.compact));
+  }
+  message.added.clear();
+  message.addedFlags.clear();
+  message.dropped.clear();
+  const uint64_t cursor = self.cursor;
+  auto event = std::upper_bound(
+      log.begin(), log.end(), cursor,
+      [](uint64_t generation, const Event &e) {
+        return generation < e.generation;
+      });
+  uint64_t reached = currentGeneration;
+  for (; event != log.end(); ++event) {
+    const Entry &entry = entries[event->peer];
+    if (event->generation == entry.changed && event->peer != peer) {
+      if (entry.live) {
+        if (message.added.size() == options.maxAdded) {
+          reached = event->generation - 1;
+          break;
+        }
+        message.added.push_back(entry.compact);
+        message.addedFlags.push_back(entry.flags);
+      } else if (entry.firstAdded <= cursor) {
+        if (message.dropped.size() == options.maxDropped) {
+          reached = event->generation - 1;
+          break;
+        }
+        message.dropped.push_back(entry.compact);
+      }
+    }
+  }
+  self.cursor = reached;
+  return !message.added.empty() || !message.dropped.empty();
+}
+
+size_t PeerExchange::size() const { return connected; }
+
+const std::string &PeerExchange::compact(PeerId peer) const {
+  return entries.at(peer).compact;
+}
+
+uint64_t PeerExchange::generation() const { return currentGeneration; }
+
+size_t PeerExchange::logSize() const { return log.size(); }
+
+/**
+ * @brief Encode a ut_pex message payload
+ * @param message The message
+ * @return The bencoded dictionary
+ *
+ * IPv4 and IPv6 peers go to their own lists; every list is present, even
+ * if empty, and keys are in sorted order.
+ */
+std::string PeerExchange::encode(const Message &message) {
+  std::string added, addedFlags, added6, added6Flags, dropped, dropped6;
+  for (size_t i = 0; i < message.added.size(); ++i) {
+    const std::string &peer = message.added[i];
+    const char flags =
+        static_cast<char>(i < message.addedFlags.size() ? message.addedFlags[i]
+                                                        : 0);
+    if (peer.size() == kCompactV4) {
+      added += peer;
+      addedFlags += flags;
+    } else if (peer.size() == kCompactV6) {
+      added6 += peer;
+      added6Flags += flags;
+    }
+  }
+  for (const std::string &peer : message.dropped) {
+    if (peer.size() == kCompactV4) {
+      dropped += peer;
+    } else if (peer.size() == kCompactV6) {
+      dropped6 += peer;
+    }
+  }
+  std::string out = "d";
+  for (auto [key, value] :
+       {std::pair<std::string_view, const std::string &>{"added", added},
+        {"added.f", addedFlags},
+        {"added6", added6},
+        {"added6.f", added6Flags},
+        {"dropped", dropped},
+        {"dropped6", dropped6}}) {
+    BencodeEncoder::encodeString(key, out);
+    BencodeEncoder::encodeString(value, out);
+  }
+  out += 'e';
+  return out;
+}
+
+/**
+ * @brief Decode a ut_pex message payload
+ * @param payload The bencoded dictionary
+ * @return The message; flags missing or of the wrong count read as 0
+ * @throws std::runtime_error if the payload is not a dictionary or a
+ * peer list is not a whole number of compact peers
+ *
+ * Unknown keys are ignored. IPv4 peers come before IPv6 ones.
+ */
+PeerExchange::Message PeerExchange::decode(std::string_view payload) {
+  if (payload.empty() || payload[0] != 'd') {
+    throw std::runtime_error("ut_pex message is not a dictionary");
+  }
+  std::string lists[6];
+  const std::string_view keys[6] = {"added",   "added.f", "added6",
+                                    "added6.f", "dropped", "dropped6"};
+  for (const BencodeParser::RawEntry &entry :
+       BencodeParser::dictEntries(payload)) {
+    auto key = std::find(std::begin(keys), std::end(keys), entry.key);
+    if (key != std::end(keys)) {
+      lists[key - std::begin(keys)] = stringValue(entry.value);
+    }
+  }
+  Message message;
+  for (size_t family = 0; family < 2; ++family) {
+    const std::string &peers = lists[family * 2];
+    const std::string &flags = lists[family * 2 + 1];
+    size_t count = splitPeers(peers, family == 0 ? kCompactV4 : kCompactV6,
+                              message.added);
+    for (size_t i = 0; i < count; ++i) {
+      message.addedFlags.push_back(
+          flags.size() == count ? static_cast<uint8_t>(flags[i]) : 0);
+    }
+  }
+  splitPeers(lists[4], kCompactV4, message.dropped);
+  splitPeers(lists[5], kCompactV6, message.dropped);
+  return message;
+}
+
+/**
+ * @brief Build the compact form of an address
+ * @param address Dotted IPv4 or textual IPv6 address
+ * @param port Port
+ * @return 6 or 18 bytes
+ * @throws std::invalid_argument if the address does not parse
+ */
+std::string PeerExchange::compactPeer(const std::string &address,
+                                      uint16_t port) {
+  unsigned char bytes[16];
+  std::string out;
+  if (inet_pton(AF_INET, address.c_str(), bytes) == 1) {
+    out.assign(reinterpret_cast<char *>(bytes), 4);
+  } else if (inet_pton(AF_INET6, address.c_str(), bytes) == 1) {
+    out.assign(reinterpret_cast<char *>(bytes), 16);
+  } else {
+    throw std::invalid_argument("Not an IP address: " + address);
+  }
+  out += static_cast<char>(port >> 8);
+  out += static_cast<char>(port);
+  return out;
+}
+
+/**
+ * @brief Format a compact peer for humans
+ * @param compact 6 or 18 bytes
+ * @return "1.2.3.4:6881" or "[2001:db8::1]:6881"
+ * @throws std::invalid_argument if compact has another length
+ */
+std::string PeerExchange::formatPeer(std::string_view compact) {
+  if (!validCompact(compact)) {
+    throw std::invalid_argument("Compact peer must be 6 or 18 bytes");
+  }
+  const bool v6 = compact.size() == kCompactV6;
+  char text[INET6_ADDRSTRLEN];
+  inet_ntop(v6 ? AF_INET6 : AF_INET, compact.data(), text, sizeof(text));
+  const auto *port = reinterpret_cast<const uint8_t *>(
+      compact.data() + compact.size() - 2);
+  const std::string host = v6 ? "[" + std::string(text) + "]" : text;
+  return host + ":" + std::to_string(port[0] << 8 | port[1]);
+}
+
+/**
+ * @brief Give a peer's change the next generation and log it
+ * @param peer The peer
+ *
+ * The peer's previous event, if any, is superseded and left for
+ * compactLog() to remove once such dead events outnumber the live ones.
+ */
+void PeerExchange::record(PeerId peer) {
+  Entry &entry = entries[peer];
+  if (entry.changed == 0) {
+    ++liveEvents;
+  }
+  entry.changed = ++currentGeneration;
+  log.push_back({entry.changed, peer});
+  if (log.size() > 2 * liveEvents + kMinLogSlack) {
+    compactLog();
+  }
+}
+
+/**
+ * @brief Drop superseded events and peers every recipient knows are gone
+ *
+ * A disconnected peer's event must stay while an enabled recipient's
+ * cursor is before it; after that the peer is forgotten and its entry
+ * reused.
+ */
+void PeerExchange::compactLog() {
+  uint64_t oldestCursor = currentGeneration;
+  for (const Entry &entry : entries) {
+    if (entry.live && entry.cursor != kDisabled) {
+      oldestCursor = std::min(oldestCursor, entry.cursor);
+    }
+  }
+  std::vector<Event> kept;
+  kept.reserve(liveEvents);
+  for (const Event &event : log) {
+    Entry &entry = entries[event.peer];
+    if (event.generation != entry.changed) {
+      continue;
+    }
+    if (entry.live || entry.changed > oldestCursor) {
+      kept.push_back(event);
+      continue;
+    }
+    byCompact.erase(entry.compact);
+    entry = Entry();
+    freeEntries.push_back(event.peer);
+  }
+  log = std::move(kept);
+  liveEvents = log.size();
+}
+
+/**
+ * @brief Look up a connected peer
+ * @param peer Its handle
+ * @return Its entry
+ * @throws std::logic_error if the handle is not a connected peer
+ */
+PeerExchange::Entry &PeerExchange::live(PeerId peer) {
+  if (peer >= entries.size() || !entries[peer].live) {
+    throw std::logic_error("Not a connected peer: " + std::to_string(peer));
+  }
+  return entries[peer];
+}
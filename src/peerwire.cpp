@@ -0,0 +1,345 @@
+#include <peerwire.hpp>
+#include <stdexcept>
+
+namespace {
+
+constexpr std::string_view kProtocol = "BitTorrent protocol";
+
+/**
+ * @brief Append a 32-bit integer in network byte order
+ */
+void appendUint32(std::string &out, uint32_t value) {
+  uint8_t bytes[4];
+  PeerWire::writeUint32(value, bytes);
+  out.append(reinterpret_cast<const char *>(bytes), 4);
+}
+
+/**
+ * @brief Append the length prefix and id of a message
+ */
+void appendHeader(std::string &out, PeerWire::MessageId id,
+                  uint32_t payloadLength) {
+  uint8_t header[PeerWire::kMessageHeaderSize];
+  PeerWire::encodeMessageHeader(id, payloadLength, header);
+  out.append(reinterpret_cast<const char *>(header), sizeof(header));
+}
+
+} // namespace
+
+/**
+ * @brief Construct a reader
+ * @param expectHandshake Whether the stream starts with a handshake
+ * @param maxMessageSize Largest accepted message length
+ */
+PeerWire::Reader::Reader(bool expectHandshake, uint32_t maxMessageSize)
+    : awaitingHandshake(expectHandshake), maxMessageSize(maxMessageSize) {}
+
+/**
+ * @brief Add received bytes to the stream
+ * @param data Pointer to the received bytes
+ * @param length Number of bytes
+ *
+ * Decoded bytes are dropped from the front of the buffer first, which
+ * invalidates views handed out by earlier calls to next().
+ */
+void PeerWire::Reader::feed(const char *data, size_t length) {
+  if (position > 0) {
+    buffer.erase(0, position);
+    position = 0;
+  }
+  buffer.append(data, length);
+}
+
+/**
+ * @brief Decode the handshake once enough bytes have arrived
+ * @param handshake Filled in on success
+ * @return true if the handshake was decoded by this call
+ * @throws std::runtime_error if the protocol string is wrong
+ */
+bool PeerWire::Reader::handshake(Handshake &handshake) {
+  if (!awaitingHandshake || buffered() < kHandshakeSize) {
+    return false;
+  }
+  std::string_view bytes(buffer.data() + position, kHandshakeSize);
+  if (static_cast<uint8_t>(bytes[0]) != kProtocol.size() ||
+      bytes.substr(1, kProtocol.size()) != kProtocol) {
+    throw std::runtime_error("Invalid handshake: unknown protocol");
+  }
+  // 8 reserved bytes follow the protocol string
+  handshake.infoHash = std::string(bytes.substr(28, 20));
+  handshake.peerId = std::string(bytes.substr(48, 20));
+  position += kHandshakeSize;
+  awaitingHandshake = false;
+  return true;
+}
+
+/**
+ * @brief Decode the next complete message
+ * @param message Filled in on success
+ * @return true if a message was decoded, false if more bytes are needed
+ * @throws std::runtime_error on a malformed message or if the handshake has
+ * not been read yet
+ *
+ * The payload length is checked against the message id, so a decoded
+ * message always has all fields its id implies. Ids this reader does not
+ * know, such as port or the fast extension's, are returned with their raw
+ * payload in data for the caller to ignore, as BEP 3 asks.
+ */
+bool PeerWire::Reader::next(Message &message) {
+  if (awaitingHandshake) {
+    throw std::runtime_error("Message received before handshake");
+  }
+  if (buffered() < 4) {
+    return false;
+  }
+  const uint8_t *bytes =
+      reinterpret_cast<const uint8_t *>(buffer.data() + position);
+  uint32_t length = readUint32(bytes);
+  if (length > maxMessageSize) {
+    throw std::runtime_error("Message too large: " + std::to_string(length));
+  }
+  if (buffered() < 4 + size_t{length}) {
+    return false;
+  }
+  position += 4 + size_t{length};
+
+  message = Message{};
+  if (length == 0) {
+    message.keepAlive = true;
+    return true;
+  }
+  message.id = static_cast<MessageId>(bytes[4]);
+  const uint8_t *payload = bytes + 5;
+  uint32_t payloadLength = length - 1;
+
+  bool valid = true;
+  switch (message.id) {
+  case MessageId::Choke:
+  case MessageId::Unchoke:
+  case MessageId::Interested:
+  case MessageId::NotInterested:
+    valid = payloadLength == 0;
+    break;
+  case MessageId::Have:
+    valid = payloadLength == 4;
+    if (valid) {
+      message.piece = readUint32(payload);
+    }
+    break;
+  case MessageId::Bitfield:
+    message.data = std::string_view(reinterpret_cast<const char *>(payload),
+                                    payloadLength);
+    break;
+  case MessageId::Request:
+  case MessageId::Cancel:
+    valid = payloadLength == 12;
+    if (valid) {
+      message.piece = readUint32(payload);
+      message.offset = readUint32(payload + 4);
+      message.length = readUint32(payload + 8);
+    }
+    break;
+  case MessageId::Piece:
+    valid = payloadLength >= 8;
+    if (valid) {
+      message.piece = readUint32(payload);
+      message.offset = readUint32(payload + 4);
+      message.length = payloadLength - 8;
+      message.data = std::string_view(
+          reinterpret_cast<const char *>(payload + 8), message.length);
+    }
+    break;
+  case MessageId::Extended:
+    valid = payloadLength >= 1;
+    if (valid) {
+      message.extendedId = payload[0];
+      message.data = std::string_view(
+          reinterpret_cast<const char *>(payload + 1), payloadLength - 1);
+    }
+    break;
+  default:
+    message.data = std::string_view(reinterpret_cast<const char *>(payload),
+                                    payloadLength);
+    break;
+  }
+  if (!valid) {
+    throw std::runtime_error("Invalid payload length for message id " +
+                             std::to_string(bytes[4]));
+  }
+  return true;
+}
+
+/**
+ * @brief Get the number of bytes received but not yet decoded
+ * @return Buffered byte count
+ */
+size_t PeerWire::Reader::buffered() const { return buffer.size() - position; }
+
+/**
+ * @brief Append a handshake
+ * @param out Buffer the message is appended to
+ * @param infoHash 20-byte info hash
+ * @param peerId 20-byte peer id
+ * @throws std::invalid_argument if a field is not 20 bytes long
+ */
+void PeerWire::appendHandshake(std::string &out, std::string_view infoHash,
+                               std::string_view peerId) {
+  if (infoHash.size() != 20 || peerId.size() != 20) {
+    throw std::invalid_argument("Info hash and peer id must be 20 bytes");
+  }
+  out += static_cast<char>(kProtocol.size());
+  out += kProtocol;
+  out.append(8, '\0'); // Reserved extension bits
+  out += infoHash;
+  out += peerId;
+}
+
+/**
+ * @brief Append a message without payload
+ * @param out Buffer the message is appended to
+ * @param id The message id
+ */
+void PeerWire::appendMessage(std::string &out, MessageId id) {
+  appendHeader(out, id, 0);
+}
+
+/**
+ * @brief Append a have message
+ * @param out Buffer the message is appended to
+ * @param piece The piece the sender now has
+ */
+void PeerWire::appendHave(std::string &out, uint32_t piece) {
+  appendHeader(out, MessageId::Have, 4);
+  appendUint32(out, piece);
+}
+
+/**
+ * @brief Append a bitfield message
+ * @param out Buffer the message is appended to
+ * @param pieces Pieces the sender has, high bit of the first byte first
+ */
+void PeerWire::appendBitfield(std::string &out,
+                              const std::vector<bool> &pieces) {
+  std::string bits((pieces.size() + 7) / 8, '\0');
+  for (size_t i = 0; i < pieces.size(); ++i) {
+    if (pieces[i]) {
+      bits[i / 8] = static_cast<char>(bits[i / 8] | (0x80 >> (i % 8)));
+    }
+  }
+  appendHeader(out, MessageId::Bitfield, static_cast<uint32_t>(bits.size()));
+  out += bits;
+}
+
+/**
+ * @brief Append a request or cancel message
+ * @param out Buffer the message is appended to
+ * @param id MessageId::Request or MessageId::Cancel
+ * @param piece Piece index
+ * @param offset Byte offset within the piece
+ * @param length Block length in bytes
+ */
+void PeerWire::appendBlockMessage(std::string &out, MessageId id,
+                                  uint32_t piece, uint32_t offset,
+                                  uint32_t length) {
+  appendHeader(out, id, 12);
+  appendUint32(out, piece);
+  appendUint32(out, offset);
+  appendUint32(out, length);
+}
+
+/**
+ * @brief Append a piece message with its block data
+ * @param out Buffer the message is appended to
+ * @param piece Piece index
+ * @param offset Byte offset within the piece
+ * @param data Block data
+ */
+void PeerWire::appendPiece(std::string &out, uint32_t piece, uint32_t offset,
+                           std::string_view data) {
+  uint8_t header[kPieceHeaderSize];
+  encodePieceHeader(piece, offset, static_cast<uint32_t>(data.size()), header);
+  out.append(reinterpret_cast<const char *>(header), sizeof(header));
+  out += data;
+}
+
+/**
+ * @brief Append a BEP 10 extended message
+ * @param out Buffer the message is appended to
+ * @param extendedId 0 for the extension handshake, else the receiver's id
+ * for the extension
+ * @param payload The extension's payload
+ */
+void PeerWire::appendExtended(std::string &out, uint8_t extendedId,
+                              std::string_view payload) {
+  appendHeader(out, MessageId::Extended,
+               static_cast<uint32_t>(payload.size() + 1));
+  out += static_cast<char>(extendedId);
+  out += payload;
+}
+
+/**
+ * @brief Decode the pieces of a bitfield message
+ * @param data Bitfield payload
+ * @param numPieces Number of pieces in the torrent
+ * @return One flag per piece
+ * @throws std::runtime_error if the payload has the wrong length
+ */
+std::vector<bool> PeerWire::decodeBitfield(std::string_view data,
+                                           uint32_t numPieces) {
+  if (data.size() != (size_t{numPieces} + 7) / 8) {
+    throw std::runtime_error("Bitfield length does not match piece count");
+  }
+  std::vector<bool> pieces(numPieces);
+  for (uint32_t i = 0; i < numPieces; ++i) {
+    pieces[i] = static_cast<uint8_t>(data[i / 8]) & (0x80 >> (i % 8));
+  }
+  return pieces;
+}
+
+/**
+ * @brief Encode the length prefix and id of a message
+ * @param id The message id
+ * @param payloadLength Length of the payload following the id
+ * @param out Buffer of at least kMessageHeaderSize bytes
+ */
+void PeerWire::encodeMessageHeader(MessageId id, uint32_t payloadLength,
+                                   uint8_t *out) {
+  writeUint32(payloadLength + 1, out);
+  out[4] = static_cast<uint8_t>(id);
+}
+
+/**
+ * @brief Encode everything of a piece message that precedes the block data
+ * @param piece Piece index
+ * @param offset Byte offset of the block within the piece
+ * @param length Length of the block data that will follow
+ * @param out Buffer of at least kPieceHeaderSize bytes
+ */
+void PeerWire::encodePieceHeader(uint32_t piece, uint32_t offset,
+                                 uint32_t length, uint8_t *out) {
+  encodeMessageHeader(MessageId::Piece, 8 + length, out);
+  writeUint32(piece, out + 5);
+  writeUint32(offset, out + 9);
+}
+
+/**
+ * @brief Write a 32-bit integer in network byte order
+ * @param value The value to write
+ * @param out Buffer of at least 4 bytes
+ */
+void PeerWire::writeUint32(uint32_t value, uint8_t *out) {
+  out[0] = static_cast<uint8_t>(value >> 24);
+  out[1] = static_cast<uint8_t>(value >> 16);
+  out[2] = static_cast<uint8_t>(value >> 8);
+  out[3] = static_cast<uint8_t>(value);
+}
+
+/**
+ * @brief Read a 32-bit integer in network byte order
+ * @param in Buffer of at least 4 bytes
+ * @return The decoded value
+ */
+uint32_t PeerWire::readUint32(const uint8_t *in) {
+  return uint32_t{in[0]} << 24 | uint32_t{in[1]} << 16 | uint32_t{in[2]} << 8 |
+         uint32_t{in[3]};
+}
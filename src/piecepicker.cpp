@@ -0,0 +1,573 @@
+#include <algorithm>
+#include <piecepicker.hpp>
+#include <stdexcept>
+
+/**
+ * @brief Compare two block requests
+ * @param other The block to compare with
+ * @return true if both describe the same range of the same piece
+ */
+bool PiecePicker::Block::operator==(const Block &other) const {
+  return piece == other.piece && offset == other.offset &&
+         length == other.length;
+}
+
+/**
+ * @brief Construct a picker for a torrent of the given size
+ * @param totalSize Total size of the torrent content in bytes
+ * @param pieceLength Nominal piece length in bytes
+ * @param maxDuplicates Maximum concurrent requests per block in endgame
+ * @throws std::invalid_argument if the sizes are not positive
+ *
+ * Block state is allocated lazily per piece, so a picker for a large torrent
+ * costs little until pieces are actually requested.
+ */
+PiecePicker::PiecePicker(int64_t totalSize, int64_t pieceLength,
+                         unsigned maxDuplicates)
+    : totalSize(totalSize), pieceLength(pieceLength),
+      maxDuplicates(std::max(maxDuplicates, 1u)) {
+  if (totalSize <= 0 || pieceLength <= 0) {
+    throw std::invalid_argument("Piece picker needs a positive size");
+  }
+
+  pieces.resize((totalSize + pieceLength - 1) / pieceLength);
+  for (uint32_t p = 0; p < pieces.size(); ++p) {
+    pieces[p].freeBlocks = blocksInPiece(p);
+    freeBlocks += pieces[p].freeBlocks;
+  }
+  missingBlocks = freeBlocks;
+}
+
+/**
+ * @brief Construct a picker for a parsed torrent
+ * @param torrent The torrent whose pieces are picked
+ * @param maxDuplicates Maximum concurrent requests per block in endgame
+ */
+PiecePicker::PiecePicker(const TorrentFile &torrent, unsigned maxDuplicates)
+    : PiecePicker(torrent.getTotalSize(), torrent.getPieceLength(),
+                  maxDuplicates) {}
+
+/**
+ * @brief Count the pieces of a peer's bitfield towards availability
+ * @param bitfield Pieces the peer has
+ */
+void PiecePicker::addPeerPieces(const std::vector<bool> &bitfield) {
+  size_t n = std::min(bitfield.size(), pieces.size());
+  for (size_t p = 0; p < n; ++p) {
+    if (bitfield[p]) {
+      ++pieces[p].availability;
+    }
+  }
+}
+
+/**
+ * @brief Remove a disconnected peer's pieces from availability
+ * @param bitfield Pieces the peer had
+ */
+void PiecePicker::removePeerPieces(const std::vector<bool> &bitfield) {
+  size_t n = std::min(bitfield.size(), pieces.size());
+  for (size_t p = 0; p < n; ++p) {
+    if (bitfield[p] && pieces[p].availability > 0) {
+      --pieces[p].availability;
+    }
+  }
+}
+
+/**
+ * @brief Count a single piece announced with a have message
+ * @param piece The piece the peer now has
+ */
+void PiecePicker::addPeerPiece(uint32_t piece) {
+  if (piece < pieces.size()) {
+    ++pieces[piece].availability;
+  }
+}
+
+/**
+ * @brief Pick blocks to request from a peer
+ * @param peer The peer the requests will be sent to
+ * @param peerHas Pieces the peer has
+ * @param count Maximum number of blocks to pick
+ * @return Blocks to request, marked as requested by the peer
+ *
+ * Pieces with a deadline go first. Then partially requested pieces are
+ * finished, then untouched pieces are started in rarest-first order (ties
+ * go to the lowest index). When no free blocks are left anywhere, endgame
+ * duplicates are handed out instead.
+ */
+std::vector<PiecePicker::Block>
+PiecePicker::pickBlocks(PeerId peer, const std::vector<bool> &peerHas,
+                        size_t count) {
+  std::vector<Block> out;
+  auto hasPiece = [&](uint32_t p) { return p < peerHas.size() && peerHas[p]; };
+
+  if (!deadlinePieces.empty()) {
+    pickDeadline(peer, peerHas, count, out);
+  }
+
+  // Finish partially requested pieces, dropping ones without free blocks
+  size_t kept = 0;
+  for (size_t i = 0; i < partialPieces.size(); ++i) {
+    uint32_t p = partialPieces[i];
+    if (out.size() < count && hasPiece(p)) {
+      pickFromPiece(peer, p, count - out.size(), out);
+    }
+    if (pieces[p].freeBlocks > 0) {
+      partialPieces[kept++] = p;
+    } else {
+      pieces[p].inPartialList = false;
+    }
+  }
+  partialPieces.resize(kept);
+
+  // Start new pieces, rarest first
+  if (out.size() < count && freeBlocks > 0) {
+    std::vector<std::pair<int, uint32_t>> candidates;
+    for (uint32_t p = 0; p < pieces.size(); ++p) {
+      if (pieces[p].blocks.empty() && hasPiece(p)) {
+        candidates.emplace_back(pieces[p].availability, p);
+      }
+    }
+    size_t wanted = std::min(candidates.size(), count - out.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + wanted,
+                      candidates.end());
+    for (size_t i = 0; i < wanted && out.size() < count; ++i) {
+      uint32_t p = candidates[i].second;
+      pickFromPiece(peer, p, count - out.size(), out);
+      if (pieces[p].freeBlocks > 0 && !pieces[p].inPartialList) {
+        pieces[p].inPartialList = true;
+        partialPieces.push_back(p);
+      }
+    }
+  }
+
+  if (out.size() < count && isEndgame()) {
+    pickEndgame(peer, peerHas, count - out.size(), out);
+  }
+  return out;
+}
+
+/**
+ * @brief Record that a block arrived
+ * @param peer The peer that sent the block
+ * @param block The received block
+ * @return Other peers that also requested the block
+ *
+ * Unsolicited blocks for free slots are accepted as well. Duplicates of a
+ * block that already arrived are ignored.
+ */
+std::vector<PiecePicker::PeerId>
+PiecePicker::blockReceived(PeerId peer, const Block &block) {
+  if (block.piece >= pieces.size()) {
+    return {};
+  }
+  blocksOf(block.piece);
+  BlockState *state = findBlock(block);
+  if (state == nullptr || state->received) {
+    return {};
+  }
+
+  PieceState &piece = pieces[block.piece];
+  if (state->requesters.empty()) {
+    --piece.freeBlocks;
+    --freeBlocks;
+  }
+  state->received = true;
+  state->late = false;
+  ++piece.receivedBlocks;
+  --missingBlocks;
+
+  // An unsolicited block may have touched a piece nobody requested yet
+  if (piece.freeBlocks > 0 && !piece.inPartialList) {
+    piece.inPartialList = true;
+    partialPieces.push_back(block.piece);
+  }
+
+  std::vector<PeerId> cancels;
+  for (PeerId other : state->requesters) {
+    if (other != peer) {
+      cancels.push_back(other);
+    }
+  }
+  state->requesters.clear();
+  state->requesters.shrink_to_fit();
+  return cancels;
+}
+
+/**
+ * @brief Return a block that will not arrive
+ * @param peer The peer the block was requested from
+ * @param block The block to release
+ *
+ * The block becomes free again once no other peer has it in flight.
+ */
+void PiecePicker::abortRequest(PeerId peer, const Block &block) {
+  BlockState *state = findBlock(block);
+  if (state == nullptr || state->received) {
+    return;
+  }
+  auto it = std::find(state->requesters.begin(), state->requesters.end(), peer);
+  if (it == state->requesters.end()) {
+    return;
+  }
+  state->requesters.erase(it);
+  if (!state->requesters.empty()) {
+    return;
+  }
+  state->late = false;
+
+  PieceState &piece = pieces[block.piece];
+  ++piece.freeBlocks;
+  ++freeBlocks;
+  if (!piece.inPartialList) {
+    piece.inPartialList = true;
+    partialPieces.push_back(block.piece);
+  }
+}
+
+/**
+ * @brief Release every block requested from a peer
+ * @param peer The peer that disconnected
+ */
+void PiecePicker::peerDisconnected(PeerId peer) {
+  for (uint32_t p = 0; p < pieces.size(); ++p) {
+    const auto &blocks = pieces[p].blocks;
+    for (uint32_t b = 0; b < blocks.size(); ++b) {
+      if (!blocks[b].requesters.empty()) {
+        abortRequest(peer, makeBlock(p, b));
+      }
+    }
+  }
+}
+
+/**
+ * @brief Reset a piece that failed hash verification
+ * @param piece The failed piece
+ *
+ * All of its blocks become free again. Requests still in flight for the
+ * piece are forgotten; if their data arrives it is accepted as unsolicited.
+ */
+void PiecePicker::pieceFailed(uint32_t piece) {
+  if (piece >= pieces.size()) {
+    return;
+  }
+  PieceState &state = pieces[piece];
+  uint32_t blocks = blocksInPiece(piece);
+  freeBlocks += blocks - state.freeBlocks;
+  missingBlocks += state.receivedBlocks;
+  state.freeBlocks = blocks;
+  state.receivedBlocks = 0;
+  state.blocks.clear();
+  state.blocks.shrink_to_fit();
+}
+
+/**
+ * @brief Make a piece time-critical, or normal again
+ * @param piece The piece index
+ * @param deadlineMicros Time the piece is needed by, or kNoDeadline
+ *
+ * The list of deadline pieces is only re-sorted when blocks are next
+ * picked, so a caller can move a whole window of deadlines at once.
+ */
+void PiecePicker::setDeadline(uint32_t piece, int64_t deadlineMicros) {
+  if (piece >= pieces.size() || pieces[piece].deadline == deadlineMicros ||
+      (deadlineMicros != kNoDeadline && isPieceComplete(piece))) {
+    return;
+  }
+  PieceState &state = pieces[piece];
+  if (deadlineMicros == kNoDeadline) {
+    deadlinePieces.erase(
+        std::find(deadlinePieces.begin(), deadlinePieces.end(), piece));
+  } else if (state.deadline == kNoDeadline) {
+    deadlinePieces.push_back(piece);
+  }
+  state.deadline = deadlineMicros;
+  deadlinesSorted = false;
+}
+
+/**
+ * @brief Get the deadline of a piece
+ * @param piece The piece index
+ * @return The deadline, kNoDeadline if none or the piece is invalid
+ */
+int64_t PiecePicker::deadline(uint32_t piece) const {
+  return piece < pieces.size() ? pieces[piece].deadline : kNoDeadline;
+}
+
+/**
+ * @brief Report that a request has been outstanding for too long
+ * @param peer The peer the block was requested from
+ * @param block The late block
+ * @return true if the block may now be picked for another peer as well
+ */
+bool PiecePicker::requestTimedOut(PeerId peer, const Block &block) {
+  BlockState *state = findBlock(block);
+  if (state == nullptr || state->received ||
+      pieces[block.piece].deadline == kNoDeadline ||
+      state->requesters.size() >= std::max(maxDuplicates, 2u) ||
+      std::find(state->requesters.begin(), state->requesters.end(), peer) ==
+          state->requesters.end()) {
+    return false;
+  }
+  state->late = true;
+  return true;
+}
+
+/**
+ * @brief Check if all blocks of a piece have been received
+ * @param piece The piece to check
+ * @return true if the piece is ready for verification
+ */
+bool PiecePicker::isPieceComplete(uint32_t piece) const {
+  return piece < pieces.size() &&
+         pieces[piece].receivedBlocks == blocksInPiece(piece);
+}
+
+/**
+ * @brief Check if a block has been received
+ * @param block The block to check
+ * @return true if the block's data has arrived
+ */
+bool PiecePicker::hasBlock(const Block &block) const {
+  if (isPieceComplete(block.piece)) {
+    return true;
+  }
+  if (block.piece >= pieces.size()) {
+    return false;
+  }
+  const auto &blocks = pieces[block.piece].blocks;
+  uint32_t index = block.offset / kBlockSize;
+  return index < blocks.size() && blocks[index].received;
+}
+
+/**
+ * @brief Mark a piece as already present
+ * @param piece The piece we have
+ */
+void PiecePicker::setHave(uint32_t piece) {
+  if (piece >= pieces.size() || isPieceComplete(piece)) {
+    return;
+  }
+  PieceState &state = pieces[piece];
+  uint32_t blocks = blocksInPiece(piece);
+  freeBlocks -= state.freeBlocks;
+  missingBlocks -= blocks - state.receivedBlocks;
+  state.freeBlocks = 0;
+  state.receivedBlocks = blocks;
+  for (auto &block : blocksOf(piece)) {
+    block.received = true;
+    block.requesters.clear();
+  }
+}
+
+/**
+ * @brief Check if the picker is in endgame mode
+ * @return true if blocks are missing but all of them are in flight
+ */
+bool PiecePicker::isEndgame() const {
+  return freeBlocks == 0 && missingBlocks > 0;
+}
+
+/**
+ * @brief Check if every block has been received
+ * @return true if the download is complete
+ */
+bool PiecePicker::isFinished() const { return missingBlocks == 0; }
+
+/**
+ * @brief Get the number of pieces in the torrent
+ * @return Piece count
+ */
+uint32_t PiecePicker::numPieces() const {
+  return static_cast<uint32_t>(pieces.size());
+}
+
+/**
+ * @brief Get the number of blocks in a piece
+ * @param piece The piece index
+ * @return Block count
+ */
+uint32_t PiecePicker::blocksInPiece(uint32_t piece) const {
+  return (pieceSize(piece) + kBlockSize - 1) / kBlockSize;
+}
+
+/**
+ * @brief Get the size of a piece
+ * @param piece The piece index
+ * @return Size in bytes, shorter for the last piece
+ */
+uint32_t PiecePicker::pieceSize(uint32_t piece) const {
+  int64_t start = static_cast<int64_t>(piece) * pieceLength;
+  return static_cast<uint32_t>(std::min(pieceLength, totalSize - start));
+}
+
+/**
+ * @brief Get the number of connected peers that have a piece
+ * @param piece The piece index
+ * @return Availability count, 0 for invalid pieces
+ */
+int PiecePicker::availability(uint32_t piece) const {
+  return piece < pieces.size() ? pieces[piece].availability : 0;
+}
+
+/**
+ * @brief Get the block list of a piece, allocating it on first use
+ * @param piece The piece index
+ * @return Per-block state of the piece
+ */
+std::vector<PiecePicker::BlockState> &PiecePicker::blocksOf(uint32_t piece) {
+  auto &blocks = pieces[piece].blocks;
+  if (blocks.empty()) {
+    blocks.resize(blocksInPiece(piece));
+  }
+  return blocks;
+}
+
+/**
+ * @brief Pick free blocks from one piece
+ * @param peer The requesting peer
+ * @param piece The piece to pick from
+ * @param count Maximum number of blocks to add
+ * @param out Picked blocks are appended here
+ */
+void PiecePicker::pickFromPiece(PeerId peer, uint32_t piece, size_t count,
+                                std::vector<Block> &out) {
+  PieceState &state = pieces[piece];
+  auto &blocks = blocksOf(piece);
+  for (uint32_t b = 0; b < blocks.size() && count > 0 && state.freeBlocks > 0;
+       ++b) {
+    if (blocks[b].received || !blocks[b].requesters.empty()) {
+      continue;
+    }
+    blocks[b].requesters.push_back(peer);
+    --state.freeBlocks;
+    --freeBlocks;
+    out.push_back(makeBlock(piece, b));
+    --count;
+  }
+}
+
+/**
+ * @brief Pick blocks of pieces with a deadline, earliest first
+ * @param peer The requesting peer
+ * @param peerHas Pieces the peer has
+ * @param count Maximum number of blocks to add
+ * @param out Picked blocks are appended here
+ *
+ * Completed pieces leave the list here. Besides free blocks, late blocks
+ * are handed out again to peers not yet asked for them; a block is late
+ * again only after the new request times out as well.
+ */
+void PiecePicker::pickDeadline(PeerId peer, const std::vector<bool> &peerHas,
+                               size_t count, std::vector<Block> &out) {
+  if (!deadlinesSorted) {
+    std::sort(deadlinePieces.begin(), deadlinePieces.end(),
+              [this](uint32_t a, uint32_t b) {
+                return pieces[a].deadline != pieces[b].deadline
+                           ? pieces[a].deadline < pieces[b].deadline
+                           : a < b;
+              });
+    deadlinesSorted = true;
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < deadlinePieces.size(); ++i) {
+    uint32_t p = deadlinePieces[i];
+    if (isPieceComplete(p)) {
+      pieces[p].deadline = kNoDeadline;
+      continue;
+    }
+    deadlinePieces[kept++] = p;
+    if (out.size() >= count || p >= peerHas.size() || !peerHas[p]) {
+      continue;
+    }
+    pickFromPiece(peer, p, count - out.size(), out);
+    if (pieces[p].freeBlocks > 0 && !pieces[p].inPartialList) {
+      pieces[p].inPartialList = true;
+      partialPieces.push_back(p);
+    }
+    auto &blocks = pieces[p].blocks;
+    for (uint32_t b = 0; b < blocks.size() && out.size() < count; ++b) {
+      auto &requesters = blocks[b].requesters;
+      if (!blocks[b].late ||
+          std::find(requesters.begin(), requesters.end(), peer) !=
+              requesters.end()) {
+        continue;
+      }
+      blocks[b].late = false;
+      requesters.push_back(peer);
+      out.push_back(makeBlock(p, b));
+    }
+  }
+  deadlinePieces.resize(kept);
+}
+
+/**
+ * @brief Pick in-flight blocks for duplicate requests in endgame mode
+ * @param peer The requesting peer
+ * @param peerHas Pieces the peer has
+ * @param count Maximum number of blocks to add
+ * @param out Picked blocks are appended here
+ *
+ * Blocks with the fewest requesters are duplicated first, so every straggler
+ * gets a second chance before any block gets a third.
+ */
+void PiecePicker::pickEndgame(PeerId peer, const std::vector<bool> &peerHas,
+                              size_t count, std::vector<Block> &out) {
+  std::vector<std::pair<size_t, Block>> candidates;
+  for (uint32_t p = 0; p < pieces.size(); ++p) {
+    const auto &blocks = pieces[p].blocks;
+    if (blocks.empty() || p >= peerHas.size() || !peerHas[p] ||
+        isPieceComplete(p)) {
+      continue;
+    }
+    for (uint32_t b = 0; b < blocks.size(); ++b) {
+      const auto &requesters = blocks[b].requesters;
+      if (blocks[b].received || requesters.size() >= maxDuplicates ||
+          std::find(requesters.begin(), requesters.end(), peer) !=
+              requesters.end()) {
+        continue;
+      }
+      candidates.emplace_back(requesters.size(), makeBlock(p, b));
+    }
+  }
+
+  std::stable_sort(
+      candidates.begin(), candidates.end(),
+      [](const auto &a, const auto &b) { return a.first < b.first; });
+  for (size_t i = 0; i < candidates.size() && i < count; ++i) {
+    const Block &block = candidates[i].second;
+    pieces[block.piece].blocks[block.offset / kBlockSize].requesters.push_back(
+        peer);
+    out.push_back(block);
+  }
+}
+
+/**
+ * @brief Make a block description for a block index within a piece
+ * @param piece The piece index
+ * @param index The block index within the piece
+ * @return Request parameters of the block
+ */
+PiecePicker::Block PiecePicker::makeBlock(uint32_t piece,
+                                          uint32_t index) const {
+  uint32_t offset = index * kBlockSize;
+  return {piece, offset, std::min(kBlockSize, pieceSize(piece) - offset)};
+}
+
+/**
+ * @brief Locate a block's state, validating the request parameters
+ * @param block The block to look up
+ * @return Pointer to the block state, or nullptr if invalid or unallocated
+ */
+PiecePicker::BlockState *PiecePicker::findBlock(const Block &block) {
+  if (block.piece >= pieces.size() || block.offset % kBlockSize != 0) {
+    return nullptr;
+  }
+  auto &blocks = pieces[block.piece].blocks;
+  uint32_t index = block.offset / kBlockSize;
+  if (index >= blocks.size() || !(makeBlock(block.piece, index) == block)) {
+    return nullptr;
+  }
+  return &blocks[index];
+}
@@ -0,0 +1,729 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <httputil.hpp>
+#include <netinet/in.h>
+#include <rangeserver.hpp>
+#include <stdexcept>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t kMaxRequestBytes = 16 * 1024; // Request line and headers
+constexpr size_t kMaxBufferedBytes = 64 * 1024; // Pipelined requests
+constexpr int kMaxEvents = 256;
+
+/**
+ * @brief Decode %XX escapes of a URL path
+ * @return false if an escape is malformed
+ */
+bool percentDecode(std::string_view text, std::string &out) {
+  out.clear();
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] != '%') {
+      out += text[i];
+      continue;
+    }
+    if (i + 2 >= text.size() ||
+        !std::isxdigit(static_cast<unsigned char>(text[i + 1])) ||
+        !std::isxdigit(static_cast<unsigned char>(text[i + 2]))) {
+      return false;
+    }
+    out += static_cast<char>(std::stoi(std::string(text.substr(i + 1, 2)),
+                                       nullptr, 16));
+    i += 2;
+  }
+  return true;
+}
+
+/**
+ * @brief Guess a media type from a file name
+ */
+const char *contentType(std::string_view path) {
+  static const std::pair<const char *, const char *> kTypes[] = {
+      {".mp4", "video/mp4"},         {".m4v", "video/mp4"},
+      {".mkv", "video/x-matroska"},  {".webm", "video/webm"},
+      {".avi", "video/x-msvideo"},   {".mov", "video/quicktime"},
+      {".ts", "video/mp2t"},         {".mp3", "audio/mpeg"},
+      {".m4a", "audio/mp4"},         {".flac", "audio/flac"},
+      {".ogg", "audio/ogg"},         {".wav", "audio/wav"},
+      {".jpg", "image/jpeg"},        {".png", "image/png"},
+      {".srt", "application/x-subrip"},
+      {".txt", "text/plain; charset=utf-8"}};
+  auto dot = path.rfind('.');
+  if (dot != std::string_view::npos) {
+    for (const auto &[extension, type] : kTypes) {
+      if (HttpUtil::equalsIgnoreCase(path.substr(dot), extension)) {
+        return type;
+      }
+    }
+  }
+  return "application/octet-stream";
+}
+
+const char *reasonPhrase(int status) {
+  switch (status) {
+  case 200:
+    return "OK";
+  case 206:
+    return "Partial Content";
+  case 400:
+    return "Bad Request";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  case 416:
+    return "Range Not Satisfiable";
+  case 431:
+    return "Request Header Fields Too Large";
+  default:
+    return ""; // The reason phrase may be empty
+  }
+}
+
+} // namespace
+
+// State of one client connection, owned by the server thread
+struct RangeServer::Connection {
+  int fd;
+  uint64_t id;
+  std::string in;          // Received bytes not yet parsed
+  std::string head;        // Status line and headers of the response
+  size_t headSent = 0;     // Bytes of head already sent
+  bool responding = false; // A response is in progress
+  bool closeAfter = false; // Close once the response is sent
+  size_t file = 0;         // File the body comes from
+  int64_t offset = 0;      // Next body byte, within the file
+  int64_t end = 0;         // End of the body within the file, exclusive
+  int64_t budget = 0;      // Bytes left to send this turn
+  bool waiting = false;    // Waiting on a piece
+  bool queued = false;     // Listed in ready
+  int64_t lastActive = 0;  // Milliseconds, steady clock
+};
+
+/**
+ * @brief Start serving a torrent's files
+ * @param torrent The torrent
+ * @param rootDir Directory the content is stored in
+ * @param have Pieces available now
+ * @param options Settings
+ * @throws std::runtime_error if the socket, epoll or thread cannot be set
+ * up
+ */
+RangeServer::RangeServer(const TorrentFile &torrent,
+                         const std::string &rootDir, std::vector<bool> have,
+                         const Options &options)
+    : torrent(torrent), options(options), storage(torrent, rootDir),
+      have(std::move(have)) {
+  this->have.resize(storage.numPieces(), false);
+  waiters.resize(storage.numPieces());
+  const auto &files = torrent.getFiles();
+  int64_t start = 0;
+  std::string path;
+  for (size_t i = 0; i < files.size(); ++i) {
+    fileStarts.push_back(start);
+    start += files[i].length;
+    if (!files[i].padding) {
+      percentDecode(urlPath(i), path);
+      filesByPath.emplace(path, i);
+    }
+  }
+
+  auto fail = [this](const std::string &what) {
+    std::runtime_error error = HttpUtil::systemError(what);
+    for (int fd : {listenFd, epollFd, wakeFd}) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+    return error;
+  };
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(options.port);
+  if (inet_pton(AF_INET, options.address.c_str(), &address.sin_addr) != 1) {
+    throw std::runtime_error("Not an IPv4 address: " + options.address);
+  }
+  listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  if (listenFd < 0 ||
+      setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+      bind(listenFd, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) < 0 ||
+      listen(listenFd, SOMAXCONN) < 0) {
+    throw fail("Cannot listen on " + options.address + ":" +
+               std::to_string(options.port));
+  }
+  socklen_t length = sizeof(address);
+  getsockname(listenFd, reinterpret_cast<sockaddr *>(&address), &length);
+  listenPort = ntohs(address.sin_port);
+
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event listenEvent{};
+  listenEvent.events = EPOLLIN | EPOLLET;
+  listenEvent.data.fd = listenFd;
+  epoll_event wakeEvent{};
+  wakeEvent.events = EPOLLIN;
+  wakeEvent.data.fd = wakeFd;
+  if (epollFd < 0 || wakeFd < 0 ||
+      epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &listenEvent) < 0 ||
+      epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &wakeEvent) < 0) {
+    throw fail("Cannot set up epoll");
+  }
+  thread = std::thread(&RangeServer::run, this);
+}
+
+/**
+ * @brief Stop serving, see stop()
+ */
+RangeServer::~RangeServer() {
+  stop();
+  close(wakeFd);
+  close(epollFd);
+  close(listenFd);
+}
+
+/**
+ * @brief Stop the server thread and close every connection
+ */
+void RangeServer::stop() {
+  stopping = true;
+  uint64_t one = 1;
+  if (write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    throw HttpUtil::systemError("Cannot signal stop to range server");
+  }
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
+
+/**
+ * @brief Report that a piece is now available on disk
+ * @param piece The verified piece
+ */
+void RangeServer::pieceCompleted(uint32_t piece) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    completed.push_back(piece);
+  }
+  uint64_t one = 1;
+  if (write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    throw HttpUtil::systemError("Cannot wake range server");
+  }
+}
+
+/**
+ * @brief Get the port the server listens on
+ * @return Port number
+ */
+uint16_t RangeServer::port() const { return listenPort; }
+
+/**
+ * @brief Get the URL path of a file
+ * @param fileIndex Index into the torrent's getFiles()
+ * @return Path of the file as stored, below the root, percent-encoded
+ * @throws std::out_of_range if the file does not exist
+ */
+std::string RangeServer::urlPath(size_t fileIndex) const {
+  const auto &file = torrent.getFiles().at(fileIndex);
+  std::string path = torrent.isSingleFile()
+                         ? file.path
+                         : torrent.getName() + "/" + file.path;
+  static const char kHex[] = "0123456789ABCDEF";
+  std::string url = "/";
+  for (unsigned char c : path) {
+    if (std::isalnum(c) || std::strchr("-._~/", c) != nullptr) {
+      url += static_cast<char>(c);
+    } else {
+      url += '%';
+      url += kHex[c >> 4];
+      url += kHex[c & 15];
+    }
+  }
+  return url;
+}
+
+/**
+ * @brief Get the activity counters
+ * @return Counters since construction
+ */
+RangeServer::Stats RangeServer::stats() const {
+  Stats result;
+  result.accepted = accepted;
+  result.refused = refused;
+  result.open = open;
+  result.requests = requests;
+  result.ranges = ranges;
+  result.errors = errors;
+  result.waits = waits;
+  result.bytesSent = bytesSent;
+  return result;
+}
+
+/**
+ * @brief Body of the server thread
+ *
+ * Sockets are edge-triggered, so every handler reads or writes until the
+ * kernel reports EAGAIN, and a connection that stops short of that, after
+ * its chunk, is listed in ready and continued after the others had their
+ * turn.
+ */
+void RangeServer::run() {
+  epoll_event events[kMaxEvents];
+  int64_t lastSweep = HttpUtil::nowMillis();
+  while (!stopping) {
+    int count = epoll_wait(epollFd, events, kMaxEvents, ready.empty() ? 1000
+                                                                      : 0);
+    if (count < 0 && errno != EINTR) {
+      break;
+    }
+    for (int i = 0; i < count; ++i) {
+      int fd = events[i].data.fd;
+      if (fd == listenFd) {
+        acceptAll();
+        continue;
+      }
+      if (fd == wakeFd) {
+        uint64_t value;
+        while (read(wakeFd, &value, sizeof(value)) > 0) {
+        }
+        applyCompleted();
+        continue;
+      }
+      if (static_cast<size_t>(fd) >= connections.size() ||
+          !connections[fd]) {
+        continue;
+      }
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        closeConnection(fd);
+        continue;
+      }
+      if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+        readFrom(*connections[fd]);
+      }
+      if (connections[fd]) {
+        progress(*connections[fd]);
+      }
+    }
+
+    std::vector<int> turn;
+    turn.swap(ready);
+    for (int fd : turn) {
+      if (connections[fd] && connections[fd]->queued) {
+        connections[fd]->queued = false;
+        progress(*connections[fd]);
+      }
+    }
+
+    int64_t now = HttpUtil::nowMillis();
+    if (now - lastSweep >= 1000) {
+      closeIdle(now);
+      lastSweep = now;
+    }
+  }
+  for (size_t fd = 0; fd < connections.size(); ++fd) {
+    if (connections[fd]) {
+      closeConnection(static_cast<int>(fd));
+    }
+  }
+}
+
+/**
+ * @brief Accept every pending connection
+ */
+void RangeServer::acceptAll() {
+  while (true) {
+    int fd = accept4(listenFd, nullptr, nullptr,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return; // EAGAIN, or out of descriptors until some close
+    }
+    if (open >= options.maxConnections) {
+      close(fd);
+      ++refused;
+      continue;
+    }
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+      close(fd);
+      ++refused;
+      continue;
+    }
+    if (static_cast<size_t>(fd) >= connections.size()) {
+      connections.resize(fd + 1);
+    }
+    connections[fd] = std::make_unique<Connection>();
+    connections[fd]->fd = fd;
+    connections[fd]->id = nextId++;
+    connections[fd]->lastActive = HttpUtil::nowMillis();
+    ++accepted;
+    ++open;
+  }
+}
+
+/**
+ * @brief Mark the pieces reported by pieceCompleted() available and list
+ * the connections waiting on them in ready
+ */
+void RangeServer::applyCompleted() {
+  std::vector<uint32_t> pieces;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pieces.swap(completed);
+  }
+  for (uint32_t piece : pieces) {
+    if (piece >= have.size() || have[piece]) {
+      continue;
+    }
+    have[piece] = true;
+    for (auto [fd, id] : waiters[piece]) {
+      Connection *conn = connections[fd].get();
+      if (conn == nullptr || conn->id != id || !conn->waiting) {
+        continue;
+      }
+      conn->waiting = false;
+      if (!conn->queued) {
+        conn->queued = true;
+        ready.push_back(fd);
+      }
+    }
+    waiters[piece].clear();
+    waiters[piece].shrink_to_fit();
+  }
+}
+
+/**
+ * @brief Close connections without traffic for the idle timeout
+ * @param now Current time in milliseconds
+ */
+void RangeServer::closeIdle(int64_t now) {
+  for (size_t fd = 0; fd < connections.size(); ++fd) {
+    const Connection *conn = connections[fd].get();
+    if (conn != nullptr && !conn->waiting &&
+        now - conn->lastActive > options.idleTimeoutMillis) {
+      closeConnection(static_cast<int>(fd));
+    }
+  }
+}
+
+/**
+ * @brief Read everything the client has sent
+ * @param conn The connection; closed on end of stream, errors or too many
+ * unanswered bytes
+ */
+void RangeServer::readFrom(Connection &conn) {
+  char buffer[16 * 1024];
+  while (true) {
+    ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+    if (n > 0) {
+      conn.in.append(buffer, n);
+      conn.lastActive = HttpUtil::nowMillis();
+      if (conn.in.size() > kMaxBufferedBytes) {
+        closeConnection(conn.fd);
+        return;
+      }
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    closeConnection(conn.fd);
+    return;
+  }
+}
+
+/**
+ * @brief Send as much as the socket, the available pieces and the chunk
+ * allow, starting the responses of pipelined requests in turn
+ * @param conn The connection; may be closed on return
+ */
+void RangeServer::progress(Connection &conn) {
+  conn.budget = options.chunkBytes;
+  while (!conn.waiting) {
+    if (!conn.responding && !startResponse(conn)) {
+      return;
+    }
+    if (conn.headSent < conn.head.size()) {
+      // Cork the headers onto the body if it can follow right away
+      int64_t position = fileStarts[conn.file] + conn.offset;
+      bool more = conn.offset < conn.end &&
+                  have[position / storage.getPieceLength()];
+      ssize_t n = send(conn.fd, conn.head.data() + conn.headSent,
+                       conn.head.size() - conn.headSent,
+                       MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+          closeConnection(conn.fd);
+        }
+        return;
+      }
+      conn.headSent += n;
+      conn.lastActive = HttpUtil::nowMillis();
+      continue;
+    }
+    if (conn.offset < conn.end) {
+      if (!sendBody(conn)) {
+        return;
+      }
+      continue;
+    }
+    conn.responding = false;
+    conn.head.clear();
+    conn.headSent = 0;
+    if (conn.closeAfter) {
+      closeConnection(conn.fd);
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Parse the next buffered request and prepare its response
+ * @param conn The connection
+ * @return true if a response is ready to send, false if the request is
+ * incomplete
+ *
+ * A single range is honoured; a list of ranges or a malformed Range header
+ * is ignored and the whole file served, as HTTP allows.
+ */
+bool RangeServer::startResponse(Connection &conn) {
+  size_t headerEnd = conn.in.find("\r\n\r\n");
+  if (headerEnd == std::string::npos) {
+    if (conn.in.size() > kMaxRequestBytes) {
+      conn.closeAfter = true;
+      sendError(conn, 431, "");
+      return true;
+    }
+    return false;
+  }
+  ++requests;
+  std::string_view request(conn.in.data(), headerEnd);
+  size_t lineEnd = std::min(request.find("\r\n"), request.size());
+  std::string_view line = request.substr(0, lineEnd);
+  std::string_view rest =
+      lineEnd < request.size() ? request.substr(lineEnd + 2) : "";
+
+  std::string_view range;
+  std::string_view connection;
+  while (!rest.empty()) {
+    size_t end = std::min(rest.find("\r\n"), rest.size());
+    std::string_view header = rest.substr(0, end);
+    rest.remove_prefix(std::min(end + 2, rest.size()));
+    size_t colon = header.find(':');
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+    std::string_view name = HttpUtil::trim(header.substr(0, colon));
+    if (HttpUtil::equalsIgnoreCase(name, "range")) {
+      range = HttpUtil::trim(header.substr(colon + 1));
+    } else if (HttpUtil::equalsIgnoreCase(name, "connection")) {
+      connection = HttpUtil::trim(header.substr(colon + 1));
+    }
+  }
+
+  size_t space1 = line.find(' ');
+  size_t space2 = line.rfind(' ');
+  std::string method(line.substr(0, space1));
+  std::string target;
+  std::string version;
+  if (space1 != std::string_view::npos && space2 > space1) {
+    target = line.substr(space1 + 1, space2 - space1 - 1);
+    version = line.substr(space2 + 1);
+  }
+  std::string rangeValue(range);
+  conn.closeAfter =
+      version == "HTTP/1.1"
+          ? HttpUtil::equalsIgnoreCase(connection, "close")
+          : !HttpUtil::equalsIgnoreCase(connection, "keep-alive");
+  conn.in.erase(0, headerEnd + 4);
+
+  if (version.compare(0, 5, "HTTP/") != 0 || target.empty() ||
+      target[0] != '/') {
+    conn.closeAfter = true;
+    sendError(conn, 400, "");
+    return true;
+  }
+  if (method != "GET" && method != "HEAD") {
+    sendError(conn, 405, "Allow: GET, HEAD\r\n");
+    return true;
+  }
+  std::string path;
+  auto fileIt = filesByPath.end();
+  if (percentDecode(target.substr(0, target.find('?')), path)) {
+    fileIt = filesByPath.find(path);
+  }
+  if (fileIt == filesByPath.end()) {
+    sendError(conn, 404, "");
+    return true;
+  }
+  const size_t file = fileIt->second;
+  const int64_t size = torrent.getFiles()[file].length;
+
+  int64_t first = 0;
+  int64_t last = size - 1;
+  bool partial = false;
+  std::string_view spec = rangeValue;
+  if (spec.substr(0, 6) == "bytes=" &&
+      spec.find(',') == std::string_view::npos) {
+    spec.remove_prefix(6);
+    size_t dash = spec.find('-');
+    if (dash != std::string_view::npos) {
+      std::string_view from = HttpUtil::trim(spec.substr(0, dash));
+      std::string_view to = HttpUtil::trim(spec.substr(dash + 1));
+      int64_t a = HttpUtil::parseWholeNumber(from);
+      int64_t b = HttpUtil::parseWholeNumber(to);
+      bool valid = false;
+      if (a >= 0 && (b >= a || to.empty())) {
+        valid = true;
+        first = a;
+        last = b >= 0 ? std::min(b, size - 1) : size - 1;
+      } else if (dash == 0 && b >= 0) {
+        valid = true;
+        first = std::max<int64_t>(0, size - b);
+        if (b == 0) {
+          first = size; // Suffix of nothing
+        }
+      }
+      if (valid && first >= size) {
+        sendError(conn, 416,
+                  "Content-Range: bytes */" + std::to_string(size) + "\r\n");
+        return true;
+      }
+      partial = valid;
+    }
+  }
+
+  const int64_t length = last - first + 1;
+  int status = partial ? 206 : 200;
+  std::string &head = conn.head;
+  head = "HTTP/1.1 ";
+  head += std::to_string(status);
+  head += ' ';
+  head += reasonPhrase(status);
+  head += "\r\nContent-Type: ";
+  head += contentType(path);
+  head += "\r\nAccept-Ranges: bytes\r\n";
+  if (partial) {
+    head += "Content-Range: bytes " + std::to_string(first) + "-" +
+            std::to_string(last) + "/" + std::to_string(size) + "\r\n";
+    ++ranges;
+  }
+  head += "Content-Length: " + std::to_string(length) + "\r\n";
+  head += conn.closeAfter ? "Connection: close\r\n\r\n"
+                          : "Connection: keep-alive\r\n\r\n";
+  conn.headSent = 0;
+  conn.file = file;
+  conn.offset = first;
+  conn.end = method == "HEAD" ? first : first + length;
+  conn.responding = true;
+  return true;
+}
+
+/**
+ * @brief Prepare a response without a body
+ * @param conn The connection
+ * @param status 4xx status code
+ * @param extra Additional header lines, each ending in CRLF
+ */
+void RangeServer::sendError(Connection &conn, int status,
+                            const std::string &extra) {
+  ++errors;
+  conn.head = "HTTP/1.1 " + std::to_string(status) + " " +
+              reasonPhrase(status) + "\r\n" + extra +
+              "Content-Length: 0\r\n" +
+              (conn.closeAfter ? "Connection: close\r\n\r\n"
+                               : "Connection: keep-alive\r\n\r\n");
+  conn.headSent = 0;
+  conn.file = 0;
+  conn.offset = conn.end = 0;
+  conn.responding = true;
+}
+
+/**
+ * @brief Send body bytes from the available pieces with sendfile
+ * @param conn The connection, with body bytes left to send
+ * @return true to continue, false if the connection waits on the socket, a
+ * piece or its next turn, or was closed
+ */
+bool RangeServer::sendBody(Connection &conn) {
+  const int64_t pieceLength = storage.getPieceLength();
+  const int64_t start = fileStarts[conn.file];
+  const int64_t position = start + conn.offset;
+  const uint32_t piece = static_cast<uint32_t>(position / pieceLength);
+  if (!have[piece]) {
+    conn.waiting = true;
+    waiters[piece].emplace_back(conn.fd, conn.id);
+    ++waits;
+    return false;
+  }
+  if (conn.budget <= 0) {
+    if (!conn.queued) {
+      conn.queued = true;
+      ready.push_back(conn.fd);
+    }
+    return false;
+  }
+
+  // Send up to the next missing piece, the end of the body or the chunk
+  const int64_t limit = std::min(start + conn.end, position + conn.budget);
+  int64_t available = (int64_t{piece} + 1) * pieceLength;
+  while (available < limit && have[available / pieceLength]) {
+    available += pieceLength;
+  }
+  int64_t count = std::min(available, limit) - position;
+
+  int fileFd;
+  try {
+    fileFd = storage.fileDescriptor(conn.file);
+  } catch (const std::exception &) {
+    closeConnection(conn.fd);
+    return false;
+  }
+  off_t offset = conn.offset;
+  ssize_t n = sendfile(conn.fd, fileFd, &offset, count);
+  if (n < 0 && errno == EINTR) {
+    return true;
+  }
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return false;
+  }
+  if (n <= 0) {
+    closeConnection(conn.fd); // Error, or the file is shorter than listed
+    return false;
+  }
+  conn.offset += n;
+  conn.budget -= n;
+  conn.lastActive = HttpUtil::nowMillis();
+  bytesSent += n;
+  return true;
+}
+
+/**
+ * @brief Close a connection and forget its state
+ * @param fd Its descriptor
+ */
+void RangeServer::closeConnection(int fd) {
+  connections[fd].reset();
+  close(fd);
+  --open;
+}
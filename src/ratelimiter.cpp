@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <limits>
+#include <ratelimiter.hpp>
+#include <stdexcept>
+
+namespace {
+// Refills longer than this are clamped so rate * elapsed cannot overflow
+constexpr int64_t kMaxRefillMicros = 10 * 1000 * 1000;
+constexpr int64_t kMicrosPerSecond = 1000 * 1000;
+} // namespace
+
+/**
+ * @brief Construct a token bucket
+ * @param rate Refill rate in bytes per second (0 = unlimited)
+ * @param burst Maximum number of tokens (0 = one second worth of tokens)
+ *
+ * The bucket starts full so a freshly created channel can be used at once.
+ */
+TokenBucket::TokenBucket(int64_t rate, int64_t burst) : rate(0), burst(0) {
+  setRate(rate, burst);
+  tokens = this->burst;
+}
+
+/**
+ * @brief Change the refill rate and capacity of the bucket
+ * @param rate Refill rate in bytes per second (0 = unlimited)
+ * @param burst Maximum number of tokens (0 = one second worth of tokens)
+ *
+ * Existing tokens are kept but clamped to the new capacity.
+ */
+void TokenBucket::setRate(int64_t rate, int64_t burst) {
+  this->rate = std::max<int64_t>(rate, 0);
+  this->burst = burst > 0 ? burst : this->rate;
+  tokens = std::min(tokens, this->burst);
+}
+
+/**
+ * @brief Add the tokens earned over an elapsed interval
+ * @param elapsedMicros Time since the last refill in microseconds
+ *
+ * Fractions of a token are carried over in `remainder` so slow rates with
+ * short ticks still accumulate correctly.
+ */
+void TokenBucket::refill(int64_t elapsedMicros) {
+  if (isUnlimited() || elapsedMicros <= 0) {
+    return;
+  }
+  elapsedMicros = std::min(elapsedMicros, kMaxRefillMicros);
+
+  int64_t earned = rate * elapsedMicros + remainder;
+  tokens += earned / kMicrosPerSecond;
+  remainder = earned % kMicrosPerSecond;
+
+  // A full bucket does not bank fractional tokens either
+  if (tokens >= burst) {
+    tokens = burst;
+    remainder = 0;
+  }
+}
+
+/**
+ * @brief Remove tokens from the bucket
+ * @param bytes Number of tokens to remove
+ *
+ * Unlimited buckets ignore consumption.
+ */
+void TokenBucket::consume(int64_t bytes) {
+  if (!isUnlimited()) {
+    tokens -= bytes;
+  }
+}
+
+/**
+ * @brief Check if the bucket has no rate limit
+ * @return true if the rate is zero (unlimited)
+ */
+bool TokenBucket::isUnlimited() const { return rate == 0; }
+
+/**
+ * @brief Get the tokens currently available
+ * @return Available tokens, or the maximum int64_t value if unlimited
+ */
+int64_t TokenBucket::available() const {
+  return isUnlimited() ? std::numeric_limits<int64_t>::max() : tokens;
+}
+
+/**
+ * @brief Get the refill rate of the bucket
+ * @return Rate in bytes per second (0 if unlimited)
+ */
+int64_t TokenBucket::getRate() const { return rate; }
+
+/**
+ * @brief Get the capacity of the bucket
+ * @return Maximum tokens the bucket can hold
+ */
+int64_t TokenBucket::getBurst() const { return burst; }
+
+/**
+ * @brief Construct a scheduler
+ * @param quantum Bytes handed to each waiting connection per round-robin pass
+ * @throws std::invalid_argument if quantum is not positive
+ */
+BandwidthScheduler::BandwidthScheduler(int64_t quantum) : quantum(quantum) {
+  if (quantum <= 0) {
+    throw std::invalid_argument("Bandwidth quantum must be positive");
+  }
+}
+
+/**
+ * @brief Create a bandwidth channel below an existing one
+ * @param parent Parent channel, or kNoParent for a root channel
+ * @param rate Rate limit in bytes per second (0 = unlimited)
+ * @param burst Bucket capacity in bytes (0 = one second worth of tokens)
+ * @return Identifier of the new channel
+ * @throws std::invalid_argument if the parent does not exist
+ */
+BandwidthScheduler::ChannelId
+BandwidthScheduler::addChannel(ChannelId parent, int64_t rate, int64_t burst) {
+  if (parent != kNoParent && parent >= channels.size()) {
+    throw std::invalid_argument("Unknown parent bandwidth channel");
+  }
+  channels.push_back({parent, TokenBucket(rate, burst)});
+  return static_cast<ChannelId>(channels.size() - 1);
+}
+
+/**
+ * @brief Change the rate limit of an existing channel
+ * @param channel The channel to update
+ * @param rate Rate limit in bytes per second (0 = unlimited)
+ * @param burst Bucket capacity in bytes (0 = one second worth of tokens)
+ * @throws std::out_of_range if the channel does not exist
+ */
+void BandwidthScheduler::setChannelRate(ChannelId channel, int64_t rate,
+                                        int64_t burst) {
+  channels.at(channel).bucket.setRate(rate, burst);
+}
+
+/**
+ * @brief Register a connection limited by the given channels
+ * @param channelList Channels the connection belongs to
+ * @return Identifier of the new connection
+ * @throws std::invalid_argument if a channel is unknown or the chain is too
+ * long
+ *
+ * The chain is the union of every listed channel and all of its ancestors, so
+ * a connection attached to a torrent channel and a peer class channel that
+ * share the global root is charged to the root only once.
+ */
+BandwidthScheduler::ConnectionId BandwidthScheduler::addConnection(
+    std::initializer_list<ChannelId> channelList) {
+  Connection conn;
+  for (ChannelId channel : channelList) {
+    // Walk up to the root, adding every channel not already in the chain
+    for (ChannelId c = channel; c != kNoParent; c = channels[c].parent) {
+      if (c >= channels.size()) {
+        throw std::invalid_argument("Unknown bandwidth channel");
+      }
+      // Ancestors of a channel already in the chain are in it as well
+      auto end = conn.chain.begin() + conn.chainLength;
+      if (std::find(conn.chain.begin(), end, c) != end) {
+        break;
+      }
+      if (conn.chainLength == kMaxChainLength) {
+        throw std::invalid_argument("Bandwidth channel chain too long");
+      }
+      conn.chain[conn.chainLength++] = c;
+    }
+  }
+  conn.active = true;
+
+  // Reuse the slot of a removed connection when possible
+  if (!freeSlots.empty()) {
+    ConnectionId id = freeSlots.back();
+    freeSlots.pop_back();
+    connections[id] = conn;
+    return id;
+  }
+  connections.push_back(conn);
+  return static_cast<ConnectionId>(connections.size() - 1);
+}
+
+/**
+ * @brief Unregister a connection, dropping any pending request
+ * @param connection The connection to remove
+ *
+ * The connection is lazily dropped from the wait queue on the next tick.
+ */
+void BandwidthScheduler::removeConnection(ConnectionId connection) {
+  if (connection >= connections.size() || !connections[connection].active) {
+    return;
+  }
+  Connection &conn = connections[connection];
+  conn.active = false;
+  conn.wanted = 0;
+  // A queued slot is released once tick() has purged it from the queue
+  if (!conn.queued) {
+    freeSlots.push_back(connection);
+  }
+}
+
+/**
+ * @brief Ask for quota on behalf of a connection
+ * @param connection The connection that wants to transfer data
+ * @param bytes Additional bytes the connection wants to transfer
+ *
+ * New connections join the back of the wait queue; connections already
+ * waiting keep their position and simply ask for more.
+ */
+void BandwidthScheduler::request(ConnectionId connection, int64_t bytes) {
+  if (bytes <= 0 || connection >= connections.size() ||
+      !connections[connection].active) {
+    return;
+  }
+  Connection &conn = connections[connection];
+  conn.wanted += bytes;
+  if (!conn.queued) {
+    conn.queued = true;
+    queue.push_back(connection);
+  }
+}
+
+/**
+ * @brief Refill all buckets and hand out quota to waiting connections
+ * @param elapsedMicros Time since the previous tick in microseconds
+ * @param grant Callback invoked once per connection that received quota
+ *
+ * Quota is distributed in round-robin passes over the wait queue. Each pass
+ * gives every waiting connection up to one quantum, limited by the tokens left
+ * in its chain. The quantum doubles after every pass so that unlimited or
+ * lightly loaded channels are drained in a logarithmic number of passes, while
+ * congested channels still split their tokens evenly in the first pass.
+ *
+ * Afterwards, connections that were served move to the back of the queue in
+ * their current order, so connections that got nothing this tick are first in
+ * line on the next one. Grants are delivered after the queue has been updated,
+ * which makes it safe for callbacks to call request() or removeConnection().
+ */
+void BandwidthScheduler::tick(int64_t elapsedMicros,
+                              const GrantCallback &grant) {
+  for (auto &channel : channels) {
+    channel.bucket.refill(elapsedMicros);
+  }
+  if (queue.empty()) {
+    return;
+  }
+
+  int64_t passQuantum = quantum;
+  for (bool progress = true; progress; passQuantum *= 2) {
+    progress = false;
+    for (ConnectionId id : queue) {
+      Connection &conn = connections[id];
+      if (conn.wanted == 0) {
+        continue;
+      }
+
+      int64_t amount = std::min({passQuantum, conn.wanted, chainTokens(conn)});
+      if (amount <= 0) {
+        continue;
+      }
+
+      // Charge every channel on the chain
+      for (uint8_t i = 0; i < conn.chainLength; ++i) {
+        channels[conn.chain[i]].bucket.consume(amount);
+      }
+      conn.wanted -= amount;
+      conn.granted += amount;
+      progress = true;
+    }
+    if (passQuantum > std::numeric_limits<int64_t>::max() / 2) {
+      break;
+    }
+  }
+
+  // Collect grants and rebuild the queue: unserved connections first, then
+  // served connections that still want more
+  grants.clear();
+  served.clear();
+  size_t kept = 0;
+  for (ConnectionId id : queue) {
+    Connection &conn = connections[id];
+    bool wasServed = conn.granted > 0;
+    if (wasServed) {
+      grants.emplace_back(id, conn.granted);
+      conn.granted = 0;
+    }
+    if (conn.active && conn.wanted > 0) {
+      if (wasServed) {
+        served.push_back(id);
+      } else {
+        queue[kept++] = id;
+      }
+      continue;
+    }
+    conn.queued = false;
+    if (!conn.active) {
+      freeSlots.push_back(id);
+    }
+  }
+  queue.resize(kept);
+  queue.insert(queue.end(), served.begin(), served.end());
+
+  for (const auto &[id, bytes] : grants) {
+    if (connections[id].active) {
+      grant(id, bytes);
+    }
+  }
+}
+
+/**
+ * @brief Get the number of bytes a connection is still waiting for
+ * @param connection The connection to query
+ * @return Outstanding requested bytes (0 if not waiting or unknown)
+ */
+int64_t BandwidthScheduler::pending(ConnectionId connection) const {
+  if (connection >= connections.size()) {
+    return 0;
+  }
+  return connections[connection].wanted;
+}
+
+/**
+ * @brief Get the number of connections waiting for quota
+ * @return Size of the wait queue
+ */
+size_t BandwidthScheduler::queueSize() const { return queue.size(); }
+
+/**
+ * @brief Get the token bucket backing a channel
+ * @param channel The channel to query
+ * @return Reference to the channel's bucket
+ * @throws std::out_of_range if the channel does not exist
+ */
+const TokenBucket &BandwidthScheduler::getChannel(ChannelId channel) const {
+  return channels.at(channel).bucket;
+}
+
+/**
+ * @brief Get the smallest token count along a connection's chain
+ * @param conn The connection whose chain to inspect
+ * @return Tokens the connection may use right now
+ */
+int64_t BandwidthScheduler::chainTokens(const Connection &conn) const {
+  int64_t tokens = std::numeric_limits<int64_t>::max();
+  for (uint8_t i = 0; i < conn.chainLength; ++i) {
+    tokens = std::min(tokens, channels[conn.chain[i]].bucket.available());
+  }
+  return tokens;
+}
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <requestpipeline.hpp>
+
+/**
+ * @brief Construct a pipeline
+ * @param settings Parameters of the depth calculation
+ */
+RequestPipeline::RequestPipeline(const Settings &settings)
+    : settings(settings), throughput(settings.rateShift) {}
+
+/**
+ * @brief Construct a pipeline with the default settings
+ */
+RequestPipeline::RequestPipeline() : RequestPipeline(Settings{}) {}
+
+/**
+ * @brief Record that a request was sent
+ * @param block The requested block
+ * @param nowMicros Current time in microseconds
+ */
+void RequestPipeline::requestSent(const Block &block, int64_t nowMicros) {
+  queue.push_back({block, nowMicros});
+}
+
+/**
+ * @brief Record that a block arrived, updating throughput and RTT
+ * @param block The received block
+ * @param nowMicros Current time in microseconds
+ * @return true if the block was outstanding on this pipeline
+ *
+ * Every latency sample feeds a running minimum. Most samples include time
+ * the request spent queued behind earlier ones at the peer; the minimum
+ * filters that out and approximates the round trip of the link itself. With
+ * a window configured, the minimum is replaced once it is older than the
+ * window. Note that once the pipeline keeps a standing queue at the peer,
+ * every fresh sample includes that queue, so short windows overestimate the
+ * RTT.
+ */
+bool RequestPipeline::blockReceived(const Block &block, int64_t nowMicros) {
+  auto it = find(block);
+  if (it == queue.end()) {
+    return false;
+  }
+  throughput.add(block.length);
+
+  int64_t latency = nowMicros - it->sentAt;
+  bool expired = settings.rttWindowMicros > 0 &&
+                 nowMicros - minRttAt > settings.rttWindowMicros;
+  if (latency > 0 && (minRtt == 0 || latency < minRtt || expired)) {
+    minRtt = latency;
+    minRttAt = nowMicros;
+  }
+  queue.erase(it);
+  return true;
+}
+
+/**
+ * @brief Forget an outstanding request
+ * @param block The block no longer expected
+ * @return true if the block was outstanding on this pipeline
+ */
+bool RequestPipeline::cancel(const Block &block) {
+  auto it = find(block);
+  if (it == queue.end()) {
+    return false;
+  }
+  queue.erase(it);
+  return true;
+}
+
+/**
+ * @brief Drop all outstanding requests
+ * @return The blocks that were outstanding, oldest first
+ */
+std::vector<RequestPipeline::Block> RequestPipeline::clear() {
+  std::vector<Block> blocks;
+  for (const auto &request : queue) {
+    blocks.push_back(request.block);
+  }
+  queue.clear();
+  return blocks;
+}
+
+/**
+ * @brief Sample the throughput estimate
+ * @param elapsedMicros Time since the previous call in microseconds
+ */
+void RequestPipeline::tick(int64_t elapsedMicros) {
+  throughput.sample(elapsedMicros);
+}
+
+/**
+ * @brief Get requests that have been outstanding for too long
+ * @param nowMicros Current time in microseconds
+ * @param timeoutMicros Age after which a request counts as timed out
+ * @return Timed out blocks, oldest first
+ */
+std::vector<RequestPipeline::Block>
+RequestPipeline::timedOut(int64_t nowMicros, int64_t timeoutMicros) const {
+  std::vector<Block> blocks;
+  for (const auto &request : queue) {
+    if (nowMicros - request.sentAt >= timeoutMicros) {
+      blocks.push_back(request.block);
+    }
+  }
+  return blocks;
+}
+
+/**
+ * @brief Get the desired number of outstanding requests
+ * @return gain * bandwidth-delay product in blocks, clamped to the limits
+ *
+ * Until both throughput and RTT have been measured, the initial depth is
+ * used.
+ */
+size_t RequestPipeline::targetDepth() const {
+  uint64_t bytesPerSecond = throughput.rate();
+  if (bytesPerSecond == 0 || minRtt == 0) {
+    return std::clamp(settings.initialDepth, settings.minDepth,
+                      settings.maxDepth);
+  }
+
+  // Bandwidth-delay product in bytes, rounded up to whole blocks
+  uint64_t bdp = bytesPerSecond * static_cast<uint64_t>(minRtt) / 1000000;
+  uint64_t blocks = (bdp * settings.gain + PiecePicker::kBlockSize - 1) /
+                    PiecePicker::kBlockSize;
+  return std::clamp(static_cast<size_t>(blocks), settings.minDepth,
+                    settings.maxDepth);
+}
+
+/**
+ * @brief Get the current number of outstanding requests
+ * @return Number of requests sent but not yet answered
+ */
+size_t RequestPipeline::outstanding() const { return queue.size(); }
+
+/**
+ * @brief Get the number of requests to send to reach the target depth
+ * @return Free slots in the pipeline, 0 if it is full
+ */
+size_t RequestPipeline::wanted() const {
+  size_t target = targetDepth();
+  return target > queue.size() ? target - queue.size() : 0;
+}
+
+/**
+ * @brief Get the round-trip estimate
+ * @return Smallest recent request latency in microseconds, 0 if unknown
+ */
+int64_t RequestPipeline::rtt() const { return minRtt; }
+
+/**
+ * @brief Get the throughput estimate
+ * @return Smoothed payload rate in bytes per second
+ */
+uint64_t RequestPipeline::rate() const { return throughput.rate(); }
+
+/**
+ * @brief Find an outstanding request
+ * @param block The block to look up
+ * @return Iterator to the request, or queue.end() if not outstanding
+ *
+ * Blocks usually arrive in request order, so the search almost always stops
+ * at the front of the queue.
+ */
+std::deque<RequestPipeline::Outstanding>::iterator
+RequestPipeline::find(const Block &block) {
+  return std::find_if(queue.begin(), queue.end(), [&](const auto &request) {
+    return request.block == block;
+  });
+}
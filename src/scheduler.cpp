@@ -0,0 +1,503 @@
+#include <algorithm>
+#include <chrono>
+#include <scheduler.hpp>
+
+namespace {
+
+constexpr size_t kInitialRing = 256;   // Initial deque capacity
+constexpr int kSpinRounds = 64;        // Searches before an idle worker parks
+constexpr size_t kTasksPerWorker = 8;  // parallelFor tasks per worker
+
+// Worker identity of the calling thread
+thread_local const Scheduler *currentScheduler = nullptr;
+thread_local size_t currentIndex = 0;
+
+/**
+ * @brief Advance a xorshift64 state and return the new value
+ */
+uint64_t nextRandom(uint64_t &state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+} // namespace
+
+/**
+ * @brief Allocate a ring of empty slots
+ * @param capacity Number of slots, a power of two
+ */
+Scheduler::Deque::Ring::Ring(size_t capacity)
+    : mask(capacity - 1), slots(new std::atomic<Task *>[capacity]) {}
+
+/**
+ * @brief Create an empty deque
+ */
+Scheduler::Deque::Deque() {
+  rings.push_back(std::make_unique<Ring>(kInitialRing));
+  ring.store(rings.back().get(), std::memory_order_relaxed);
+}
+
+/**
+ * @brief Destroy the deque; tasks still in it are leaked to the caller
+ */
+Scheduler::Deque::~Deque() = default;
+
+/**
+ * @brief Push a task at the bottom
+ * @param task The task
+ *
+ * The slot is written before bottom is published with a release store, so a
+ * thief that sees the new bottom also sees the task.
+ */
+void Scheduler::Deque::push(Task *task) {
+  int64_t b = bottom.load(std::memory_order_relaxed);
+  int64_t t = top.load(std::memory_order_acquire);
+  Ring *current = ring.load(std::memory_order_relaxed);
+  if (static_cast<size_t>(b - t) > current->mask) {
+    // Full: copy the live range into a ring twice as large
+    auto grown = std::make_unique<Ring>((current->mask + 1) * 2);
+    for (int64_t i = t; i < b; ++i) {
+      grown->slots[i & grown->mask].store(
+          current->slots[i & current->mask].load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+    }
+    current = grown.get();
+    rings.push_back(std::move(grown));
+    ring.store(current, std::memory_order_release);
+  }
+  current->slots[b & current->mask].store(task, std::memory_order_relaxed);
+  bottom.store(b + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Take the newest task
+ * @return The task, or nullptr if the deque is empty
+ *
+ * When one task is left, the owner races thieves for it with a CAS on top.
+ */
+Scheduler::Task *Scheduler::Deque::take() {
+  int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+  Ring *current = ring.load(std::memory_order_relaxed);
+  bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t t = top.load(std::memory_order_relaxed);
+  if (t > b) {
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  Task *task =
+      current->slots[b & current->mask].load(std::memory_order_relaxed);
+  if (t == b) {
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed)) {
+      task = nullptr;
+    }
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+  return task;
+}
+
+/**
+ * @brief Steal the oldest task
+ * @param contended Set to true if another thread won the race for the task
+ * @return The task, or nullptr if the deque was empty or the race was lost
+ */
+Scheduler::Task *Scheduler::Deque::steal(bool &contended) {
+  int64_t t = top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t b = bottom.load(std::memory_order_acquire);
+  if (t >= b) {
+    return nullptr;
+  }
+  Ring *current = ring.load(std::memory_order_acquire);
+  Task *task =
+      current->slots[t & current->mask].load(std::memory_order_relaxed);
+  if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                   std::memory_order_relaxed)) {
+    contended = true;
+    return nullptr;
+  }
+  return task;
+}
+
+/**
+ * @brief Check whether the deque looks empty
+ * @return true if no task was visible at the time of the call
+ */
+bool Scheduler::Deque::empty() const {
+  return bottom.load(std::memory_order_acquire) <=
+         top.load(std::memory_order_acquire);
+}
+
+/**
+ * @brief Start the worker threads
+ * @param numThreads Number of workers, 0 for one per hardware thread
+ */
+Scheduler::Scheduler(size_t numThreads) {
+  if (numThreads == 0) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (size_t i = 0; i < numThreads; ++i) {
+    workers.push_back(std::make_unique<Worker>());
+    workers.back()->random = 0x9e3779b97f4a7c15ULL * (i + 1);
+  }
+  // Start threads only once every worker exists, since they steal from all
+  for (size_t i = 0; i < numThreads; ++i) {
+    workers[i]->thread = std::thread(&Scheduler::workerLoop, this, i);
+  }
+}
+
+/**
+ * @brief Run all queued tasks, then stop and join the workers
+ */
+Scheduler::~Scheduler() {
+  {
+    std::lock_guard<std::mutex> lock(parkMutex);
+    stopping.store(true, std::memory_order_seq_cst);
+    wakeEpoch.fetch_add(1, std::memory_order_relaxed);
+  }
+  parkCondition.notify_all();
+  for (auto &worker : workers) {
+    worker->thread.join();
+  }
+}
+
+/**
+ * @brief Get the scheduler shared by the whole process
+ * @return A scheduler with one worker per hardware thread
+ *
+ * It is never destroyed, so tasks may still be running when static
+ * destructors run; the workers die with the process.
+ */
+Scheduler &Scheduler::shared() {
+  static Scheduler *instance = new Scheduler;
+  return *instance;
+}
+
+/**
+ * @brief Queue a task that nobody waits for
+ * @param task The task; an exception escaping it terminates the program
+ * @param priority Task priority
+ */
+void Scheduler::submit(std::function<void()> task, Priority priority) {
+  enqueue(new Task{std::move(task), nullptr}, priority);
+}
+
+/**
+ * @brief Run fn(i) for every i in [begin, end) and wait for all of them
+ * @param begin First index
+ * @param end One past the last index
+ * @param fn Function called once per index, from any thread
+ * @param grain Indices per task, 0 to pick one from the range size
+ * @param priority Task priority
+ * @throws The first exception thrown by fn, after all tasks finished
+ */
+void Scheduler::parallelFor(size_t begin, size_t end,
+                            const std::function<void(size_t)> &fn,
+                            size_t grain, Priority priority) {
+  if (begin >= end) {
+    return;
+  }
+  if (grain == 0) {
+    size_t tasks = workers.size() * kTasksPerWorker;
+    grain = std::max<size_t>(1, (end - begin + tasks - 1) / tasks);
+  }
+  TaskGroup group(*this);
+  for (size_t first = begin; first < end; first += grain) {
+    size_t last = std::min(end, first + grain);
+    group.spawn(
+        [&fn, first, last] {
+          for (size_t i = first; i < last; ++i) {
+            fn(i);
+          }
+        },
+        priority);
+  }
+  group.wait();
+}
+
+/**
+ * @brief Get the number of worker threads
+ * @return Worker count
+ */
+size_t Scheduler::numThreads() const { return workers.size(); }
+
+/**
+ * @brief Get activity counters summed over the workers
+ * @return The counters
+ */
+Scheduler::Stats Scheduler::stats() const {
+  Stats total;
+  for (const auto &worker : workers) {
+    total.executed += worker->executed.load(std::memory_order_relaxed);
+    total.stolen += worker->stolen.load(std::memory_order_relaxed);
+    total.injected += worker->injected.load(std::memory_order_relaxed);
+    total.parks += worker->parks.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+/**
+ * @brief Find the calling thread's worker index
+ * @return Index in [0, numThreads()), or numThreads() for other threads
+ */
+size_t Scheduler::currentWorker() const {
+  return currentScheduler == this ? currentIndex : workers.size();
+}
+
+/**
+ * @brief Queue a task on the calling worker's deque, or on the injection
+ * queue when called from another thread
+ */
+void Scheduler::enqueue(Task *task, Priority priority) {
+  size_t level = static_cast<size_t>(priority);
+  size_t self = currentWorker();
+  if (self < workers.size()) {
+    workers[self]->deques[level].push(task);
+  } else {
+    std::lock_guard<std::mutex> lock(injectMutex);
+    injectQueues[level].push_back(task);
+    injectedCount.fetch_add(1, std::memory_order_relaxed);
+  }
+  wakeOne();
+}
+
+/**
+ * @brief Unpark a worker if any is parked
+ *
+ * The fence pairs with the one in park(): either this thread sees the
+ * sleeper, or the sleeper's recheck sees the new task.
+ */
+void Scheduler::wakeOne() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleepers.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(parkMutex);
+    wakeEpoch.fetch_add(1, std::memory_order_relaxed);
+  }
+  parkCondition.notify_one();
+}
+
+/**
+ * @brief Find a task to run, highest priority first
+ * @param self Index of the calling worker
+ * @return A task, or nullptr if none was found
+ */
+Scheduler::Task *Scheduler::findTask(size_t self) {
+  uint64_t &random = workers[self]->random;
+  size_t count = workers.size();
+
+  for (size_t level = 0; level < kNumPriorities; ++level) {
+    if (Task *task = workers[self]->deques[level].take()) {
+      return task;
+    }
+    if (Task *task = popInjected(level)) {
+      workers[self]->injected.fetch_add(1, std::memory_order_relaxed);
+      return task;
+    }
+    // Visit every other worker once from a random start; retry the pass
+    // while thieves collided, since a lost race means work was there
+    bool contended = true;
+    while (contended) {
+      contended = false;
+      size_t start = nextRandom(random) % count;
+      for (size_t k = 0; k < count; ++k) {
+        size_t victim = (start + k) % count;
+        if (victim == self) {
+          continue;
+        }
+        if (Task *task = workers[victim]->deques[level].steal(contended)) {
+          workers[self]->stolen.fetch_add(1, std::memory_order_relaxed);
+          return task;
+        }
+      }
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief Pop the oldest injected task of a priority
+ * @return The task, or nullptr if there is none
+ */
+Scheduler::Task *Scheduler::popInjected(size_t priority) {
+  if (injectedCount.load(std::memory_order_relaxed) == 0) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(injectMutex);
+  auto &queue = injectQueues[priority];
+  if (queue.empty()) {
+    return nullptr;
+  }
+  Task *task = queue.front();
+  queue.pop_front();
+  injectedCount.fetch_sub(1, std::memory_order_relaxed);
+  return task;
+}
+
+/**
+ * @brief Check whether any task is queued anywhere
+ */
+bool Scheduler::hasWork() const {
+  if (injectedCount.load(std::memory_order_relaxed) > 0) {
+    return true;
+  }
+  for (const auto &worker : workers) {
+    for (const auto &deque : worker->deques) {
+      if (!deque.empty()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Run a task and release it
+ */
+void Scheduler::run(Task *task) {
+  std::unique_ptr<Task> owned(task);
+  if (task->group == nullptr) {
+    task->fn();
+    return;
+  }
+  std::exception_ptr error;
+  try {
+    task->fn();
+  } catch (...) {
+    error = std::current_exception();
+  }
+  TaskGroup *group = task->group;
+  owned.reset(); // Free the task before the group can be destroyed
+  group->finish(error);
+}
+
+/**
+ * @brief Main loop of a worker thread
+ * @param index The worker's index
+ */
+void Scheduler::workerLoop(size_t index) {
+  currentScheduler = this;
+  currentIndex = index;
+  Worker &worker = *workers[index];
+  int idleRounds = 0;
+  while (true) {
+    if (Task *task = findTask(index)) {
+      worker.executed.fetch_add(1, std::memory_order_relaxed);
+      run(task);
+      idleRounds = 0;
+      continue;
+    }
+    if (stopping.load(std::memory_order_acquire) && !hasWork()) {
+      return;
+    }
+    if (++idleRounds < kSpinRounds) {
+      std::this_thread::yield();
+      continue;
+    }
+    park(worker);
+    idleRounds = 0;
+  }
+}
+
+/**
+ * @brief Sleep until a task is queued or the scheduler stops
+ *
+ * The epoch is read before announcing the sleeper and the queues are checked
+ * after, so a task queued in between is either seen here or bumps the epoch.
+ */
+void Scheduler::park(Worker &worker) {
+  uint64_t epoch = wakeEpoch.load(std::memory_order_acquire);
+  sleepers.fetch_add(1, std::memory_order_seq_cst);
+  if (!hasWork() && !stopping.load(std::memory_order_acquire)) {
+    worker.parks.fetch_add(1, std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lock(parkMutex);
+    parkCondition.wait(lock, [&] {
+      return wakeEpoch.load(std::memory_order_relaxed) != epoch;
+    });
+  }
+  sleepers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Create an empty group
+ * @param scheduler The scheduler that runs the group's tasks
+ */
+Scheduler::TaskGroup::TaskGroup(Scheduler &scheduler) : scheduler(scheduler) {}
+
+/**
+ * @brief Wait for outstanding tasks; exceptions they threw are dropped
+ */
+Scheduler::TaskGroup::~TaskGroup() {
+  try {
+    wait();
+  } catch (...) {
+  }
+}
+
+/**
+ * @brief Queue a task in this group
+ * @param task The task
+ * @param priority Task priority
+ */
+void Scheduler::TaskGroup::spawn(std::function<void()> task,
+                                 Priority priority) {
+  pending.fetch_add(1, std::memory_order_relaxed);
+  scheduler.enqueue(new Task{std::move(task), this}, priority);
+}
+
+/**
+ * @brief Wait until every task of the group has finished
+ * @throws The first exception thrown by a task of the group
+ *
+ * A worker runs queued tasks (its own first, then stolen ones) while it
+ * waits, and sleeps briefly when it finds none, waking now and then to help
+ * with tasks spawned meanwhile. Other threads just block: their spawns go to
+ * the shared FIFO injection queue, so running tasks from it while waiting
+ * would nest unrelated waits without bound on their stack.
+ */
+void Scheduler::TaskGroup::wait() {
+  size_t self = scheduler.currentWorker();
+  auto finished = [&] { return pending.load(std::memory_order_acquire) == 0; };
+  while (!finished()) {
+    if (self == scheduler.numThreads()) {
+      std::unique_lock<std::mutex> lock(mutex);
+      done.wait(lock, finished);
+      break;
+    }
+    if (Task *task = scheduler.findTask(self)) {
+      scheduler.workers[self]->executed.fetch_add(1, std::memory_order_relaxed);
+      scheduler.run(task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait_for(lock, std::chrono::microseconds(200), finished);
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  if (error) {
+    std::exception_ptr thrown = error;
+    error = nullptr;
+    std::rethrow_exception(thrown);
+  }
+}
+
+/**
+ * @brief Record the end of a task of the group
+ * @param taskError Exception thrown by the task, or nullptr
+ *
+ * The last task notifies under the mutex, so the group cannot be destroyed
+ * by a returning wait() before the notification is done.
+ */
+void Scheduler::TaskGroup::finish(std::exception_ptr taskError) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (taskError && !error) {
+    error = taskError;
+  }
+  if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    done.notify_all();
+  }
+}
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cstring>
+#include <metrics.hpp>
+#include <sha1.hpp>
+#include <trace.hpp>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief Rotate a 32-bit value left
+ */
+inline uint32_t rotl(uint32_t value, int bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+} // namespace
+
+/**
+ * @brief Start a new hash with the standard initial state
+ */
+Sha1::Sha1()
+    : state{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0} {}
+
+/**
+ * @brief Add data to the message being hashed
+ * @param data Pointer to the data
+ * @param length Number of bytes
+ *
+ * Whole blocks are processed straight from the input; only a trailing
+ * partial block is copied into the internal buffer.
+ */
+void Sha1::update(const void *data, size_t length) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  this->length += length;
+
+  if (buffered > 0) {
+    size_t take = std::min(length, sizeof(buffer) - buffered);
+    std::memcpy(buffer + buffered, bytes, take);
+    buffered += take;
+    bytes += take;
+    length -= take;
+    if (buffered < sizeof(buffer)) {
+      return;
+    }
+    processBlock(buffer);
+    buffered = 0;
+  }
+
+  for (; length >= sizeof(buffer); bytes += 64, length -= 64) {
+    processBlock(bytes);
+  }
+  std::memcpy(buffer, bytes, length);
+  buffered = length;
+}
+
+/**
+ * @brief Add data to the message being hashed
+ * @param data The data
+ */
+void Sha1::update(std::string_view data) { update(data.data(), data.size()); }
+
+/**
+ * @brief Add zero bytes to the message being hashed
+ * @param count Number of zero bytes
+ *
+ * At the start of a message, up to kZeroStates whole blocks are skipped by
+ * loading the state they lead to from a table. Further whole blocks go
+ * through the compression function without loading a message schedule,
+ * and nothing is read but a small static block of zeros.
+ */
+void Sha1::updateZeros(uint64_t count) {
+  static const uint8_t zeros[64] = {};
+  if (length == 0 && count >= sizeof(buffer)) {
+    uint64_t blocks = std::min<uint64_t>(count / sizeof(buffer), kZeroStates);
+    std::copy_n(zeroStates() + blocks * 5, 5, state);
+    length = blocks * sizeof(buffer);
+    count -= length;
+  }
+  if (buffered > 0) {
+    size_t take = std::min<uint64_t>(count, sizeof(buffer) - buffered);
+    update(zeros, take);
+    count -= take;
+  }
+  if (buffered == 0) {
+    for (; count >= sizeof(buffer); count -= sizeof(buffer)) {
+      processZeroBlock();
+      length += sizeof(buffer);
+    }
+  }
+  update(zeros, count);
+}
+
+/**
+ * @brief Complete the hash
+ * @return The 20-byte binary digest
+ *
+ * The message is padded with a single 1 bit, zeros, and its length in bits
+ * as a 64-bit big-endian integer, to a multiple of 64 bytes.
+ */
+std::string Sha1::finish() {
+  static MetricsRegistry::Counter &bytesHashed =
+      MetricsRegistry::global().counter("sha1_bytes_total",
+                                        "Bytes hashed with SHA-1");
+  bytesHashed.add(length);
+
+  uint64_t bits = length * 8;
+  uint8_t padding[72] = {0x80};
+  size_t padLength = (buffered < 56 ? 56 : 120) - buffered;
+  for (int i = 0; i < 8; ++i) {
+    padding[padLength + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+  }
+  update(padding, padLength + 8);
+
+  std::string digest(kDigestSize, '\0');
+  for (size_t i = 0; i < kDigestSize; ++i) {
+    digest[i] = static_cast<char>(state[i / 4] >> (24 - 8 * (i % 4)));
+  }
+  return digest;
+}
+
+/**
+ * @brief Hash a complete message
+ * @param data The message
+ * @return The 20-byte binary digest
+ */
+std::string Sha1::hash(std::string_view data) {
+  TRACE_SCOPE("sha1.hash", "hash", "bytes", data.size());
+  Sha1 sha1;
+  sha1.update(data);
+  return sha1.finish();
+}
+
+/**
+ * @brief Format a binary digest as lowercase hexadecimal
+ * @param digest The binary digest
+ * @return Hexadecimal representation, two characters per byte
+ */
+std::string Sha1::toHex(std::string_view digest) {
+  static const char digits[] = "0123456789abcdef";
+  std::string hex;
+  hex.reserve(digest.size() * 2);
+  for (unsigned char c : digest) {
+    hex += digits[c >> 4];
+    hex += digits[c & 0xf];
+  }
+  return hex;
+}
+
+namespace {
+
+/**
+ * @brief Mix one 64-byte block into a state
+ * @param state The five state words
+ * @param block The block to process, unused if zero is set
+ *
+ * The schedule of an all-zero block is all zeros, so with zero set the
+ * compiler drops the loads and the schedule expansion.
+ */
+template <bool zero> void compress(uint32_t state[5], const uint8_t *block) {
+  // The message schedule is kept as a ring of 16 words, expanded on the fly
+  uint32_t w[16];
+  if constexpr (!zero) {
+    for (int i = 0; i < 16; ++i) {
+      w[i] = uint32_t{block[4 * i]} << 24 | uint32_t{block[4 * i + 1]} << 16 |
+             uint32_t{block[4 * i + 2]} << 8 | uint32_t{block[4 * i + 3]};
+    }
+  }
+  auto schedule = [&w](int i) -> uint32_t {
+    if constexpr (zero) {
+      return 0;
+    }
+    if (i >= 16) {
+      w[i & 15] = rotl(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^
+                           w[i & 15],
+                       1);
+    }
+    return w[i & 15];
+  };
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+           e = state[4];
+
+  // One loop per round function, so the compiler can unroll each of them
+  auto round = [&](uint32_t f, uint32_t k, uint32_t word) {
+    uint32_t temp = rotl(a, 5) + f + e + k + word;
+    e = d;
+    d = c;
+    c = rotl(b, 30);
+    b = a;
+    a = temp;
+  };
+  for (int i = 0; i < 20; ++i) {
+    round(d ^ (b & (c ^ d)), 0x5a827999, schedule(i));
+  }
+  for (int i = 20; i < 40; ++i) {
+    round(b ^ c ^ d, 0x6ed9eba1, schedule(i));
+  }
+  for (int i = 40; i < 60; ++i) {
+    round((b & c) | (d & (b | c)), 0x8f1bbcdc, schedule(i));
+  }
+  for (int i = 60; i < 80; ++i) {
+    round(b ^ c ^ d, 0xca62c1d6, schedule(i));
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+} // namespace
+
+/**
+ * @brief Mix one 64-byte block into the state
+ * @param block The block to process
+ */
+void Sha1::processBlock(const uint8_t *block) {
+  compress<false>(state, block);
+}
+
+/**
+ * @brief Mix one all-zero block into the state
+ */
+void Sha1::processZeroBlock() { compress<true>(state, nullptr); }
+
+/**
+ * @brief Get the states after 0 to kZeroStates zero blocks of a message
+ * @return kZeroStates + 1 states of five words each, computed once
+ */
+const uint32_t *Sha1::zeroStates() {
+  static const std::vector<uint32_t> states = [] {
+    std::vector<uint32_t> table((kZeroStates + 1) * 5);
+    Sha1 sha1;
+    for (size_t i = 0; i <= kZeroStates; ++i) {
+      std::copy(sha1.state, sha1.state + 5, table.begin() + i * 5);
+      sha1.processZeroBlock();
+    }
+    return table;
+  }();
+  return states.data();
+}
@@ -0,0 +1,387 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <metrics.hpp>
+#include <sha1.hpp>
+#include <stdexcept>
+#include <storage.hpp>
+#include <trace.hpp>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief Build the on-disk file list of a torrent
+ * @param torrent The parsed torrent
+ * @return Files with paths relative to the storage root
+ */
+std::vector<TorrentFile::FileInfo> filesOnDisk(const TorrentFile &torrent) {
+  std::vector<TorrentFile::FileInfo> files = torrent.getFiles();
+  if (!torrent.isSingleFile()) {
+    // Multi-file paths are relative to a directory named after the torrent
+    for (auto &file : files) {
+      file.path = torrent.getName() + "/" + file.path;
+    }
+  }
+  return files;
+}
+
+/**
+ * @brief Check that a file path stays under the storage root
+ * @param rootDir The storage root
+ * @param path Path relative to it
+ * @throws std::invalid_argument if the path is empty or absolute, or
+ * resolves to rootDir itself or outside it
+ */
+void checkUnderRoot(const std::string &rootDir, const std::string &path) {
+  namespace fs = std::filesystem;
+  const fs::path root = fs::path(rootDir.empty() ? "." : rootDir);
+  const fs::path relative =
+      (root / path).lexically_normal().lexically_relative(
+          root.lexically_normal());
+  if (path.empty() || fs::path(path).is_absolute() || relative.empty() ||
+      relative == "." || *relative.begin() == "..") {
+    throw std::invalid_argument("File path " + path + " is outside of " +
+                                rootDir);
+  }
+}
+
+/**
+ * @brief Build an exception for a failed system call on a file
+ * @param what Description of the operation
+ * @param path The file involved
+ * @return Exception carrying the errno description
+ */
+std::runtime_error fileError(const std::string &what, const std::string &path) {
+  return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+/**
+ * @brief Get a descriptor cache counter, registering it on first use
+ * @param result "hit", "miss" or "eviction"
+ * @return The counter in the global registry
+ */
+MetricsRegistry::Counter &descriptorCacheCounter(const std::string &result) {
+  return MetricsRegistry::global().counter(
+      "storage_fd_cache_total",
+      "File descriptor cache lookups and evictions of Storage",
+      {{"result", result}});
+}
+
+} // namespace
+
+/**
+ * @brief Construct storage for a parsed torrent
+ * @param torrent The torrent whose content is stored
+ * @param rootDir Directory the torrent's name is resolved against
+ */
+Storage::Storage(const TorrentFile &torrent, const std::string &rootDir)
+    : Storage(filesOnDisk(torrent), torrent.getPieceLength(), rootDir) {}
+
+/**
+ * @brief Construct storage for an explicit file layout
+ * @param files Files in torrent order, paths relative to rootDir
+ * @param pieceLength Nominal piece length in bytes
+ * @param rootDir Directory the file paths are resolved against
+ * @param maxOpenFiles Maximum number of file descriptors kept open
+ * @throws std::invalid_argument if the piece length is not positive, a
+ * file length is negative or a path leaves rootDir
+ */
+Storage::Storage(const std::vector<TorrentFile::FileInfo> &files,
+                 int64_t pieceLength, const std::string &rootDir,
+                 size_t maxOpenFiles)
+    : pieceLength(pieceLength),
+      maxOpenFiles(std::max<size_t>(maxOpenFiles, 1)) {
+  if (pieceLength <= 0) {
+    throw std::invalid_argument("Piece length must be positive");
+  }
+  for (const auto &file : files) {
+    if (file.length < 0) {
+      throw std::invalid_argument("Negative length for file " + file.path);
+    }
+    checkUnderRoot(rootDir, file.path);
+    this->files.push_back(
+        {rootDir + "/" + file.path, totalSize, file.length, file.padding});
+    totalSize += file.length;
+  }
+}
+
+/**
+ * @brief Close all open file descriptors
+ */
+Storage::~Storage() {
+  for (auto &file : files) {
+    if (file.fd >= 0) {
+      ::close(file.fd);
+    }
+  }
+}
+
+/**
+ * @brief Split a block into the file slices that hold it
+ * @param piece Piece index
+ * @param offset Byte offset within the piece
+ * @param length Length of the block in bytes
+ * @return Slices in content order; zero-length files are skipped
+ * @throws std::out_of_range if the block extends past its piece or the end
+ * of the content
+ */
+std::vector<Storage::FileSlice> Storage::mapBlock(uint32_t piece,
+                                                  uint32_t offset,
+                                                  uint32_t length) const {
+  if (piece >= numPieces() ||
+      int64_t{offset} + length > int64_t{pieceSize(piece)}) {
+    throw std::out_of_range("Block outside of piece " + std::to_string(piece));
+  }
+
+  // First file that ends after the block's first byte
+  int64_t position = int64_t{piece} * pieceLength + offset;
+  auto it = std::partition_point(files.begin(), files.end(),
+                                 [&](const File &file) {
+                                   return file.start + file.length <= position;
+                                 });
+
+  std::vector<FileSlice> slices;
+  int64_t remaining = length;
+  for (; remaining > 0 && it != files.end(); ++it) {
+    if (it->length == 0) {
+      continue;
+    }
+    int64_t fileOffset = position - it->start;
+    int64_t sliceLength = std::min(remaining, it->length - fileOffset);
+    slices.push_back({static_cast<size_t>(it - files.begin()), fileOffset,
+                      sliceLength, it->padding});
+    position += sliceLength;
+    remaining -= sliceLength;
+  }
+  return slices;
+}
+
+/**
+ * @brief Read a block into memory
+ * @param piece Piece index
+ * @param offset Byte offset within the piece
+ * @param length Length of the block in bytes
+ * @param out Buffer of at least length bytes
+ * @throws std::runtime_error if a file cannot be read or is too short
+ *
+ * Parts in padding files are filled with zeros.
+ */
+void Storage::readBlock(uint32_t piece, uint32_t offset, uint32_t length,
+                        char *out) {
+  TRACE_SCOPE("storage.readBlock", "disk", "bytes", length);
+  for (const auto &slice : mapBlock(piece, offset, length)) {
+    if (slice.padding) {
+      std::memset(out, 0, slice.length);
+      out += slice.length;
+      continue;
+    }
+    int fd = fileDescriptor(slice.fileIndex);
+    int64_t done = 0;
+    while (done < slice.length) {
+      ssize_t n = ::pread(fd, out + done, slice.length - done,
+                          slice.offset + done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0) {
+        throw fileError("Could not read", files[slice.fileIndex].path);
+      }
+      if (n == 0) {
+        throw std::runtime_error("Unexpected end of file: " +
+                                 files[slice.fileIndex].path);
+      }
+      done += n;
+    }
+    out += slice.length;
+  }
+}
+
+/**
+ * @brief Write a block to its files, creating files and directories
+ * @param piece Piece index
+ * @param offset Byte offset within the piece
+ * @param length Length of the block in bytes
+ * @param data The block data
+ * @throws std::runtime_error if a file cannot be written
+ *
+ * Parts in padding files are not written anywhere.
+ */
+void Storage::writeBlock(uint32_t piece, uint32_t offset, uint32_t length,
+                         const char *data) {
+  TRACE_SCOPE("storage.writeBlock", "disk", "bytes", length);
+  for (const auto &slice : mapBlock(piece, offset, length)) {
+    if (slice.padding) {
+      data += slice.length; // Zeros by definition, verified by piece hash
+      continue;
+    }
+    int fd = fileDescriptor(slice.fileIndex, true);
+    int64_t done = 0;
+    while (done < slice.length) {
+      ssize_t n = ::pwrite(fd, data + done, slice.length - done,
+                           slice.offset + done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0) {
+        throw fileError("Could not write", files[slice.fileIndex].path);
+      }
+      done += n;
+    }
+    data += slice.length;
+  }
+}
+
+/**
+ * @brief Compute the SHA-1 of a piece as stored
+ * @param piece Piece index
+ * @return The 20-byte digest
+ * @throws std::out_of_range if the piece does not exist
+ * @throws std::runtime_error if a file cannot be read
+ *
+ * Real files are read in chunks through one buffer; padding is hashed as
+ * zeros with Sha1::updateZeros and costs no I/O.
+ */
+std::string Storage::hashPiece(uint32_t piece) {
+  if (piece >= numPieces()) {
+    throw std::out_of_range("No piece " + std::to_string(piece));
+  }
+  TRACE_SCOPE("storage.hashPiece", "disk", "piece", piece);
+  constexpr int64_t kChunk = 64 * 1024;
+  thread_local std::vector<char> buffer(kChunk);
+  Sha1 sha1;
+  for (const auto &slice : mapBlock(piece, 0, pieceSize(piece))) {
+    if (slice.padding) {
+      sha1.updateZeros(slice.length);
+      continue;
+    }
+    int fd = fileDescriptor(slice.fileIndex);
+    for (int64_t done = 0; done < slice.length;) {
+      size_t want = std::min(kChunk, slice.length - done);
+      ssize_t n = ::pread(fd, buffer.data(), want, slice.offset + done);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0) {
+        throw fileError("Could not read", files[slice.fileIndex].path);
+      }
+      if (n == 0) {
+        throw std::runtime_error("Unexpected end of file: " +
+                                 files[slice.fileIndex].path);
+      }
+      sha1.update(buffer.data(), n);
+      done += n;
+    }
+  }
+  return sha1.finish();
+}
+
+/**
+ * @brief Get an open descriptor for a file
+ * @param fileIndex Index into the file list
+ * @param forWrite Open for writing, creating the file if needed
+ * @return A descriptor owned by the storage
+ * @throws std::runtime_error if the file cannot be opened
+ * @throws std::invalid_argument for padding files
+ *
+ * Descriptors are cached. When more than maxOpenFiles would be open, the
+ * least recently used one is closed first. A file opened read-only is
+ * reopened read-write on the first write.
+ */
+int Storage::fileDescriptor(size_t fileIndex, bool forWrite) {
+  static MetricsRegistry::Counter &hits = descriptorCacheCounter("hit");
+  static MetricsRegistry::Counter &misses = descriptorCacheCounter("miss");
+
+  File &file = files.at(fileIndex);
+  if (file.padding) {
+    throw std::invalid_argument("Padding file has no descriptor: " +
+                                file.path);
+  }
+  file.lastUse = ++useCounter;
+  if (file.fd >= 0 && (file.writable || !forWrite)) {
+    hits.add();
+    return file.fd;
+  }
+  misses.add();
+
+  if (file.fd >= 0) {
+    ::close(file.fd);
+    file.fd = -1;
+    --openFiles;
+  }
+  if (openFiles >= maxOpenFiles) {
+    evictOne();
+  }
+
+  int flags = O_CLOEXEC;
+  if (forWrite) {
+    auto parent = std::filesystem::path(file.path).parent_path();
+    if (!parent.empty()) {
+      std::filesystem::create_directories(parent);
+    }
+    flags |= O_RDWR | O_CREAT;
+  } else {
+    flags |= O_RDONLY;
+  }
+  int fd = ::open(file.path.c_str(), flags, 0644);
+  if (fd < 0) {
+    throw fileError("Could not open", file.path);
+  }
+  file.fd = fd;
+  file.writable = forWrite;
+  ++openFiles;
+  return fd;
+}
+
+/**
+ * @brief Get the combined size of all files
+ * @return Content size in bytes
+ */
+int64_t Storage::getTotalSize() const { return totalSize; }
+
+/**
+ * @brief Get the nominal piece length
+ * @return Piece length in bytes
+ */
+int64_t Storage::getPieceLength() const { return pieceLength; }
+
+/**
+ * @brief Get the number of pieces
+ * @return Piece count, the last piece may be short
+ */
+uint32_t Storage::numPieces() const {
+  return static_cast<uint32_t>((totalSize + pieceLength - 1) / pieceLength);
+}
+
+/**
+ * @brief Get the size of a piece
+ * @param piece The piece index
+ * @return Size in bytes; only the last piece may be shorter
+ */
+uint32_t Storage::pieceSize(uint32_t piece) const {
+  int64_t start = int64_t{piece} * pieceLength;
+  return static_cast<uint32_t>(std::min(pieceLength, totalSize - start));
+}
+
+/**
+ * @brief Close the least recently used descriptor
+ */
+void Storage::evictOne() {
+  File *oldest = nullptr;
+  for (auto &file : files) {
+    if (file.fd >= 0 && (!oldest || file.lastUse < oldest->lastUse)) {
+      oldest = &file;
+    }
+  }
+  if (oldest) {
+    static MetricsRegistry::Counter &evictions =
+        descriptorCacheCounter("eviction");
+    evictions.add();
+    ::close(oldest->fd);
+    oldest->fd = -1;
+    --openFiles;
+  }
+}
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <stdexcept>
+#include <streamwindow.hpp>
+#include <string>
+
+/**
+ * @brief Stream one file of a torrent
+ * @param picker Picker for the torrent
+ * @param torrent The torrent, for its file layout
+ * @param fileIndex Index into torrent.getFiles()
+ * @param settings Bitrate and window size
+ * @throws std::out_of_range if the file does not exist
+ * @throws std::invalid_argument if it is a padding file or empty, or the
+ * bitrate or window is not positive
+ */
+StreamWindow::StreamWindow(PiecePicker &picker, const TorrentFile &torrent,
+                           size_t fileIndex, const Settings &settings)
+    : picker(picker), settings(settings), start(0),
+      pieceLength(torrent.getPieceLength()) {
+  const auto &files = torrent.getFiles();
+  if (fileIndex >= files.size()) {
+    throw std::out_of_range("No file " + std::to_string(fileIndex) +
+                            " in torrent");
+  }
+  if (files[fileIndex].padding || files[fileIndex].length <= 0) {
+    throw std::invalid_argument("Cannot stream " + files[fileIndex].path);
+  }
+  if (settings.bitrate <= 0 || settings.windowBytes <= 0) {
+    throw std::invalid_argument("Stream needs a positive bitrate and window");
+  }
+  for (size_t i = 0; i < fileIndex; ++i) {
+    start += files[i].length;
+  }
+  size = files[fileIndex].length;
+}
+
+/**
+ * @brief Remove the window's deadlines
+ */
+StreamWindow::~StreamWindow() { stop(); }
+
+/**
+ * @brief Announce a read and move the window to it
+ * @param offset Byte offset of the read within the file
+ * @param length Bytes wanted now
+ * @param nowMicros Current time in the picker's deadline clock
+ * @return The pieces holding the read
+ *
+ * Pieces of the read are due at nowMicros. A piece further ahead is due
+ * when playback at the bitrate, starting at offset, reaches its first byte.
+ * Deadlines are set again on every call, so a player that falls behind
+ * pushes them back rather than leaving them in the past.
+ */
+StreamWindow::PieceRange StreamWindow::read(int64_t offset, int64_t length,
+                                            int64_t nowMicros) {
+  PieceRange range = pieces(offset, length);
+  const int64_t position = start + offset;
+  const int64_t end =
+      std::min(start + size, position + std::max(length, settings.windowBytes));
+  const PieceRange next{range.first,
+                        static_cast<uint32_t>((end - 1) / pieceLength)};
+
+  if (active) {
+    for (uint32_t p = window.first; p <= window.last; ++p) {
+      if (p < next.first || p > next.last) {
+        picker.setDeadline(p, PiecePicker::kNoDeadline);
+      }
+    }
+  }
+  for (uint32_t p = next.first; p <= next.last; ++p) {
+    int64_t deadline = nowMicros;
+    if (p > range.last) {
+      int64_t ahead = int64_t{p} * pieceLength - position;
+      deadline += ahead * 1000000 / settings.bitrate;
+    }
+    picker.setDeadline(p, deadline);
+  }
+  window = next;
+  active = true;
+  return range;
+}
+
+/**
+ * @brief Remove every deadline the window has set
+ */
+void StreamWindow::stop() {
+  if (!active) {
+    return;
+  }
+  for (uint32_t p = window.first; p <= window.last; ++p) {
+    picker.setDeadline(p, PiecePicker::kNoDeadline);
+  }
+  active = false;
+}
+
+/**
+ * @brief Get the pieces holding a byte range of the file
+ * @param offset Byte offset within the file
+ * @param length Length of the range
+ * @return Piece range, clipped to the end of the file
+ * @throws std::out_of_range if the offset is outside the file
+ * @throws std::invalid_argument if the length is not positive
+ */
+StreamWindow::PieceRange StreamWindow::pieces(int64_t offset,
+                                              int64_t length) const {
+  if (offset < 0 || offset >= size) {
+    throw std::out_of_range("Stream offset outside of file");
+  }
+  if (length <= 0) {
+    throw std::invalid_argument("Stream read needs a positive length");
+  }
+  int64_t first = start + offset;
+  int64_t last = start + std::min(size, offset + length) - 1;
+  return {static_cast<uint32_t>(first / pieceLength),
+          static_cast<uint32_t>(last / pieceLength)};
+}
+
+/**
+ * @brief Get the size of the streamed file
+ * @return Size in bytes
+ */
+int64_t StreamWindow::fileSize() const { return size; }
+
+/**
+ * @brief Get the offset of the streamed file in the torrent content
+ * @return Offset of its first byte in bytes
+ */
+int64_t StreamWindow::fileStart() const { return start; }
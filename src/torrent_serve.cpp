@@ -0,0 +1,112 @@
+/**
+ * @brief Serve the files of a downloaded torrent over HTTP
+ *
+ * Checks which pieces of the torrent are present and intact below the
+ * root directory, prints a URL for every file and serves them with a
+ * RangeServer until interrupted, so media players can open and seek in
+ * them. Ranges that reach a missing piece wait for it; since this tool
+ * does not download, they wait until the client gives up.
+ *
+ * Exits with 0 on SIGINT or SIGTERM and 1 on errors.
+ */
+
+#include <csignal>
+#include <iostream>
+#include <rangeserver.hpp>
+#include <stdexcept>
+#include <storage.hpp>
+#include <string>
+#include <torrentfile.hpp>
+#include <vector>
+
+namespace {
+
+const char *const kUsage =
+    "Usage: torrent_serve [options] <file.torrent> <root directory>\n"
+    "  --address ADDR  IPv4 address to listen on (default: 127.0.0.1)\n"
+    "  --port N        Port to listen on (default: any free port)\n"
+    "  --no-verify     Take every piece as present without hashing\n";
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  RangeServer::Options options;
+  bool verify = true;
+  std::vector<std::string> args;
+  try {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      auto value = [&]() -> std::string {
+        if (i + 1 >= argc) {
+          throw std::invalid_argument("Missing value for " + arg);
+        }
+        return argv[++i];
+      };
+      if (arg == "--address") {
+        options.address = value();
+      } else if (arg == "--port") {
+        options.port = static_cast<uint16_t>(std::stoul(value()));
+      } else if (arg == "--no-verify") {
+        verify = false;
+      } else if (arg == "--help" || arg == "-h") {
+        std::cout << kUsage;
+        return 0;
+      } else if (!arg.empty() && arg[0] == '-') {
+        throw std::invalid_argument("Unknown option: " + arg);
+      } else {
+        args.push_back(arg);
+      }
+    }
+    if (args.size() != 2) {
+      throw std::invalid_argument("Expected a torrent and a directory");
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << '\n' << kUsage;
+    return 1;
+  }
+
+  try {
+    TorrentFile torrent(args[0]);
+    std::vector<bool> have(torrent.getPieces().size(), true);
+    if (verify) {
+      Storage storage(torrent, args[1]);
+      size_t present = 0;
+      for (uint32_t piece = 0; piece < have.size(); ++piece) {
+        try {
+          have[piece] = storage.hashPiece(piece) == torrent.getPieces()[piece];
+        } catch (const std::runtime_error &) {
+          have[piece] = false; // File missing or short
+        }
+        present += have[piece];
+      }
+      std::cerr << present << " of " << have.size() << " pieces present\n";
+    }
+
+    // Block the signals before the server thread starts, so it inherits
+    // the mask and sigwait() below receives them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    RangeServer server(torrent, args[1], std::move(have), options);
+    for (size_t i = 0; i < torrent.getFiles().size(); ++i) {
+      if (!torrent.getFiles()[i].padding) {
+        std::cout << "http://" << options.address << ':' << server.port()
+                  << server.urlPath(i) << '\n';
+      }
+    }
+    std::cout.flush();
+    int signal = 0;
+    sigwait(&signals, &signal);
+    server.stop();
+    RangeServer::Stats stats = server.stats();
+    std::cerr << stats.requests << " requests, " << stats.bytesSent
+              << " bytes sent\n";
+    return 0;
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << '\n';
+    return 1;
+  }
+}
@@ -1,6 +1,171 @@
+#include <algorithm>
 #include <fstream>
+#include <iterator>
+#include <metrics.hpp>
+#include <optional>
+#include <parsestats.hpp>
+#include <sha1.hpp>
 #include <stdexcept>
 #include <torrentfile.hpp>
+#include <trace.hpp>
+
+namespace {
+
+/**
+ * @brief Count the values of a decoded Bencode tree
+ * @param value Root of the tree
+ * @return Number of values including the root
+ */
+size_t countNodes(const BencodeValue &value) {
+  size_t count = 1;
+  if (value.isList()) {
+    for (const auto &item : value.getList()) {
+      count += countNodes(*item);
+    }
+  } else if (value.isDict()) {
+    for (const auto &[key, item] : value.getDict()) {
+      count += countNodes(*item);
+    }
+  }
+  return count;
+}
+
+/**
+ * @brief Library metrics of torrent loading
+ */
+struct LoadMetrics {
+  MetricsRegistry::Counter &loads;
+  MetricsRegistry::Counter &bytes;
+  MetricsRegistry::Counter *errors[ParseStats::kNumPhases];
+};
+
+/**
+ * @brief Get the load metrics, registering them on first use
+ * @return The metrics in the global registry
+ */
+const LoadMetrics &loadMetrics() {
+  static const LoadMetrics metrics = [] {
+    auto &registry = MetricsRegistry::global();
+    const char *help = "Torrent loads that failed, by phase";
+    return LoadMetrics{
+        registry.counter("torrent_loads_total", "Torrents loaded"),
+        registry.counter("torrent_load_bytes_total",
+                         "Bencode bytes of loaded torrents"),
+        {&registry.counter("torrent_load_errors_total", help,
+                           {{"phase", "read"}}),
+         &registry.counter("torrent_load_errors_total", help,
+                           {{"phase", "decode"}}),
+         &registry.counter("torrent_load_errors_total", help,
+                           {{"phase", "extract"}})}};
+  }();
+  return metrics;
+}
+
+/**
+ * @brief Count a failed load
+ * @param phase The phase that threw
+ */
+void countError(ParseStats::Phase phase) {
+  loadMetrics().errors[static_cast<size_t>(phase)]->add();
+}
+
+// Keys parseTorrentDict and parseInfoDict interpret
+constexpr std::string_view kRootKeys[] = {"announce", "comment", "created by",
+                                          "creation date", "info"};
+constexpr std::string_view kInfoKeys[] = {
+    "attr", "files", "length", "name", "piece length", "pieces",
+    "symlink path"};
+
+template <size_t N>
+bool isOneOf(std::string_view key, const std::string_view (&keys)[N]) {
+  return std::find(std::begin(keys), std::end(keys), key) != std::end(keys);
+}
+
+/**
+ * @brief Encode a string field, or nothing if it is empty
+ */
+std::optional<std::string> encodedString(const std::string &value) {
+  if (value.empty()) {
+    return std::nullopt;
+  }
+  std::string out;
+  BencodeEncoder::encodeString(value, out);
+  return out;
+}
+
+/**
+ * @brief Encode an integer field, or nothing if it is zero
+ */
+std::optional<std::string> encodedInt(int64_t value) {
+  if (value == 0) {
+    return std::nullopt;
+  }
+  std::string out;
+  BencodeEncoder::encodeInt(value, out);
+  return out;
+}
+
+/**
+ * @brief Read the BEP 47 attributes of a file
+ * @param dict The file's dictionary, or the info dictionary of a
+ * single-file torrent
+ * @param file The file to mark
+ *
+ * Unknown attribute letters are ignored, as BEP 47 asks, so that later
+ * extensions do not make torrents unreadable.
+ */
+void parseAttributes(const BencodeValue::Dict &dict,
+                     TorrentFile::FileInfo &file) {
+  auto it = dict.find("attr");
+  if (it == dict.end() || !it->second->isString()) {
+    return;
+  }
+  for (char attribute : it->second->getString()) {
+    switch (attribute) {
+    case 'p':
+      file.padding = true;
+      break;
+    case 'x':
+      file.executable = true;
+      break;
+    case 'h':
+      file.hidden = true;
+      break;
+    case 'l':
+      if (auto target = dict.find("symlink path");
+          target != dict.end() && target->second->isList()) {
+        for (const auto &component : target->second->getList()) {
+          if (!component->isString()) {
+            continue;
+          }
+          if (!file.symlink.empty()) {
+            file.symlink += '/';
+          }
+          file.symlink += component->getString();
+        }
+      }
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+/**
+ * @brief Check a torrent name or file path part before it names a file
+ * @param part The name or path part
+ * @param what Field it came from, for the error message
+ * @throws std::runtime_error if the part is empty, "." or "..", or holds
+ * a '/' or NUL, any of which could resolve outside the storage directory
+ */
+void checkPathPart(const std::string &part, const std::string &what) {
+  if (part.empty() || part == "." || part == ".." ||
+      part.find_first_of(std::string("/\0", 2)) != std::string::npos) {
+    throw std::runtime_error("Invalid torrent file: unsafe " + what);
+  }
+}
+
+} // namespace
 
 /**
  * @brief Read a .torrent file from disk into a string
@@ -13,6 +178,7 @@
  * which is important for Bencode parsing.
  */
 std::string readTorrentFile(const std::string &filepath) {
+  TRACE_SCOPE("torrent.read", "disk");
   // Open file in binary mode and position at end for size calculation
   std::ifstream file(filepath, std::ios::binary | std::ios::ate);
   if (!file.is_open()) {
@@ -41,26 +207,144 @@ std::string readTorrentFile(const std::string &filepath) {
  * @throws std::runtime_error if file is invalid or required fields are missing
  */
 TorrentFile::TorrentFile(const std::string &filepath) {
+  TRACE_SCOPE("torrent.load", "parse");
+  // Measure the load only if instrumentation is enabled
+  std::optional<ParseStats::Sample> sample;
+  if (ParseStats::isEnabled()) {
+    sample.emplace();
+  }
+
   // Read the raw contents of the .torrent file from disk
-  std::string torrentData = readTorrentFile(filepath);
+  std::string torrentData;
+  try {
+    torrentData = readTorrentFile(filepath);
+  } catch (...) {
+    countError(ParseStats::Phase::Read);
+    throw;
+  }
+  if (sample) {
+    sample->endPhase(ParseStats::Phase::Read);
+  }
+  source = std::make_shared<const std::string>(std::move(torrentData));
+  parseTorrentData(*source, sample ? &*sample : nullptr);
+}
 
-  // Parse the Bencode-encoded data into a structured format
-  // This will handle all bencode types (integers, strings, lists, and
-  // dictionaries)
-  BencodeValue result = BencodeParser::parse(torrentData);
+/**
+ * @brief Construct a TorrentFile from Bencode data already in memory
+ * @param torrentData Content of a .torrent file
+ * @return The parsed torrent
+ * @throws std::runtime_error if the data is invalid or required fields are
+ * missing
+ *
+ * Useful for torrents that never touch the disk, such as metadata received
+ * from peers or torrents generated for simulations.
+ */
+TorrentFile TorrentFile::fromBencode(std::string_view torrentData) {
+  TRACE_SCOPE("torrent.fromBencode", "parse", "bytes", torrentData.size());
+  std::optional<ParseStats::Sample> sample;
+  if (ParseStats::isEnabled()) {
+    sample.emplace();
+  }
+  TorrentFile torrent;
+  torrent.source = std::make_shared<const std::string>(torrentData);
+  torrent.parseTorrentData(*torrent.source, sample ? &*sample : nullptr);
+  return torrent;
+}
 
-  // Validate that the root element is a dictionary
-  // According to the BitTorrent specification, all .torrent files must have a
-  // dictionary as the root
-  if (!result.isDict()) {
-    throw std::runtime_error("Invalid torrent file: root must be a dictionary");
+/**
+ * @brief Compute the v1 info hash of a torrent
+ * @param torrentData Content of a .torrent file
+ * @return The 20-byte SHA-1 of the info dictionary
+ * @throws std::runtime_error if the data has no info dictionary
+ */
+std::string TorrentFile::computeInfoHash(std::string_view torrentData) {
+  std::string_view info = BencodeParser::findRaw(torrentData, "info");
+  if (info.empty() || info[0] != 'd') {
+    throw std::runtime_error(
+        "Invalid torrent file: missing or invalid info dictionary");
   }
+  return Sha1::hash(info);
+}
+
+/**
+ * @brief Load many .torrent files in parallel
+ * @param paths Files to load
+ * @param onLoad Called once per file, from whichever thread loaded it
+ * @param scheduler Scheduler the loads run on
+ * @throws Whatever onLoad throws, after all other loads finished
+ */
+void TorrentFile::loadMany(const std::vector<std::string> &paths,
+                           const LoadCallback &onLoad, Scheduler &scheduler) {
+  // Small tasks: load times vary by orders of magnitude between torrents,
+  // so balance comes from stealing rather than from equal-sized chunks
+  scheduler.parallelFor(
+      0, paths.size(),
+      [&](size_t i) {
+        std::optional<TorrentFile> torrent;
+        std::string error;
+        try {
+          torrent.emplace(paths[i]);
+        } catch (const std::exception &e) {
+          error = e.what();
+        }
+        onLoad(i, torrent ? &*torrent : nullptr, error);
+      },
+      4);
+}
 
-  // Get the root dictionary and parse its contents
-  // This will extract all metadata including tracker URL, file info, and piece
-  // hashes
-  const auto &dict = result.getDict();
-  parseTorrentDict(dict);
+/**
+ * @brief Parse Bencode-encoded torrent data into this object
+ * @param torrentData Content of a .torrent file
+ * @param sample Measurements of this load, or nullptr if not recording
+ * @throws std::runtime_error if the data is invalid or required fields are
+ * missing
+ *
+ * With a sample, the decode and extract phases are timed and the decoded
+ * values are counted between them, outside both phases. A load that throws
+ * leaves the sample uncommitted, which counts it as a failure. Loads and
+ * failures by phase are always counted in the global MetricsRegistry.
+ */
+void TorrentFile::parseTorrentData(std::string_view torrentData,
+                                   ParseStats::Sample *sample) {
+  size_t nodeCount = 0;
+  ParseStats::Phase phase = ParseStats::Phase::Decode;
+  try {
+    // Parse the Bencode-encoded data into a structured format
+    // This will handle all bencode types (integers, strings, lists, and
+    // dictionaries)
+    BencodeValue result = BencodeParser::parse(torrentData);
+    phase = ParseStats::Phase::Extract;
+    if (sample != nullptr) {
+      sample->endPhase(ParseStats::Phase::Decode);
+      nodeCount = countNodes(result);
+      sample->skip();
+    }
+
+    // Validate that the root element is a dictionary
+    // According to the BitTorrent specification, all .torrent files must have
+    // a dictionary as the root
+    if (!result.isDict()) {
+      throw std::runtime_error(
+          "Invalid torrent file: root must be a dictionary");
+    }
+
+    // Get the root dictionary and parse its contents
+    // This will extract all metadata including tracker URL, file info, and
+    // piece hashes
+    const auto &dict = result.getDict();
+    parseTorrentDict(dict);
+    indexRawFields();
+    // The decoded tree is freed on leaving this block, in the extract phase
+  } catch (...) {
+    countError(phase);
+    throw;
+  }
+  if (sample != nullptr) {
+    sample->endPhase(ParseStats::Phase::Extract);
+    sample->commit(torrentData.size(), nodeCount);
+  }
+  loadMetrics().loads.add();
+  loadMetrics().bytes.add(torrentData.size());
 }
 
 // Getter implementations
@@ -110,6 +394,12 @@ const std::vector<TorrentFile::FileInfo> &TorrentFile::getFiles() const {
  */
 int64_t TorrentFile::getTotalSize() const { return totalSize; }
 
+/**
+ * @brief Get the combined size of the padding files (BEP 47)
+ * @return Size in bytes of the zeros that only align other files
+ */
+int64_t TorrentFile::getPaddingSize() const { return paddingSize; }
+
 /**
  * @brief Get the client software that created this torrent file
  * @return A reference to the string identifying the creator client (may be
@@ -130,6 +420,124 @@ int64_t TorrentFile::getCreationDate() const { return creationDate; }
  */
 bool TorrentFile::isSingleFile() const { return singleFile; }
 
+/**
+ * @brief Get the free-form comment of the torrent
+ * @return A reference to the comment (empty if not specified)
+ */
+const std::string &TorrentFile::getComment() const { return comment; }
+
+/**
+ * @brief Get the root entries this class does not interpret
+ * @return Views into the parsed data, in file order
+ */
+const std::vector<TorrentFile::RawField> &TorrentFile::getExtraFields() const {
+  return extraFields;
+}
+
+/**
+ * @brief Get the info dictionary entries this class does not interpret
+ * @return Views into the parsed data, in file order
+ */
+const std::vector<TorrentFile::RawField> &
+TorrentFile::getExtraInfoFields() const {
+  return extraInfoFields;
+}
+
+/**
+ * @brief Get the info dictionary exactly as it appears in the data
+ * @return A view into the parsed data
+ */
+std::string_view TorrentFile::getRawInfo() const { return rawInfo; }
+
+/**
+ * @brief Set the tracker URL, removing the key if empty
+ */
+void TorrentFile::setAnnounce(const std::string &url) {
+  announce = url;
+  edit("announce", encodedString(url));
+}
+
+/**
+ * @brief Set the comment, removing the key if empty
+ */
+void TorrentFile::setComment(const std::string &text) {
+  comment = text;
+  edit("comment", encodedString(text));
+}
+
+/**
+ * @brief Set the creating client, removing the key if empty
+ */
+void TorrentFile::setCreatedBy(const std::string &client) {
+  createdBy = client;
+  edit("created by", encodedString(client));
+}
+
+/**
+ * @brief Set the creation date, removing the key if zero
+ */
+void TorrentFile::setCreationDate(int64_t date) {
+  creationDate = date;
+  edit("creation date", encodedInt(date));
+}
+
+/**
+ * @brief Set a root entry that has no typed setter
+ * @param key The key
+ * @param encodedValue Its new value, Bencode-encoded
+ * @throws std::invalid_argument if the key is info or has a typed setter,
+ * or the value is not exactly one Bencode value
+ */
+void TorrentFile::setField(std::string_view key,
+                           std::string_view encodedValue) {
+  if (isOneOf(key, kRootKeys)) {
+    throw std::invalid_argument("Cannot set " + std::string(key) +
+                                " as a raw field");
+  }
+  size_t pos = 0;
+  try {
+    BencodeParser::skipValue(encodedValue, pos);
+  } catch (const std::runtime_error &e) {
+    throw std::invalid_argument("Invalid value for " + std::string(key) +
+                                ": " + e.what());
+  }
+  if (pos != encodedValue.size()) {
+    throw std::invalid_argument("Invalid value for " + std::string(key) +
+                                ": trailing data");
+  }
+  edit(key, std::string(encodedValue));
+}
+
+/**
+ * @brief Remove a root entry that has no typed setter
+ * @param key The key
+ * @throws std::invalid_argument if the key is info or has a typed setter
+ */
+void TorrentFile::removeField(std::string_view key) {
+  if (isOneOf(key, kRootKeys)) {
+    throw std::invalid_argument("Cannot remove " + std::string(key) +
+                                " as a raw field");
+  }
+  edit(key, std::nullopt);
+}
+
+/**
+ * @brief Encode the torrent, with its edits, as Bencode
+ * @return The parsed data with edited entries replaced, removed or inserted
+ *
+ * Runs of unedited entries, the info dictionary always among them, are
+ * copied from the parsed data in one piece.
+ */
+std::string TorrentFile::toBencode() const {
+  if (edits.empty()) {
+    return *source;
+  }
+  std::string out;
+  out.reserve(source->size() + 256);
+  BencodeEncoder::spliceDict(*source, rootFields, edits, out);
+  return out;
+}
+
 /**
  * @brief Parse the main dictionary of the torrent file containing all metadata
  * @param dict The root Bencode dictionary from the .torrent file
@@ -158,6 +566,12 @@ void TorrentFile::parseTorrentDict(const BencodeValue::Dict &dict) {
     createdBy = it->second->getString();
   }
 
+  // Parse the free-form comment (optional field)
+  if (auto it = dict.find("comment");
+      it != dict.end() && it->second->isString()) {
+    comment = it->second->getString();
+  }
+
   // Find and validate the info dictionary (required field)
   // The info dictionary contains the core data about files, pieces, and paths
   auto infoIt = dict.find("info");
@@ -203,9 +617,11 @@ void TorrentFile::parseInfoDict(const BencodeValue::Dict &infoDict) {
 
   // Parse the suggested name for the file/directory (required field)
   // This is the default name shown to users in torrent clients
-  if (auto it = infoDict.find("name");
-      it != infoDict.end() && it->second->isString()) {
-    name = it->second->getString();
+  const auto nameIt = infoDict.find("name");
+  const bool hasName =
+      nameIt != infoDict.end() && nameIt->second->isString();
+  if (hasName) {
+    name = nameIt->second->getString();
   }
 
   // Determine if this is a single-file or multi-file torrent
@@ -217,6 +633,8 @@ void TorrentFile::parseInfoDict(const BencodeValue::Dict &infoDict) {
     singleFile = true;
     totalSize = lengthIt->second->getInt();
     files.push_back({name, totalSize}); // Create single FileInfo entry
+    parseAttributes(infoDict, files.back());
+    files.back().padding = false; // A torrent of padding alone is content
   } else if (auto filesIt = infoDict.find("files");
              filesIt != infoDict.end() && filesIt->second->isList()) {
     // Multiple files mode: list of files with paths and lengths
@@ -225,14 +643,23 @@ void TorrentFile::parseInfoDict(const BencodeValue::Dict &infoDict) {
   } else {
     throw std::runtime_error("Invalid torrent file: missing length or files");
   }
+
+  // The name names the torrent's directory, or for a single file the file
+  // itself, which therefore cannot go without one
+  if (hasName || singleFile) {
+    checkPathPart(name, "name");
+  }
 }
 
 /**
  * @brief Parse the list of files in a multi-file torrent
  * @param filesList List of dictionaries containing file paths and sizes
  *
- * This method processes each file entry, building the complete path and
- * calculating total torrent size. Invalid entries are skipped silently.
+ * This method processes each file entry, building the complete path,
+ * reading its BEP 47 attributes and calculating total torrent size.
+ * Entries without a length or path are skipped silently.
+ * @throws std::runtime_error if a path is empty or has a part that is not
+ * a string or could resolve outside the storage directory
  */
 void TorrentFile::parseFilesList(const BencodeValue::List &filesList) {
   // Iterate through each file entry in the files list
@@ -262,10 +689,17 @@ void TorrentFile::parseFilesList(const BencodeValue::List &filesList) {
     if (auto it = fileDict.find("path");
         it != fileDict.end() && it->second->isList()) {
       const auto &pathList = it->second->getList();
+      if (pathList.empty()) {
+        throw std::runtime_error("Invalid torrent file: empty file path");
+      }
       for (size_t i = 0; i < pathList.size(); ++i) {
-        // Skip invalid path components
-        if (!pathList[i]->isString())
-          continue;
+        // Parts are joined below the torrent's directory, so one like ".."
+        // or "/etc" would name a file outside it
+        if (!pathList[i]->isString()) {
+          throw std::runtime_error("Invalid torrent file: file path part "
+                                   "is not a string");
+        }
+        checkPathPart(pathList[i]->getString(), "file path part");
         // Add directory separator except for first component
         if (i > 0)
           path += "/";
@@ -275,8 +709,51 @@ void TorrentFile::parseFilesList(const BencodeValue::List &filesList) {
       continue;
     }
 
-    // Add valid file entry to our list and update total size
+    // Add valid file entry to our list and update total size; padding
+    // files count, since the piece layout includes them
     files.push_back({path, length});
+    parseAttributes(fileDict, files.back());
     totalSize += length;
+    if (files.back().padding) {
+      paddingSize += length;
+    }
+  }
+}
+
+/**
+ * @brief Record the raw entries of the root and info dictionaries
+ * @throws std::runtime_error if the data is not a dictionary
+ *
+ * Runs after the decoded tree validated the data, so the scans cannot
+ * fail on anything the decode accepted.
+ */
+void TorrentFile::indexRawFields() {
+  rootFields = BencodeParser::dictEntries(*source);
+  for (const RawField &field : rootFields) {
+    if (field.key == "info") {
+      rawInfo = field.value;
+    } else if (!isOneOf(field.key, kRootKeys)) {
+      extraFields.push_back(field);
+    }
+  }
+  for (const RawField &field : BencodeParser::dictEntries(rawInfo)) {
+    if (!isOneOf(field.key, kInfoKeys)) {
+      extraInfoFields.push_back(field);
+    }
+  }
+}
+
+/**
+ * @brief Record an edit of a root key
+ * @param key The key
+ * @param encodedValue Its new encoding, or nullopt to remove it
+ */
+void TorrentFile::edit(std::string_view key,
+                       std::optional<std::string> encodedValue) {
+  auto it = edits.find(key);
+  if (it == edits.end()) {
+    edits.emplace(std::string(key), std::move(encodedValue));
+  } else {
+    it->second = std::move(encodedValue);
   }
 }
@@ -0,0 +1,494 @@
+#include <algorithm>
+#include <bencode.hpp>
+#include <cmath>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <torrentgen.hpp>
+
+namespace {
+
+// Characters of generated names; multi-byte UTF-8 sequences are rare
+constexpr char kNameChars[] = "abcdefghijklmnopqrstuvwxyz"
+                              "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 -_";
+const char *const kUtf8Chars[] = {"\xc3\xa9", "\xc3\xbc", "\xe6\x97\xa5",
+                                  "\xd0\xb4", "\xf0\x9f\x8e\xb5"};
+const char *const kExtensions[] = {".mkv", ".mp4", ".flac", ".iso",
+                                   ".txt", ".nfo", ".jpg",  ".bin"};
+
+// A directory level of the v2 file tree
+struct TreeNode {
+  std::map<std::string, TreeNode> children; // Sorted, as Bencode requires
+  int64_t length = -1;                       // File length, -1 for a dir
+  std::string piecesRoot;                    // Merkle root of a file
+};
+
+/**
+ * @brief Append the Bencode encoding of a v2 file tree node
+ * @param node The node to encode
+ * @param out Buffer the encoding is appended to
+ */
+void encodeTree(const TreeNode &node, std::string &out) {
+  out += 'd';
+  for (const auto &[name, child] : node.children) {
+    BencodeEncoder::encodeString(name, out);
+    if (child.length < 0) {
+      encodeTree(child, out);
+      continue;
+    }
+    // A file is a dictionary with a single empty key holding its properties
+    out += "d0:d";
+    BencodeEncoder::encodeString("length", out);
+    BencodeEncoder::encodeInt(child.length, out);
+    if (!child.piecesRoot.empty()) {
+      BencodeEncoder::encodeString("pieces root", out);
+      BencodeEncoder::encodeString(child.piecesRoot, out);
+    }
+    out += "ee";
+  }
+  out += 'e';
+}
+
+/**
+ * @brief Append a dictionary from unsorted entries
+ * @param entries Keys and encoded values
+ * @param out Buffer the encoding is appended to
+ */
+void encodeEntries(std::vector<std::pair<std::string, std::string>> &entries,
+                   std::string &out) {
+  std::sort(entries.begin(), entries.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+  out += 'd';
+  for (const auto &[key, value] : entries) {
+    BencodeEncoder::encodeString(key, out);
+    out += value;
+  }
+  out += 'e';
+}
+
+/**
+ * @brief Encode a string as a Bencode value
+ */
+std::string stringValue(std::string_view s) {
+  std::string out;
+  BencodeEncoder::encodeString(s, out);
+  return out;
+}
+
+/**
+ * @brief Encode an integer as a Bencode value
+ */
+std::string intValue(int64_t i) {
+  std::string out;
+  BencodeEncoder::encodeInt(i, out);
+  return out;
+}
+
+} // namespace
+
+/**
+ * @brief Advance the generator
+ * @return 64 random bits
+ */
+uint64_t TorrentGenerator::Random::next() {
+  uint64_t x = (state += 0x9e3779b97f4a7c15ull);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+/**
+ * @brief Draw a uniform integer
+ * @param bound Exclusive upper bound, must be positive
+ * @return Value in [0, bound)
+ */
+uint64_t TorrentGenerator::Random::below(uint64_t bound) {
+  return static_cast<uint64_t>(
+      (static_cast<unsigned __int128>(next()) * bound) >> 64);
+}
+
+/**
+ * @brief Draw an integer whose logarithm is uniform
+ * @param low Inclusive lower bound, must be positive
+ * @param high Inclusive upper bound
+ * @return Value in [low, high], small values as likely per octave as large
+ */
+int64_t TorrentGenerator::Random::logUniform(int64_t low, int64_t high) {
+  if (low >= high) {
+    return low;
+  }
+  double u = static_cast<double>(next() >> 11) / 9007199254740992.0;
+  double value = std::exp(std::log(static_cast<double>(low)) +
+                          u * std::log(static_cast<double>(high + 1) / low));
+  return std::clamp(static_cast<int64_t>(value), low, high);
+}
+
+/**
+ * @brief Append random bytes
+ * @param out Buffer the bytes are appended to
+ * @param count Number of bytes
+ */
+void TorrentGenerator::Random::bytes(std::string &out, size_t count) {
+  size_t start = out.size();
+  out.resize(start + count);
+  for (size_t i = 0; i < count; i += 8) {
+    uint64_t word = next();
+    for (size_t j = 0; j < 8 && i + j < count; ++j) {
+      out[start + i + j] = static_cast<char>(word >> (8 * j));
+    }
+  }
+}
+
+/**
+ * @brief Construct a generator
+ * @param options Shape of the generated torrents
+ * @throws std::invalid_argument if a range is empty or a size is not positive
+ */
+TorrentGenerator::TorrentGenerator(const Options &options) : options(options) {
+  if (options.minFiles == 0 || options.minFiles > options.maxFiles) {
+    throw std::invalid_argument("Invalid file count range");
+  }
+  if (options.minNameLength == 0 ||
+      options.minNameLength > options.maxNameLength) {
+    throw std::invalid_argument("Invalid name length range");
+  }
+  if (options.minFileSize < 0 || options.minFileSize > options.maxFileSize) {
+    throw std::invalid_argument("Invalid file size range");
+  }
+  auto powerOfTwo = [](int64_t n) { return n > 0 && (n & (n - 1)) == 0; };
+  if (!powerOfTwo(options.minPieceLength) ||
+      !powerOfTwo(options.maxPieceLength) ||
+      options.minPieceLength > options.maxPieceLength) {
+    throw std::invalid_argument("Piece lengths must be powers of two");
+  }
+}
+
+/**
+ * @brief Generate one torrent
+ * @param index Position of the torrent in the corpus
+ * @return Bencoded .torrent data
+ */
+std::string TorrentGenerator::generate(uint64_t index) const {
+  std::string out;
+  generate(index, out);
+  return out;
+}
+
+/**
+ * @brief Generate one torrent into a reusable buffer
+ * @param index Position of the torrent in the corpus
+ * @param out Buffer that receives the .torrent data (cleared first)
+ *
+ * Each torrent draws from its own random stream, derived from the seed and
+ * the index, so torrents can be generated in any order or in parallel.
+ */
+void TorrentGenerator::generate(uint64_t index, std::string &out) const {
+  Random random(Random(options.seed ^ (index * 0xd1342543de82ef95ull)).next());
+  out.clear();
+
+  std::string name;
+  appendName(random, name);
+  std::vector<File> files = makeFiles(random, name);
+
+  int64_t contentSize = 0;
+  for (const auto &file : files) {
+    contentSize += file.length;
+  }
+  int64_t pieceLength = options.minPieceLength;
+  if (options.targetPieces > 0) {
+    while (pieceLength < options.maxPieceLength &&
+           (contentSize + pieceLength - 1) / pieceLength >
+               options.targetPieces) {
+      pieceLength *= 2;
+    }
+  } else {
+    int steps = 0;
+    while ((options.minPieceLength << steps) < options.maxPieceLength) {
+      ++steps;
+    }
+    pieceLength <<= random.below(steps + 1);
+  }
+
+  // Hybrid torrents align every file to a piece boundary with pad files
+  bool multiFile = options.maxFiles > 1;
+  if (options.v2 && multiFile) {
+    std::vector<File> padded;
+    for (size_t i = 0; i < files.size(); ++i) {
+      padded.push_back(files[i]);
+      int64_t tail = files[i].length % pieceLength;
+      if (tail != 0 && i + 1 < files.size()) {
+        int64_t padLength = pieceLength - tail;
+        padded.push_back(
+            {{".pad", std::to_string(padLength)}, padLength, true});
+      }
+    }
+    files = std::move(padded);
+  }
+  int64_t totalSize = 0;
+  for (const auto &file : files) {
+    totalSize += file.length;
+  }
+  int64_t numPieces = (totalSize + pieceLength - 1) / pieceLength;
+
+  // Info dictionary
+  Entries info;
+  info.emplace_back("name", stringValue(name));
+  info.emplace_back("piece length", intValue(pieceLength));
+  std::string pieces;
+  pieces.reserve(numPieces * 20);
+  random.bytes(pieces, numPieces * 20);
+  info.emplace_back("pieces", stringValue(pieces));
+
+  if (multiFile) {
+    std::string list = "l";
+    for (const auto &file : files) {
+      list += 'd';
+      if (file.padding) {
+        BencodeEncoder::encodeString("attr", list);
+        BencodeEncoder::encodeString("p", list);
+      }
+      BencodeEncoder::encodeString("length", list);
+      BencodeEncoder::encodeInt(file.length, list);
+      BencodeEncoder::encodeString("path", list);
+      list += 'l';
+      for (const auto &component : file.path) {
+        BencodeEncoder::encodeString(component, list);
+      }
+      list += "ee";
+    }
+    list += 'e';
+    info.emplace_back("files", std::move(list));
+  } else {
+    info.emplace_back("length", intValue(files.front().length));
+  }
+
+  Entries root;
+  if (options.v2) {
+    TreeNode tree;
+    std::map<std::string, std::string> layers; // Sorted by pieces root
+    for (const auto &file : files) {
+      if (file.padding) {
+        continue;
+      }
+      TreeNode *node = &tree;
+      if (!multiFile) {
+        node = &node->children[name];
+      } else {
+        for (const auto &component : file.path) {
+          node = &node->children[component];
+        }
+      }
+      node->length = file.length;
+      if (file.length > 0) {
+        random.bytes(node->piecesRoot, 32);
+      }
+      // Files larger than one piece list their piece hashes in the root
+      if (file.length > pieceLength) {
+        int64_t filePieces = (file.length + pieceLength - 1) / pieceLength;
+        random.bytes(layers[node->piecesRoot], filePieces * 32);
+      }
+    }
+    std::string encodedTree;
+    encodeTree(tree, encodedTree);
+    info.emplace_back("file tree", std::move(encodedTree));
+    info.emplace_back("meta version", intValue(2));
+    std::string encodedLayers = "d";
+    for (const auto &[piecesRoot, hashes] : layers) {
+      BencodeEncoder::encodeString(piecesRoot, encodedLayers);
+      BencodeEncoder::encodeString(hashes, encodedLayers);
+    }
+    encodedLayers += 'e';
+    root.emplace_back("piece layers", std::move(encodedLayers));
+  }
+  addExtraKeys(random, "x-info-", info);
+
+  // Root dictionary
+  std::string tracker = "http://tracker" + std::to_string(random.below(100)) +
+                        ".example.org:" +
+                        std::to_string(6881 + random.below(100)) + "/announce";
+  root.emplace_back("announce", stringValue(tracker));
+  if (options.announceList) {
+    std::string tiers = "l";
+    uint64_t numTiers = 1 + random.below(3);
+    for (uint64_t t = 0; t < numTiers; ++t) {
+      tiers += 'l';
+      uint64_t numUrls = 1 + random.below(2);
+      for (uint64_t u = 0; u < numUrls; ++u) {
+        std::string url = t == 0 && u == 0
+                              ? tracker
+                              : "udp://tracker" +
+                                    std::to_string(random.below(1000)) +
+                                    ".example.net:1337/announce";
+        BencodeEncoder::encodeString(url, tiers);
+      }
+      tiers += 'e';
+    }
+    tiers += 'e';
+    root.emplace_back("announce-list", std::move(tiers));
+  }
+  std::string comment;
+  appendName(random, comment);
+  root.emplace_back("comment", stringValue(comment));
+  root.emplace_back("created by", stringValue("torrentgen/1.0"));
+  // Between 2005 and 2026
+  root.emplace_back("creation date",
+                    intValue(1104537600 + random.below(694224000)));
+  addExtraKeys(random, "x-", root);
+
+  std::string encodedInfo;
+  encodeEntries(info, encodedInfo);
+  root.emplace_back("info", std::move(encodedInfo));
+  encodeEntries(root, out);
+}
+
+/**
+ * @brief Get the generator's options
+ * @return Options given at construction
+ */
+const TorrentGenerator::Options &TorrentGenerator::getOptions() const {
+  return options;
+}
+
+/**
+ * @brief Append a random name without dots
+ * @param random Random source
+ * @param out Buffer the name is appended to
+ *
+ * The length in bytes is log-uniform between the configured limits. About
+ * one character in thirty is a multi-byte UTF-8 sequence, so parsers see
+ * non-ASCII paths.
+ */
+void TorrentGenerator::appendName(Random &random, std::string &out) const {
+  size_t length = static_cast<size_t>(
+      random.logUniform(options.minNameLength, options.maxNameLength));
+  size_t start = out.size();
+  while (out.size() - start < length) {
+    uint64_t r = random.next();
+    if (r % 30 == 0 && length - (out.size() - start) >= 4) {
+      out += kUtf8Chars[(r >> 8) % std::size(kUtf8Chars)];
+    } else {
+      out += kNameChars[(r >> 8) % (sizeof(kNameChars) - 1)];
+    }
+  }
+  // Leading and trailing spaces are legal but make paths painful to inspect
+  if (out[start] == ' ') {
+    out[start] = '_';
+  }
+  if (out.back() == ' ') {
+    out.back() = '_';
+  }
+}
+
+/**
+ * @brief Choose the files of a torrent
+ * @param random Random source
+ * @param name Torrent name, used as path for single-file torrents
+ * @return Files in torrent order
+ *
+ * Directories are drawn from a small pool per level so that files share
+ * them, as in real torrents. Directory names never contain a dot and file
+ * names always end in an extension, so no file path is also a directory.
+ */
+std::vector<TorrentGenerator::File>
+TorrentGenerator::makeFiles(Random &random, const std::string &name) const {
+  uint32_t count = static_cast<uint32_t>(
+      options.minFiles + random.below(options.maxFiles - options.minFiles + 1));
+  std::vector<File> files;
+  if (options.maxFiles == 1) {
+    files.push_back(
+        {{name},
+         random.logUniform(std::max<int64_t>(options.minFileSize, 1),
+                           options.maxFileSize),
+         false});
+    return files;
+  }
+
+  size_t poolSize = 2 + count / 16;
+  std::vector<std::vector<std::string>> pools(options.maxPathDepth);
+  for (auto &pool : pools) {
+    for (size_t i = 0; i < poolSize; ++i) {
+      pool.emplace_back();
+      appendName(random, pool.back());
+    }
+  }
+
+  std::set<std::string> used;
+  for (uint32_t i = 0; i < count; ++i) {
+    File file{{}, 0, false};
+    uint64_t depth = random.below(options.maxPathDepth + 1);
+    std::string joined;
+    for (uint64_t level = 0; level < depth; ++level) {
+      file.path.push_back(pools[level][random.below(poolSize)]);
+      joined += file.path.back() + '/';
+    }
+    std::string fileName;
+    appendName(random, fileName);
+    std::string extension = kExtensions[random.below(std::size(kExtensions))];
+    if (used.count(joined + fileName + extension)) {
+      fileName += "~" + std::to_string(i);
+    }
+    fileName += extension;
+    used.insert(joined + fileName);
+    file.path.push_back(std::move(fileName));
+    file.length = random.logUniform(std::max<int64_t>(options.minFileSize, 1),
+                                    options.maxFileSize);
+    // Some torrents contain empty files
+    if (options.minFileSize == 0 && random.below(50) == 0) {
+      file.length = 0;
+    }
+    files.push_back(std::move(file));
+  }
+  return files;
+}
+
+/**
+ * @brief Add unknown keys with random values to a dictionary
+ * @param random Random source
+ * @param prefix Key prefix
+ * @param entries Keys and encoded values of the dictionary
+ *
+ * Values cycle through all Bencode types, including nested containers, so
+ * parsers have to skip over every kind of unknown data.
+ */
+void TorrentGenerator::addExtraKeys(Random &random, const std::string &prefix,
+                                    Entries &entries) const {
+  for (uint32_t i = 0; i < options.extraKeys; ++i) {
+    std::string key = prefix + std::to_string(i) + "-";
+    appendName(random, key);
+    std::string value;
+    switch (random.below(4)) {
+    case 0:
+      BencodeEncoder::encodeInt(
+          static_cast<int64_t>(random.next() >> 1) - (INT64_MAX / 2), value);
+      break;
+    case 1:
+      random.bytes(value, random.below(64));
+      value = stringValue(value);
+      break;
+    case 2: {
+      value = "l";
+      uint64_t n = random.below(8);
+      for (uint64_t k = 0; k < n; ++k) {
+        BencodeEncoder::encodeInt(static_cast<int64_t>(random.below(1000)),
+                                  value);
+        std::string item;
+        appendName(random, item);
+        BencodeEncoder::encodeString(item, value);
+      }
+      value += 'e';
+      break;
+    }
+    default: {
+      Entries nested;
+      uint64_t n = 1 + random.below(4);
+      for (uint64_t k = 0; k < n; ++k) {
+        std::string nestedKey = std::to_string(k);
+        nested.emplace_back(nestedKey, "l" + intValue(k) + "de" + "e");
+      }
+      encodeEntries(nested, value);
+      break;
+    }
+    }
+    entries.emplace_back(std::move(key), std::move(value));
+  }
+}
@@ -0,0 +1,290 @@
+#include <stdexcept>
+#include <string>
+#include <torrentregistry.hpp>
+
+namespace {
+
+constexpr size_t kMinCapacity = 16;
+
+/**
+ * @brief Round up to a power of two, at least kMinCapacity
+ */
+size_t roundCapacity(size_t n) {
+  size_t capacity = kMinCapacity;
+  while (capacity < n) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+/**
+ * @brief Check whether a table with this many used slots must be rebuilt
+ *
+ * Tables stay at most 3/4 full, counting tombstones, so probes stay short
+ * and always reach an empty slot.
+ */
+bool overloaded(size_t used, size_t capacity) {
+  return used * 4 > capacity * 3;
+}
+
+} // namespace
+
+TorrentRegistry::Entry TorrentRegistry::tombstone;
+
+/**
+ * @brief Wrap a binary digest
+ * @param digest 20 or 32 bytes
+ * @throws std::invalid_argument for any other length
+ */
+InfoHash::InfoHash(std::string_view digest) {
+  if (digest.size() != 20 && digest.size() != 32) {
+    throw std::invalid_argument("Info hash must be 20 or 32 bytes, got " +
+                                std::to_string(digest.size()));
+  }
+  std::memcpy(bytes, digest.data(), digest.size());
+  length = static_cast<uint8_t>(digest.size());
+}
+
+/**
+ * @brief Allocate a table of empty slots
+ * @param capacity Number of slots, a power of two
+ */
+TorrentRegistry::Table::Table(size_t capacity)
+    : mask(capacity - 1), slots(new Slot[capacity]) {}
+
+/**
+ * @brief Create an empty registry
+ * @param expected Number of torrents to size the tables for
+ */
+TorrentRegistry::TorrentRegistry(size_t expected) {
+  size_t perShard = (expected + kShards - 1) / kShards;
+  size_t capacity = roundCapacity(perShard * 4 / 3 + 1);
+  for (Shard &shard : shards) {
+    shard.table.store(new Table(capacity), std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief Delete all entries and tables
+ *
+ * Entries and tables retired earlier are still owned by Epoch, which
+ * deletes them on its own schedule.
+ */
+TorrentRegistry::~TorrentRegistry() {
+  for (Shard &shard : shards) {
+    Table *table = shard.table.load(std::memory_order_relaxed);
+    for (size_t i = 0; i <= table->mask; ++i) {
+      Entry *entry = table->slots[i].entry.load(std::memory_order_relaxed);
+      if (entry != nullptr && entry != &tombstone) {
+        delete entry;
+      }
+    }
+    delete table;
+  }
+}
+
+/**
+ * @brief Add a torrent
+ * @param key The torrent's info hash
+ * @param torrent The torrent
+ * @return true if added, false if the key was present
+ */
+bool TorrentRegistry::insert(const InfoHash &key,
+                             std::shared_ptr<const TorrentFile> torrent) {
+  return store(key, std::move(torrent), false);
+}
+
+/**
+ * @brief Add a torrent or replace the one under its key
+ * @param key The torrent's info hash
+ * @param torrent The torrent
+ * @return true if added, false if an entry was replaced
+ */
+bool TorrentRegistry::assign(const InfoHash &key,
+                             std::shared_ptr<const TorrentFile> torrent) {
+  return store(key, std::move(torrent), true);
+}
+
+/**
+ * @brief Add a torrent, or replace or keep the one under its key
+ * @param key The torrent's info hash
+ * @param torrent The torrent
+ * @param replace Whether an existing entry is replaced or kept
+ * @return true if added, false if the key was present
+ *
+ * The slot's hash is stored before the entry is published with a release
+ * store, so a reader that sees the entry also sees the matching hash. A
+ * tombstone on the probe path is reused; readers skip tombstones whatever
+ * hash the slot holds. A replacement is published into the same slot in
+ * one store and the old entry retired through Epoch, so the key is never
+ * missing.
+ */
+bool TorrentRegistry::store(const InfoHash &key,
+                            std::shared_ptr<const TorrentFile> torrent,
+                            bool replace) {
+  uint64_t hash = key.hash();
+  Shard &shard = shards[hash >> (64 - kShardBits)];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  Table *table = shard.table.load(std::memory_order_relaxed);
+
+  Slot *free = nullptr;
+  for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+    Slot &slot = table->slots[i];
+    Entry *entry = slot.entry.load(std::memory_order_relaxed);
+    if (entry == nullptr) {
+      if (free == nullptr) {
+        free = &slot;
+      }
+      break;
+    }
+    if (entry == &tombstone) {
+      if (free == nullptr) {
+        free = &slot;
+      }
+    } else if (slot.hash.load(std::memory_order_relaxed) == hash &&
+               entry->key == key) {
+      if (replace) {
+        slot.entry.store(new Entry{key, std::move(torrent)},
+                         std::memory_order_release);
+        Epoch::retire(entry);
+      }
+      return false;
+    }
+  }
+
+  bool reuse = free->entry.load(std::memory_order_relaxed) == &tombstone;
+  if (!reuse &&
+      overloaded(shard.live + shard.removed + 1, table->mask + 1)) {
+    // Grow only if live entries fill half the table; otherwise the
+    // tombstones are what fills it and a rebuild at the same size drops them
+    size_t capacity = table->mask + 1;
+    if ((shard.live + 1) * 2 > capacity) {
+      capacity *= 2;
+    }
+    rebuild(shard, capacity);
+    table = shard.table.load(std::memory_order_relaxed);
+    size_t i = hash & table->mask;
+    while (table->slots[i].entry.load(std::memory_order_relaxed) != nullptr) {
+      i = (i + 1) & table->mask;
+    }
+    free = &table->slots[i];
+  }
+
+  Entry *entry = new Entry{key, std::move(torrent)};
+  free->hash.store(hash, std::memory_order_relaxed);
+  free->entry.store(entry, std::memory_order_release);
+  if (reuse) {
+    shard.removed--;
+  }
+  shard.live++;
+  count.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+/**
+ * @brief Remove a torrent
+ * @param key The torrent's info hash
+ * @return true if it was present
+ *
+ * The slot becomes a tombstone so that probes for keys further along the
+ * chain still pass it; the entry is retired through Epoch.
+ */
+bool TorrentRegistry::erase(const InfoHash &key) {
+  uint64_t hash = key.hash();
+  Shard &shard = shards[hash >> (64 - kShardBits)];
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  Table *table = shard.table.load(std::memory_order_relaxed);
+  for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+    Slot &slot = table->slots[i];
+    Entry *entry = slot.entry.load(std::memory_order_relaxed);
+    if (entry == nullptr) {
+      return false;
+    }
+    if (entry != &tombstone &&
+        slot.hash.load(std::memory_order_relaxed) == hash &&
+        entry->key == key) {
+      slot.entry.store(&tombstone, std::memory_order_release);
+      shard.live--;
+      shard.removed++;
+      count.fetch_sub(1, std::memory_order_relaxed);
+      Epoch::retire(entry);
+      return true;
+    }
+  }
+}
+
+/**
+ * @brief Look up a torrent without touching its reference count
+ * @param key Info hash to look up
+ * @return The torrent, or nullptr if absent
+ */
+const TorrentFile *TorrentRegistry::find(const Epoch::Guard & /*guard*/,
+                                         const InfoHash &key) const {
+  const Entry *entry = lookup(key);
+  return entry != nullptr ? entry->torrent.get() : nullptr;
+}
+
+/**
+ * @brief Look up a torrent and take a reference to it
+ * @param key Info hash to look up
+ * @return The torrent, or nullptr if absent
+ */
+std::shared_ptr<const TorrentFile>
+TorrentRegistry::get(const InfoHash &key) const {
+  Epoch::Guard guard;
+  const Entry *entry = lookup(key);
+  return entry != nullptr ? entry->torrent : nullptr;
+}
+
+/**
+ * @brief Probe the key's shard for its entry
+ * @param key Info hash to look up
+ * @return The entry, or nullptr if absent
+ *
+ * A lookup racing with a rebuild may probe the old table; it is retired
+ * through Epoch like removed entries, so it stays readable.
+ */
+const TorrentRegistry::Entry *
+TorrentRegistry::lookup(const InfoHash &key) const {
+  uint64_t hash = key.hash();
+  const Shard &shard = shards[hash >> (64 - kShardBits)];
+  const Table *table = shard.table.load(std::memory_order_acquire);
+  for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+    const Slot &slot = table->slots[i];
+    const Entry *entry = slot.entry.load(std::memory_order_acquire);
+    if (entry == nullptr) {
+      return nullptr;
+    }
+    if (entry != &tombstone &&
+        slot.hash.load(std::memory_order_relaxed) == hash &&
+        entry->key == key) {
+      return entry;
+    }
+  }
+}
+
+/**
+ * @brief Move a shard's entries into a fresh table, dropping tombstones
+ * @param shard The shard, whose mutex the caller holds
+ * @param capacity Slot count of the new table, a power of two
+ */
+void TorrentRegistry::rebuild(Shard &shard, size_t capacity) {
+  Table *old = shard.table.load(std::memory_order_relaxed);
+  auto table = std::make_unique<Table>(capacity);
+  for (size_t i = 0; i <= old->mask; ++i) {
+    Entry *entry = old->slots[i].entry.load(std::memory_order_relaxed);
+    if (entry == nullptr || entry == &tombstone) {
+      continue;
+    }
+    uint64_t hash = old->slots[i].hash.load(std::memory_order_relaxed);
+    size_t j = hash & table->mask;
+    while (table->slots[j].entry.load(std::memory_order_relaxed) != nullptr) {
+      j = (j + 1) & table->mask;
+    }
+    table->slots[j].hash.store(hash, std::memory_order_relaxed);
+    table->slots[j].entry.store(entry, std::memory_order_relaxed);
+  }
+  shard.table.store(table.release(), std::memory_order_release);
+  shard.removed = 0;
+  Epoch::retire(old);
+}
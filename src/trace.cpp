@@ -0,0 +1,272 @@
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <trace.hpp>
+#include <vector>
+
+namespace {
+
+/**
+ * @brief A recorded span
+ *
+ * The fields are relaxed atomics so that a dump can read a slot while its
+ * thread overwrites it; on x86 and ARM these are plain loads and stores.
+ */
+struct Event {
+  std::atomic<const char *> name{nullptr};
+  std::atomic<const char *> category{nullptr};
+  std::atomic<const char *> argName{nullptr};
+  std::atomic<int64_t> arg{0};
+  std::atomic<uint64_t> start{0};
+  std::atomic<uint64_t> end{0};
+};
+
+/**
+ * @brief Plain copy of an Event taken by a dump
+ */
+struct EventCopy {
+  const char *name;
+  const char *category;
+  const char *argName;
+  int64_t arg;
+  uint64_t start;
+  uint64_t end;
+};
+
+/**
+ * @brief Ring buffer of one thread's events
+ *
+ * Only the owning thread writes. head counts every event ever written, so
+ * slot head % capacity is the next to be overwritten. The capacity is a
+ * power of two.
+ */
+struct ThreadBuffer {
+  ThreadBuffer(size_t capacity, uint32_t threadId)
+      : events(capacity), threadId(threadId) {}
+
+  std::vector<Event> events;
+  std::atomic<uint64_t> head{0};
+  uint32_t threadId;
+  std::string threadName; // Guarded by the registry mutex
+};
+
+/**
+ * @brief All thread buffers, kept after their threads exit
+ */
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  size_t capacity = 16384; // Events per new buffer, a power of two
+  uint64_t epoch = 0; // Ticks at the first enable, time zero of the trace
+};
+
+/**
+ * @brief Get the registry, which is never destroyed so threads can record
+ * during static destruction
+ */
+Registry &registry() {
+  static Registry *instance = new Registry;
+  return *instance;
+}
+
+/**
+ * @brief Get the calling thread's buffer, creating it on first use
+ */
+ThreadBuffer &threadBuffer() {
+  thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    auto created = std::make_shared<ThreadBuffer>(
+        reg.capacity, static_cast<uint32_t>(reg.buffers.size() + 1));
+    reg.buffers.push_back(created);
+    return created;
+  }();
+  return *buffer;
+}
+
+/**
+ * @brief Write a string as a JSON string literal
+ */
+void writeJsonString(std::ostream &out, const char *text) {
+  out << '"';
+  for (; *text != '\0'; ++text) {
+    unsigned char c = static_cast<unsigned char>(*text);
+    if (c == '"' || c == '\\') {
+      out << '\\' << *text;
+    } else if (c < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out << escaped;
+    } else {
+      out << *text;
+    }
+  }
+  out << '"';
+}
+
+} // namespace
+
+/**
+ * @brief Start recording
+ * @param eventsPerThread Capacity of each thread's ring buffer; applies to
+ * threads that record their first span after this call
+ */
+void Trace::enable(size_t eventsPerThread) {
+  CycleClock::nanosPerTick();
+  Registry &reg = registry();
+  {
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    // A power of two, so slots are found with a mask
+    reg.capacity = 1;
+    while (reg.capacity < eventsPerThread) {
+      reg.capacity *= 2;
+    }
+    if (reg.epoch == 0) {
+      reg.epoch = CycleClock::now();
+    }
+  }
+  enabled.store(true, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Stop recording; recorded events are kept
+ */
+void Trace::disable() { enabled.store(false, std::memory_order_relaxed); }
+
+/**
+ * @brief Name the calling thread in the trace
+ * @param name Thread name shown by the viewer
+ */
+void Trace::setThreadName(const std::string &name) {
+  ThreadBuffer &buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock(registry().mutex);
+  buffer.threadName = name;
+}
+
+/**
+ * @brief Drop all recorded events
+ */
+void Trace::clear() {
+  Registry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  for (auto &buffer : reg.buffers) {
+    for (auto &event : buffer->events) {
+      event.end.store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+/**
+ * @brief Write all buffered events as Chrome trace JSON
+ * @param out Stream the JSON object is written to
+ *
+ * Each buffer is copied by reading head, the slots, then head again; slots
+ * the writer may have reached in between are dropped, as a seqlock would.
+ * Spans are complete ("X") events with times in microseconds.
+ */
+void Trace::writeChromeJson(std::ostream &out) {
+  Registry &reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  double microsPerTick = CycleClock::nanosPerTick() / 1000;
+  char number[32];
+  auto micros = [&](uint64_t ticks) {
+    std::snprintf(number, sizeof(number), "%.3f", ticks * microsPerTick);
+    return number;
+  };
+
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  for (const auto &buffer : reg.buffers) {
+    if (!buffer->threadName.empty()) {
+      out << (first ? "" : ",") << "\n{\"ph\":\"M\",\"pid\":1,\"tid\":"
+          << buffer->threadId
+          << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+      writeJsonString(out, buffer->threadName.c_str());
+      out << "}}";
+      first = false;
+    }
+
+    size_t capacity = buffer->events.size();
+    uint64_t head = buffer->head.load(std::memory_order_acquire);
+    uint64_t begin = head > capacity ? head - capacity : 0;
+    std::vector<EventCopy> events;
+    events.reserve(head - begin);
+    for (uint64_t i = begin; i < head; ++i) {
+      const Event &event = buffer->events[i & (capacity - 1)];
+      events.push_back({event.name.load(std::memory_order_relaxed),
+                        event.category.load(std::memory_order_relaxed),
+                        event.argName.load(std::memory_order_relaxed),
+                        event.arg.load(std::memory_order_relaxed),
+                        event.start.load(std::memory_order_relaxed),
+                        event.end.load(std::memory_order_relaxed)});
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // The writer may have published up to headAfter and be filling the slot
+    // of event headAfter, so events up to headAfter - capacity are suspect
+    uint64_t headAfter = buffer->head.load(std::memory_order_relaxed) + 1;
+    uint64_t valid = headAfter > capacity ? headAfter - capacity : 0;
+
+    for (uint64_t i = begin; i < head; ++i) {
+      const EventCopy &event = events[i - begin];
+      if (i < valid || event.end == 0 || event.start < reg.epoch) {
+        continue;
+      }
+      out << (first ? "" : ",") << "\n{\"ph\":\"X\",\"pid\":1,\"tid\":"
+          << buffer->threadId << ",\"name\":";
+      writeJsonString(out, event.name);
+      out << ",\"cat\":";
+      writeJsonString(out, event.category);
+      out << ",\"ts\":" << micros(event.start - reg.epoch);
+      out << ",\"dur\":" << micros(event.end - event.start);
+      if (event.argName != nullptr) {
+        out << ",\"args\":{";
+        writeJsonString(out, event.argName);
+        out << ':' << event.arg << '}';
+      }
+      out << '}';
+      first = false;
+    }
+  }
+  out << "\n]}\n";
+}
+
+/**
+ * @brief Write all buffered events as Chrome trace JSON to a file
+ * @param path Output file
+ * @throws std::runtime_error if the file cannot be written
+ */
+void Trace::writeChromeJson(const std::string &path) {
+  std::ofstream file(path);
+  if (!file) {
+    throw std::runtime_error("Could not open trace file: " + path);
+  }
+  writeChromeJson(file);
+  if (!file.flush()) {
+    throw std::runtime_error("Could not write trace file: " + path);
+  }
+}
+
+/**
+ * @brief Append a finished span to the calling thread's buffer
+ *
+ * The slot is filled before head is published with a release store, so a
+ * dump that sees the new head also sees the event. The fence keeps the
+ * stores into the slot from overtaking the previous event's head store.
+ */
+void Trace::record(const char *name, const char *category,
+                   const char *argName, int64_t arg, uint64_t start,
+                   uint64_t end) {
+  ThreadBuffer &buffer = threadBuffer();
+  uint64_t head = buffer.head.load(std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  Event &event = buffer.events[head & (buffer.events.size() - 1)];
+  event.name.store(name, std::memory_order_relaxed);
+  event.category.store(category, std::memory_order_relaxed);
+  event.argName.store(argName, std::memory_order_relaxed);
+  event.arg.store(arg, std::memory_order_relaxed);
+  event.start.store(start, std::memory_order_relaxed);
+  event.end.store(end, std::memory_order_relaxed);
+  buffer.head.store(head + 1, std::memory_order_release);
+}
@@ -0,0 +1,196 @@
+#include <bencode.hpp>
+#include <sha1.hpp>
+#include <stdexcept>
+#include <trackerrewriter.hpp>
+
+namespace {
+
+using Tiers = std::vector<std::vector<std::string>>;
+
+/**
+ * @brief Find an entry of a dictionary by key
+ * @return The entry, or nullptr if absent
+ */
+const BencodeParser::RawEntry *
+findEntry(const std::vector<BencodeParser::RawEntry> &entries,
+          std::string_view key) {
+  for (const auto &entry : entries) {
+    if (entry.key == key) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief Decode an announce-list value
+ * @throws std::runtime_error if it is not a list of lists of strings
+ */
+Tiers decodeTiers(std::string_view encoded) {
+  BencodeValue value = BencodeParser::parse(encoded);
+  if (!value.isList()) {
+    throw std::runtime_error("Invalid announce-list: must be a list");
+  }
+  Tiers tiers;
+  for (const auto &tier : value.getList()) {
+    if (!tier->isList()) {
+      throw std::runtime_error("Invalid announce-list: tier must be a list");
+    }
+    tiers.emplace_back();
+    for (const auto &url : tier->getList()) {
+      if (!url->isString()) {
+        throw std::runtime_error(
+            "Invalid announce-list: URL must be a string");
+      }
+      tiers.back().push_back(url->getString());
+    }
+  }
+  return tiers;
+}
+
+/**
+ * @brief Encode an announce-list value
+ */
+std::string encodeTiers(const Tiers &tiers) {
+  std::string out = "l";
+  for (const auto &tier : tiers) {
+    out += 'l';
+    for (const auto &url : tier) {
+      BencodeEncoder::encodeString(url, out);
+    }
+    out += 'e';
+  }
+  out += 'e';
+  return out;
+}
+
+} // namespace
+
+/**
+ * @brief Build a rewriter
+ * @param options Changes to apply
+ */
+TrackerRewriter::TrackerRewriter(Options options)
+    : options(std::move(options)) {}
+
+/**
+ * @brief Rewrite the trackers of one torrent
+ * @param input Content of a .torrent file
+ * @param out Receives the rewritten torrent
+ * @return What was done
+ * @throws std::runtime_error if the input is not a torrent, its tracker
+ * entries are malformed, or its info dictionary would change
+ *
+ * The output is split into entries again and its info dictionary compared
+ * with the input's byte for byte: equal bytes have equal hashes, and the
+ * comparison costs far less than hashing.
+ */
+TrackerRewriter::Result TrackerRewriter::rewrite(std::string_view input,
+                                                 std::string &out) const {
+  std::vector<BencodeParser::RawEntry> entries =
+      BencodeParser::dictEntries(input);
+  const BencodeParser::RawEntry *info = findEntry(entries, "info");
+  if (info == nullptr || info->value.empty() || info->value[0] != 'd') {
+    throw std::runtime_error(
+        "Invalid torrent file: missing or invalid info dictionary");
+  }
+
+  BencodeEncoder::Edits edits;
+  const BencodeParser::RawEntry *announce = findEntry(entries, "announce");
+  std::optional<std::string> oldAnnounce;
+  if (announce != nullptr) {
+    BencodeValue value = BencodeParser::parse(announce->value);
+    if (!value.isString()) {
+      throw std::runtime_error("Invalid announce: must be a string");
+    }
+    oldAnnounce = value.getString();
+  }
+  std::optional<std::string> newAnnounce =
+      oldAnnounce ? mapUrl(*oldAnnounce) : std::nullopt;
+  if (options.announce) {
+    newAnnounce = options.announce->empty()
+                      ? std::nullopt
+                      : std::optional<std::string>(*options.announce);
+  }
+  if (newAnnounce != oldAnnounce) {
+    std::optional<std::string> encoded;
+    if (newAnnounce) {
+      encoded.emplace();
+      BencodeEncoder::encodeString(*newAnnounce, *encoded);
+    }
+    edits.emplace("announce", std::move(encoded));
+  }
+
+  const BencodeParser::RawEntry *list = findEntry(entries, "announce-list");
+  std::optional<Tiers> oldTiers;
+  if (list != nullptr) {
+    oldTiers = decodeTiers(list->value);
+  }
+  std::optional<Tiers> newTiers;
+  if (oldTiers) {
+    newTiers.emplace();
+    for (const auto &tier : *oldTiers) {
+      std::vector<std::string> mapped;
+      for (const auto &url : tier) {
+        if (auto replacement = mapUrl(url)) {
+          mapped.push_back(std::move(*replacement));
+        }
+      }
+      // Only a tier the rewrite emptied goes away, so that a torrent
+      // no URL matched compares equal and is left alone
+      if (!mapped.empty() || tier.empty()) {
+        newTiers->push_back(std::move(mapped));
+      }
+    }
+    if (newTiers->empty() && !oldTiers->empty()) {
+      newTiers.reset();
+    }
+  }
+  if (options.announceList) {
+    newTiers = options.announceList->empty()
+                   ? std::nullopt
+                   : std::optional<Tiers>(*options.announceList);
+  }
+  if (newTiers != oldTiers) {
+    edits.emplace("announce-list", newTiers ? std::optional<std::string>(
+                                                  encodeTiers(*newTiers))
+                                            : std::nullopt);
+  }
+
+  Result result;
+  if (options.computeInfoHash) {
+    result.infoHash = Sha1::hash(info->value);
+  }
+  out.clear();
+  if (edits.empty()) {
+    out.assign(input);
+    return result;
+  }
+  out.reserve(input.size() + 256);
+  BencodeEncoder::spliceDict(input, entries, edits, out);
+
+  std::vector<BencodeParser::RawEntry> written =
+      BencodeParser::dictEntries(out);
+  const BencodeParser::RawEntry *newInfo = findEntry(written, "info");
+  if (newInfo == nullptr || newInfo->value != info->value) {
+    throw std::runtime_error("Rewrite would change the info dictionary");
+  }
+  result.changed = true;
+  return result;
+}
+
+/**
+ * @brief Apply the replacement table to one URL
+ * @return The URL to keep, or nullopt if it is removed
+ */
+std::optional<std::string>
+TrackerRewriter::mapUrl(const std::string &url) const {
+  auto it = options.replace.find(url);
+  if (it == options.replace.end()) {
+    return url;
+  }
+  if (it->second.empty()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
@@ -0,0 +1,408 @@
+#include <algorithm>
+#include <stdexcept>
+#include <trigramindex.hpp>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr uint32_t kMaxDocuments = uint32_t(1) << 31;
+
+// Below this many candidates, verifying them is cheaper than decoding
+// blocks of further posting lists
+constexpr size_t kVerifyDirectly = 64;
+
+/**
+ * @brief Fold ASCII upper case to lower case
+ */
+char fold(char c) { return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c; }
+
+/**
+ * @brief Pack three folded bytes into a trigram key
+ */
+uint32_t trigramAt(std::string_view folded, size_t i) {
+  return uint32_t(uint8_t(folded[i])) << 16 |
+         uint32_t(uint8_t(folded[i + 1])) << 8 | uint8_t(folded[i + 2]);
+}
+
+/**
+ * @brief Append an unsigned integer as a LEB128 varint
+ */
+void appendVarint(std::vector<uint8_t> &out, uint32_t value) {
+  while (value >= 0x80) {
+    out.push_back(uint8_t(value) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(uint8_t(value));
+}
+
+/**
+ * @brief Intersect two strictly increasing arrays
+ * @param a First array; out may alias it
+ * @param b Second array
+ * @param out Receives the common values, at most na of them
+ * @return Number of common values
+ *
+ * For each value of a, the SSE2 path compares four values of b at once: the
+ * mask of those below the value tells how far to advance in b, and an
+ * equality mask whether it was found. Values must be below 2^31, since
+ * SSE2 compares are signed.
+ */
+size_t intersectSorted(const uint32_t *a, size_t na, const uint32_t *b,
+                       size_t nb, uint32_t *out) {
+  size_t count = 0;
+  size_t j = 0;
+  for (size_t i = 0; i < na && j < nb; ++i) {
+    uint32_t value = a[i];
+    bool decided = false;
+#if defined(__SSE2__)
+    __m128i key = _mm_set1_epi32(static_cast<int>(value));
+    while (j + 4 <= nb) {
+      __m128i block =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + j));
+      int less =
+          _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(block, key)));
+      if (less == 0xf) {
+        j += 4;
+        continue;
+      }
+      int equal =
+          _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(block, key)));
+      j += __builtin_popcount(less);
+      if (equal != 0) {
+        out[count++] = value;
+        j++;
+      }
+      decided = true;
+      break;
+    }
+#endif
+    if (!decided) {
+      while (j < nb && b[j] < value) {
+        j++;
+      }
+      if (j < nb && b[j] == value) {
+        out[count++] = value;
+        j++;
+      }
+    }
+  }
+  return count;
+}
+
+} // namespace
+
+/**
+ * @brief Add a torrent's name and file paths
+ * @param torrent The torrent
+ * @return The torrent's document number
+ * @throws std::length_error past 2^31 documents
+ *
+ * The name is indexed once for single-file torrents, whose only path is
+ * the name itself. Padding file paths are not content and are skipped.
+ */
+uint32_t TrigramIndex::add(const TorrentFile &torrent) {
+  std::vector<std::string_view> strings{torrent.getName()};
+  for (const auto &file : torrent.getFiles()) {
+    if (!file.padding && file.path != torrent.getName()) {
+      strings.push_back(file.path);
+    }
+  }
+  return add(strings);
+}
+
+/**
+ * @brief Add a document made of arbitrary strings
+ * @param strings Strings searched independently of each other
+ * @return The document number
+ * @throws std::length_error past 2^31 documents
+ *
+ * The strings are stored folded and the document's distinct trigrams are
+ * buffered for the next commit.
+ */
+uint32_t TrigramIndex::add(const std::vector<std::string_view> &strings) {
+  if (textOffsets.size() >= kMaxDocuments) {
+    throw std::length_error("Trigram index is full");
+  }
+  uint32_t doc = static_cast<uint32_t>(textOffsets.size());
+  textOffsets.push_back(text.size());
+
+  std::vector<uint32_t> trigrams;
+  for (std::string_view string : strings) {
+    size_t start = text.size();
+    for (char c : string) {
+      text.push_back(fold(c));
+    }
+    std::string_view folded(text.data() + start, string.size());
+    for (size_t i = 0; i + 3 <= folded.size(); ++i) {
+      trigrams.push_back(trigramAt(folded, i));
+    }
+    text.push_back('\0');
+  }
+  std::sort(trigrams.begin(), trigrams.end());
+  trigrams.erase(std::unique(trigrams.begin(), trigrams.end()),
+                 trigrams.end());
+  for (uint32_t trigram : trigrams) {
+    pending.push_back(uint64_t(trigram) << 32 | doc);
+  }
+  if (pending.size() >= kCommitPairs) {
+    commit();
+  }
+  return doc;
+}
+
+/**
+ * @brief Make all added documents searchable
+ *
+ * A stable radix sort on the 24 trigram bits (two passes of 12) groups the
+ * buffered pairs by trigram while keeping each group in document order.
+ * Then every group is appended to its list: a new block starts with a skip
+ * entry, otherwise the gap to the previous document is appended.
+ */
+void TrigramIndex::commit() {
+  constexpr unsigned kRadixBits = 12;
+  constexpr size_t kBuckets = size_t(1) << kRadixBits;
+  std::vector<uint64_t> sorted(pending.size());
+  for (unsigned shift = 32; shift < 56; shift += kRadixBits) {
+    std::vector<size_t> starts(kBuckets + 1, 0);
+    for (uint64_t pair : pending) {
+      starts[((pair >> shift) & (kBuckets - 1)) + 1]++;
+    }
+    for (size_t i = 1; i <= kBuckets; ++i) {
+      starts[i] += starts[i - 1];
+    }
+    for (uint64_t pair : pending) {
+      sorted[starts[(pair >> shift) & (kBuckets - 1)]++] = pair;
+    }
+    pending.swap(sorted);
+  }
+
+  for (size_t i = 0; i < pending.size();) {
+    uint32_t trigram = static_cast<uint32_t>(pending[i] >> 32);
+    auto [it, added] = trigramLists.try_emplace(
+        trigram, static_cast<uint32_t>(lists.size()));
+    if (added) {
+      lists.emplace_back();
+    }
+    PostingList &list = lists[it->second];
+    for (; i < pending.size() && (pending[i] >> 32) == trigram; ++i) {
+      uint32_t doc = static_cast<uint32_t>(pending[i]);
+      if (list.count % kBlockSize == 0) {
+        if (list.bytes.size() > std::numeric_limits<uint32_t>::max()) {
+          throw std::length_error("Trigram posting list is full");
+        }
+        list.skips.push_back(
+            {doc, static_cast<uint32_t>(list.bytes.size())});
+      } else {
+        appendVarint(list.bytes, doc - list.lastDoc);
+      }
+      list.lastDoc = doc;
+      list.count++;
+    }
+  }
+  pending.clear();
+  committed = static_cast<uint32_t>(textOffsets.size());
+}
+
+/**
+ * @brief Find the documents containing a substring
+ * @param query Substring to look for; ASCII case is ignored
+ * @param limit Most documents to return
+ * @param stats If not nullptr, receives counters describing the search
+ * @return Matching document numbers in increasing order
+ *
+ * The posting lists are intersected shortest first, and intersection stops
+ * early once few candidates are left, since verification weeds out the
+ * rest anyway.
+ */
+std::vector<uint32_t> TrigramIndex::search(std::string_view query,
+                                           size_t limit,
+                                           SearchStats *stats) const {
+  SearchStats local;
+  SearchStats &counters = stats != nullptr ? *stats : local;
+  counters = SearchStats();
+  std::string folded(query.size(), '\0');
+  std::transform(query.begin(), query.end(), folded.begin(), fold);
+
+  std::vector<uint32_t> candidates;
+  if (folded.size() < 3) {
+    // No trigram to narrow the search: every document is a candidate
+    candidates.resize(committed);
+    for (uint32_t doc = 0; doc < candidates.size(); ++doc) {
+      candidates[doc] = doc;
+    }
+  } else {
+    std::vector<uint32_t> trigrams;
+    for (size_t i = 0; i + 3 <= folded.size(); ++i) {
+      trigrams.push_back(trigramAt(folded, i));
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()),
+                   trigrams.end());
+    std::vector<const PostingList *> found;
+    for (uint32_t trigram : trigrams) {
+      auto it = trigramLists.find(trigram);
+      if (it == trigramLists.end()) {
+        return {};
+      }
+      found.push_back(&lists[it->second]);
+    }
+    std::sort(found.begin(), found.end(),
+              [](const PostingList *a, const PostingList *b) {
+                return a->count < b->count;
+              });
+
+    const PostingList &shortest = *found.front();
+    candidates.resize(shortest.count);
+    size_t decoded = 0;
+    for (size_t block = 0; block < shortest.skips.size(); ++block) {
+      decoded += decodeBlock(shortest, block, candidates.data() + decoded);
+    }
+    counters.lists = 1;
+    counters.blocks = shortest.skips.size();
+    for (size_t i = 1; i < found.size(); ++i) {
+      if (candidates.size() <= kVerifyDirectly) {
+        break;
+      }
+      intersect(*found[i], candidates, counters);
+      counters.lists++;
+    }
+  }
+
+  std::vector<uint32_t> result;
+  for (uint32_t doc : candidates) {
+    if (result.size() >= limit) {
+      break;
+    }
+    counters.candidates++;
+    if (documentText(doc).find(folded) != std::string_view::npos) {
+      result.push_back(doc);
+    }
+  }
+  counters.matches = result.size();
+  return result;
+}
+
+/**
+ * @brief Get the memory held by strings and postings
+ * @return Byte counts of stored strings and of posting lists
+ *
+ * The posting figure includes an estimate of the trigram hash table.
+ */
+std::pair<size_t, size_t> TrigramIndex::memoryUsage() const {
+  size_t strings =
+      text.capacity() + textOffsets.capacity() * sizeof(textOffsets[0]);
+  size_t postings = lists.capacity() * sizeof(PostingList) +
+                    trigramLists.size() * 32 +
+                    trigramLists.bucket_count() * sizeof(void *);
+  for (const PostingList &list : lists) {
+    postings += list.bytes.capacity() + list.skips.capacity() * sizeof(Skip);
+  }
+  return {strings, postings};
+}
+
+/**
+ * @brief Release spare capacity left by adding documents
+ */
+void TrigramIndex::shrinkToFit() {
+  pending.shrink_to_fit();
+  text.shrink_to_fit();
+  textOffsets.shrink_to_fit();
+  lists.shrink_to_fit();
+  for (PostingList &list : lists) {
+    list.bytes.shrink_to_fit();
+    list.skips.shrink_to_fit();
+  }
+}
+
+/**
+ * @brief Get a document's folded strings
+ * @param doc Document number
+ * @return The strings, each followed by a zero byte
+ */
+std::string_view TrigramIndex::documentText(uint32_t doc) const {
+  size_t start = textOffsets[doc];
+  size_t end = doc + 1 < textOffsets.size() ? textOffsets[doc + 1]
+                                            : text.size();
+  return std::string_view(text).substr(start, end - start);
+}
+
+/**
+ * @brief Decode one block of a posting list
+ * @param list The posting list
+ * @param block Block number
+ * @param out Receives the block's documents, up to kBlockSize
+ * @return Number of documents in the block
+ */
+size_t TrigramIndex::decodeBlock(const PostingList &list, size_t block,
+                                 uint32_t *out) const {
+  size_t count = block + 1 < list.skips.size()
+                     ? kBlockSize
+                     : list.count - block * kBlockSize;
+  const uint8_t *p = list.bytes.data() + list.skips[block].offset;
+  uint32_t doc = list.skips[block].firstDoc;
+  out[0] = doc;
+  for (size_t i = 1; i < count; ++i) {
+    uint32_t gap = 0;
+    for (unsigned shift = 0;; shift += 7) {
+      uint8_t byte = *p++;
+      gap |= uint32_t(byte & 0x7f) << shift;
+      if (byte < 0x80) {
+        break;
+      }
+    }
+    doc += gap;
+    out[i] = doc;
+  }
+  return count;
+}
+
+/**
+ * @brief Keep only the candidates that appear in a posting list
+ * @param list The posting list
+ * @param candidates Increasing document numbers, filtered in place
+ * @param stats Counts the decoded blocks
+ *
+ * Walks the candidates and jumps to the block that could hold each one
+ * with a binary search over the skip entries, so blocks without
+ * candidates are never decoded.
+ */
+void TrigramIndex::intersect(const PostingList &list,
+                             std::vector<uint32_t> &candidates,
+                             SearchStats &stats) const {
+  uint32_t decoded[kBlockSize];
+  size_t kept = 0;
+  size_t next = 0;
+  auto skipBegin = list.skips.begin();
+  while (next < candidates.size()) {
+    uint32_t doc = candidates[next];
+    // Last block starting at or before doc
+    auto skip = std::upper_bound(
+        skipBegin, list.skips.end(), doc,
+        [](uint32_t value, const Skip &s) { return value < s.firstDoc; });
+    if (skip == list.skips.begin()) {
+      // Before the first block: skip candidates up to it
+      next = std::lower_bound(candidates.begin() + next, candidates.end(),
+                              list.skips.front().firstDoc) -
+             candidates.begin();
+      continue;
+    }
+    --skip;
+    skipBegin = skip;
+    size_t block = skip - list.skips.begin();
+    size_t end = candidates.size();
+    if (block + 1 < list.skips.size()) {
+      end = std::lower_bound(candidates.begin() + next, candidates.end(),
+                             list.skips[block + 1].firstDoc) -
+            candidates.begin();
+    }
+    size_t count = decodeBlock(list, block, decoded);
+    stats.blocks++;
+    kept += intersectSorted(candidates.data() + next, end - next, decoded,
+                            count, candidates.data() + kept);
+    next = end;
+  }
+  candidates.resize(kept);
+}
@@ -0,0 +1,336 @@
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <stdexcept>
+#include <udpsocket.hpp>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t kMaxSegments = 64;       // Per GSO message
+constexpr size_t kMaxGsoBytes = 65000;    // Payload of one GSO message
+
+/**
+ * @brief Build an exception for a failed system call
+ * @param what Description of the operation
+ * @return Exception carrying the errno description
+ */
+std::runtime_error systemError(const std::string &what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+bool sameAddress(const sockaddr_in &a, const sockaddr_in &b) {
+  return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+} // namespace
+
+/**
+ * @brief Open and bind the socket
+ * @param options Settings
+ * @throws std::runtime_error if the socket cannot be bound
+ * @throws std::invalid_argument if batchSize or slotSize is 0, or the
+ * address is not IPv4
+ *
+ * UDP_SEGMENT is used only if the kernel accepts it on this socket.
+ */
+UdpSocket::UdpSocket(const Options &options) : options(options) {
+  if (options.batchSize == 0 || options.slotSize == 0) {
+    throw std::invalid_argument("UDP batch and slot sizes must be positive");
+  }
+  sockaddr_in address = endpoint(options.address, options.port);
+  socketFd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (socketFd < 0) {
+    throw systemError("Cannot create UDP socket");
+  }
+  setsockopt(socketFd, SOL_SOCKET, SO_RCVBUF, &options.bufferBytes,
+             sizeof(options.bufferBytes));
+  setsockopt(socketFd, SOL_SOCKET, SO_SNDBUF, &options.bufferBytes,
+             sizeof(options.bufferBytes));
+  socklen_t length = sizeof(address);
+  if (bind(socketFd, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) < 0 ||
+      getsockname(socketFd, reinterpret_cast<sockaddr *>(&address),
+                  &length) < 0) {
+    std::runtime_error error = systemError("Cannot bind " + options.address);
+    close(socketFd);
+    throw error;
+  }
+  boundPort = ntohs(address.sin_port);
+  int noSegment = 0;
+  gso = options.segmentation &&
+        setsockopt(socketFd, SOL_UDP, UDP_SEGMENT, &noSegment,
+                   sizeof(noSegment)) == 0;
+
+  const size_t batch = options.batchSize;
+  receiveSlab.resize(batch * options.slotSize);
+  receiveMessages.resize(batch);
+  receiveVectors.resize(batch);
+  senders.resize(batch);
+  for (size_t i = 0; i < batch; ++i) {
+    receiveVectors[i] = {&receiveSlab[i * options.slotSize],
+                         options.slotSize};
+    receiveMessages[i].msg_hdr.msg_iov = &receiveVectors[i];
+    receiveMessages[i].msg_hdr.msg_iovlen = 1;
+    receiveMessages[i].msg_hdr.msg_name = &senders[i];
+  }
+  sendSlab.resize(batch * options.slotSize);
+  destinations.resize(batch);
+  lengths.resize(batch);
+  sendMessages.resize(batch);
+  sendVectors.resize(batch);
+  messageDatagrams.resize(batch);
+  control.resize(batch * CMSG_SPACE(sizeof(uint16_t)));
+}
+
+UdpSocket::~UdpSocket() { close(socketFd); }
+
+/**
+ * @brief Add a route for received datagrams, after the existing ones
+ * @param match Accepts the route's datagrams
+ * @param handler Receives them
+ * @return Identifier of the route, for unroute()
+ */
+size_t UdpSocket::route(Match match, Handler handler) {
+  routes.push_back({std::move(match), std::move(handler)});
+  return routes.size() - 1;
+}
+
+/**
+ * @brief Stop dispatching to a route, as its handler goes away
+ * @param id Identifier route() returned
+ *
+ * The route keeps its place, empty, so other identifiers stay valid.
+ */
+void UdpSocket::unroute(size_t id) {
+  if (id < routes.size()) {
+    routes[id] = Route();
+  }
+}
+
+/**
+ * @brief Receive waiting datagrams and dispatch them
+ * @param maxBatches recvmmsg() calls at most
+ * @return Datagrams received
+ *
+ * Stops at the first batch that is not full: the socket is then drained
+ * and one more call would only return EAGAIN.
+ */
+size_t UdpSocket::receive(size_t maxBatches) {
+  const size_t batch = options.batchSize;
+  size_t total = 0;
+  for (size_t round = 0; round < maxBatches; ++round) {
+    for (mmsghdr &message : receiveMessages) {
+      message.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+      message.msg_hdr.msg_flags = 0;
+    }
+    ++counters.receiveCalls;
+    int count = recvmmsg(socketFd, receiveMessages.data(), batch,
+                         MSG_DONTWAIT, nullptr);
+    if (count <= 0) {
+      break; // EAGAIN, or an error left for the next call
+    }
+    counters.datagramsReceived += count;
+    total += count;
+    for (int i = 0; i < count; ++i) {
+      const mmsghdr &message = receiveMessages[i];
+      if (message.msg_hdr.msg_flags & MSG_TRUNC) {
+        ++counters.truncated;
+        continue;
+      }
+      const char *data = &receiveSlab[i * options.slotSize];
+      auto route = routes.begin();
+      while (route != routes.end() &&
+             !(route->match && route->match(data, message.msg_len))) {
+        ++route;
+      }
+      if (route == routes.end()) {
+        ++counters.unrouted;
+      } else {
+        route->handler(data, message.msg_len, senders[i]);
+      }
+    }
+    if (static_cast<size_t>(count) < batch) {
+      break;
+    }
+  }
+  return total;
+}
+
+/**
+ * @brief Queue a datagram, sending the batch once it is full
+ * @param to Destination
+ * @param data The datagram
+ * @param length Its size, at most slotSize
+ * @throws std::invalid_argument if the datagram is larger than a slot
+ */
+void UdpSocket::send(const sockaddr_in &to, const char *data,
+                     size_t length) {
+  if (length > options.slotSize) {
+    throw std::invalid_argument("Datagram larger than the UDP slot size");
+  }
+  std::memcpy(&sendSlab[queued * options.slotSize], data, length);
+  destinations[queued] = to;
+  lengths[queued] = length;
+  if (++queued == options.batchSize) {
+    flush();
+  }
+}
+
+/**
+ * @brief Send the queued datagrams
+ *
+ * Datagrams the kernel refuses are dropped and counted. A kernel or
+ * device that rejects GSO messages turns segmentation off, and the
+ * datagrams are sent again one per message.
+ */
+void UdpSocket::flush() {
+  size_t done = 0;
+  while (done < queued) {
+    size_t count = buildMessages(done);
+    ++counters.sendCalls;
+    int sent = sendmmsg(socketFd, sendMessages.data(), count, 0);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (gso && messageDatagrams[0] > 1 &&
+          (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP)) {
+        gso = false;
+        continue;
+      }
+      counters.dropped += messageDatagrams[0];
+      done += messageDatagrams[0];
+      continue;
+    }
+    for (int i = 0; i < sent; ++i) {
+      counters.datagramsSent += messageDatagrams[i];
+      if (messageDatagrams[i] > 1) {
+        counters.segmented += messageDatagrams[i];
+      }
+      done += messageDatagrams[i];
+    }
+  }
+  queued = 0;
+}
+
+/**
+ * @brief Block until a datagram arrives
+ * @param timeoutMicros Longest wait, negative to wait indefinitely
+ * @return true if a datagram is waiting
+ */
+bool UdpSocket::wait(int64_t timeoutMicros) {
+  pollfd entry{socketFd, POLLIN, 0};
+  timespec timeout{static_cast<time_t>(timeoutMicros / 1000000),
+                   static_cast<long>(timeoutMicros % 1000000 * 1000)};
+  return ppoll(&entry, 1, timeoutMicros < 0 ? nullptr : &timeout,
+               nullptr) > 0;
+}
+
+int UdpSocket::fd() const { return socketFd; }
+
+uint16_t UdpSocket::port() const { return boundPort; }
+
+bool UdpSocket::segmenting() const { return gso; }
+
+size_t UdpSocket::slotSize() const { return options.slotSize; }
+
+size_t UdpSocket::pending() const { return queued; }
+
+const UdpSocket::Stats &UdpSocket::stats() const { return counters; }
+
+/**
+ * @brief Build an IPv4 socket address
+ * @param address Dotted IPv4 address
+ * @param port Port
+ * @return The address
+ * @throws std::invalid_argument if the address is not IPv4
+ */
+sockaddr_in UdpSocket::endpoint(const std::string &address, uint16_t port) {
+  sockaddr_in out{};
+  out.sin_family = AF_INET;
+  out.sin_port = htons(port);
+  if (inet_pton(AF_INET, address.c_str(), &out.sin_addr) != 1) {
+    throw std::invalid_argument("Not an IPv4 address: " + address);
+  }
+  return out;
+}
+
+/**
+ * @brief Check for a uTP (BEP 29) version 1 packet
+ * @param data The datagram
+ * @param length Its size
+ * @return true if it holds a uTP header of a known type and version 1
+ *
+ * A DHT message starts with 'd' and a tracker response with a zero byte,
+ * neither of which has version 1 in its low nibble.
+ */
+bool UdpSocket::isUtp(const char *data, size_t length) {
+  return length >= 20 && (static_cast<uint8_t>(data[0]) & 15) == 1 &&
+         static_cast<uint8_t>(data[0]) >> 4 <= 4;
+}
+
+/**
+ * @brief Check for a bencoded dictionary, as DHT (BEP 5) messages are
+ * @param data The datagram
+ * @param length Its size
+ * @return true if it starts with 'd' and ends with 'e'
+ */
+bool UdpSocket::isBencode(const char *data, size_t length) {
+  return length >= 2 && data[0] == 'd' && data[length - 1] == 'e';
+}
+
+/**
+ * @brief Fill the message headers for queued datagrams
+ * @param first Index of the first datagram to send
+ * @return Number of messages built
+ *
+ * With GSO, a run of datagrams to one destination that share a size,
+ * except for a shorter last one, becomes one message whose iovecs the
+ * kernel cuts into datagrams of that size.
+ */
+size_t UdpSocket::buildMessages(size_t first) {
+  const size_t cmsgSpace = CMSG_SPACE(sizeof(uint16_t));
+  size_t count = 0;
+  size_t vector = 0;
+  for (size_t i = first; i < queued; ++count) {
+    const size_t segment = lengths[i];
+    size_t end = i + 1;
+    size_t bytes = segment;
+    if (gso) {
+      while (end < queued && end - i < kMaxSegments &&
+             bytes + lengths[end] <= kMaxGsoBytes &&
+             lengths[end] <= segment &&
+             sameAddress(destinations[end], destinations[i])) {
+        bytes += lengths[end];
+        if (lengths[end++] < segment) {
+          break; // Only the last segment may be shorter
+        }
+      }
+    }
+    mmsghdr &message = sendMessages[count];
+    message = {};
+    message.msg_hdr.msg_name = &destinations[i];
+    message.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    message.msg_hdr.msg_iov = &sendVectors[vector];
+    message.msg_hdr.msg_iovlen = end - i;
+    for (size_t j = i; j < end; ++j) {
+      sendVectors[vector++] = {&sendSlab[j * options.slotSize], lengths[j]};
+    }
+    if (end - i > 1) {
+      message.msg_hdr.msg_control = &control[count * cmsgSpace];
+      message.msg_hdr.msg_controllen = cmsgSpace;
+      cmsghdr *header = CMSG_FIRSTHDR(&message.msg_hdr);
+      header->cmsg_level = SOL_UDP;
+      header->cmsg_type = UDP_SEGMENT;
+      header->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      const auto size = static_cast<uint16_t>(segment);
+      std::memcpy(CMSG_DATA(header), &size, sizeof(size));
+    }
+    messageDatagrams[count] = end - i;
+    i = end;
+  }
+  return count;
+}
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <peerwire.hpp>
+#include <stdexcept>
+#include <string>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <trace.hpp>
+#include <unistd.h>
+#include <uploader.hpp>
+
+namespace {
+
+constexpr int kPipeSize = 1024 * 1024; // Requested splice pipe capacity
+
+/**
+ * @brief Build an exception for a failed system call
+ * @param what Description of the operation
+ * @return Exception carrying the errno description
+ */
+std::runtime_error systemError(const std::string &what) {
+  return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+/**
+ * @brief Send a gather list completely, resuming after partial writes
+ * @param socketFd Connected blocking socket
+ * @param iov The buffers to send; modified while sending
+ * @param count Number of buffers
+ * @param flags Flags passed to sendmsg()
+ * @throws std::runtime_error if the send fails
+ */
+void sendAll(int socketFd, iovec *iov, size_t count, int flags) {
+  while (count > 0) {
+    msghdr message{};
+    message.msg_iov = iov;
+    message.msg_iovlen = count;
+    ssize_t n = ::sendmsg(socketFd, &message, flags | MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      throw systemError("Could not send piece message");
+    }
+    // Skip the buffers that went out and advance into the partial one
+    while (count > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + n;
+      iov->iov_len -= n;
+    }
+  }
+}
+
+/**
+ * @brief Send the zeros of a padding slice from a static buffer
+ * @param socketFd Connected blocking socket
+ * @param length Number of zero bytes
+ * @param last Whether the slice ends the message
+ */
+void sendZeros(int socketFd, int64_t length, bool last) {
+  static const char zeros[16 * 1024] = {};
+  while (length > 0) {
+    size_t chunk = std::min<int64_t>(length, sizeof(zeros));
+    iovec iov{const_cast<char *>(zeros), chunk};
+    length -= chunk;
+    sendAll(socketFd, &iov, 1, length > 0 || !last ? MSG_MORE : 0);
+  }
+}
+
+} // namespace
+
+/**
+ * @brief Construct an uploader reading from the given storage
+ * @param storage Storage holding the torrent content
+ * @param method How the block data is sent
+ * @throws std::runtime_error if the splice pipe cannot be created
+ */
+Uploader::Uploader(Storage &storage, Method method)
+    : storage(storage), method(method) {
+  if (method == Method::Splice) {
+    resetPipe();
+  }
+}
+
+/**
+ * @brief Close the splice pipe
+ */
+Uploader::~Uploader() { closePipe(); }
+
+/**
+ * @brief Send a piece message carrying one block
+ * @param socketFd Connected blocking socket
+ * @param piece Piece index
+ * @param offset Byte offset within the piece
+ * @param length Length of the block in bytes
+ * @return Number of bytes written to the socket, header included
+ * @throws std::out_of_range if the block is outside the torrent
+ * @throws std::runtime_error if reading or sending fails
+ */
+int64_t Uploader::sendPiece(int socketFd, uint32_t piece, uint32_t offset,
+                            uint32_t length) {
+  TRACE_SCOPE("uploader.sendPiece", "network", "bytes", length);
+  uint8_t header[PeerWire::kPieceHeaderSize];
+  PeerWire::encodePieceHeader(piece, offset, length, header);
+
+  if (method == Method::Copy) {
+    buffer.resize(std::max<size_t>(buffer.size(), length));
+    storage.readBlock(piece, offset, length, buffer.data());
+    sendCopy(socketFd, header, length);
+    return PeerWire::kPieceHeaderSize + int64_t{length};
+  }
+
+  // Validate the block before anything reaches the socket
+  auto slices = storage.mapBlock(piece, offset, length);
+  iovec iov{header, sizeof(header)};
+  sendAll(socketFd, &iov, 1, length > 0 ? MSG_MORE : 0);
+  for (size_t i = 0; i < slices.size(); ++i) {
+    if (slices[i].padding) {
+      sendZeros(socketFd, slices[i].length, i + 1 == slices.size());
+    } else if (method == Method::Sendfile) {
+      sendSliceSendfile(socketFd, slices[i]);
+    } else {
+      sendSliceSplice(socketFd, slices[i], i + 1 == slices.size());
+    }
+  }
+  return PeerWire::kPieceHeaderSize + int64_t{length};
+}
+
+/**
+ * @brief Get the configured send method
+ * @return The method used for block data
+ */
+Uploader::Method Uploader::getMethod() const { return method; }
+
+/**
+ * @brief Send the piece header and the data of the copy path
+ * @param socketFd Connected blocking socket
+ * @param header Encoded piece header
+ * @param length Block length in bytes; the data is in buffer
+ */
+void Uploader::sendCopy(int socketFd, const uint8_t *header, uint32_t length) {
+  iovec iov[2] = {
+      {const_cast<uint8_t *>(header), PeerWire::kPieceHeaderSize},
+      {buffer.data(), length}};
+  sendAll(socketFd, iov, 2, 0);
+}
+
+/**
+ * @brief Send a file slice with sendfile
+ * @param socketFd Connected blocking socket
+ * @param slice The slice to send
+ */
+void Uploader::sendSliceSendfile(int socketFd,
+                                 const Storage::FileSlice &slice) {
+  int fd = storage.fileDescriptor(slice.fileIndex);
+  off_t position = slice.offset;
+  int64_t remaining = slice.length;
+  while (remaining > 0) {
+    ssize_t n = ::sendfile(socketFd, fd, &position, remaining);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      throw systemError("Could not sendfile block data");
+    }
+    if (n == 0) {
+      throw std::runtime_error("Unexpected end of file while sending block");
+    }
+    remaining -= n;
+  }
+}
+
+/**
+ * @brief Send a file slice through the splice pipe
+ * @param socketFd Connected blocking socket
+ * @param slice The slice to send
+ * @param last Whether the slice ends the message
+ *
+ * Data moves from the file into the pipe and from the pipe into the socket
+ * in chunks of at most the pipe capacity. If either step fails, whatever is
+ * left in the pipe would be sent with the next block, so the pipe is
+ * replaced.
+ */
+void Uploader::sendSliceSplice(int socketFd, const Storage::FileSlice &slice,
+                               bool last) {
+  int fd = storage.fileDescriptor(slice.fileIndex);
+  loff_t position = slice.offset;
+  int64_t remaining = slice.length;
+  try {
+    while (remaining > 0) {
+      size_t chunk = std::min<int64_t>(remaining, pipeCapacity);
+      ssize_t in = ::splice(fd, &position, pipeFds[1], nullptr, chunk,
+                            SPLICE_F_MOVE);
+      if (in < 0 && errno == EINTR) {
+        continue;
+      }
+      if (in < 0) {
+        throw systemError("Could not splice block data from file");
+      }
+      if (in == 0) {
+        throw std::runtime_error("Unexpected end of file while sending block");
+      }
+      remaining -= in;
+
+      unsigned flags = SPLICE_F_MOVE;
+      if (remaining > 0 || !last) {
+        flags |= SPLICE_F_MORE;
+      }
+      while (in > 0) {
+        ssize_t out =
+            ::splice(pipeFds[0], nullptr, socketFd, nullptr, in, flags);
+        if (out < 0 && errno == EINTR) {
+          continue;
+        }
+        if (out < 0) {
+          throw systemError("Could not splice block data to socket");
+        }
+        in -= out;
+      }
+    }
+  } catch (...) {
+    resetPipe();
+    throw;
+  }
+}
+
+/**
+ * @brief Create the splice pipe, discarding any previous one
+ * @throws std::runtime_error if the pipe cannot be created
+ *
+ * A larger pipe means fewer splice calls per block. Raising the capacity is
+ * only an optimization, so failure (e.g. over the per-user limit) is ignored.
+ */
+void Uploader::resetPipe() {
+  closePipe();
+  if (::pipe2(pipeFds, O_CLOEXEC) < 0) {
+    pipeFds[0] = pipeFds[1] = -1;
+    throw systemError("Could not create splice pipe");
+  }
+  ::fcntl(pipeFds[1], F_SETPIPE_SZ, kPipeSize);
+  int capacity = ::fcntl(pipeFds[1], F_GETPIPE_SZ);
+  pipeCapacity = capacity > 0 ? static_cast<size_t>(capacity) : 65536;
+}
+
+/**
+ * @brief Close the splice pipe
+ */
+void Uploader::closePipe() {
+  for (int &fd : pipeFds) {
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+}
@@ -0,0 +1,836 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <utpconnection.hpp>
+
+namespace {
+
+constexpr uint8_t kVersion = 1;
+constexpr uint8_t kSelectiveAck = 1;  // Extension type
+constexpr size_t kMaxSackBits = 512;  // Packets a selective ACK covers
+constexpr int64_t kMinRto = 500000;   // BEP 29 lower bound
+constexpr int64_t kMaxRto = 60000000;
+constexpr int kMaxTimeouts = 8;       // In a row, before giving up
+constexpr int kMaxSynTimeouts = 3;
+constexpr int64_t kMinute = 60000000;
+constexpr int64_t kBurstMicros = 1000; // Pacing credit after idle polls
+
+/**
+ * @brief Compare sequence numbers modulo 2^16
+ * @return true if a comes before b
+ */
+bool seqLess(uint16_t a, uint16_t b) {
+  return static_cast<int16_t>(static_cast<uint16_t>(a - b)) < 0;
+}
+
+void put16(std::string &out, uint16_t value) {
+  out += static_cast<char>(value >> 8);
+  out += static_cast<char>(value);
+}
+
+void put32(std::string &out, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out += static_cast<char>(value >> shift);
+  }
+}
+
+uint16_t get16(const uint8_t *p) { return uint16_t(p[0] << 8 | p[1]); }
+
+uint32_t get32(const uint8_t *p) {
+  return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 |
+         p[3];
+}
+
+// Fields of a parsed packet header
+struct Header {
+  uint8_t type;
+  uint16_t connectionId;
+  uint32_t timestamp;
+  uint32_t timestampDifference;
+  uint32_t window;
+  uint16_t seq;
+  uint16_t ack;
+  const uint8_t *sack = nullptr; // Selective ACK bitmask, if present
+  size_t sackLength = 0;
+  size_t payloadOffset = UtpConnection::kHeaderSize;
+};
+
+/**
+ * @brief Parse and validate a packet header and its extensions
+ * @return false if the packet is malformed
+ */
+bool parseHeader(const char *packet, size_t length, Header &header) {
+  const auto *p = reinterpret_cast<const uint8_t *>(packet);
+  if (length < UtpConnection::kHeaderSize || (p[0] & 15) != kVersion ||
+      (p[0] >> 4) > UtpConnection::kSyn) {
+    return false;
+  }
+  header.type = p[0] >> 4;
+  header.connectionId = get16(p + 2);
+  header.timestamp = get32(p + 4);
+  header.timestampDifference = get32(p + 8);
+  header.window = get32(p + 12);
+  header.seq = get16(p + 16);
+  header.ack = get16(p + 18);
+  uint8_t extension = p[1];
+  size_t offset = UtpConnection::kHeaderSize;
+  while (extension != 0) {
+    if (offset + 2 > length || offset + 2 + p[offset + 1] > length) {
+      return false;
+    }
+    if (extension == kSelectiveAck) {
+      header.sack = p + offset + 2;
+      header.sackLength = p[offset + 1];
+    }
+    extension = p[offset];
+    offset += 2 + p[offset + 1];
+  }
+  header.payloadOffset = offset;
+  return true;
+}
+
+} // namespace
+
+/**
+ * @brief Construct an idle connection
+ * @param settings Parameters
+ * @throws std::invalid_argument if a buffer is smaller than a packet
+ */
+UtpConnection::UtpConnection(const Settings &settings)
+    : settings(settings), sendRing(kRingSize), recvRing(kRingSize) {
+  if (settings.packetPayload == 0 ||
+      settings.sendBufferBytes < settings.packetPayload ||
+      settings.receiveBufferBytes < settings.packetPayload ||
+      settings.targetDelayMicros <= 0) {
+    throw std::invalid_argument(
+        "uTP buffers must hold a packet and the delay target be positive");
+  }
+  cwnd = 4.0 * settings.packetPayload;
+}
+
+UtpConnection::UtpConnection() : UtpConnection(Settings()) {}
+
+/**
+ * @brief Open a connection: the next poll() sends a SYN
+ * @param connectionId Identifier the peer will address us with
+ * @param nowMicros Current time
+ * @throws std::logic_error if the connection is not idle
+ */
+void UtpConnection::connect(uint16_t connectionId, int64_t nowMicros) {
+  if (currentState != State::Idle) {
+    throw std::logic_error("uTP connection already in use");
+  }
+  recvId = connectionId;
+  sendId = static_cast<uint16_t>(connectionId + 1);
+  seqNr = oldest = 1;
+  lastAckReceived = 0;
+  peerWindow = static_cast<uint32_t>(settings.receiveBufferBytes);
+  currentState = State::SynSent;
+  queuePacket(kSyn, std::string());
+  sendRing[oldest % kRingSize].resend = true; // Sent by the next poll()
+  ++resendPending;
+  nextSendMicros = nowMicros;
+}
+
+/**
+ * @brief Accept a connection from its SYN
+ * @param packet The SYN datagram
+ * @param length Its size
+ * @param initialSeq Our first sequence number
+ * @param nowMicros Current time
+ * @return false if the datagram is not a valid SYN
+ * @throws std::logic_error if the connection is not idle
+ *
+ * The next poll() answers with a STATE before any data written meanwhile.
+ */
+bool UtpConnection::accept(const char *packet, size_t length,
+                           uint16_t initialSeq, int64_t nowMicros) {
+  if (currentState != State::Idle) {
+    throw std::logic_error("uTP connection already in use");
+  }
+  Header header;
+  if (!parseHeader(packet, length, header) || header.type != kSyn) {
+    return false;
+  }
+  recvId = static_cast<uint16_t>(header.connectionId + 1);
+  sendId = header.connectionId;
+  ackNr = header.seq;
+  firstSeq = seqNr = oldest = initialSeq;
+  lastAckReceived = static_cast<uint16_t>(initialSeq - 1);
+  peerWindow = header.window;
+  replyMicros = static_cast<uint32_t>(nowMicros) - header.timestamp;
+  ++counters.packetsReceived;
+  currentState = State::Connected;
+  synAckPending = true;
+  nextSendMicros = nowMicros;
+  return true;
+}
+
+/**
+ * @brief Queue bytes to send
+ * @param data The bytes
+ * @param length Their number
+ * @return Bytes accepted, less than length when the send buffer is full
+ */
+size_t UtpConnection::write(const char *data, size_t length) {
+  if (finQueued || (currentState != State::SynSent &&
+                    currentState != State::Connected)) {
+    return 0;
+  }
+  length = std::min(length, writable());
+  if (unsentOffset > 0 && unsentOffset >= unsent.size() / 2) {
+    unsent.erase(0, unsentOffset);
+    unsentOffset = 0;
+  }
+  unsent.append(data, length);
+  return length;
+}
+
+/**
+ * @brief Take received bytes, in order
+ * @param out Buffer for the bytes
+ * @param length Its size
+ * @return Bytes copied, 0 if none are waiting
+ *
+ * Reading from a receive buffer that was too full for a packet makes the
+ * next poll() announce the reopened window.
+ */
+size_t UtpConnection::read(char *out, size_t length) {
+  length = std::min(length, readable());
+  std::memcpy(out, received.data() + receivedOffset, length);
+  receivedOffset += length;
+  if (receivedOffset == received.size()) {
+    received.clear();
+    receivedOffset = 0;
+  } else if (receivedOffset >= received.size() / 2) {
+    received.erase(0, receivedOffset);
+    receivedOffset = 0;
+  }
+  if (length > 0 &&
+      lastWindowSent < static_cast<int64_t>(settings.packetPayload) &&
+      receiveWindow() >= static_cast<int64_t>(settings.packetPayload)) {
+    ackPending = true;
+  }
+  return length;
+}
+
+/**
+ * @brief Finish sending: a FIN follows the bytes written so far
+ */
+void UtpConnection::close() {
+  if (currentState == State::Idle) {
+    currentState = State::Closed;
+  }
+  finQueued = true;
+}
+
+/**
+ * @brief Process a datagram addressed to this connection
+ * @param packet The datagram
+ * @param length Its size
+ * @param nowMicros Current time, when it arrived
+ */
+void UtpConnection::receive(const char *packet, size_t length,
+                            int64_t nowMicros) {
+  Header header;
+  if (currentState == State::Idle || currentState == State::Reset ||
+      !parseHeader(packet, length, header)) {
+    return;
+  }
+  if (header.type == kReset) {
+    if (header.connectionId == recvId || header.connectionId == sendId) {
+      currentState = State::Reset;
+    }
+    return;
+  }
+  if (header.connectionId != recvId &&
+      !(header.type == kSyn && header.connectionId == sendId)) {
+    return;
+  }
+  ++counters.packetsReceived;
+  replyMicros = static_cast<uint32_t>(nowMicros) - header.timestamp;
+  const uint32_t previousWindow = peerWindow;
+  peerWindow = header.window;
+  if (header.timestampDifference != 0) {
+    updateDelay(header.timestampDifference, nowMicros);
+  }
+
+  if (header.type == kSyn) {
+    synAckPending = true; // Our reply to it was lost
+    return;
+  }
+  if (currentState == State::SynSent) {
+    if (header.type != kState) {
+      return;
+    }
+    currentState = State::Connected;
+    ackNr = static_cast<uint16_t>(header.seq - 1);
+  }
+  handleAcks(header.ack, header.sack, header.sackLength,
+             header.type == kState && length == header.payloadOffset,
+             nowMicros);
+  if (previousWindow < settings.packetPayload &&
+      peerWindow >= settings.packetPayload && oldest != seqNr) {
+    // The window reopened: the probe sent into it was likely dropped
+    OutPacket &probe = sendRing[oldest % kRingSize];
+    if (probe.inFlight && probe.transmissions > 0 && !probe.resend) {
+      probe.resend = true;
+      flightBytes -= probe.payload.size();
+      ++resendPending;
+    }
+  }
+
+  if (header.type == kData || header.type == kFin) {
+    const char *payload = packet + header.payloadOffset;
+    const size_t size = length - header.payloadOffset;
+    const bool fin = header.type == kFin;
+    const uint16_t distance = static_cast<uint16_t>(header.seq - ackNr);
+    ackPending = true;
+    if (peerFin || distance == 0 || distance >= kRingSize) {
+      ++counters.duplicates; // Old, or too far ahead to hold
+    } else if (distance == 1) {
+      if (static_cast<int64_t>(size) <= receiveWindow() + reorderBytes) {
+        deliver(payload, size, fin);
+        ackNr = header.seq;
+        InPacket *next;
+        while (!peerFin &&
+               (next = &recvRing[uint16_t(ackNr + 1) % kRingSize])->present) {
+          reorderBytes -= next->payload.size();
+          --heldPackets;
+          deliver(next->payload.data(), next->payload.size(), next->fin);
+          next->present = false;
+          next->payload.clear();
+          ++ackNr;
+        }
+      }
+    } else {
+      InPacket &slot = recvRing[header.seq % kRingSize];
+      if (slot.present) {
+        ++counters.duplicates;
+      } else if (static_cast<int64_t>(size) <= receiveWindow()) {
+        slot.payload.assign(payload, size);
+        slot.fin = fin;
+        slot.present = true;
+        reorderBytes += size;
+        ++heldPackets;
+      }
+    }
+  }
+  checkClosed();
+}
+
+/**
+ * @brief Send what is due and run the timers
+ * @param nowMicros Current time
+ * @param send Receives each datagram to send
+ * @return Time of the next poll needed, kNever if none
+ *
+ * Packets marked lost go first, then new packets while the congestion
+ * window, the peer's receive window and pacing allow, then the FIN, and a
+ * STATE if something must be acknowledged that no data packet carried.
+ */
+int64_t UtpConnection::poll(int64_t nowMicros, const Send &send) {
+  if (currentState == State::Idle || currentState == State::Reset) {
+    return kNever;
+  }
+
+  // Retransmission timeout: collapse the window and resend everything
+  if (flightPackets > 0 && nowMicros >= rtoDeadline) {
+    ++counters.timeouts;
+    if (++timeoutsInRow > (currentState == State::SynSent ? kMaxSynTimeouts
+                                                           : kMaxTimeouts)) {
+      currentState = State::Reset;
+      return kNever;
+    }
+    for (uint16_t seq = oldest; seq != seqNr; ++seq) {
+      OutPacket &slot = sendRing[seq % kRingSize];
+      if (slot.inFlight && slot.transmissions > 0 && !slot.resend) {
+        slot.resend = true;
+        flightBytes -= slot.payload.size();
+        ++resendPending;
+      }
+    }
+    cwnd = static_cast<double>(settings.packetPayload);
+    slowStart = false;
+    inRecovery = false;
+    rto = std::min(rto * 2, kMaxRto);
+    rtoDeadline = nowMicros + rto;
+  }
+
+  const int64_t window =
+      std::min<int64_t>(static_cast<int64_t>(cwnd), peerWindow);
+  auto fits = [&](size_t size) {
+    return flightBytes == 0 ||
+           flightBytes + static_cast<int64_t>(size) <= window;
+  };
+
+  // The SYN's reply goes first and carries our first sequence number,
+  // even after data, since the connector counts our packets from it
+  if (synAckPending) {
+    synAckPending = false;
+    sendState(firstSeq, nowMicros, send);
+  }
+
+  // Lost packets, and the SYN
+  for (uint16_t seq = oldest; seq != seqNr && resendPending > 0; ++seq) {
+    OutPacket &slot = sendRing[seq % kRingSize];
+    if (slot.inFlight && slot.resend) {
+      if (!fits(slot.payload.size())) {
+        break;
+      }
+      sendPacket(seq, nowMicros, send);
+    }
+  }
+
+  // New packets, paced over the round trip
+  int64_t wake = kNever;
+  if (currentState == State::Connected) {
+    while (unsentOffset < unsent.size() &&
+           static_cast<uint16_t>(seqNr - oldest) < kRingSize - 1) {
+      size_t size = std::min(settings.packetPayload,
+                             unsent.size() - unsentOffset);
+      if (!fits(size)) {
+        break;
+      }
+      if (settings.pacing && rtt > 0 && nowMicros < nextSendMicros) {
+        wake = nextSendMicros;
+        break;
+      }
+      uint16_t seq = seqNr;
+      queuePacket(kData, unsent.substr(unsentOffset, size));
+      unsentOffset += size;
+      sendPacket(seq, nowMicros, send);
+      if (rtt > 0) {
+        nextSendMicros = std::max(nextSendMicros, nowMicros - kBurstMicros) +
+                         static_cast<int64_t>(rtt * double(size) / cwnd);
+      }
+    }
+    if (unsentOffset == unsent.size()) {
+      unsent.clear();
+      unsentOffset = 0;
+      if (finQueued && !finSent) {
+        finSent = true;
+        finSeq = seqNr;
+        queuePacket(kFin, std::string());
+        sendPacket(finSeq, nowMicros, send);
+      }
+    }
+  }
+
+  if (ackPending) {
+    sendState(seqNr, nowMicros, send);
+  }
+  if (flightPackets == 0) {
+    rtoDeadline = kNever;
+  }
+  return std::min(wake, rtoDeadline);
+}
+
+/**
+ * @brief Get the progress of the connection
+ * @return Its state
+ */
+UtpConnection::State UtpConnection::state() const { return currentState; }
+
+/**
+ * @brief Check whether the peer finished sending
+ * @return true once its FIN and every byte before it arrived; read() may
+ * still have bytes to return
+ */
+bool UtpConnection::eof() const { return peerFin; }
+
+size_t UtpConnection::readable() const {
+  return received.size() - receivedOffset;
+}
+
+size_t UtpConnection::writable() const {
+  int64_t used = static_cast<int64_t>(unsent.size() - unsentOffset) +
+                 bufferedBytes;
+  return static_cast<size_t>(
+      std::max<int64_t>(0, settings.sendBufferBytes - used));
+}
+
+size_t UtpConnection::unacknowledged() const {
+  return unsent.size() - unsentOffset + bufferedBytes;
+}
+
+uint16_t UtpConnection::receiveId() const { return recvId; }
+
+int64_t UtpConnection::window() const { return static_cast<int64_t>(cwnd); }
+
+int64_t UtpConnection::rttMicros() const { return rtt; }
+
+int64_t UtpConnection::queuingDelayMicros() const { return ourDelay; }
+
+const UtpConnection::Stats &UtpConnection::stats() const { return counters; }
+
+/**
+ * @brief Read the fields a socket needs to dispatch a datagram
+ * @param packet The datagram
+ * @param length Its size
+ * @param type Set to the packet type
+ * @param connectionId Set to the connection ID field
+ * @return false if it is not a uTP version 1 packet
+ */
+bool UtpConnection::peek(const char *packet, size_t length, uint8_t &type,
+                         uint16_t &connectionId) {
+  const auto *p = reinterpret_cast<const uint8_t *>(packet);
+  if (length < kHeaderSize || (p[0] & 15) != kVersion || (p[0] >> 4) > kSyn) {
+    return false;
+  }
+  type = p[0] >> 4;
+  connectionId = get16(p + 2);
+  return true;
+}
+
+/**
+ * @brief Build a RESET for a datagram that matches no connection
+ * @param packet The datagram
+ * @param length Its size
+ * @return The RESET, or empty if the datagram is itself a RESET or invalid
+ *
+ * The RESET carries the datagram's own connection ID, which the sender
+ * matches against the IDs it sends and receives with.
+ */
+std::string UtpConnection::resetFor(const char *packet, size_t length) {
+  Header header;
+  std::string out;
+  if (!parseHeader(packet, length, header) || header.type == kReset) {
+    return out;
+  }
+  out += static_cast<char>(kReset << 4 | kVersion);
+  out += '\0';
+  put16(out, header.connectionId);
+  put32(out, 0);
+  put32(out, 0);
+  put32(out, 0);
+  put16(out, 0);
+  put16(out, header.seq);
+  return out;
+}
+
+/**
+ * @brief Get the receive window to advertise
+ * @return Bytes the receive buffer can still take
+ */
+int64_t UtpConnection::receiveWindow() const {
+  const int64_t capacity = static_cast<int64_t>(settings.receiveBufferBytes);
+  return std::max<int64_t>(
+      0, capacity - static_cast<int64_t>(readable()) - reorderBytes);
+}
+
+/**
+ * @brief Give the next sequence number to a new packet, not yet sent
+ * @param type Packet type
+ * @param payload Its data bytes
+ */
+void UtpConnection::queuePacket(uint8_t type, std::string payload) {
+  OutPacket &slot = sendRing[seqNr % kRingSize];
+  slot.payload = std::move(payload);
+  slot.type = type;
+  slot.inFlight = true;
+  slot.resend = false;
+  slot.transmissions = 0;
+  bufferedBytes += slot.payload.size();
+  ++flightPackets;
+  ++seqNr;
+}
+
+/**
+ * @brief Transmit a packet of the send ring
+ * @param seq Its sequence number
+ * @param now Current time
+ * @param send Receives the datagram
+ */
+void UtpConnection::sendPacket(uint16_t seq, int64_t now, const Send &send) {
+  OutPacket &slot = sendRing[seq % kRingSize];
+  writeHeader(slot.type, seq, now, heldPackets > 0);
+  scratch += slot.payload;
+  send(scratch.data(), scratch.size());
+  if (slot.transmissions > 0) {
+    ++counters.resends;
+  }
+  ++slot.transmissions;
+  slot.sentMicros = now;
+  if (slot.resend) {
+    slot.resend = false;
+    --resendPending;
+  }
+  flightBytes += slot.payload.size();
+  ++counters.packetsSent;
+  counters.bytesSent += slot.payload.size();
+  ackPending = false;
+  if (rtoDeadline == kNever) {
+    rtoDeadline = now + rto;
+  }
+}
+
+/**
+ * @brief Send a STATE packet acknowledging what arrived
+ * @param seq Sequence number: the next packet's, or our first to answer
+ * a SYN
+ * @param now Current time
+ * @param send Receives the datagram
+ */
+void UtpConnection::sendState(uint16_t seq, int64_t now, const Send &send) {
+  writeHeader(kState, seq, now, heldPackets > 0);
+  send(scratch.data(), scratch.size());
+  ++counters.packetsSent;
+  ackPending = false;
+}
+
+/**
+ * @brief Write a packet header into the scratch buffer
+ * @param type Packet type
+ * @param seq Sequence number
+ * @param now Current time, for the timestamp
+ * @param sack Append a selective ACK of the packets held out of order
+ */
+void UtpConnection::writeHeader(uint8_t type, uint16_t seq, int64_t now,
+                                bool sack) {
+  scratch.clear();
+  scratch += static_cast<char>(type << 4 | kVersion);
+  scratch += static_cast<char>(sack ? kSelectiveAck : 0);
+  put16(scratch, type == kSyn ? recvId : sendId);
+  put32(scratch, static_cast<uint32_t>(now));
+  put32(scratch, replyMicros);
+  lastWindowSent = receiveWindow();
+  put32(scratch, static_cast<uint32_t>(lastWindowSent));
+  put16(scratch, seq);
+  put16(scratch, ackNr);
+  if (sack) {
+    // Bit i stands for ackNr + 2 + i; ackNr + 1 is missing by definition
+    size_t last = 0;
+    for (size_t i = 0; i < kMaxSackBits; ++i) {
+      if (recvRing[uint16_t(ackNr + 2 + i) % kRingSize].present) {
+        last = i;
+      }
+    }
+    size_t bytes = (last / 32 + 1) * 4;
+    scratch += '\0';
+    scratch += static_cast<char>(bytes);
+    size_t at = scratch.size();
+    scratch.append(bytes, '\0');
+    for (size_t i = 0; i <= last; ++i) {
+      if (recvRing[uint16_t(ackNr + 2 + i) % kRingSize].present) {
+        scratch[at + i / 8] =
+            static_cast<char>(scratch[at + i / 8] | (1 << (i % 8)));
+      }
+    }
+  }
+}
+
+/**
+ * @brief Process the cumulative and selective ACKs of a packet
+ * @param ack Last packet the peer received in order
+ * @param sack Selective ACK bitmask, nullptr if none
+ * @param sackLength Its size in bytes
+ * @param pureAck Whether the packet is a STATE without payload
+ * @param now Current time
+ *
+ * A packet overtaken by three selectively acknowledged ones, or the
+ * oldest packet after three duplicate ACKs, counts as lost and is sent
+ * again; the window is halved once per window of packets lost from. Only
+ * a pure ACK can be a duplicate (RFC 5681): the peer's data packets
+ * repeat its latest ACK whenever it has nothing new to acknowledge.
+ */
+void UtpConnection::handleAcks(uint16_t ack, const uint8_t *sack,
+                               size_t sackLength, bool pureAck,
+                               int64_t now) {
+  if (oldest == seqNr || seqLess(ack, uint16_t(oldest - 1)) ||
+      !seqLess(ack, seqNr)) {
+    return; // Nothing outstanding, an old ACK, or one from the future
+  }
+  int64_t bytesAcked = 0;
+  for (uint16_t seq = oldest; seq != uint16_t(ack + 1); ++seq) {
+    acknowledge(seq, now, bytesAcked);
+  }
+  for (size_t i = 0; sack != nullptr && i < sackLength * 8; ++i) {
+    uint16_t seq = static_cast<uint16_t>(ack + 2 + i);
+    if (!seqLess(seq, seqNr)) {
+      break;
+    }
+    if (sack[i / 8] & (1 << (i % 8))) {
+      acknowledge(seq, now, bytesAcked);
+    }
+  }
+  while (oldest != seqNr && !sendRing[oldest % kRingSize].inFlight) {
+    ++oldest;
+  }
+  if (finSent && !seqLess(ack, finSeq)) {
+    finAcked = true;
+  }
+
+  if (sack != nullptr) {
+    // Only packets acknowledged after being sent later count, so a resent
+    // packet is not declared lost again by the ACKs that caused the resend
+    std::array<int64_t, 3> latest{-1, -1, -1}; // Descending send times
+    for (uint16_t seq = seqNr; seq != oldest;) {
+      --seq;
+      const OutPacket &slot = sendRing[seq % kRingSize];
+      if (!slot.inFlight) {
+        if (slot.sentMicros > latest[2]) {
+          latest[2] = slot.sentMicros;
+          std::sort(latest.begin(), latest.end(), std::greater<>());
+        }
+      } else if (latest[2] > slot.sentMicros ||
+                 (latest[2] == slot.sentMicros && slot.transmissions == 1)) {
+        lose(seq);
+      }
+    }
+  } else if (pureAck && bytesAcked == 0 && ack == lastAckReceived &&
+             oldest != seqNr) {
+    if (++duplicateAcks == 3) {
+      lose(oldest);
+    }
+  }
+
+  if (bytesAcked > 0) {
+    duplicateAcks = 0;
+    timeoutsInRow = 0;
+    growWindow(bytesAcked);
+    rtoDeadline = flightPackets > 0 ? now + rto : kNever;
+  }
+  if (inRecovery && !seqLess(ack, recoverySeq)) {
+    inRecovery = false;
+  }
+  lastAckReceived = ack;
+}
+
+/**
+ * @brief Mark a sent packet acknowledged
+ * @param seq Its sequence number
+ * @param now Current time, for the RTT sample
+ * @param bytesAcked Increased by its payload
+ *
+ * Only packets sent once give RTT samples (Karn's algorithm).
+ */
+void UtpConnection::acknowledge(uint16_t seq, int64_t now,
+                                int64_t &bytesAcked) {
+  OutPacket &slot = sendRing[seq % kRingSize];
+  if (!slot.inFlight || slot.transmissions == 0) {
+    return;
+  }
+  if (slot.transmissions == 1) {
+    int64_t sample = now - slot.sentMicros;
+    if (rtt == 0) {
+      rtt = sample;
+      rttVar = sample / 2;
+    } else {
+      rttVar += (std::abs(rtt - sample) - rttVar) / 4;
+      rtt += (sample - rtt) / 8;
+    }
+    rto = std::clamp(rtt + 4 * rttVar, kMinRto, kMaxRto);
+  }
+  const int64_t size = slot.payload.size();
+  if (slot.resend) {
+    --resendPending;
+  } else {
+    flightBytes -= size;
+  }
+  bufferedBytes -= size;
+  bytesAcked += size;
+  slot.inFlight = false;
+  slot.resend = false;
+  slot.payload.clear();
+  --flightPackets;
+}
+
+/**
+ * @brief Record a one-way delay sample from the peer
+ * @param delaySample The peer's receive time minus our send time, with
+ * the clock offset between us; only differences matter
+ * @param now Current time
+ *
+ * The base delay is the smallest sample of the last two minutes, kept as
+ * one minimum per minute so that it follows route changes and clock
+ * drift; the queuing delay is the latest sample above it.
+ */
+void UtpConnection::updateDelay(uint32_t delaySample, int64_t now) {
+  auto before = [](uint32_t a, uint32_t b) { return int32_t(a - b) < 0; };
+  const int64_t minute = now / kMinute;
+  if (baseDelayMinute < 0 || minute > baseDelayMinute + 1) {
+    baseDelays = {delaySample, delaySample};
+  } else if (minute == baseDelayMinute + 1) {
+    baseDelays = {baseDelays[1], delaySample};
+  } else if (before(delaySample, baseDelays[1])) {
+    baseDelays[1] = delaySample;
+  }
+  baseDelayMinute = minute;
+  uint32_t base = before(baseDelays[0], baseDelays[1]) ? baseDelays[0]
+                                                       : baseDelays[1];
+  ourDelay = std::max<int32_t>(0, int32_t(delaySample - base));
+}
+
+/**
+ * @brief Apply LEDBAT to the window after an ACK
+ * @param bytesAcked Payload newly acknowledged
+ *
+ * In slow start the window grows by the bytes acknowledged, doubling each
+ * round trip, until the queuing delay reaches half the target or a packet
+ * is lost. After that it moves by maxWindowIncrease per round trip scaled
+ * by how far the delay is below the target, and shrinks as fast above it.
+ */
+void UtpConnection::growWindow(int64_t bytesAcked) {
+  const double target = static_cast<double>(settings.targetDelayMicros);
+  const double minWindow = static_cast<double>(settings.packetPayload);
+  const double maxWindow =
+      static_cast<double>(settings.packetPayload) * (kRingSize - 1);
+  if (slowStart && ourDelay * 2 > settings.targetDelayMicros) {
+    // The window doubled during the round trip this delay took to show
+    slowStart = false;
+    cwnd /= 2;
+  }
+  if (slowStart) {
+    cwnd += bytesAcked;
+  } else {
+    double delayFactor = (target - ourDelay) / target;
+    double windowFactor = std::min<double>(bytesAcked, cwnd) /
+                          std::max<double>(cwnd, bytesAcked);
+    cwnd += settings.maxWindowIncrease * delayFactor * windowFactor;
+  }
+  cwnd = std::clamp(cwnd, minWindow, maxWindow);
+}
+
+/**
+ * @brief Mark a packet lost, to be sent again
+ * @param seq Its sequence number
+ */
+void UtpConnection::lose(uint16_t seq) {
+  OutPacket &slot = sendRing[seq % kRingSize];
+  if (!slot.inFlight || slot.resend || slot.transmissions == 0) {
+    return;
+  }
+  slot.resend = true;
+  flightBytes -= slot.payload.size();
+  ++resendPending;
+  ++counters.fastResends;
+  if (!inRecovery) {
+    cwnd = std::max(cwnd / 2, static_cast<double>(settings.packetPayload));
+    slowStart = false;
+    inRecovery = true;
+    recoverySeq = static_cast<uint16_t>(seqNr - 1);
+  }
+}
+
+/**
+ * @brief Append in-order payload to the receive buffer
+ * @param data The bytes
+ * @param length Their number
+ * @param fin Whether the packet was the peer's FIN
+ */
+void UtpConnection::deliver(const char *data, size_t length, bool fin) {
+  received.append(data, length);
+  counters.bytesReceived += length;
+  peerFin = peerFin || fin;
+}
+
+/**
+ * @brief Enter Closed once both FINs are through
+ */
+void UtpConnection::checkClosed() {
+  if (finAcked && peerFin && currentState == State::Connected) {
+    currentState = State::Closed;
+  }
+}
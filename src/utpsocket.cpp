@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <utpsocket.hpp>
+
+namespace {
+
+constexpr size_t kSlotSlack = 256; // Header and selective ACK room
+
+/**
+ * @brief Settings of the UDP socket a UtpSocket opens for itself
+ * @param options Settings of the uTP socket
+ * @return Settings with slots large enough for its packets
+ */
+UdpSocket::Options udpOptions(const UtpSocket::Options &options) {
+  UdpSocket::Options udp;
+  udp.address = options.address;
+  udp.port = options.port;
+  udp.batchSize = options.batchSize;
+  udp.slotSize = std::max<size_t>(
+      udp.slotSize, options.settings.packetPayload + kSlotSlack);
+  udp.segmentation = options.segmentation;
+  return udp;
+}
+
+} // namespace
+
+/**
+ * @brief Open and bind a UDP socket of its own
+ * @param options Settings
+ * @throws std::runtime_error if the socket cannot be bound
+ * @throws std::invalid_argument if batchSize is 0
+ */
+UtpSocket::UtpSocket(const Options &options)
+    : options(options),
+      ownSocket(std::make_unique<UdpSocket>(udpOptions(options))),
+      udp(*ownSocket), random(std::random_device()()) {
+  attach();
+}
+
+/**
+ * @brief Run on a shared UDP socket, routing its uTP datagrams here
+ * @param udp The socket, which must outlive this one
+ * @param options Settings; those of the UDP socket are ignored
+ * @throws std::invalid_argument if a packet does not fit a slot
+ */
+UtpSocket::UtpSocket(UdpSocket &udp, const Options &options)
+    : options(options), udp(udp), random(std::random_device()()) {
+  attach();
+}
+
+UtpSocket::~UtpSocket() { udp.unroute(routeId); }
+
+/**
+ * @brief Open a connection; the next process() sends its SYN
+ * @param address IPv4 address of the peer
+ * @param port Its port
+ * @param nowMicros Current time
+ * @return The connection
+ * @throws std::invalid_argument if the address is not IPv4
+ */
+std::shared_ptr<UtpConnection>
+UtpSocket::connect(const std::string &address, uint16_t port,
+                   int64_t nowMicros) {
+  const sockaddr_in peer = UdpSocket::endpoint(address, port);
+  uint16_t id;
+  do {
+    id = static_cast<uint16_t>(random());
+  } while (entries.count(key(peer, id)) != 0);
+  auto connection = std::make_shared<UtpConnection>(options.settings);
+  connection->connect(id, nowMicros);
+  entries.emplace(key(peer, id), Entry{connection, peer});
+  return connection;
+}
+
+/**
+ * @brief Accept connections; without a callback SYNs are reset
+ * @param callback Called from process() for each new connection
+ */
+void UtpSocket::onAccept(AcceptCallback callback) {
+  acceptCallback = std::move(callback);
+}
+
+/**
+ * @brief Receive, run every connection, and send
+ * @param nowMicros Current time
+ * @return Time the next call is due at the latest, kNever if none
+ *
+ * Receiving dispatches every datagram waiting on the UDP socket, those of
+ * the other protocols sharing it included. Connections that are closed or
+ * reset and no longer referenced outside the socket are dropped.
+ */
+int64_t UtpSocket::process(int64_t nowMicros) {
+  processMicros = nowMicros;
+  udp.receive();
+  processMicros = -1;
+  int64_t wake = UtpConnection::kNever;
+  for (auto it = entries.begin(); it != entries.end();) {
+    UtpConnection &connection = *it->second.connection;
+    const sockaddr_in &peer = it->second.peer;
+    int64_t due = connection.poll(
+        nowMicros, [this, &peer, nowMicros](const char *data, size_t length) {
+          emit(peer, data, length, nowMicros);
+        });
+    auto state = connection.state();
+    if ((state == UtpConnection::State::Closed ||
+         state == UtpConnection::State::Reset) &&
+        it->second.connection.use_count() == 1) {
+      it = entries.erase(it);
+      continue;
+    }
+    wake = std::min(wake, due);
+    ++it;
+  }
+
+  // Release what the emulated link delivered by now
+  while (!link.empty() && link.front().releaseMicros <= nowMicros) {
+    ++counters.datagramsSent;
+    udp.send(link.front().to, link.front().data.data(),
+             link.front().data.size());
+    link.pop_front();
+  }
+  udp.flush();
+  if (!link.empty()) {
+    wake = std::min(wake, link.front().releaseMicros);
+  }
+  return wake;
+}
+
+/**
+ * @brief Block until a datagram arrives or a time is reached
+ * @param nowMicros Current time
+ * @param untilMicros Time to return at, kNever to wait for a datagram only
+ */
+void UtpSocket::wait(int64_t nowMicros, int64_t untilMicros) {
+  udp.wait(untilMicros == UtpConnection::kNever
+               ? -1
+               : std::max<int64_t>(0, untilMicros - nowMicros));
+}
+
+uint16_t UtpSocket::port() const { return udp.port(); }
+
+size_t UtpSocket::connections() const { return entries.size(); }
+
+UdpSocket &UtpSocket::socket() { return udp; }
+
+const UtpSocket::Stats &UtpSocket::stats() const { return counters; }
+
+int64_t UtpSocket::now() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * @brief Route the UDP socket's uTP datagrams to this socket
+ * @throws std::invalid_argument if a packet does not fit a slot
+ */
+void UtpSocket::attach() {
+  if (udp.slotSize() < options.settings.packetPayload + kSlotSlack) {
+    throw std::invalid_argument("UDP slots too small for uTP packets");
+  }
+  routeId = udp.route(
+      UdpSocket::isUtp,
+      [this](const char *data, size_t length, const sockaddr_in &from) {
+        dispatch(data, length, from);
+      });
+}
+
+/**
+ * @brief Hand a datagram to its connection, accept it, or reset it
+ * @param data The datagram
+ * @param length Its size
+ * @param from Its sender
+ *
+ * A RESET carries the ID its sender saw from us, which is our receive ID
+ * plus or minus one. Datagrams another protocol's loop receives outside
+ * process() are timed by the clock.
+ */
+void UtpSocket::dispatch(const char *data, size_t length,
+                         const sockaddr_in &from) {
+  const int64_t now = processMicros >= 0 ? processMicros : UtpSocket::now();
+  uint8_t type;
+  uint16_t id;
+  if (!UtpConnection::peek(data, length, type, id)) {
+    return;
+  }
+  ++counters.datagramsReceived;
+  auto it = entries.find(key(from, id));
+  if (it != entries.end() && type != UtpConnection::kSyn) {
+    it->second.connection->receive(data, length, now);
+    return;
+  }
+  if (type == UtpConnection::kReset) {
+    for (uint16_t candidate : {uint16_t(id - 1), uint16_t(id + 1)}) {
+      auto match = entries.find(key(from, candidate));
+      if (match != entries.end()) {
+        match->second.connection->receive(data, length, now);
+      }
+    }
+    return;
+  }
+  if (type == UtpConnection::kSyn) {
+    // A repeated SYN goes to the connection it opened
+    auto opened = entries.find(key(from, uint16_t(id + 1)));
+    if (opened != entries.end()) {
+      opened->second.connection->receive(data, length, now);
+      return;
+    }
+    if (acceptCallback) {
+      auto connection = std::make_shared<UtpConnection>(options.settings);
+      if (connection->accept(data, length, static_cast<uint16_t>(random()),
+                             now)) {
+        entries.emplace(key(from, connection->receiveId()),
+                        Entry{connection, from});
+        acceptCallback(connection);
+      }
+      return;
+    }
+  }
+  std::string reset = UtpConnection::resetFor(data, length);
+  if (!reset.empty()) {
+    ++counters.resets;
+    emit(from, reset.data(), reset.size(), now);
+  }
+}
+
+/**
+ * @brief Send a datagram, through the emulated link if there is one
+ * @param to Destination
+ * @param data The datagram
+ * @param length Its size
+ * @param now Current time
+ */
+void UtpSocket::emit(const sockaddr_in &to, const char *data, size_t length,
+                     int64_t now) {
+  if (options.rateBytesPerSecond <= 0 && options.delayMicros <= 0) {
+    ++counters.datagramsSent;
+    udp.send(to, data, length);
+    return;
+  }
+  int64_t departure = now;
+  if (options.rateBytesPerSecond > 0) {
+    int64_t start = std::max(now, linkFreeMicros);
+    int64_t queued = (start - now) * options.rateBytesPerSecond / 1000000;
+    if (queued + static_cast<int64_t>(length) > options.queueBytes) {
+      ++counters.linkDrops;
+      return;
+    }
+    departure = start + static_cast<int64_t>(length) * 1000000 /
+                            options.rateBytesPerSecond;
+    linkFreeMicros = departure;
+  }
+  link.push_back({departure + options.delayMicros, to,
+                  std::string(data, length)});
+}
+
+/**
+ * @brief Key of a connection in the entry map
+ * @param address Peer address
+ * @param connectionId Receive ID of the connection
+ */
+uint64_t UtpSocket::key(const sockaddr_in &address, uint16_t connectionId) {
+  return uint64_t(address.sin_addr.s_addr) << 32 |
+         uint64_t(address.sin_port) << 16 | connectionId;
+}
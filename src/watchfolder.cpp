@@ -0,0 +1,539 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <watchfolder.hpp>
+
+namespace {
+
+/**
+ * @brief Loaded files behind the entries of a registry mirror
+ *
+ * Several files may hold the same torrent. Each info hash keeps its
+ * files in load order, and the registry shows the newest one's torrent.
+ */
+struct RegistryMirror {
+  struct Hasher {
+    size_t operator()(const InfoHash &key) const { return key.hash(); }
+  };
+  using File = std::pair<std::string, std::shared_ptr<const TorrentFile>>;
+
+  std::mutex mutex; // Callbacks may be shared by several watchers
+  std::unordered_map<InfoHash, std::vector<File>, Hasher> files;
+};
+
+constexpr uint32_t kWatchMask = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE |
+                                IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE |
+                                IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+/**
+ * @brief Build an exception for a failed system call
+ * @param what Description of the operation
+ * @param path The file involved
+ * @return Exception carrying the errno description
+ */
+std::runtime_error systemError(const std::string &what,
+                               const std::string &path) {
+  return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+/**
+ * @brief Read a whole file
+ * @throws std::runtime_error if it cannot be read
+ */
+std::string readFile(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw systemError("Cannot open", path);
+  }
+  std::string data((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+  if (file.bad()) {
+    throw systemError("Cannot read", path);
+  }
+  return data;
+}
+
+} // namespace
+
+/**
+ * @brief Start watching a directory
+ * @param directory Directory to watch
+ * @param callbacks Receivers of the changes
+ * @param options Settings
+ * @throws std::runtime_error if inotify or the directory is unavailable
+ *
+ * The watch is in place before the initial scan, so a file created during
+ * the scan is seen by one or the other.
+ */
+WatchFolder::WatchFolder(std::string directory, Callbacks callbacks,
+                         Options options)
+    : directory(std::move(directory)), callbacks(std::move(callbacks)),
+      options(std::move(options)),
+      scheduler(this->options.scheduler != nullptr ? *this->options.scheduler
+                                                   : Scheduler::shared()) {
+  inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotifyFd < 0) {
+    throw systemError("Cannot initialize inotify for", this->directory);
+  }
+  if (inotify_add_watch(inotifyFd, this->directory.c_str(), kWatchMask) < 0) {
+    std::runtime_error error = systemError("Cannot watch", this->directory);
+    close(inotifyFd);
+    throw error;
+  }
+  stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (stopFd < 0) {
+    std::runtime_error error =
+        systemError("Cannot create stop event for", this->directory);
+    close(inotifyFd);
+    throw error;
+  }
+  thread = std::thread(&WatchFolder::run, this);
+}
+
+/**
+ * @brief Stop watching, see stop()
+ */
+WatchFolder::~WatchFolder() {
+  stop();
+  close(stopFd);
+  close(inotifyFd);
+}
+
+/**
+ * @brief Stop the watcher thread and wait for loads in flight
+ */
+void WatchFolder::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+  }
+  uint64_t one = 1;
+  if (write(stopFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    throw systemError("Cannot signal stop to watcher of", directory);
+  }
+  if (thread.joinable()) {
+    thread.join();
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this] { return inFlight == 0; });
+}
+
+/**
+ * @brief Wait until no file is settling or loading
+ * @param timeout Longest wait
+ * @return true if idle, false on timeout
+ */
+bool WatchFolder::waitIdle(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex);
+  return idle.wait_for(lock, timeout,
+                       [this] { return settling == 0 && inFlight == 0; });
+}
+
+/**
+ * @brief Get the number of loaded files
+ * @return Files currently reported as added
+ */
+size_t WatchFolder::size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return std::count_if(loaded.begin(), loaded.end(),
+                       [](const auto &entry) { return entry.second.valid; });
+}
+
+/**
+ * @brief Get the activity counters
+ * @return Counters since construction
+ */
+WatchFolder::Stats WatchFolder::stats() const {
+  Stats result;
+  result.events = events.load(std::memory_order_relaxed);
+  result.loads = loads.load(std::memory_order_relaxed);
+  result.failures = failures.load(std::memory_order_relaxed);
+  result.removals = removals.load(std::memory_order_relaxed);
+  result.rescans = rescans.load(std::memory_order_relaxed);
+  result.overflows = overflows.load(std::memory_order_relaxed);
+  return result;
+}
+
+/**
+ * @brief Make callbacks that mirror the directory into a registry
+ * @param registry Registry to update
+ * @return Callbacks mirroring the folder's files into the registry
+ *
+ * The callbacks share a RegistryMirror, so an info hash leaves the
+ * registry only with the last file that holds it. Replacements are done
+ * in place, so lookups never miss a torrent that stays in the folder.
+ */
+WatchFolder::Callbacks
+WatchFolder::registryCallbacks(TorrentRegistry &registry) {
+  auto mirror = std::make_shared<RegistryMirror>();
+  Callbacks result;
+  result.onAdded = [&registry, mirror](
+                       const std::string &path,
+                       std::shared_ptr<const TorrentFile> torrent,
+                       const InfoHash &infoHash) {
+    std::lock_guard<std::mutex> lock(mirror->mutex);
+    mirror->files[infoHash].emplace_back(path, torrent);
+    registry.assign(infoHash, std::move(torrent));
+  };
+  result.onRemoved = [&registry, mirror](const std::string &path,
+                                         const InfoHash &infoHash) {
+    std::lock_guard<std::mutex> lock(mirror->mutex);
+    auto found = mirror->files.find(infoHash);
+    if (found == mirror->files.end()) {
+      return;
+    }
+    std::vector<RegistryMirror::File> &files = found->second;
+    auto file = std::find_if(files.begin(), files.end(), [&](const auto &f) {
+      return f.first == path;
+    });
+    if (file == files.end()) {
+      return;
+    }
+    const bool shown = file + 1 == files.end();
+    files.erase(file);
+    if (files.empty()) {
+      mirror->files.erase(found);
+      registry.erase(infoHash);
+    } else if (shown) {
+      registry.assign(infoHash, files.back().second);
+    }
+  };
+  return result;
+}
+
+/**
+ * @brief Body of the watcher thread
+ *
+ * Sleeps in poll() until an inotify event, the stop event or the earliest
+ * settle deadline, whichever comes first.
+ */
+void WatchFolder::run() {
+  rescan(true);
+  while (true) {
+    int timeout = -1;
+    if (!pending.empty()) {
+      auto earliest = std::min_element(
+          pending.begin(), pending.end(), [](const auto &a, const auto &b) {
+            return a.second.deadline < b.second.deadline;
+          });
+      auto wait = std::chrono::ceil<std::chrono::milliseconds>(
+          earliest->second.deadline - std::chrono::steady_clock::now());
+      timeout = static_cast<int>(std::max<int64_t>(0, wait.count()));
+    }
+    pollfd fds[2] = {{stopFd, POLLIN, 0}, {inotifyFd, POLLIN, 0}};
+    if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+      if (callbacks.onError) {
+        std::lock_guard<std::mutex> lock(mutex);
+        callbacks.onError(directory, std::string("poll: ") +
+                                         std::strerror(errno));
+      }
+      break;
+    }
+    if (fds[0].revents != 0) {
+      break;
+    }
+    if (fds[1].revents != 0 && !readEvents()) {
+      break;
+    }
+    settle();
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  pending.clear();
+  settling = 0;
+  idle.notify_all();
+}
+
+/**
+ * @brief Read all queued inotify events and schedule their files
+ * @return false if the directory itself went away
+ *
+ * A close or a rename into the folder usually ends a write, so the file
+ * is loaded after one quiet settle time; bare creations and writes need
+ * two matching checks. Deletions are checked at once.
+ */
+bool WatchFolder::readEvents() {
+  alignas(inotify_event) char buffer[64 * 1024];
+  auto now = std::chrono::steady_clock::now();
+  while (true) {
+    ssize_t n = read(inotifyFd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    for (char *p = buffer; p < buffer + n;) {
+      auto *event = reinterpret_cast<inotify_event *>(p);
+      p += sizeof(inotify_event) + event->len;
+      events.fetch_add(1, std::memory_order_relaxed);
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        overflows.fetch_add(1, std::memory_order_relaxed);
+        rescan(false);
+        continue;
+      }
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (callbacks.onError) {
+          callbacks.onError(directory, "Watched directory went away");
+        }
+        return false;
+      }
+      if (event->len == 0 || (event->mask & IN_ISDIR)) {
+        continue;
+      }
+      std::string name(event->name);
+      if (!followed(name)) {
+        continue;
+      }
+      Pending &entry = pending[name];
+      if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        entry.deadline = now;
+        entry.closed = true;
+      } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        entry.deadline = now + options.settle;
+        entry.closed = true;
+      } else {
+        entry.deadline = now + options.settle;
+        entry.closed = false;
+        entry.checked = false;
+      }
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  settling = pending.size();
+  return true;
+}
+
+/**
+ * @brief Compare the directory against the loaded files
+ * @param initial Whether this is the scan on start
+ *
+ * Files missing from the loaded set or whose size or modification time
+ * changed are scheduled like freshly written ones; loaded files no longer
+ * in the directory are scheduled for removal.
+ *
+ * On start, a file last modified at least a settle time ago is treated as
+ * closed and loaded at once: its size and modification time have been
+ * stable for as long as two checks would wait, and the directory was
+ * already watched, so a write from now on schedules it again.
+ */
+void WatchFolder::rescan(bool initial) {
+  rescans.fetch_add(1, std::memory_order_relaxed);
+  auto now = std::chrono::steady_clock::now();
+  const int64_t settledBefore =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          (std::chrono::system_clock::now() - options.settle)
+              .time_since_epoch())
+          .count();
+  std::unordered_set<std::string> present;
+  std::error_code error;
+  for (std::filesystem::directory_iterator it(directory, error), end;
+       !error && it != end; it.increment(error)) {
+    std::string name = it->path().filename().string();
+    if (!followed(name)) {
+      continue;
+    }
+    FileState state = statFile(name);
+    if (state.size < 0) {
+      continue;
+    }
+    present.insert(name);
+    bool unchanged;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto found = loaded.find(name);
+      unchanged = found != loaded.end() && found->second.state == state;
+    }
+    if (!unchanged && pending.find(name) == pending.end()) {
+      Pending &entry = pending[name];
+      entry.deadline = now;
+      entry.closed = initial && state.mtime <= settledBefore;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (error && callbacks.onError) {
+    callbacks.onError(directory, "Cannot scan: " + error.message());
+  }
+  for (const auto &[name, entry] : loaded) {
+    if (present.find(name) == present.end()) {
+      Pending &removal = pending[name];
+      removal.deadline = now;
+      removal.closed = true;
+    }
+  }
+  settling = pending.size();
+}
+
+/**
+ * @brief Check every file whose settle deadline has passed
+ */
+void WatchFolder::settle() {
+  auto now = std::chrono::steady_clock::now();
+  for (auto it = pending.begin(); it != pending.end();) {
+    auto next = std::next(it);
+    if (it->second.deadline <= now && check(it->first, it->second)) {
+      pending.erase(it);
+    }
+    it = next;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  settling = pending.size();
+  if (settling == 0 && inFlight == 0) {
+    idle.notify_all();
+  }
+}
+
+/**
+ * @brief Load, remove or keep waiting for a file whose deadline passed
+ * @param name File name in the directory
+ * @param entry Its pending entry
+ * @return true if the entry is done, false if the file is still changing
+ * and the entry got a new deadline
+ */
+bool WatchFolder::check(const std::string &name, Pending &entry) {
+  FileState state = statFile(name);
+  if (state.size < 0) {
+    remove(name);
+    return true;
+  }
+  if (!entry.closed && !(entry.checked && entry.seen == state)) {
+    // Still being written, or not known to be complete yet
+    entry.checked = true;
+    entry.seen = state;
+    entry.deadline = std::chrono::steady_clock::now() + options.settle;
+    return false;
+  }
+
+  uint64_t loadGeneration;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = loaded.find(name);
+    if (found != loaded.end() && found->second.state == state) {
+      return true;
+    }
+    loadGeneration = ++generation;
+    latest[name] = loadGeneration;
+    inFlight++;
+  }
+  scheduler.submit([this, name, loadGeneration] {
+    load(name, loadGeneration);
+  });
+  return true;
+}
+
+/**
+ * @brief Load a file and report the result, on a scheduler worker
+ * @param name File name in the directory
+ * @param loadGeneration Number of this load; the result is dropped if a
+ * newer load or a removal of the file was scheduled since
+ */
+void WatchFolder::load(const std::string &name, uint64_t loadGeneration) {
+  FileState state = statFile(name);
+  std::shared_ptr<const TorrentFile> torrent;
+  InfoHash infoHash;
+  std::string error;
+  try {
+    std::string data = readFile(pathOf(name));
+    torrent = std::make_shared<const TorrentFile>(
+        TorrentFile::fromBencode(data));
+    infoHash = InfoHash(TorrentFile::computeInfoHash(data));
+  } catch (const std::exception &e) {
+    error = e.what();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto newest = latest.find(name);
+  if (!stopped && newest != latest.end() &&
+      newest->second == loadGeneration) {
+    latest.erase(newest);
+    Loaded &entry = loaded[name];
+    if (entry.valid && callbacks.onRemoved) {
+      callbacks.onRemoved(pathOf(name), entry.infoHash);
+    }
+    entry.state = state;
+    entry.valid = torrent != nullptr;
+    entry.infoHash = infoHash;
+    if (torrent != nullptr) {
+      loads.fetch_add(1, std::memory_order_relaxed);
+      if (callbacks.onAdded) {
+        callbacks.onAdded(pathOf(name), std::move(torrent), infoHash);
+      }
+    } else {
+      failures.fetch_add(1, std::memory_order_relaxed);
+      if (callbacks.onError) {
+        callbacks.onError(pathOf(name), error);
+      }
+    }
+  }
+  if (--inFlight == 0) {
+    idle.notify_all();
+  }
+}
+
+/**
+ * @brief Forget a file that is gone and report it if it was loaded
+ * @param name File name in the directory
+ *
+ * A load of the file still in flight is invalidated.
+ */
+void WatchFolder::remove(const std::string &name) {
+  std::lock_guard<std::mutex> lock(mutex);
+  latest.erase(name);
+  auto found = loaded.find(name);
+  if (found == loaded.end()) {
+    return;
+  }
+  if (found->second.valid) {
+    removals.fetch_add(1, std::memory_order_relaxed);
+    if (callbacks.onRemoved) {
+      callbacks.onRemoved(pathOf(name), found->second.infoHash);
+    }
+  }
+  loaded.erase(found);
+}
+
+/**
+ * @brief Check whether a file name has the followed extension
+ */
+bool WatchFolder::followed(const std::string &name) const {
+  const std::string &extension = options.extension;
+  return name.size() > extension.size() &&
+         name.compare(name.size() - extension.size(), extension.size(),
+                      extension) == 0;
+}
+
+/**
+ * @brief Get the path of a file in the directory
+ */
+std::string WatchFolder::pathOf(const std::string &name) const {
+  return directory + "/" + name;
+}
+
+/**
+ * @brief Get the size and modification time of a file
+ * @return The state, with size -1 if it is missing or not a regular file
+ */
+WatchFolder::FileState WatchFolder::statFile(const std::string &name) const {
+  FileState state;
+  struct stat info;
+  if (::stat(pathOf(name).c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+    state.size = info.st_size;
+    state.mtime = int64_t(info.st_mtim.tv_sec) * 1000000000 +
+                  info.st_mtim.tv_nsec;
+  }
+  return state;
+}
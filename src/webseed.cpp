@@ -0,0 +1,804 @@
+#include <algorithm>
+#include <bencode.hpp>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <httputil.hpp>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sha1.hpp>
+#include <stdexcept>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <webseed.hpp>
+
+namespace {
+
+constexpr size_t kMaxHeadBytes = 64 * 1024;  // Status line and headers
+constexpr size_t kMaxErrorBytes = 1024;      // Kept of an error body
+constexpr size_t kReceiveBytes = 256 * 1024; // Read per recv()
+constexpr int kMaxEvents = 64;
+
+/**
+ * @brief Percent-encode bytes for a URL
+ * @param keep Characters besides the unreserved ones to keep as they are
+ */
+std::string percentEncode(std::string_view text, const char *keep) {
+  static const char kHex[] = "0123456789ABCDEF";
+  std::string out;
+  for (unsigned char c : text) {
+    if (std::isalnum(c) || std::strchr("-._~", c) != nullptr ||
+        (c != 0 && std::strchr(keep, c) != nullptr)) {
+      out += static_cast<char>(c);
+    } else {
+      out += '%';
+      out += kHex[c >> 4];
+      out += kHex[c & 15];
+    }
+  }
+  return out;
+}
+
+/**
+ * @brief Decode a url-list or httpseeds value
+ * @return The URLs it holds; a single string counts as a list of one
+ */
+std::vector<std::string> decodeUrls(std::string_view encoded) {
+  std::vector<std::string> urls;
+  BencodeValue value = BencodeParser::parse(encoded);
+  if (value.isString()) {
+    urls.push_back(value.getString());
+  } else if (value.isList()) {
+    for (const auto &url : value.getList()) {
+      if (url->isString()) {
+        urls.push_back(url->getString());
+      }
+    }
+  }
+  urls.erase(std::remove(urls.begin(), urls.end(), std::string()),
+             urls.end());
+  return urls;
+}
+
+} // namespace
+
+/**
+ * @brief A keep-alive connection to the seed and its response parser
+ */
+struct WebSeed::Connection {
+  uint32_t slot = 0; // Index in the download's connections
+  int fd = -1;
+  bool connected = false;       // Connect finished
+  int failures = 0;             // Consecutive attempts without a response
+  int64_t reopenMillis = 0;     // Do not reconnect before then
+  int64_t lastActive = 0;       // Last time bytes moved
+  std::deque<Request> inFlight; // Sent, in response order
+  std::string out;              // Requests not yet written to the socket
+  size_t outSent = 0;
+
+  // The response being read
+  std::string in;       // Head bytes, until the blank line
+  bool inBody = false;
+  int status = 0;
+  int64_t bodyLeft = 0; // -1: until the connection closes
+  int64_t skip = 0;     // Body bytes before the wanted ones
+  bool usable = false;  // The body holds the requested range
+  bool closeAfter = false;
+  std::string error;    // Start of a body that is not content
+};
+
+/**
+ * @brief List the web seeds of a torrent
+ * @param torrent The torrent
+ * @return Its url-list entries, then its httpseeds entries
+ *
+ * Entries that are not strings or lists of strings are skipped; many
+ * torrents carry an empty url-list.
+ */
+std::vector<WebSeed::Source> WebSeed::sources(const TorrentFile &torrent) {
+  std::vector<Source> result;
+  for (auto [key, protocol] : {std::pair("url-list", Protocol::UrlList),
+                               std::pair("httpseeds", Protocol::HttpSeed)}) {
+    for (const auto &field : torrent.getExtraFields()) {
+      if (field.key != key) {
+        continue;
+      }
+      try {
+        for (auto &url : decodeUrls(field.value)) {
+          result.push_back({std::move(url), protocol});
+        }
+      } catch (const std::runtime_error &) {
+        // Not valid Bencode: no seeds from this entry
+      }
+    }
+  }
+  return result;
+}
+
+/**
+ * @brief Prepare a download from one web seed
+ * @param torrent The torrent; must outlive the web seed
+ * @param storage Where the content is written; must outlive it
+ * @param source The seed
+ * @param options Settings
+ * @throws std::invalid_argument if the URL is not http:// or the options
+ * are not positive
+ */
+WebSeed::WebSeed(const TorrentFile &torrent, Storage &storage,
+                 const Source &source, const Options &options)
+    : torrent(torrent), storage(storage), protocol(source.protocol),
+      options(options) {
+  if (options.connections == 0 || options.pipelineDepth == 0 ||
+      options.requestBytes <= 0 || options.timeoutMillis <= 0 ||
+      options.maxRetries < 0) {
+    throw std::invalid_argument("Web seed options must be positive");
+  }
+  std::string_view url = source.url;
+  if (url.size() < 7 ||
+      !HttpUtil::equalsIgnoreCase(url.substr(0, 7), "http://")) {
+    throw std::invalid_argument("Unsupported web seed URL: " + source.url);
+  }
+  url.remove_prefix(7);
+  size_t slash = std::min(url.find('/'), url.size());
+  std::string_view authority = url.substr(0, slash);
+  path = slash < url.size() ? std::string(url.substr(slash)) : "/";
+  size_t colon = authority.rfind(':');
+  if (colon != std::string_view::npos &&
+      authority.find(']', colon) == std::string_view::npos) {
+    port = authority.substr(colon + 1);
+    authority = authority.substr(0, colon);
+  } else {
+    port = "80";
+  }
+  if (authority.size() > 2 && authority.front() == '[') {
+    authority = authority.substr(1, authority.size() - 2); // IPv6 literal
+  }
+  host = authority;
+  if (host.empty() || HttpUtil::parseWholeNumber(port) <= 0 ||
+      HttpUtil::parseWholeNumber(port) > 65535) {
+    throw std::invalid_argument("Invalid web seed URL: " + source.url);
+  }
+
+  int64_t start = 0;
+  for (const auto &file : torrent.getFiles()) {
+    fileStarts.push_back(start);
+    start += file.length;
+  }
+  infoHash = percentEncode(Sha1::hash(torrent.getRawInfo()), "");
+}
+
+/**
+ * @brief Download pieces, blocking until done
+ * @param wanted Pieces to fetch; missing entries count as not wanted
+ * @param onPiece Called for each completed piece, may be empty
+ * @return Pieces that were downloaded and verified
+ * @throws std::runtime_error if the host cannot be resolved or a file
+ * cannot be written
+ *
+ * All connections run on one epoll loop in the calling thread.
+ */
+std::vector<bool> WebSeed::download(const std::vector<bool> &wanted,
+                                    const PieceCallback &onPiece) {
+  counters = Stats();
+  callback = &onPiece;
+  resumeMillis = 0;
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *addresses = nullptr;
+  int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+  if (status != 0) {
+    throw std::runtime_error("Could not resolve " + host + ": " +
+                             gai_strerror(status));
+  }
+  int epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd < 0) {
+    freeaddrinfo(addresses);
+    throw HttpUtil::systemError("Cannot create epoll instance");
+  }
+
+  std::vector<Connection> conns(options.connections);
+  for (size_t i = 0; i < conns.size(); ++i) {
+    conns[i].slot = static_cast<uint32_t>(i);
+  }
+  auto cleanup = [&] {
+    for (auto &conn : conns) {
+      if (conn.fd >= 0) {
+        close(conn.fd);
+      }
+    }
+    close(epollFd);
+    freeaddrinfo(addresses);
+    pending.clear();
+    callback = nullptr;
+  };
+  try {
+    plan(wanted);
+    std::vector<char> buffer(kReceiveBytes);
+    epoll_event events[kMaxEvents];
+    while (true) {
+      const int64_t now = HttpUtil::nowMillis();
+      int64_t wake = now + 1000;
+      bool active = false;
+      for (auto &conn : conns) {
+        // A connect that never finishes times out like a silent request
+        if (conn.fd >= 0 && (!conn.connected || !conn.inFlight.empty()) &&
+            now - conn.lastActive > options.timeoutMillis) {
+          drop(conn, true);
+        }
+        if (conn.fd < 0 && !pending.empty() &&
+            conn.failures <= options.maxRetries) {
+          if (now >= std::max(conn.reopenMillis, resumeMillis)) {
+            open(conn, addresses->ai_addr, addresses->ai_addrlen, epollFd);
+          } else {
+            wake = std::min(wake, std::max(conn.reopenMillis, resumeMillis));
+          }
+        }
+        if (conn.fd >= 0 && conn.connected) {
+          fill(conn);
+          if (!flush(conn)) {
+            drop(conn, true);
+          }
+        }
+        if (conn.fd >= 0 && conn.inFlight.empty() && pending.empty()) {
+          drop(conn, false); // Nothing left to ask for
+        }
+        if (conn.fd >= 0 && (!conn.connected || !conn.inFlight.empty())) {
+          wake = std::min(wake, conn.lastActive + options.timeoutMillis + 1);
+        }
+        active = active || conn.fd >= 0 ||
+                 (!pending.empty() && conn.failures <= options.maxRetries);
+      }
+      if (!active) {
+        break;
+      }
+      if (resumeMillis > now) {
+        wake = std::min(wake, resumeMillis);
+      }
+      int count = epoll_wait(epollFd, events, kMaxEvents,
+                             static_cast<int>(std::max<int64_t>(
+                                 0, wake - HttpUtil::nowMillis())));
+      if (count < 0 && errno != EINTR) {
+        throw HttpUtil::systemError("epoll_wait failed");
+      }
+      for (int i = 0; i < count; ++i) {
+        Connection &conn = conns[events[i].data.u32];
+        if (conn.fd < 0) {
+          continue;
+        }
+        if (!conn.connected) {
+          int error = 0;
+          socklen_t length = sizeof(error);
+          getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+          if (error != 0) {
+            drop(conn, true);
+            continue;
+          }
+          conn.connected = true;
+          conn.lastActive = HttpUtil::nowMillis();
+          fill(conn);
+        }
+        if (!flush(conn)) {
+          drop(conn, true);
+          continue;
+        }
+        if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+            !receive(conn, buffer.data(), buffer.size())) {
+          continue; // Dropped
+        }
+      }
+    }
+    // Requests left belong to connections that kept failing
+    counters.failed += pending.size();
+  } catch (...) {
+    cleanup();
+    throw;
+  }
+  cleanup();
+  return done;
+}
+
+/**
+ * @brief Get the URL path a file is requested at (BEP 19)
+ * @param fileIndex Index into the torrent's getFiles()
+ * @return Path with percent-encoded components
+ * @throws std::out_of_range if the file does not exist
+ *
+ * A single-file torrent is fetched from the URL itself, or from url/name
+ * when the URL ends with a slash; a multi-file torrent from
+ * url/name/path.
+ */
+std::string WebSeed::filePath(size_t fileIndex) const {
+  const auto &file = torrent.getFiles().at(fileIndex);
+  std::string base = path.substr(0, path.find('?'));
+  if (torrent.isSingleFile()) {
+    return base.back() == '/' ? base + percentEncode(torrent.getName(), "")
+                              : base;
+  }
+  if (base.back() != '/') {
+    base += '/';
+  }
+  return base + percentEncode(torrent.getName(), "") + "/" +
+         percentEncode(file.path, "/");
+}
+
+/**
+ * @brief Get the counters of the last download
+ * @return The counters, also while a download runs
+ */
+const WebSeed::Stats &WebSeed::stats() const { return counters; }
+
+/**
+ * @brief Queue the requests for the wanted pieces
+ * @param wanted Pieces to fetch
+ *
+ * BEP 19: runs of consecutive wanted pieces, up to requestBytes, are cut
+ * at file boundaries into one Range request per file part; padding files
+ * are not requested. BEP 17: one request per piece. Pieces that are all
+ * padding have nothing to fetch and are verified right away.
+ */
+void WebSeed::plan(const std::vector<bool> &wanted) {
+  const uint32_t pieceCount = storage.numPieces();
+  const int64_t pieceLength = storage.getPieceLength();
+  const auto &files = torrent.getFiles();
+  done.assign(pieceCount, false);
+  missingBytes.assign(pieceCount, 0);
+  pending.clear();
+
+  std::vector<uint32_t> empty;
+  uint32_t piece = 0;
+  while (piece < pieceCount) {
+    if (piece >= wanted.size() || !wanted[piece]) {
+      ++piece;
+      continue;
+    }
+    uint32_t last = piece;
+    while (last + 1 < pieceCount && last + 1 < wanted.size() &&
+           wanted[last + 1] &&
+           int64_t{last + 2 - piece} * pieceLength <= options.requestBytes) {
+      ++last;
+    }
+    const int64_t begin = int64_t{piece} * pieceLength;
+    const int64_t end = std::min(storage.getTotalSize(),
+                                 int64_t{last + 1} * pieceLength);
+    for (size_t f = std::upper_bound(fileStarts.begin(), fileStarts.end(),
+                                     begin) -
+                    fileStarts.begin() - 1;
+         f < files.size() && fileStarts[f] < end; ++f) {
+      int64_t from = std::max(begin, fileStarts[f]);
+      int64_t to = std::min(end, fileStarts[f] + files[f].length);
+      if (files[f].padding || from >= to) {
+        continue;
+      }
+      for (int64_t p = from / pieceLength; p * pieceLength < to; ++p) {
+        missingBytes[p] += std::min(to, (p + 1) * pieceLength) -
+                           std::max(from, p * pieceLength);
+      }
+      if (protocol == Protocol::UrlList) {
+        pending.push_back({from, to, f, 0});
+      }
+    }
+    for (uint32_t p = piece; p <= last; ++p) {
+      if (protocol == Protocol::HttpSeed && missingBytes[p] > 0) {
+        pending.push_back({int64_t{p} * pieceLength,
+                           int64_t{p} * pieceLength + storage.pieceSize(p), 0,
+                           p});
+      } else if (missingBytes[p] == 0) {
+        empty.push_back(p);
+      }
+    }
+    piece = last + 1;
+  }
+  for (uint32_t p : empty) {
+    verify(p);
+  }
+}
+
+/**
+ * @brief Build the HTTP request for a range
+ * @param request The range; a BEP 19 request starts after what was written
+ * @return Request line and headers
+ */
+std::string WebSeed::head(const Request &request) const {
+  std::string text = "GET ";
+  if (protocol == Protocol::UrlList) {
+    const int64_t start = fileStarts[request.file];
+    text += filePath(request.file);
+    text += " HTTP/1.1\r\nRange: bytes=" +
+            std::to_string(request.begin + request.written - start) + "-" +
+            std::to_string(request.end - 1 - start);
+  } else {
+    text += path;
+    text += path.find('?') == std::string::npos ? '?' : '&';
+    text += "info_hash=" + infoHash + "&piece=" + std::to_string(request.piece);
+    text += " HTTP/1.1";
+  }
+  text += "\r\nHost: " + (host.find(':') == std::string::npos
+                              ? host
+                              : "[" + host + "]");
+  if (port != "80") {
+    text += ":" + port;
+  }
+  text += "\r\n\r\n";
+  return text;
+}
+
+/**
+ * @brief Start connecting a connection to the seed
+ * @param conn The closed connection
+ * @param address Address of the seed
+ * @param length Size of the address
+ * @param epollFd Loop the connection is added to
+ */
+void WebSeed::open(Connection &conn, const void *address, unsigned length,
+                   int epollFd) {
+  const auto *socketAddress = static_cast<const sockaddr *>(address);
+  conn.fd = socket(socketAddress->sa_family,
+                   SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (conn.fd < 0) {
+    throw HttpUtil::systemError("Cannot create socket");
+  }
+  ++counters.connects;
+  int one = 1;
+  setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  conn.connected = false;
+  conn.lastActive = HttpUtil::nowMillis();
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.u32 = conn.slot;
+  if ((::connect(conn.fd, socketAddress, length) < 0 &&
+       errno != EINPROGRESS) ||
+      epoll_ctl(epollFd, EPOLL_CTL_ADD, conn.fd, &event) < 0) {
+    drop(conn, true);
+  }
+}
+
+/**
+ * @brief Send requests from the queue until the pipeline is full
+ * @param conn A connected connection
+ */
+void WebSeed::fill(Connection &conn) {
+  while (conn.inFlight.size() < options.pipelineDepth && !pending.empty() &&
+         HttpUtil::nowMillis() >= resumeMillis) {
+    conn.out += head(pending.front());
+    conn.inFlight.push_back(pending.front());
+    pending.pop_front();
+    ++counters.requests;
+  }
+}
+
+/**
+ * @brief Write queued request bytes to the socket
+ * @param conn The connection
+ * @return false if the socket failed
+ */
+bool WebSeed::flush(Connection &conn) {
+  while (conn.outSent < conn.out.size()) {
+    ssize_t n = send(conn.fd, conn.out.data() + conn.outSent,
+                     conn.out.size() - conn.outSent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    conn.outSent += n;
+  }
+  conn.out.clear();
+  conn.outSent = 0;
+  return true;
+}
+
+/**
+ * @brief Read and process everything the socket has
+ * @param conn The connection
+ * @param buffer Scratch space for recv()
+ * @param size Its size
+ * @return false if the connection was dropped
+ */
+bool WebSeed::receive(Connection &conn, char *buffer, size_t size) {
+  while (true) {
+    ssize_t n = recv(conn.fd, buffer, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    if (n <= 0) {
+      // A body delimited by the end of the connection is complete now
+      if (n == 0 && conn.inBody && conn.bodyLeft < 0) {
+        finish(conn);
+      }
+      drop(conn, n < 0 || !conn.inFlight.empty());
+      return false;
+    }
+    conn.lastActive = HttpUtil::nowMillis();
+    if (!process(conn, buffer, n)) {
+      return false;
+    }
+  }
+}
+
+/**
+ * @brief Parse response bytes and write their content
+ * @param conn The connection
+ * @param data Bytes received
+ * @param length Their number
+ * @return false if the connection was dropped
+ */
+bool WebSeed::process(Connection &conn, const char *data, size_t length) {
+  while (length > 0) {
+    if (!conn.inBody) {
+      const size_t before = conn.in.size();
+      conn.in.append(data, length);
+      size_t end = conn.in.find("\r\n\r\n", before < 3 ? 0 : before - 3);
+      if (end == std::string::npos) {
+        if (conn.in.size() > kMaxHeadBytes) {
+          drop(conn, true);
+          return false;
+        }
+        return true;
+      }
+      const size_t used = end + 4 - before;
+      conn.in.resize(end + 4);
+      data += used;
+      length -= used;
+      if (!parseHead(conn)) {
+        drop(conn, true);
+        return false;
+      }
+      if (conn.bodyLeft == 0 && !finish(conn)) {
+        return false;
+      }
+      continue;
+    }
+
+    int64_t take = conn.bodyLeft < 0
+                       ? static_cast<int64_t>(length)
+                       : std::min<int64_t>(length, conn.bodyLeft);
+    const char *body = data;
+    int64_t bodyLength = take;
+    if (!conn.usable) {
+      conn.error.append(body, std::min<size_t>(bodyLength,
+                                               kMaxErrorBytes -
+                                                   conn.error.size()));
+    } else {
+      const int64_t skipped = std::min(conn.skip, bodyLength);
+      conn.skip -= skipped;
+      body += skipped;
+      bodyLength -= skipped;
+      Request &request = conn.inFlight.front();
+      const int64_t wanted = std::min(
+          bodyLength, request.end - request.begin - request.written);
+      if (wanted > 0) {
+        write(request.begin + request.written, body, wanted);
+        request.written += wanted;
+      }
+    }
+    data += take;
+    length -= take;
+    if (conn.bodyLeft > 0) {
+      conn.bodyLeft -= take;
+      if (conn.bodyLeft == 0 && !finish(conn)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Parse the head of a response to the oldest request in flight
+ * @param conn The connection, with the complete head in conn.in
+ * @return false if the response is malformed, unexpected or chunked
+ */
+bool WebSeed::parseHead(Connection &conn) {
+  std::string_view text = conn.in;
+  if (conn.inFlight.empty() || text.substr(0, 5) != "HTTP/" ||
+      text.size() < 12) {
+    return false;
+  }
+  const bool http10 = text.substr(5, 3) == "1.0";
+  conn.status =
+      static_cast<int>(HttpUtil::parseLeadingNumber(text.substr(9, 3)));
+  int64_t contentLength = -1;
+  int64_t rangeStart = -1;
+  std::string_view connection;
+  text.remove_prefix(std::min(text.find("\r\n") + 2, text.size()));
+  while (!text.empty()) {
+    size_t end = std::min(text.find("\r\n"), text.size());
+    std::string_view line = text.substr(0, end);
+    text.remove_prefix(std::min(end + 2, text.size()));
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+    std::string_view name = HttpUtil::trim(line.substr(0, colon));
+    std::string_view value = HttpUtil::trim(line.substr(colon + 1));
+    if (HttpUtil::equalsIgnoreCase(name, "content-length")) {
+      contentLength = HttpUtil::parseLeadingNumber(value);
+    } else if (HttpUtil::equalsIgnoreCase(name, "content-range") &&
+               value.substr(0, 6) == "bytes ") {
+      rangeStart = HttpUtil::parseLeadingNumber(value.substr(6));
+    } else if (HttpUtil::equalsIgnoreCase(name, "connection")) {
+      connection = value;
+    } else if (HttpUtil::equalsIgnoreCase(name, "transfer-encoding") &&
+               !HttpUtil::equalsIgnoreCase(value, "identity")) {
+      return false;
+    }
+  }
+  conn.in.clear();
+  if (conn.status < 200) {
+    return false; // No 1xx responses were asked for
+  }
+
+  // Where the body starts in the content, to skip to the requested bytes
+  const Request &request = conn.inFlight.front();
+  int64_t bodyStart = -1;
+  if (protocol == Protocol::HttpSeed && conn.status == 200) {
+    bodyStart = request.begin;
+  } else if (protocol == Protocol::UrlList && conn.status == 200) {
+    bodyStart = fileStarts[request.file];
+  } else if (protocol == Protocol::UrlList && conn.status == 206 &&
+             rangeStart >= 0) {
+    bodyStart = fileStarts[request.file] + rangeStart;
+  }
+  const int64_t position = request.begin + request.written;
+  conn.usable = bodyStart >= 0 && bodyStart <= position;
+  conn.skip = conn.usable ? position - bodyStart : 0;
+  conn.error.clear();
+  conn.bodyLeft = contentLength;
+  conn.closeAfter =
+      http10 ? !HttpUtil::equalsIgnoreCase(connection, "keep-alive")
+             : HttpUtil::equalsIgnoreCase(connection, "close");
+  conn.closeAfter = conn.closeAfter || contentLength < 0;
+  conn.inBody = true;
+  return true;
+}
+
+/**
+ * @brief Complete the response to the oldest request in flight
+ * @param conn The connection, after the end of the body
+ * @return false if the connection was dropped
+ *
+ * A request whose range arrived only in part is queued again for the
+ * rest, as is one answered with a 5xx status; a 503 from a BEP 17 seed
+ * carries the seconds to wait before asking again. Other statuses fail
+ * the request.
+ */
+bool WebSeed::finish(Connection &conn) {
+  Request request = conn.inFlight.front();
+  conn.inFlight.pop_front();
+  conn.inBody = false;
+  if (conn.usable && request.begin + request.written == request.end) {
+    conn.failures = 0;
+  } else if (conn.usable || conn.status >= 500) {
+    if (conn.status == 503) {
+      int64_t seconds =
+          HttpUtil::parseLeadingNumber(HttpUtil::trim(conn.error));
+      resumeMillis =
+          HttpUtil::nowMillis() + std::clamp<int64_t>(seconds, 1, 60) * 1000;
+    }
+    retry(request);
+  } else {
+    ++counters.failed;
+  }
+  if (conn.closeAfter) {
+    drop(conn, false);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Write received content to storage and account for its pieces
+ * @param position Content offset of the first byte
+ * @param data The bytes
+ * @param length Their number
+ * @throws std::runtime_error if a file cannot be written
+ *
+ * Bytes that fall into padding files are dropped; they are zeros.
+ */
+void WebSeed::write(int64_t position, const char *data, int64_t length) {
+  const auto &files = torrent.getFiles();
+  const int64_t pieceLength = storage.getPieceLength();
+  size_t f = std::upper_bound(fileStarts.begin(), fileStarts.end(),
+                              position) -
+             fileStarts.begin() - 1;
+  while (length > 0) {
+    const int64_t offset = position - fileStarts[f];
+    const int64_t part = std::min(length, files[f].length - offset);
+    if (part > 0 && !files[f].padding) {
+      const int fd = storage.fileDescriptor(f, true);
+      for (int64_t written = 0; written < part;) {
+        ssize_t n = pwrite(fd, data + written, part - written,
+                           offset + written);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n <= 0) {
+          throw HttpUtil::systemError("Could not write " + files[f].path);
+        }
+        written += n;
+      }
+      counters.bytesReceived += part;
+      const int64_t end = position + part;
+      for (int64_t p = position / pieceLength; p * pieceLength < end; ++p) {
+        int64_t overlap = std::min(end, (p + 1) * pieceLength) -
+                          std::max(position, p * pieceLength);
+        missingBytes[p] -= overlap;
+        if (missingBytes[p] == 0) {
+          verify(static_cast<uint32_t>(p));
+        }
+      }
+    }
+    position += std::max<int64_t>(part, 0);
+    data += std::max<int64_t>(part, 0);
+    length -= std::max<int64_t>(part, 0);
+    ++f;
+  }
+}
+
+/**
+ * @brief Hash a piece whose bytes are all written and report it
+ * @param piece The piece
+ *
+ * A corrupt piece is not fetched again: the same seed would send the same
+ * bytes, so it is left to peers.
+ */
+void WebSeed::verify(uint32_t piece) {
+  const bool valid = storage.hashPiece(piece) == torrent.getPieces()[piece];
+  done[piece] = valid;
+  ++(valid ? counters.verified : counters.corrupt);
+  if (callback != nullptr && *callback) {
+    (*callback)(piece, valid);
+  }
+}
+
+/**
+ * @brief Queue a request again after a failed attempt
+ * @param request The request; given up on after maxRetries attempts
+ */
+void WebSeed::retry(Request request) {
+  if (++request.tries > options.maxRetries) {
+    ++counters.failed;
+    return;
+  }
+  if (protocol == Protocol::UrlList) {
+    // Ask only for the rest; a BEP 17 piece comes whole and is skipped into
+    request.begin += request.written;
+    request.written = 0;
+  }
+  ++counters.retries;
+  pending.push_front(request);
+}
+
+/**
+ * @brief Close a connection and queue its unanswered requests again
+ * @param conn The connection
+ * @param failed Whether it failed, rather than closing as the seed asked;
+ * failures delay and eventually stop reconnecting
+ */
+void WebSeed::drop(Connection &conn, bool failed) {
+  if (conn.fd >= 0) {
+    close(conn.fd); // Also removes it from the epoll set
+    conn.fd = -1;
+  }
+  while (!conn.inFlight.empty()) {
+    retry(conn.inFlight.back());
+    conn.inFlight.pop_back();
+  }
+  if (failed) {
+    ++conn.failures;
+    conn.reopenMillis = HttpUtil::nowMillis() + 100 * conn.failures;
+  }
+  conn.connected = false;
+  conn.in.clear();
+  conn.inBody = false;
+  conn.out.clear();
+  conn.outSent = 0;
+}